@@ -21,9 +21,10 @@
 
 #include "cliclient.h"
 
-CliClient::CliClient()
+CliClient::CliClient(const QJsonValue &subscription)
     : _connection{nullptr}
 {
+    _connection.setSubscription(subscription);
     _connection.connectToDaemon();
 
     // Trace the state just for diagnostics
@@ -31,7 +31,9 @@ class CliClient : public QObject
     Q_OBJECT
 
 public:
-    CliClient();
+    // The subscription limits the properties received from the daemon (see
+    // DaemonConnection::setSubscription()); by default all are received.
+    explicit CliClient(const QJsonValue &subscription = QJsonValue::Null);
 
 public:
     DaemonConnection &connection() {return _connection;}
@@ -214,6 +214,68 @@ namespace
     }
     const std::map<QString, SupportedType> _getSupportedTypes{buildGetSupportedTypes()};
 
+    // Get the daemon properties needed for a type, so 'get', 'monitor', and
+    // 'dump' only receive those properties (see
+    // DaemonConnection::setSubscription()).
+    QJsonObject getTypeSubscription(const QString &type)
+    {
+        // State properties always include dedicatedIpLocations - locations
+        // and IPs may be dedicated IPs, and DaemonConnection uses this to
+        // redact them from logs.
+        auto stateProperties = [](QJsonArray properties)
+        {
+            properties.push_back(QStringLiteral("dedicatedIpLocations"));
+            return QJsonObject{{QStringLiteral("state"), std::move(properties)}};
+        };
+        auto settingsProperties = [](QJsonArray properties)
+        {
+            return QJsonObject{{QStringLiteral("settings"), std::move(properties)}};
+        };
+
+        if(type == GetSetType::connectionState)
+            return stateProperties({QStringLiteral("connectionState")});
+        else if(type == GetSetType::debugLogging)
+            return settingsProperties({QStringLiteral("debugLogging")});
+        else if(type == GetSetType::portForward)
+            return stateProperties({QStringLiteral("forwardedPort")});
+        else if(type == GetSetType::requestPortForward)
+            return settingsProperties({QStringLiteral("portForward")});
+        else if(type == GetSetType::protocol)
+            return settingsProperties({QStringLiteral("method")});
+        // Rendering a location also uses the region metadata and country groups
+        else if(type == GetSetType::region)
+        {
+            return stateProperties({QStringLiteral("vpnLocations"),
+                                    QStringLiteral("regionsMetadata"),
+                                    QStringLiteral("groupedLocations")});
+        }
+        else if(type == GetSetType::regions)
+        {
+            return stateProperties({QStringLiteral("regionsMetadata"),
+                                    QStringLiteral("groupedLocations")});
+        }
+        else if(type == GetSetType::vpnIp)
+            return stateProperties({QStringLiteral("externalVpnIp")});
+        else if(type == GetSetType::pubIp)
+            return stateProperties({QStringLiteral("externalIp")});
+        else if(type == GetSetType::allowLAN)
+            return settingsProperties({QStringLiteral("allowLAN")});
+        else if(type == GetSetType::daemonState)
+            return {{QStringLiteral("state"), true}};
+        else if(type == GetSetType::daemonSettings)
+            return {{QStringLiteral("settings"), true}};
+        else if(type == GetSetType::daemonData)
+            return {{QStringLiteral("data"), true}};
+        else if(type == GetSetType::daemonAccount)
+            return {{QStringLiteral("account"), true}};
+        else
+        {
+            // exec() prevents this by checking the type with checkParams()
+            Q_ASSERT(false);
+            return {};
+        }
+    }
+
     void printSupportedTypes(const std::map<QString, SupportedType> &types)
     {
         outln() << "Available types:";
@@ -481,7 +543,7 @@ int GetCommand::exec(const QStringList &params, QCoreApplication &app)
 {
     checkParams(params, _getSupportedTypes);
 
-    CliClient client;
+    CliClient client{getTypeSubscription(params[1])};
     CliTimeout timeout{app};
     QObject localConnState{};
 
@@ -533,7 +595,7 @@ int MonitorCommand::exec(const QStringList &params, QCoreApplication &app)
 {
     checkParams(params, _monitorSupportedTypes);
 
-    CliClient client;
+    CliClient client{getTypeSubscription(params[1])};
     ValuePrinter printer{client, params[1]};
 
     return app.exec();
@@ -551,7 +613,7 @@ int DumpCommand::exec(const QStringList &params, QCoreApplication &app)
 {
     checkParams(params, _dumpSupportedTypes);
 
-    CliClient client;
+    CliClient client{getTypeSubscription(params[1])};
     CliTimeout timeout{app};
     QObject localConnState{};
     QObject::connect(&client, &CliClient::firstConnected, &localConnState, [&]()
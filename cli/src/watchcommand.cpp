@@ -28,7 +28,7 @@ class JsonChangePrinter : public QObject
 {
     Q_OBJECT
 
-private:
+public:
     // A few huge (and largely uninteresting) properties are not printed
     static const std::unordered_set<QString> propertyBlacklist;
 
@@ -63,6 +63,7 @@ const std::unordered_set<QString> JsonChangePrinter::propertyBlacklist{
     QStringLiteral("regionsMetadata"),
     QStringLiteral("groupedLocations"),
     QStringLiteral("modernLatencies"),
+    QStringLiteral("modernLatencyQuality"),
     QStringLiteral("cachedModernShadowsocksList"),
     QStringLiteral("cachedModernRegionsList"),
     QStringLiteral("modernRegionsMeta")
@@ -84,7 +85,15 @@ int WatchCommand::exec(const QStringList &params, QCoreApplication &app)
 {
     checkNoParams(params);
 
-    CliClient client;
+    // Don't receive the blacklisted properties at all
+    QJsonArray blacklist;
+    for(const auto &property : JsonChangePrinter::propertyBlacklist)
+        blacklist.push_back(property);
+    const QJsonObject exceptBlacklist{{QStringLiteral("except"), blacklist}};
+    CliClient client{QJsonObject{{QStringLiteral("data"), exceptBlacklist},
+                                 {QStringLiteral("settings"), exceptBlacklist},
+                                 {QStringLiteral("state"), exceptBlacklist},
+                                 {QStringLiteral("account"), exceptBlacklist}}};
 
     QObject localConnState{};
     JsonChangePrinter data{client.connection().data, QStringLiteral("data")};
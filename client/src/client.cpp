@@ -660,6 +660,22 @@ Client::Client(bool hasExistingSettingsFile, const QJsonObject &initialSettings,
             _clientInterface.get_state()->setRegionsMetadata(_daemon->state.regionsMetadata());
         });
     _clientInterface.get_state()->setRegionsMetadata(_daemon->state.regionsMetadata());
+
+    // The daemon measures favorites and recents frequently, but they're client
+    // settings - tell the daemon about them
+    auto updateLatencyPriorities = [this]
+    {
+        const ClientSettings &settings = *_clientInterface.get_settings();
+        QStringList locationIds = settings.recentLocations();
+        for(const auto &locationId : settings.favoriteLocations())
+            locationIds.push_back(locationId);
+        _daemon->setLatencyPriorityLocations(locationIds);
+    };
+    connect(_clientInterface.get_settings(), &ClientSettings::favoriteLocationsChanged,
+            this, updateLatencyPriorities);
+    connect(_clientInterface.get_settings(), &ClientSettings::recentLocationsChanged,
+            this, updateLatencyPriorities);
+    updateLatencyPriorities();
 }
 
 Client::~Client()
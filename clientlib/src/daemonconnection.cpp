@@ -21,10 +21,40 @@
 
 #include "daemonconnection.h"
 
+namespace
+{
+    // Assign the properties for one object from a "data" notification,
+    // applying any patches for that object to its current property values.
+    // Throws if a patch can't be applied; the object isn't changed in that
+    // case.
+    void assignData(NativeJsonObject &object, const QString &name,
+                    const QJsonObject &data, const QJsonObject &patches)
+    {
+        auto itProperties = data.find(name);
+        bool hasProperties = itProperties != data.end() && itProperties.value().isObject();
+        const QJsonObject &objectPatches = patches.value(name).toObject();
+        if(!hasProperties && objectPatches.isEmpty())
+            return;
+
+        QJsonObject properties;
+        if(hasProperties)
+            properties = itProperties.value().toObject();
+        for(auto itPatch = objectPatches.begin(); itPatch != objectPatches.end(); ++itPatch)
+        {
+            properties.insert(itPatch.key(),
+                applyJsonPatch(object.get(itPatch.key()), itPatch.value().toArray()));
+        }
+        // Assign everything at once, so patched properties are updated
+        // atomically with the rest of the changes
+        object.assign(properties);
+    }
+}
+
 DaemonConnection::DaemonConnection(QObject* parent)
     : QObject(parent)
     , _ipc(nullptr)
     , _connected(false)
+    , _dataDeltas(false)
 {
     _rpc = new ClientSideInterface(&_methods, this);
     _methods.add({ QStringLiteral("data"), this, &DaemonConnection::RPC_data });
@@ -92,6 +122,7 @@ void DaemonConnection::connectToDaemon()
     _ipc = new ThreadedLocalIPCConnection(this);
 
     connect(_ipc, &IPCConnection::connected, this, &DaemonConnection::socketConnected);
+    connect(_ipc, &IPCConnection::connected, this, &DaemonConnection::configureConnection);
     connect(_ipc, &IPCConnection::disconnected, this, &DaemonConnection::socketDisconnected);
     connect(_ipc, &IPCConnection::error, this, &DaemonConnection::socketError);
 
@@ -102,22 +133,106 @@ void DaemonConnection::connectToDaemon()
     _ipc->connectToServer();
 }
 
+void DaemonConnection::setSubscription(const QJsonValue &subscription)
+{
+    _subscription = subscription;
+    if(_ipc && _ipc->isConnected())
+        post(QStringLiteral("setSubscription"), {_subscription});
+}
+
+void DaemonConnection::setLatencyPriorityLocations(const QStringList &locationIds)
+{
+    if(locationIds == _latencyPriorityLocations)
+        return;
+    _latencyPriorityLocations = locationIds;
+    if(_ipc && _ipc->isConnected())
+    {
+        post(QStringLiteral("setLatencyPriorityLocations"),
+             {QJsonArray::fromStringList(_latencyPriorityLocations)});
+    }
+}
+
+void DaemonConnection::configureConnection()
+{
+    // The subscription is sent first, so it applies to the initial data.  The
+    // daemon keeps waiting for setRpcEncoding after it, so the initial data are
+    // still sent in CBOR.
+    if(!_subscription.isNull())
+        post(QStringLiteral("setSubscription"), {_subscription});
+
+    // Ask for CBOR; the daemon sends the initial data once it has switched.
+    // Until the daemon has accepted it, keep sending JSON.  (Older daemons
+    // don't have this method and just continue using JSON.)
+    _rpc->call(QStringLiteral("setRpcEncoding"), QStringLiteral("cbor"))
+        ->notify(this, [this](const Error &error, const QJsonValue &)
+        {
+            if(error)
+            {
+                qInfo() << "Daemon did not accept CBOR encoding, using JSON -"
+                    << error;
+                return;
+            }
+            _rpc->setEncoding(JsonRPCEncoding::Cbor);
+        });
+
+    // Sent after the encoding negotiation, so it doesn't trigger the initial
+    // data early
+    if(!_latencyPriorityLocations.isEmpty())
+    {
+        post(QStringLiteral("setLatencyPriorityLocations"),
+             {QJsonArray::fromStringList(_latencyPriorityLocations)});
+    }
+}
+
 void DaemonConnection::RPC_data(const QJsonObject &data)
 {
-    QJsonObject::const_iterator it;
-#define AssignObject(name) \
-    if ((it = data.find(QStringLiteral(#name))) != data.end() && it.value().isObject()) this->name.assign(it.value().toObject())
-
-    AssignObject(data);
-    AssignObject(account);
-    AssignObject(settings);
-    AssignObject(state);
+    const QJsonObject &patches = data.value(QStringLiteral("patches")).toObject();
+    try
+    {
+#define AssignObject(name) assignData(this->name, QStringLiteral(#name), data, patches)
+
+        AssignObject(data);
+        AssignObject(account);
+        AssignObject(settings);
+        AssignObject(state);
 #undef AssignObject
+    }
+    catch(const std::exception &ex)
+    {
+        // Our state no longer matches the daemon's baseline for patches.  Turn
+        // off deltas, which causes the daemon to send the complete state
+        // again.
+        // (If deltas were already turned off, patches sent before the daemon
+        // received that request may still arrive, the complete state follows
+        // them.)
+        qWarning() << "Unable to apply data patch:" << ex.what();
+        if(_dataDeltas)
+        {
+            _dataDeltas = false;
+            // The daemon sends the complete state before its reply, so once
+            // the reply arrives we're synchronized again and can go back to
+            // patches.  If the connection is lost first, the call is rejected
+            // and the next connection enables deltas itself.
+            _rpc->call(QStringLiteral("setDataDeltas"), false)
+                ->notify(this, [this](const Error &error, const QJsonValue &)
+                {
+                    if(error || _dataDeltas || !_connected)
+                        return;
+                    qInfo() << "Received complete state, re-enabling data deltas";
+                    _dataDeltas = true;
+                    post(QStringLiteral("setDataDeltas"), {true});
+                });
+        }
+    }
 
     if (!_connected && _ipc->isConnected())
     {
         _connectionTimer.stop();
         emit connectedChanged(_connected = true);
+        // The initial data have been received, accept patches for subsequent
+        // changes to large properties
+        _dataDeltas = true;
+        post(QStringLiteral("setDataDeltas"), {true});
     }
 }
 
@@ -141,6 +256,10 @@ void DaemonConnection::socketDisconnected()
     }
     // Reject any requests that were sent before the connection was lost
     _rpc->connectionLost();
+    // A new connection starts without deltas, and in JSON until an encoding is
+    // negotiated again
+    _dataDeltas = false;
+    _rpc->setEncoding(JsonRPCEncoding::Json);
     if (_connected)
     {
         emit connectedChanged(_connected = false);
@@ -43,6 +43,19 @@ public:
     void connectToDaemon();
     bool isConnected() const { return _connected; }
 
+    // Limit the properties received from the daemon to those needed by this
+    // client (see Daemon::RPC_setSubscription()).  Properties that aren't
+    // subscribed keep their default values.  null (the default) receives all
+    // properties.  Takes effect for the initial data if it's set before the
+    // connection is established.
+    void setSubscription(const QJsonValue &subscription);
+
+    // Set the locations the daemon should measure frequently on behalf of this
+    // client - its favorites and recents, which are client settings (see
+    // Daemon::RPC_setLatencyPriorityLocations()).  Sent again whenever the
+    // connection is established.
+    void setLatencyPriorityLocations(const QStringList &locationIds);
+
 // Information gathered from the daemon to display in the client
 public:
     // List of server locations and certificate info
@@ -80,6 +93,7 @@ protected slots:
     void RPC_error(const QJsonObject& errorObject);
 
 protected slots:
+    void configureConnection();
     void socketDisconnected();
     void socketError(const QString& errorString);
 
@@ -98,6 +112,11 @@ private:
     ClientSideInterface* _rpc;
     QTimer _connectionTimer;
     bool _connected;
+    // Whether data deltas have been enabled for this connection (see
+    // Daemon::RPC_setDataDeltas())
+    bool _dataDeltas;
+    QJsonValue _subscription;
+    QStringList _latencyPriorityLocations;
 };
 
 #endif
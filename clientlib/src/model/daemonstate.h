@@ -86,6 +86,7 @@ public:
     JsonField(QJsonArray, openvpnUdpPortChoices, {})
     JsonField(QJsonArray, openvpnTcpPortChoices, {})
     JsonField(QJsonArray, intervalMeasurements, {})
+    JsonField(QJsonArray, latestBandwidthSamples, {})
     JsonField(qint64, connectionTimestamp, {})
     JsonField(QStringList, overridesFailed, {})
     JsonField(QStringList, overridesActive, {})
@@ -20,10 +20,12 @@
 #line SOURCE_FILE("builtin/logging.cpp")
 
 #include "logging.h"
+#include "logrotator.h"
 #include "error.h"
 #include "path.h"
 #include "util.h"
 #include "version.h"
+#include <kapps_core/src/stringredactor.h>
 
 #if defined(Q_OS_LINUX) && PIA_CLIENT
 #include "../exec.h"
@@ -39,7 +41,10 @@
 #include <QTextStream>
 #include <QThread>
 
+#include <condition_variable>
 #include <cstdlib>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <cstring>
 
@@ -66,44 +71,46 @@ namespace
         }
     };
     // Log redactions - maps redact strings to replacements (which now include
-    // the angle brackets).  All redactions are applied sequentially when
-    // redacting text, but they're stored in a map so that adding the same
+    // the angle brackets).  These are stored in a map so that adding the same
     // redaction again doesn't accumulate.
     std::unordered_map<std::string, std::string> g_redactions;
+    // The redactions compiled into a StringRedactor; rebuilt when a redaction
+    // is added so each message is scanned only once.
+    kapps::core::StringRedactor g_redactor;
+
+    std::string redactTextNoLock(std::string text)
+    {
+        if(g_redactor.empty())
+            return text;
+        return g_redactor.redact(text);
+    }
 
     QString redactTextNoLock(QString text)
     {
-        for(const auto &redaction : g_redactions)
-        {
-            text.replace(QString::fromStdString(redaction.first),
-                         QString::fromStdString(redaction.second));
-        }
-        return text;
+        if(g_redactor.empty())
+            return text;
+        return QString::fromStdString(redactTextNoLock(text.toStdString()));
     }
 
     QByteArray redactTextNoLock(QByteArray text)
     {
-        for(const auto &redaction : g_redactions)
-        {
-            text.replace(redaction.first.c_str(), redaction.first.size(),
-                         redaction.second.c_str(), redaction.second.size());
-        }
-        return text;
+        if(g_redactor.empty())
+            return text;
+        std::string redacted = g_redactor.redact({text.data(), static_cast<std::size_t>(text.size())});
+        return QByteArray{redacted.data(), static_cast<qsizetype>(redacted.size())};
     }
 
-    std::string redactTextNoLock(std::string text)
+    // Apply filter rules to both Qt logging categories and kapps::core
+    // categories.  The kapps::core rules are checked before a message is
+    // rendered, so filtered messages cost almost nothing.
+    void applyFilterRules(const QString &rules)
     {
-        for(const auto &redaction : g_redactions)
-        {
-            while(true)
-            {
-                auto pos = text.find(redaction.first);
-                if(pos == std::string::npos)
-                    break;
-                text.replace(pos, redaction.first.size(), redaction.second);
-            }
-        }
-        return text;
+        QLoggingCategory::setFilterRules(rules);
+
+        std::vector<std::string> ruleLines;
+        for(const auto &line : rules.split('\n', Qt::SkipEmptyParts))
+            ruleLines.push_back(line.toStdString());
+        kapps::core::log::setFilterRules(ruleLines);
     }
 }
 
@@ -111,6 +118,18 @@ namespace
 const qint64 standardLogFileLimit = 4000000;
 const qint64 largeLogFileLimit = 40000000;
 
+// With compressed rotation, this many compressed generations are kept (in
+// addition to the ".old" file), within a total disk budget that depends on the
+// log file limit.
+const int compressedLogGenerations = 10;
+const qint64 standardCompressedLogBudget = 10000000;
+const qint64 largeCompressedLogBudget = 50000000;
+
+// With async writes, queued log output is written at most this long after it
+// is queued, or sooner if asyncWriteThreshold bytes are queued.
+const std::chrono::milliseconds asyncWriteInterval{250};
+const std::size_t asyncWriteThreshold = 64*1024;
+
 class LoggerPrivate
 {
     CLASS_LOGGING_CATEGORY("logger")
@@ -120,6 +139,7 @@ class LoggerPrivate
     Logger * const q_ptr;
 
     LoggerPrivate(Logger* logger, const Path &logFilePath);
+    ~LoggerPrivate();
 
     QFile logFile;
     qint64 logSize;
@@ -127,6 +147,9 @@ class LoggerPrivate
     QStringList filters;
     QFileSystemWatcher watcher;
     Path logFilePath;
+    // Compresses rotated log segments when compressed rotation is enabled
+    LogRotator rotator;
+    bool compressedRotation = false;
 
     static const QString defaultFilters;
     static const QString disabledFilters;
@@ -145,8 +168,34 @@ class LoggerPrivate
     // Helper to write a pre-formatted chunk of lines to the log file
     void writeToLogFile(const kapps::core::StringSlice &data);
 
+    // Write log output to the log file, or queue it for the writer thread if
+    // async writes are enabled.  Called with g_logMutex held.
+    void writeLogOutput(std::string data);
+    // Start or stop the writer thread for async writes.  Stopping the thread
+    // writes any remaining output synchronously.
+    void startAsyncWrites();
+    void stopAsyncWrites();
+    // Write all queued output now.  Used by the writer thread, and when
+    // draining the queue synchronously before the log file is closed or
+    // before a fatal exit.
+    void drainAsyncWrites();
+    void asyncWriterProc();
+
+    // The writer thread; joinable() if async writes are enabled
+    std::thread asyncThread;
+    // Guards asyncBuffer and asyncStop; always locked _after_ g_logMutex if
+    // both are needed
+    std::mutex asyncMutex;
+    std::condition_variable asyncWake;
+    // Output queued for the writer thread
+    std::string asyncBuffer;
+    bool asyncStop = false;
+
     // Wipe log file and backup log file if exists
     void wipeLogFile();
+
+    // Apply the compressed rotation configuration to rotator
+    void configureRotation();
 };
 
 // This is the default "base" filterset applied when logging to disk is enabled.
@@ -196,6 +245,7 @@ void Logger::addRedaction(const QString &redact, const QString &replace)
 {
     QMutexLocker lock{&g_logMutex};
     g_redactions[redact.toStdString()] = QStringLiteral("<<%1>>").arg(replace).toStdString();
+    g_redactor = kapps::core::StringRedactor{{g_redactions.begin(), g_redactions.end()}};
 }
 
 QString Logger::redactText(QString text)
@@ -234,6 +284,15 @@ Logger::~Logger()
     delete d_ptr;
 }
 
+void Logger::setAsyncWrites(bool asyncWrites)
+{
+    Q_D(Logger);
+    if(asyncWrites)
+        d->startAsyncWrites();
+    else
+        d->stopAsyncWrites();
+}
+
 bool Logger::logToFile() const
 {
     Q_D(Logger);
@@ -248,6 +307,13 @@ QStringList Logger::filters() const
     return d->filters;
 }
 
+void Logger::setCompressedRotation(bool compressedRotation)
+{
+    Q_D(Logger);
+    d->compressedRotation = compressedRotation;
+    d->configureRotation();
+}
+
 void Logger::wipeLogFile()
 {
     Q_D(Logger);
@@ -260,6 +326,7 @@ void Logger::configure(bool logToFile, bool largeLogFiles, const QStringList& fi
     bool changed = false, success = true, writeDebugFile = false, removeDebugFile = false;
     {
         d->logFileLimit = largeLogFiles ? largeLogFileLimit : standardLogFileLimit;
+        d->configureRotation();
         QMutexLocker lock(&g_logMutex);
         if (logToFile && !d->logToFile())
         {
@@ -276,6 +343,8 @@ void Logger::configure(bool logToFile, bool largeLogFiles, const QStringList& fi
         }
         else if (!logToFile && d->logToFile())
         {
+            // Write output that was already queued before closing the file
+            d->drainAsyncWrites();
             d->logFile.close();
             d->logFile.remove();
 #ifdef Q_OS_MAC
@@ -291,7 +360,7 @@ void Logger::configure(bool logToFile, bool largeLogFiles, const QStringList& fi
         if (filters != d->filters)
         {
             d->filters = filters;
-            QLoggingCategory::setFilterRules((logToFile ? d->defaultFilters : d->disabledFilters) + filters.join('\n'));
+            applyFilterRules((logToFile ? d->defaultFilters : d->disabledFilters) + filters.join('\n'));
             changed = true;
             if (logToFile)
                 writeDebugFile = true;
@@ -316,8 +385,9 @@ LoggerPrivate::LoggerPrivate(Logger* logger, const Path &logFilePath)
     : q_ptr(logger)
     , logSize(0)
     , logFilePath{logFilePath}
+    , rotator{logFilePath}
 {
-    QLoggingCategory::setFilterRules(disabledFilters + filters.join('\n'));
+    applyFilterRules(disabledFilters + filters.join('\n'));
 
     QObject::connect(&watcher, &QFileSystemWatcher::directoryChanged, logger, [this]() { readDebugFile(true); });
     QObject::connect(&watcher, &QFileSystemWatcher::fileChanged, logger, [this]() { readDebugFile(false); });
@@ -340,6 +410,14 @@ LoggerPrivate::LoggerPrivate(Logger* logger, const Path &logFilePath)
         watcher.addPath(Path::DebugFile.parent());
 }
 
+LoggerPrivate::~LoggerPrivate()
+{
+    // Stop compression before tearing down logging, the rotator's worker
+    // may trace
+    rotator.stop();
+    stopAsyncWrites();
+}
+
 void LoggerPrivate::readDebugFile(bool watchingDirectory)
 {
     Q_Q(Logger);
@@ -364,7 +442,7 @@ void LoggerPrivate::readDebugFile(bool watchingDirectory)
         if (filterLines != filters)
         {
             filters = filterLines;
-            QLoggingCategory::setFilterRules((logToFile() ? defaultFilters : disabledFilters) + filterString);
+            applyFilterRules((logToFile() ? defaultFilters : disabledFilters) + filterString);
             changed = true;
         }
         g_logMutex.unlock();
@@ -380,6 +458,7 @@ void LoggerPrivate::readDebugFile(bool watchingDirectory)
         g_logMutex.lock();
         if (logToFile())
         {
+            drainAsyncWrites();
             logFile.close();
             // Clear out the file name, so logToFile() == false
             logFile.setFileName({});
@@ -388,7 +467,7 @@ void LoggerPrivate::readDebugFile(bool watchingDirectory)
         if (!filters.empty())
         {
             filters.clear();
-            QLoggingCategory::setFilterRules(disabledFilters);
+            applyFilterRules(disabledFilters);
             changed = true;
         }
         g_logMutex.unlock();
@@ -463,7 +542,9 @@ void LoggerPrivate::writeToLogFile(const kapps::core::StringSlice &data)
             Path oldFilePath = logFilePath + oldFileSuffix;
             QFileInfo oldFileInfo(oldFilePath);
 
-            if(oldFileInfo.exists()) {
+            // With compressed rotation, the old file is compressed into the
+            // next generation rather than being deleted.
+            if(oldFileInfo.exists() && !rotator.rotateOldSegment()) {
                 if(oldFileInfo.isWritable()) {
                     QFile::remove(oldFilePath);
                 }
@@ -486,6 +567,88 @@ void LoggerPrivate::writeToLogFile(const kapps::core::StringSlice &data)
     }
 }
 
+void LoggerPrivate::writeLogOutput(std::string data)
+{
+    // Nothing to do if we're not writing to a file
+    if(!logFile.isOpen())
+        return;
+
+    if(!asyncThread.joinable())
+    {
+        writeToLogFile(data);
+        return;
+    }
+
+    bool wake;
+    {
+        std::unique_lock<std::mutex> lock{asyncMutex};
+        // Wake the writer if it's idle (to start the write interval), or if
+        // enough output has accumulated to write now
+        wake = asyncBuffer.empty();
+        asyncBuffer += data;
+        wake = wake || asyncBuffer.size() >= asyncWriteThreshold;
+    }
+    if(wake)
+        asyncWake.notify_one();
+}
+
+void LoggerPrivate::startAsyncWrites()
+{
+    if(asyncThread.joinable())
+        return;
+    asyncStop = false;
+    asyncThread = std::thread{[this](){asyncWriterProc();}};
+}
+
+void LoggerPrivate::stopAsyncWrites()
+{
+    if(!asyncThread.joinable())
+        return;
+    {
+        std::unique_lock<std::mutex> lock{asyncMutex};
+        asyncStop = true;
+    }
+    asyncWake.notify_one();
+    asyncThread.join();
+    // The writer drains the queue before exiting, but output could have been
+    // queued after that
+    drainAsyncWrites();
+}
+
+void LoggerPrivate::drainAsyncWrites()
+{
+    // Hold g_logMutex while taking the queued output and writing it, so
+    // output is written in order even if the queue is drained synchronously
+    // while the writer thread is active.
+    QMutexLocker logLock{&g_logMutex};
+    std::string data;
+    {
+        std::unique_lock<std::mutex> lock{asyncMutex};
+        data.swap(asyncBuffer);
+    }
+    if(!data.empty())
+        writeToLogFile(data);
+}
+
+void LoggerPrivate::asyncWriterProc()
+{
+    std::unique_lock<std::mutex> lock{asyncMutex};
+    while(!asyncStop)
+    {
+        // Sleep until there is some output, then wait for the write interval
+        // to elapse (or for enough output to accumulate) to batch it up
+        asyncWake.wait(lock, [this](){return asyncStop || !asyncBuffer.empty();});
+        asyncWake.wait_for(lock, asyncWriteInterval, [this]()
+        {
+            return asyncStop || asyncBuffer.size() >= asyncWriteThreshold;
+        });
+
+        lock.unlock();
+        drainAsyncWrites();
+        lock.lock();
+    }
+}
+
 void LoggerPrivate::wipeLogFile()
 {
     Path oldFilePath = logFilePath + oldFileSuffix;
@@ -499,6 +662,14 @@ void LoggerPrivate::wipeLogFile()
     if(QFile::exists(oldFilePath)) {
         QFile::remove(oldFilePath);
     }
+    rotator.wipe();
+}
+
+void LoggerPrivate::configureRotation()
+{
+    rotator.configure(compressedRotation ? compressedLogGenerations : 0,
+                      logFileLimit == largeLogFileLimit ? largeCompressedLogBudget
+                                                        : standardCompressedLogBudget);
 }
 
 namespace
@@ -632,9 +803,13 @@ void Logger::writeMsg(kapps::core::LogMessage msg)
 
 void Logger::fatalExit(LoggerPrivate *d)
 {
-    // One last extra attempt to ensure file data is flushed
+    // Write any output queued for async writes, then make one last extra
+    // attempt to ensure file data is flushed
     if (d)
+    {
+        d->drainAsyncWrites();
         d->logFile.close();
+    }
 
     // Abort - treat this as an unclean exit.  Also gives a chance to debug
     // in debug builds (this is how failed asserts are handled).
@@ -664,6 +839,11 @@ void Logger::writePrefixedMsg(LoggerPrivate *d, const std::string &logPrefix, st
 
     std::string redacted = redactTextNoLock(std::move(msg));
 
+    // Build the complete output, so it can be written to the console and log
+    // file in one write each
+    std::string output;
+    output.reserve(redacted.size() + logPrefix.size() + 1);
+
     // Slice out each line of the message and log it with the prefix
     std::size_t lineEnd = 0;
     while(lineEnd < redacted.size())
@@ -675,22 +855,16 @@ void Logger::writePrefixedMsg(LoggerPrivate *d, const std::string &logPrefix, st
         else
             ++lineEnd;  // Include the line break in the output
 
-        kapps::core::StringSlice line{redacted.c_str() + lineStart,
-                                     redacted.c_str() + lineEnd};
-
-        writeToConsoleNoLock(logPrefix);
-        writeToConsoleNoLock(line);
-        if(d)
-        {
-            d->writeToLogFile(logPrefix);
-            d->writeToLogFile(line);
-        }
+        output += logPrefix;
+        output.append(redacted, lineStart, lineEnd - lineStart);
     }
 
     // Terminate the last line
-    writeToConsoleNoLock("\n");
+    output += '\n';
+
+    writeToConsoleNoLock(output);
     if(d)
-        d->writeToLogFile("\n");
+        d->writeLogOutput(std::move(output));
 
     g_logMutex.unlock();
 }
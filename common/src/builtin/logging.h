@@ -135,6 +135,19 @@ public:
     void wipeLogFile ();
 
     Q_SLOT void configure(bool logToFile, bool largeLogFiles, const QStringList& filters);
+
+    // Write log output to the log file asynchronously.  Output is queued and
+    // written in batches by a writer thread, rather than being written and
+    // flushed synchronously by the thread that logged it.  Queued output is
+    // written within a short interval, and it's written synchronously before
+    // a fatal exit or when the Logger is destroyed.
+    void setAsyncWrites(bool asyncWrites);
+
+    // Keep compressed generations of the log file.  When the log is rotated,
+    // the prior ".old" file is compressed on a background thread rather than
+    // being deleted, and several compressed generations are kept within a
+    // disk budget.  See LogRotator.
+    void setCompressedRotation(bool compressedRotation);
     Q_SIGNAL void configurationChanged(bool logToFile, const QStringList& filters);
 
 public:
@@ -0,0 +1,339 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("builtin/logrotator.cpp")
+
+#include "logrotator.h"
+#include "logging.h"
+#include <QFile>
+#include <QFileInfo>
+
+#include <XzEnc.h>
+#include <Alloc.h>
+#include <7zCrc.h>
+#include <XzCrc64.h>
+
+namespace
+{
+    // Compression settings for log segments.  Logs compress very well even
+    // with a small dictionary, and a low preset keeps the memory and CPU
+    // usage of the background compression modest.
+    const int xzLevel = 3;
+    const UInt32 xzDictSize = 1u << 20;
+    // Size of the read buffer used by the input stream
+    const qint64 xzReadChunk = 64*1024;
+
+    std::once_flag xzTablesInit;
+
+    // Adapts QFile to the LZMA SDK's sequential input stream; the vtable must
+    // be the first member.
+    struct XzFileInStream
+    {
+        ISeqInStream vt;
+        QFile *pFile;
+        // Checked during compression to abandon it
+        const std::atomic<bool> *pStop;
+    };
+
+    SRes xzFileRead(ISeqInStreamPtr p, void *buf, size_t *size)
+    {
+        auto pStream = reinterpret_cast<const XzFileInStream*>(p);
+        if(pStream->pStop->load(std::memory_order_relaxed))
+            return SZ_ERROR_PROGRESS;
+        qint64 read = pStream->pFile->read(reinterpret_cast<char*>(buf),
+            std::min(static_cast<qint64>(*size), xzReadChunk));
+        if(read < 0)
+            return SZ_ERROR_READ;
+        *size = static_cast<size_t>(read);
+        return SZ_OK;
+    }
+
+    // Reports progress to the encoder; abandons compression when stopped.
+    // (The input stream's errors aren't passed through by the encoder, they
+    // all become SZ_ERROR_READ.)
+    struct XzStopProgress
+    {
+        ICompressProgress vt;
+        const std::atomic<bool> *pStop;
+    };
+
+    SRes xzStopProgress(ICompressProgressPtr p, UInt64, UInt64)
+    {
+        auto pProgress = reinterpret_cast<const XzStopProgress*>(p);
+        return pProgress->pStop->load(std::memory_order_relaxed) ? SZ_ERROR_PROGRESS : SZ_OK;
+    }
+
+    struct XzFileOutStream
+    {
+        ISeqOutStream vt;
+        QFile *pFile;
+    };
+
+    size_t xzFileWrite(ISeqOutStreamPtr p, const void *buf, size_t size)
+    {
+        auto pStream = reinterpret_cast<const XzFileOutStream*>(p);
+        qint64 written = pStream->pFile->write(reinterpret_cast<const char*>(buf),
+                                               static_cast<qint64>(size));
+        return written < 0 ? 0 : static_cast<size_t>(written);
+    }
+
+    // Replace a file with a rename, removing the target first if needed
+    bool replaceFile(const QString &from, const QString &to)
+    {
+        if(QFile::exists(to))
+            QFile::remove(to);
+        return QFile::rename(from, to);
+    }
+}
+
+const QString LogRotator::compressedSuffix{QStringLiteral(".xz")};
+const QString LogRotator::rotatingSuffix{QStringLiteral(".rotating")};
+
+QString LogRotator::generationPath(const QString &logPath, int generation)
+{
+    return logPath + QStringLiteral(".%1").arg(generation) + compressedSuffix;
+}
+
+LogRotator::LogRotator(QString logPath)
+    : _logPath{std::move(logPath)}, _generations{0}, _diskBudget{0},
+      _busy{false}, _stop{false}
+{
+}
+
+LogRotator::~LogRotator()
+{
+    stop();
+}
+
+void LogRotator::configure(int generations, qint64 diskBudget)
+{
+    bool resume = false;
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _generations = std::max(generations, 0);
+        _diskBudget = diskBudget;
+        // If a segment was left over from a prior run, compress it now
+        if(_generations > 0 && !_busy && QFile::exists(_logPath + rotatingSuffix))
+        {
+            _busy = true;
+            resume = true;
+        }
+    }
+
+    if(generations > 0)
+        startWorker();
+    if(resume)
+        _wake.notify_one();
+}
+
+bool LogRotator::rotateOldSegment()
+{
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if(_generations <= 0 || _busy || !_worker.joinable())
+            return false;
+        if(!replaceFile(_logPath + oldFileSuffix, _logPath + rotatingSuffix))
+            return false;
+        _busy = true;
+    }
+    _wake.notify_one();
+    return true;
+}
+
+void LogRotator::wipe()
+{
+    // Stop the worker to abandon any compression in progress
+    bool restart;
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        restart = _worker.joinable();
+    }
+    stop();
+
+    int generation = 1;
+    while(QFile::exists(generationPath(_logPath, generation)))
+    {
+        QFile::remove(generationPath(_logPath, generation));
+        ++generation;
+    }
+    QFile::remove(_logPath + rotatingSuffix);
+
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _busy = false;
+    }
+    if(restart)
+        startWorker();
+}
+
+void LogRotator::startWorker()
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    if(_worker.joinable())
+        return;
+    _stop = false;
+    _worker = std::thread{[this]{workerProc();}};
+}
+
+void LogRotator::stop()
+{
+    // Take the thread out of _worker so it can be joined without holding the
+    // lock (the worker needs it to exit); rotateOldSegment() stops taking
+    // segments right away.
+    std::thread worker;
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if(!_worker.joinable())
+            return;
+        _stop = true;
+        worker = std::move(_worker);
+    }
+    _wake.notify_one();
+    worker.join();
+    // A segment that was being compressed remains in the rotating file, it's
+    // picked up again by configure()
+    std::lock_guard<std::mutex> lock{_mutex};
+    _busy = false;
+}
+
+void LogRotator::workerProc()
+{
+    std::unique_lock<std::mutex> lock{_mutex};
+    while(true)
+    {
+        _wake.wait(lock, [this]{return _stop || _busy;});
+        if(_stop)
+            return;
+
+        int generations = _generations;
+        qint64 diskBudget = _diskBudget;
+        lock.unlock();
+        bool compressed = compressSegment(generations);
+        if(compressed)
+            enforceLimits(generations, diskBudget);
+        lock.lock();
+
+        // If compression was abandoned due to a stop, leave _busy set so no
+        // new segment is taken; stop() resets it.
+        if(!_stop)
+            _busy = false;
+    }
+}
+
+bool LogRotator::compressSegment(int generations)
+{
+    std::call_once(xzTablesInit, []
+    {
+        CrcGenerateTable();
+        Crc64GenerateTable();
+    });
+
+    const QString segmentPath = _logPath + rotatingSuffix;
+    const QString tempPath = generationPath(_logPath, 1) + QStringLiteral(".tmp");
+
+    QFile segment{segmentPath};
+    QFile compressed{tempPath};
+    if(!segment.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Unable to open log segment" << segmentPath
+            << "for compression:" << segment.errorString();
+        // Nothing can be done with this segment, discard it
+        QFile::remove(segmentPath);
+        return false;
+    }
+    if(!compressed.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "Unable to create compressed log" << tempPath << "-"
+            << compressed.errorString();
+        QFile::remove(segmentPath);
+        return false;
+    }
+
+    XzFileInStream inStream{{&xzFileRead}, &segment, &_stop};
+    XzFileOutStream outStream{{&xzFileWrite}, &compressed};
+    XzStopProgress progress{{&xzStopProgress}, &_stop};
+
+    CXzProps props;
+    XzProps_Init(&props);
+    props.lzma2Props.lzmaProps.level = xzLevel;
+    props.lzma2Props.lzmaProps.dictSize = xzDictSize;
+    props.lzma2Props.lzmaProps.reduceSize = static_cast<UInt64>(segment.size());
+    // Compress on this thread only; this is a background task
+    props.lzma2Props.lzmaProps.numThreads = 1;
+    props.lzma2Props.numBlockThreads_Max = 1;
+    props.lzma2Props.numTotalThreads = 1;
+    props.numBlockThreads_Max = 1;
+    props.numTotalThreads = 1;
+    props.checkId = XZ_CHECK_CRC32;
+
+    SRes result = Xz_Encode(&outStream.vt, &inStream.vt, &props, &progress.vt);
+    segment.close();
+    compressed.close();
+
+    if(result != SZ_OK)
+    {
+        QFile::remove(tempPath);
+        // If compression was abandoned, keep the segment to resume later.
+        // Otherwise, discard it - trying again would most likely fail again.
+        if(result == SZ_ERROR_PROGRESS || _stop)
+            return false;
+        qWarning() << "Unable to compress log segment" << segmentPath
+            << "- error" << result;
+        QFile::remove(segmentPath);
+        return false;
+    }
+
+    // Shift existing generations up to make room for the new generation 1.
+    // The oldest generation allowed is replaced (if present).
+    for(int generation = generations-1; generation >= 1; --generation)
+    {
+        QString path = generationPath(_logPath, generation);
+        if(QFile::exists(path))
+            replaceFile(path, generationPath(_logPath, generation+1));
+    }
+    if(!replaceFile(tempPath, generationPath(_logPath, 1)))
+    {
+        qWarning() << "Unable to store compressed log generation"
+            << generationPath(_logPath, 1);
+        QFile::remove(tempPath);
+    }
+    QFile::remove(segmentPath);
+    return true;
+}
+
+void LogRotator::enforceLimits(int generations, qint64 diskBudget)
+{
+    qint64 totalSize = 0;
+    int generation = 1;
+    // Keep the newest generations that fit in the count and budget
+    while(generation <= generations)
+    {
+        QFileInfo info{generationPath(_logPath, generation)};
+        if(!info.exists())
+            break;
+        totalSize += info.size();
+        if(totalSize > diskBudget)
+            break;
+        ++generation;
+    }
+    // Delete everything from the first generation that didn't fit.  Stop at
+    // the first gap, there are no generations beyond that.
+    while(QFile::remove(generationPath(_logPath, generation)))
+        ++generation;
+}
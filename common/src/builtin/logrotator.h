@@ -0,0 +1,121 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("builtin/logrotator.h")
+
+#ifndef BUILTIN_LOGROTATOR_H
+#define BUILTIN_LOGROTATOR_H
+#pragma once
+
+#include <QString>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// LogRotator keeps compressed generations of a log file.
+//
+// Logger still rotates the live log file to the ".old" file when it reaches its
+// size limit.  When compressed rotation is enabled, the previous ".old" file is
+// handed to LogRotator instead of being deleted; LogRotator compresses it with
+// xz on a background thread to become generation 1 ("daemon.log.1.xz"), and
+// prior generations shift up ("daemon.log.2.xz", etc.).  Generations beyond the
+// configured count or beyond the disk budget are deleted, oldest first.
+//
+// The segment being compressed is held as "daemon.log.rotating".  If the
+// rotator is stopped before compression completes, that file is left in place
+// and compressed the next time compressed rotation is configured.
+//
+// Since the compressed files are complete xz streams, they can be included
+// directly in a debug report without decompressing them.
+//
+// LogRotator does not trace while holding its own lock, since tracing can
+// cause the log to rotate.
+class COMMON_EXPORT LogRotator
+{
+public:
+    // Suffix used for compressed generations
+    static const QString compressedSuffix;
+    // Suffix used for the segment being compressed
+    static const QString rotatingSuffix;
+
+    // Get the path to a particular compressed generation of a log file.
+    // Generations start from 1.
+    static QString generationPath(const QString &logPath, int generation);
+
+public:
+    explicit LogRotator(QString logPath);
+    // Stops the worker thread if it's running; see stop().
+    ~LogRotator();
+
+private:
+    LogRotator(const LogRotator &) = delete;
+    LogRotator &operator=(const LogRotator &) = delete;
+
+public:
+    // Enable compressed rotation with a number of generations and a total disk
+    // budget (in bytes) for all compressed generations.  0 generations disables
+    // compressed rotation; existing generations are left alone in that case
+    // (they are removed by wipe()).
+    void configure(int generations, qint64 diskBudget);
+
+    // Take the ".old" segment for compression.  Returns true if the segment
+    // was taken; the caller can then rotate the live log to ".old".  Returns
+    // false if compressed rotation is disabled or if the previous segment is
+    // still being compressed; the caller should delete the ".old" segment in
+    // that case.
+    bool rotateOldSegment();
+
+    // Delete all compressed generations and any segment waiting to be
+    // compressed.  Abandons compression in progress.
+    void wipe();
+
+    // Stop the worker thread.  If compression is in progress, it's abandoned
+    // and resumed the next time compressed rotation is configured.  This must
+    // not be called while holding the log mutex, since the worker may be
+    // tracing.
+    void stop();
+
+private:
+    void startWorker();
+    void workerProc();
+    // Compress the rotating segment to generation 1, shifting existing
+    // generations.  Returns false if compression failed or was abandoned.
+    bool compressSegment(int generations);
+    // Delete generations that exceed the generation count or disk budget
+    void enforceLimits(int generations, qint64 diskBudget);
+
+private:
+    const QString _logPath;
+    // Guards all fields below
+    std::mutex _mutex;
+    // The worker thread.  configure(), wipe(), and stop() start and stop it,
+    // they must be called from one thread.
+    std::thread _worker;
+    std::condition_variable _wake;
+    int _generations;
+    qint64 _diskBudget;
+    // Whether a segment is waiting to be compressed or being compressed
+    bool _busy;
+    // Set to stop the worker; also checked (without the lock) during
+    // compression to abandon it
+    std::atomic<bool> _stop;
+};
+
+#endif
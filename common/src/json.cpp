@@ -446,3 +446,119 @@ QJsonObject adaptJsonTextToQJsonObject(kapps::core::StringSlice jsonText)
     }
     return qtJsonDoc.object();
 }
+
+namespace
+{
+    enum class PatchOp
+    {
+        Add,
+        Remove,
+        Replace,
+    };
+
+    // Parse an RFC 6901 JSON Pointer into its reference tokens
+    QStringList parseJsonPointer(const QString &pointer)
+    {
+        if(pointer.isEmpty())
+            return {};  // Refers to the whole document
+        if(!pointer.startsWith('/'))
+            throw std::runtime_error{"JSON pointer must begin with '/'"};
+        QStringList tokens = pointer.mid(1).split('/');
+        for(auto &token : tokens)
+        {
+            // Order matters, "~01" is "~1", not "/"
+            token.replace(QStringLiteral("~1"), QStringLiteral("/"));
+            token.replace(QStringLiteral("~0"), QStringLiteral("~"));
+        }
+        return tokens;
+    }
+
+    int parseArrayIndex(const QString &token, qsizetype size, bool allowEnd)
+    {
+        if(allowEnd && token == QStringLiteral("-"))
+            return static_cast<int>(size);
+        bool ok{false};
+        int index = token.toInt(&ok);
+        if(!ok || index < 0 || index > size || (!allowEnd && index == size))
+            throw std::runtime_error{"JSON patch array index out of range"};
+        return index;
+    }
+
+    // Apply one operation at path[pos...] within target
+    QJsonValue applyPatchOp(const QJsonValue &target, const QStringList &path,
+                            qsizetype pos, PatchOp op, const QJsonValue &value)
+    {
+        // The whole target is replaced (or removed) by this operation
+        if(pos == path.size())
+            return op == PatchOp::Remove ? QJsonValue{} : value;
+
+        const QString &token = path[pos];
+        bool last = pos + 1 == path.size();
+
+        if(target.isObject())
+        {
+            QJsonObject object = target.toObject();
+            auto itMember = object.find(token);
+            if(last && op == PatchOp::Add)
+                object.insert(token, value);
+            else if(itMember == object.end())
+                throw std::runtime_error{"JSON patch path does not exist"};
+            else if(last && op == PatchOp::Remove)
+                object.erase(itMember);
+            else if(last)
+                *itMember = value;
+            else
+                *itMember = applyPatchOp(itMember.value(), path, pos+1, op, value);
+            return object;
+        }
+
+        if(target.isArray())
+        {
+            QJsonArray array = target.toArray();
+            int index = parseArrayIndex(token, array.size(), last && op == PatchOp::Add);
+            if(last && op == PatchOp::Add)
+                array.insert(index, value);
+            else if(last && op == PatchOp::Remove)
+                array.removeAt(index);
+            else if(last)
+                array[index] = value;
+            else
+                array[index] = applyPatchOp(array.at(index), path, pos+1, op, value);
+            return array;
+        }
+
+        throw std::runtime_error{"JSON patch path does not exist"};
+    }
+}
+
+QJsonValue applyJsonPatch(QJsonValue value, const QJsonArray &patch)
+{
+    for(const auto &opValue : patch)
+    {
+        const QJsonObject &opObject = opValue.toObject();
+        const QString &opName = opObject.value(QStringLiteral("op")).toString();
+        PatchOp op;
+        if(opName == QStringLiteral("add"))
+            op = PatchOp::Add;
+        else if(opName == QStringLiteral("remove"))
+            op = PatchOp::Remove;
+        else if(opName == QStringLiteral("replace"))
+            op = PatchOp::Replace;
+        else
+        {
+            KAPPS_CORE_WARNING() << "Unsupported JSON patch operation" << opName;
+            throw std::runtime_error{"unsupported JSON patch operation"};
+        }
+
+        auto itPath = opObject.find(QStringLiteral("path"));
+        if(itPath == opObject.end() || !itPath.value().isString())
+            throw std::runtime_error{"JSON patch operation has no path"};
+        QJsonValue opArg = opObject.value(QStringLiteral("value"));
+        if(op != PatchOp::Remove && opArg.isUndefined())
+            throw std::runtime_error{"JSON patch operation has no value"};
+
+        value = applyPatchOp(value, parseJsonPointer(itPath.value().toString()), 0,
+                             op, opArg);
+    }
+    return value;
+}
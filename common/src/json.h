@@ -734,6 +734,15 @@ COMMON_EXPORT void writeProperties(const QJsonObject &object, const Path &settin
 // it's trivial - just QJsonDocument{o}.toJson() followed by
 // nlohmann::json::parse(), which throws good exceptions for errors.
 COMMON_EXPORT QJsonObject adaptJsonTextToQJsonObject(kapps::core::StringSlice jsonText);
+
+// Apply an RFC 6902 JSON Patch to a value, returning the patched value.  The
+// "add", "remove", and "replace" operations are supported (these are the only
+// operations produced by nlohmann::json::diff(), which is used to generate
+// patches in the daemon).  Unchanged parts of the value remain shared with the
+// original value.
+//
+// Throws if the patch is not valid or can't be applied to this value.
+COMMON_EXPORT QJsonValue applyJsonPatch(QJsonValue value, const QJsonArray &patch);
 template<class JsonT>
 QJsonObject adaptNljToQt(const JsonT &j)
 {
@@ -20,9 +20,65 @@
 #line SOURCE_FILE("jsonrpc.cpp")
 
 #include "jsonrpc.h"
+#include <QCborMap>
+#include <QCborValue>
+#include <algorithm>
 
 namespace
 {
+    // The IPC framing reserves 0xFF to identify the start of a frame (see
+    // ipc.cpp), but CBOR can contain any byte value.  CBOR payloads escape
+    // 0xFE and 0xFF as 0xFE 0x00 and 0xFE 0x01.  Neither byte occurs in UTF-8,
+    // so JSON payloads never need to be escaped.
+    const char cborEscape = static_cast<char>(0xFE);
+
+    bool isReservedByte(char c)
+    {
+        return static_cast<unsigned char>(c) >= 0xFE;
+    }
+
+    QByteArray escapeCbor(const QByteArray &cbor)
+    {
+        if(std::none_of(cbor.begin(), cbor.end(), &isReservedByte))
+            return cbor;
+
+        QByteArray escaped;
+        escaped.reserve(cbor.size() + cbor.size() / 64 + 16);
+        for(char c : cbor)
+        {
+            if(isReservedByte(c))
+            {
+                escaped.push_back(cborEscape);
+                escaped.push_back(static_cast<char>(c - cborEscape));
+            }
+            else
+                escaped.push_back(c);
+        }
+        return escaped;
+    }
+
+    QByteArray unescapeCbor(const QByteArray &escaped) throws(Error)
+    {
+        if(!escaped.contains(cborEscape))
+            return escaped;
+
+        QByteArray cbor;
+        cbor.reserve(escaped.size());
+        for(auto it = escaped.begin(); it != escaped.end(); ++it)
+        {
+            if(*it == cborEscape)
+            {
+                ++it;
+                if(it == escaped.end() || static_cast<unsigned char>(*it) > 1)
+                    throw JsonRPCParseError(HERE, "invalid CBOR escape");
+                cbor.push_back(static_cast<char>(cborEscape + *it));
+            }
+            else
+                cbor.push_back(*it);
+        }
+        return cbor;
+    }
+
     // The "data" method is used from the daemon to provide updates to clients.
     // It's invoked a lot and is not interesting, suppress normal tracing for
     // this method.
@@ -32,8 +88,45 @@ namespace
     }
 }
 
+QByteArray encodeJsonRPCMessage(const QJsonObject &msg, JsonRPCEncoding encoding)
+{
+    if(encoding == JsonRPCEncoding::Cbor)
+        return escapeCbor(QCborMap::fromJsonObject(msg).toCborValue().toCbor());
+    return QJsonDocument(msg).toJson(QJsonDocument::Compact);
+}
+
+JsonRPCEncoding detectJsonRPCEncoding(const QByteArray &msg)
+{
+    // Messages are always objects.  A CBOR map begins with major type 5
+    // (0xA0-0xBF), which can't begin a JSON document.
+    if(!msg.isEmpty() && (static_cast<unsigned char>(msg[0]) & 0xE0) == 0xA0)
+        return JsonRPCEncoding::Cbor;
+    return JsonRPCEncoding::Json;
+}
+
+QJsonObject buildJsonRPCRequest(const QJsonValue &id, const QString &method, const QJsonArray &params)
+{
+    QJsonObject msg;
+    msg[QStringLiteral("jsonrpc")] = QStringLiteral("2.0");
+    if (id.isString() || id.isDouble())
+        msg[QStringLiteral("id")] = id;
+    msg[QStringLiteral("method")] = method;
+    msg[QStringLiteral("params")] = params;
+    return msg;
+}
+
 QJsonObject parseJsonRPCMessage(const QByteArray &msg) throws(Error)
 {
+    if (detectJsonRPCEncoding(msg) == JsonRPCEncoding::Cbor)
+    {
+        QCborParserError error;
+        QCborValue cbor = QCborValue::fromCbor(unescapeCbor(msg), &error);
+        if (error.error != QCborError::NoError)
+            throw JsonRPCParseError(HERE, error.errorString());
+        // Only maps can be detected as CBOR
+        return cbor.toMap().toJsonObject();
+    }
+
     QJsonParseError error;
     QJsonDocument json = QJsonDocument::fromJson(msg, &error);
     if (error.error != QJsonParseError::NoError)
@@ -310,7 +403,7 @@ void LocalCallInterface::respondWithResult(const QJsonValue &id, const QJsonValu
         { QStringLiteral("id"), id },
         { QStringLiteral("result"), result.isUndefined() ? QJsonValue::Null : result },
     };
-    emit messageReady(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    emit messageReady(encodeJsonRPCMessage(msg, _encoding));
 }
 
 void LocalCallInterface::respondWithError(const QJsonValue &id, const Error &error)
@@ -325,7 +418,7 @@ void LocalCallInterface::respondWithError(const QJsonValue &id, const QJsonObjec
     msg[QStringLiteral("jsonrpc")] = QStringLiteral("2.0");
     msg[QStringLiteral("id")] = (id.isString() || id.isDouble()) ? id : QJsonValue(QJsonValue::Null);
     msg[QStringLiteral("error")] = error;
-    emit messageReady(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    emit messageReady(encodeJsonRPCMessage(msg, _encoding));
 }
 
 void RemoteNotificationInterface::postWithParams(const QString& method, const QJsonArray& params)
@@ -339,13 +432,7 @@ void RemoteNotificationInterface::request(const QJsonValue &id, const QString &m
     {
         qInfo() << "Sending request" << id << "to invoke RPC method" << method;
     }
-    QJsonObject msg;
-    msg[QStringLiteral("jsonrpc")] = QStringLiteral("2.0");
-    if (id.isString() || id.isDouble())
-        msg[QStringLiteral("id")] = id;
-    msg[QStringLiteral("method")] = method;
-    msg[QStringLiteral("params")] = params;
-    emit messageReady(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+    emit messageReady(encodeJsonRPCMessage(buildJsonRPCRequest(id, method, params), _encoding));
 }
 
 double RemoteCallInterface::getNextId()
@@ -519,6 +606,12 @@ ServerSideInterface::ServerSideInterface(LocalMethodRegistry *methods, QObject *
     connect(&_local, &LocalCallInterface::messageReady, this, &ServerSideInterface::messageReady);
 }
 
+void ServerSideInterface::setEncoding(JsonRPCEncoding encoding)
+{
+    RemoteNotificationInterface::setEncoding(encoding);
+    _local.setEncoding(encoding);
+}
+
 bool ServerSideInterface::processMessage(const QByteArray &msg)
 {
     return _local.processMessage(msg);
@@ -38,6 +38,20 @@
 #include <initializer_list>
 
 
+// Encodings that can be used for JSON-RPC messages.  All nodes understand
+// JSON; CBOR is more compact and faster to serialize and parse, but it's only
+// sent once the remote node has agreed to it (see
+// Daemon::RPC_setRpcEncoding()).  Received messages are always accepted in
+// either encoding.
+enum class JsonRPCEncoding
+{
+    Json,
+    Cbor,
+};
+
+COMMON_EXPORT QByteArray encodeJsonRPCMessage(const QJsonObject& msg, JsonRPCEncoding encoding);
+COMMON_EXPORT JsonRPCEncoding detectJsonRPCEncoding(const QByteArray& msg);
+COMMON_EXPORT QJsonObject buildJsonRPCRequest(const QJsonValue& id, const QString& method, const QJsonArray& params);
 COMMON_EXPORT QJsonObject parseJsonRPCMessage(const QByteArray& msg) throws(Error);
 COMMON_EXPORT void parseJsonRPCRequest(const QJsonObject& request, QString& method, QJsonArray& params) throws(Error);
 
@@ -209,6 +223,10 @@ class COMMON_EXPORT LocalCallInterface : public LocalNotificationInterface
 public:
     using LocalNotificationInterface::LocalNotificationInterface;
 
+    // Encoding used for responses (JSON by default)
+    JsonRPCEncoding encoding() const { return _encoding; }
+    void setEncoding(JsonRPCEncoding encoding) { _encoding = encoding; }
+
 public slots:
     virtual bool processMessage(const QByteArray& msg) override;
     virtual bool processRequest(const QJsonObject& request) override;
@@ -220,6 +238,9 @@ protected:
 
 signals:
     void messageReady(const QByteArray& response);
+
+private:
+    JsonRPCEncoding _encoding = JsonRPCEncoding::Json;
 };
 
 
@@ -234,6 +255,10 @@ class COMMON_EXPORT RemoteNotificationInterface : public QObject
 public:
     using QObject::QObject;
 
+    // Encoding used for outgoing requests (JSON by default)
+    JsonRPCEncoding encoding() const { return _encoding; }
+    virtual void setEncoding(JsonRPCEncoding encoding) { _encoding = encoding; }
+
     template<typename... Args>
     inline void post(const QString& name, Args&&... args);
 
@@ -244,6 +269,9 @@ protected:
 
 signals:
     void messageReady(const QByteArray& msg);
+
+private:
+    JsonRPCEncoding _encoding = JsonRPCEncoding::Json;
 };
 
 
@@ -305,6 +333,9 @@ class COMMON_EXPORT ServerSideInterface : public RemoteNotificationInterface
 public:
     explicit ServerSideInterface(LocalMethodRegistry* methods, QObject* parent = nullptr);
 
+    // Sets the encoding for both notifications and responses
+    virtual void setEncoding(JsonRPCEncoding encoding) override;
+
 public slots:
     bool processMessage(const QByteArray& msg);
 
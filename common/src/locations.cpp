@@ -23,6 +23,7 @@
 #include <kapps_regions/src/regionlist.h>
 #include <kapps_regions/src/metadata.h>
 #include <QJsonDocument>
+#include <cmath>
 
 namespace
 {
@@ -37,6 +38,21 @@ namespace
         QStringLiteral("ovpnudp"),
         QStringLiteral("wg")
     };
+
+    // Parameters of LatencyPredictor's model.  Light in fiber covers about
+    // 200 km/ms, so a round trip costs at least 0.01 ms/km; real routes are
+    // indirect, so the default is twice that.  A fitted slope is limited to a
+    // plausible range, since a few measurements could be noisy.
+    const double earthRadiusKm{6371.0};
+    const double defaultLatencyPerKm{0.02};
+    const double minLatencyPerKm{0.01};
+    const double maxLatencyPerKm{0.1};
+    // A slope is only fitted with at least this many measurements
+    const std::size_t minFitMeasurements{3};
+
+    const double degreesPerRadian{180.0 / 3.14159265358979323846};
+
+    double toRadians(double degrees) {return degrees / degreesPerRadian;}
 }
 
 const std::unordered_map<QString, QString> shadowsocksLegacyRegionMap
@@ -54,7 +70,8 @@ auto buildModernLocations(const LatencyMap &latencies,
                           const QJsonArray &shadowsocksObj,
                           const QJsonObject &metadataObj,
                           const std::vector<AccountDedicatedIp> &dedicatedIps,
-                          const ManualServer &manualServer)
+                          const ManualServer &manualServer,
+                          const LatencyQualityMap &latencyQuality)
     -> std::pair<LocationsById, kapps::regions::Metadata>
 {
     QByteArray regionsJson = QJsonDocument{regionsObj}.toJson();
@@ -131,14 +148,193 @@ auto buildModernLocations(const LatencyMap &latencies,
         auto itLatency = latencies.find(regionId);
         if(itLatency != latencies.end())
             latency.emplace(itLatency->second);
+        LatencyQuality quality;
+        auto itQuality = latencyQuality.find(regionId);
+        if(itQuality != latencyQuality.end())
+            quality = itQuality->second;
 
         newLocations.emplace(pRegion->id().to_string(),
-            QSharedPointer<Location>::create(pRegion->shared_from_this(), latency));
+            QSharedPointer<Location>::create(pRegion->shared_from_this(),
+                                             latency, quality));
     }
 
     return {std::move(newLocations), std::move(metadata)};
 }
 
+bool applyLocationLatencies(LocationsById &locations, const LatencyMap &latencies,
+                            const LatencyQualityMap &latencyQuality,
+                            const ServerRankingMap &serverRankings)
+{
+    const std::vector<QString> noRanking;
+    bool changed = false;
+    for(auto &locationEntry : locations)
+    {
+        Q_ASSERT(locationEntry.second);
+        const Location &oldLocation = *locationEntry.second;
+
+        QString locationId{qs::toQString(locationEntry.first)};
+        nullable_t<double> latency;
+        auto itLatency = latencies.find(locationId);
+        if(itLatency != latencies.end())
+            latency.emplace(itLatency->second);
+        LatencyQuality quality;
+        auto itQuality = latencyQuality.find(locationId);
+        if(itQuality != latencyQuality.end())
+            quality = itQuality->second;
+
+        auto itRanking = serverRankings.find(locationId);
+        const auto &ranking = itRanking != serverRankings.end() ? itRanking->second : noRanking;
+
+        if(latency == oldLocation.latency() && quality == oldLocation.latencyQuality() &&
+           ranking == oldLocation.serverRanking())
+        {
+            continue;
+        }
+
+        locationEntry.second = QSharedPointer<Location>::create(oldLocation,
+                                                                latency, quality,
+                                                                ranking,
+                                                                oldLocation.predictedLatency());
+        changed = true;
+    }
+    return changed;
+}
+
+void LatencyPredictor::addMeasurement(double latitude, double longitude,
+                                      double latency)
+{
+    if(std::isnan(latitude) || std::isnan(longitude) || latency < 0)
+        return;
+    _measurements.push_back({latitude, longitude, latency});
+    _fitted = false;
+}
+
+double LatencyPredictor::distanceKm(double latitude1, double longitude1,
+                                    double latitude2, double longitude2)
+{
+    // Haversine formula
+    double dLat = toRadians(latitude2 - latitude1);
+    double dLon = toRadians(longitude2 - longitude1);
+    double a = std::sin(dLat / 2) * std::sin(dLat / 2) +
+        std::cos(toRadians(latitude1)) * std::cos(toRadians(latitude2)) *
+        std::sin(dLon / 2) * std::sin(dLon / 2);
+    return 2 * earthRadiusKm * std::asin(std::min(1.0, std::sqrt(a)));
+}
+
+void LatencyPredictor::fit()
+{
+    _fitted = true;
+    if(_measurements.empty())
+        return;
+
+    // Estimate the client's position as the centroid of the measured regions
+    // weighted by 1/latency^2, so the nearest regions dominate.  The centroid
+    // is computed with unit vectors so it works across the antimeridian.
+    double x{0}, y{0}, z{0};
+    for(const auto &measurement : _measurements)
+    {
+        double weight = 1.0 / std::pow(std::max(measurement.latency, 1.0), 2);
+        double lat = toRadians(measurement.latitude);
+        double lon = toRadians(measurement.longitude);
+        x += weight * std::cos(lat) * std::cos(lon);
+        y += weight * std::cos(lat) * std::sin(lon);
+        z += weight * std::sin(lat);
+    }
+    _latitude = std::atan2(z, std::sqrt(x * x + y * y)) * degreesPerRadian;
+    _longitude = std::atan2(y, x) * degreesPerRadian;
+
+    // Fit latency = base + slope * distance with least squares if there are
+    // enough measurements
+    std::vector<double> distances;
+    distances.reserve(_measurements.size());
+    double meanDistance{0}, meanLatency{0};
+    for(const auto &measurement : _measurements)
+    {
+        distances.push_back(distanceKm(_latitude, _longitude,
+                                       measurement.latitude, measurement.longitude));
+        meanDistance += distances.back();
+        meanLatency += measurement.latency;
+    }
+    meanDistance /= _measurements.size();
+    meanLatency /= _measurements.size();
+
+    _latencyPerKm = defaultLatencyPerKm;
+    if(_measurements.size() >= minFitMeasurements)
+    {
+        double covariance{0}, variance{0};
+        for(std::size_t i=0; i<_measurements.size(); ++i)
+        {
+            covariance += (distances[i] - meanDistance) * (_measurements[i].latency - meanLatency);
+            variance += (distances[i] - meanDistance) * (distances[i] - meanDistance);
+        }
+        if(variance > 0)
+        {
+            _latencyPerKm = std::max(minLatencyPerKm,
+                                     std::min(covariance / variance, maxLatencyPerKm));
+        }
+    }
+    // The base latency is the average residual; it covers the client's
+    // access network and the server's processing time
+    _baseLatency = std::max(0.0, meanLatency - _latencyPerKm * meanDistance);
+}
+
+nullable_t<double> LatencyPredictor::predict(double latitude, double longitude)
+{
+    if(!_fitted)
+        fit();
+    if(_measurements.empty() || std::isnan(latitude) || std::isnan(longitude))
+        return {};
+    double distance = distanceKm(_latitude, _longitude, latitude, longitude);
+    // Round to whole milliseconds like the measurements, so small changes in
+    // the fit don't replace every location
+    return std::round(_baseLatency + _latencyPerKm * distance);
+}
+
+bool applyPredictedLatencies(LocationsById &locations,
+                             const kapps::regions::Metadata &metadata)
+{
+    auto findDisplay = [&](const Location &location)
+    {
+        return metadata.getRegionDisplay(location.id().toStdString());
+    };
+
+    LatencyPredictor predictor;
+    for(const auto &locationEntry : locations)
+    {
+        Q_ASSERT(locationEntry.second);
+        const Location &location = *locationEntry.second;
+        const auto *pDisplay = findDisplay(location);
+        if(location.latency() && pDisplay)
+        {
+            predictor.addMeasurement(pDisplay->geoLatitude(), pDisplay->geoLongitude(),
+                                     location.latency().get());
+        }
+    }
+
+    bool changed = false;
+    for(auto &locationEntry : locations)
+    {
+        const Location &oldLocation = *locationEntry.second;
+        // Measured locations don't need a prediction
+        nullable_t<double> predicted;
+        if(!oldLocation.latency())
+        {
+            const auto *pDisplay = findDisplay(oldLocation);
+            if(pDisplay)
+                predicted = predictor.predict(pDisplay->geoLatitude(), pDisplay->geoLongitude());
+        }
+
+        if(predicted == oldLocation.predictedLatency())
+            continue;
+
+        locationEntry.second = QSharedPointer<Location>::create(oldLocation,
+            oldLocation.latency(), oldLocation.latencyQuality(),
+            oldLocation.serverRanking(), predicted);
+        changed = true;
+    }
+    return changed;
+}
+
 // Compare two locations to sort them.
 // Sorts by latencies first, then by IDs.
 // Tiebreaking by ID ensures that we sort regions the same way in all contexts.
@@ -231,18 +427,102 @@ void buildGroupedLocations(const LocationsById &locations,
         });
 }
 
+// Compare two locations to select the best one automatically.
+// Sorts by selection scores first (latency penalized by jitter/loss), then by
+// IDs, like compareEntries().
+bool compareSelectionScores(const Location &first, const Location &second)
+{
+    const auto &firstScore = first.selectionScore();
+    const auto &secondScore = second.selectionScore();
+    // Unknown scores sort last
+    if(firstScore && !secondScore)
+        return true;
+    if(!firstScore && secondScore)
+        return false;
+
+    if(firstScore && firstScore.get() != secondScore.get())
+        return firstScore.get() < secondScore.get();
+
+    return first.id().compare(second.id(), Qt::CaseSensitivity::CaseInsensitive) < 0;
+}
+
+bool NearestLocations::CompareScores::operator()(const QSharedPointer<const Location> &pFirst,
+                                                 const QSharedPointer<const Location> &pSecond) const
+{
+    Q_ASSERT(pFirst);
+    Q_ASSERT(pSecond);
+    return compareSelectionScores(*pFirst, *pSecond);
+}
+
 NearestLocations::NearestLocations(const LocationsById &allLocations)
 {
-    _locations.reserve(allLocations.size());
+    update(allLocations);
+}
+
+auto NearestLocations::locationTier(const Location &location) -> Tier
+{
+    if(location.autoSafe())
+        return location.geoLocated() ? AutoSafeGeo : AutoSafeNonGeo;
+    return location.geoLocated() ? Geo : NonGeo;
+}
+
+void NearestLocations::insert(const QSharedPointer<const Location> &pLocation)
+{
+    if(!pLocation->offline())
+        _tiers[locationTier(*pLocation)].insert(pLocation);
+}
+
+void NearestLocations::erase(const QSharedPointer<const Location> &pLocation)
+{
+    // Location objects are immutable, so this finds the same position where
+    // it was inserted
+    if(!pLocation->offline())
+        _tiers[locationTier(*pLocation)].erase(pLocation);
+}
+
+void NearestLocations::update(const LocationsById &allLocations)
+{
+    // Drop locations that are no longer present
+    for(auto itRanked = _rankedLocations.begin(); itRanked != _rankedLocations.end(); )
+    {
+        if(allLocations.count(itRanked->first))
+            ++itRanked;
+        else
+        {
+            erase(itRanked->second);
+            itRanked = _rankedLocations.erase(itRanked);
+        }
+    }
+
+    // Re-rank locations that changed, and add new locations
     for(const auto &locationEntry : allLocations)
-        _locations.push_back(locationEntry.second);
-    std::sort(_locations.begin(), _locations.end(),
-                   [](const auto &pFirst, const auto &pSecond) {
-                       Q_ASSERT(pFirst);
-                       Q_ASSERT(pSecond);
-
-                       return compareEntries(*pFirst, *pSecond);
-                   });
+    {
+        Q_ASSERT(locationEntry.second);
+        auto &pRanked = _rankedLocations[locationEntry.first];
+        if(pRanked == locationEntry.second)
+            continue;
+        if(pRanked)
+            erase(pRanked);
+        pRanked = locationEntry.second;
+        insert(pRanked);
+    }
+}
+
+QSharedPointer<const Location> NearestLocations::getBestLocation() const
+{
+    if(_rankedLocations.empty())
+    {
+        qWarning() << "There are no available Server Locations!";
+        return {};
+    }
+
+    // No context criterion, just take the first location of the best tier
+    for(const auto &tier : _tiers)
+    {
+        if(!tier.empty())
+            return *tier.begin();
+    }
+    return {};
 }
 
 QSharedPointer<const Location> NearestLocations::getNearestSafeVpnLocation(bool portForward) const
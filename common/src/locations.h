@@ -24,31 +24,123 @@
 #include "settings/locations.h"
 #include "settings/dedicatedip.h"
 #include <kapps_regions/src/metadata.h>
+#include <array>
+#include <set>
 
 
 // Build Location and Server objects for the modern region infrastructure from
 // the latencies, modern regions list, and Shadowsocks regions list.
 // Dedicated IPs and the dev manual server are added as additional regions.
+// Latency quality (jitter/loss) is optional; it's used to select locations
+// automatically.
 COMMON_EXPORT auto buildModernLocations(const LatencyMap &latencies,
                                         const QJsonObject &regionsObj,
                                         const QJsonArray &shadowsocksObj,
                                         const QJsonObject &metadataObj,
                                         const std::vector<AccountDedicatedIp> &dedicatedIps,
-                                        const ManualServer &manualServer)
+                                        const ManualServer &manualServer,
+                                        const LatencyQualityMap &latencyQuality = {})
     -> std::pair<LocationsById, kapps::regions::Metadata>;
 
+// Apply new latencies to locations previously built by buildModernLocations().
+// Locations whose latency is unchanged are kept as-is; the others are replaced
+// with copies carrying the new latency.  This does not re-parse the regions
+// list or metadata, so it's much cheaper than a full rebuild when only
+// latencies have changed.
+//
+// Server rankings from per-server measurements are applied too, so the
+// fastest servers are tried first when connecting (see
+// Location::serverRanking()).
+//
+// Returns true if any location's latency, latency quality, or server ranking
+// changed.
+COMMON_EXPORT bool applyLocationLatencies(LocationsById &locations,
+                                          const LatencyMap &latencies,
+                                          const LatencyQualityMap &latencyQuality = {},
+                                          const ServerRankingMap &serverRankings = {});
+
+// LatencyPredictor estimates the latency to regions that haven't been measured
+// yet from their great-circle distance to the client.
+//
+// The client's position is estimated from the regions that have been measured
+// (nearby regions have the lowest latency), then a linear model of latency vs.
+// distance is fitted to those measurements.  This is only a rough estimate,
+// but it's much better than nothing for selecting a region automatically at
+// startup or after new regions appear, before all regions have been measured.
+class COMMON_EXPORT LatencyPredictor
+{
+private:
+    struct Measurement
+    {
+        double latitude;
+        double longitude;
+        double latency;
+    };
+
+public:
+    // Add a measured region's coordinates (degrees) and latency (ms).  Regions
+    // without coordinates (NaN) are ignored.
+    void addMeasurement(double latitude, double longitude, double latency);
+
+    // Predict the latency (ms) to a position.  Unknown if no measurements have
+    // been added or if the coordinates are NaN.
+    nullable_t<double> predict(double latitude, double longitude);
+
+    // The estimated client position - valid once a prediction has been made
+    double latitude() const {return _latitude;}
+    double longitude() const {return _longitude;}
+
+    // Great-circle distance between two positions in km
+    static double distanceKm(double latitude1, double longitude1,
+                             double latitude2, double longitude2);
+
+private:
+    void fit();
+
+private:
+    std::vector<Measurement> _measurements;
+    bool _fitted{false};
+    double _latitude{0};
+    double _longitude{0};
+    double _baseLatency{0};
+    double _latencyPerKm{0};
+};
+
+// Apply predicted latencies to the locations that haven't been measured, using
+// the measured locations to seed a LatencyPredictor (see
+// Location::predictedLatency()).  Predictions are cleared for measured
+// locations.
+//
+// Returns true if any location's predicted latency changed.
+COMMON_EXPORT bool applyPredictedLatencies(LocationsById &locations,
+                                           const kapps::regions::Metadata &metadata);
+
 // Build the grouped and sorted locations from the flat locations.
 COMMON_EXPORT void buildGroupedLocations(const LocationsById &locations,
                                          const kapps::regions::Metadata &metadata,
                                          std::vector<CountryLocations> &groupedLocations,
                                          std::vector<QSharedPointer<const Location>> &dedicatedIpLocations);
 
+// "Nearest" locations are ranked by Location::selectionScore() - the latency,
+// penalized by the jitter and loss of the latency measurements.
+//
+// NearestLocations keeps the locations in ordered indexes - one for each
+// fallback tier of the selection algorithm (see below).  It can be kept and
+// updated when the locations change; only the locations that actually changed
+// are re-ranked, which is O(log n) each.  The best location is found without
+// scanning, and predicates only examine locations until one matches.
 class COMMON_EXPORT NearestLocations
 {
 public:
+    NearestLocations() = default;
     NearestLocations(const LocationsById &locations);
 
 public:
+    // Update the indexes with a new set of locations.  Locations that are
+    // unchanged (the same Location object) are left in place; changed
+    // locations are re-ranked, and removed locations are dropped.
+    void update(const LocationsById &locations);
+
     // Find the closest server location that is safe to use with 'connect auto'.
     // This only considers non-geo servers that are indicated for auto selection
     // in the servers list.
@@ -99,71 +191,63 @@ public:
     // match the predicate, per above.  Does _not_ fall back to locations that
     // do not match the predicate; use getBestLocation() as a fallback if that
     // is possible and this method fails to find a location.
+    //
+    // Each fallback step in the table above only adds one tier of locations
+    // that wasn't considered by the prior steps, so this just searches the
+    // tiers in order.  Offline locations are never indexed.
     template<class LocationTestFunc>
-    QSharedPointer<const Location> getBestMatchingLocation(LocationTestFunc isAllowedBase) const
+    QSharedPointer<const Location> getBestMatchingLocation(LocationTestFunc isAllowed) const
     {
-        if(_locations.empty())
+        if(_rankedLocations.empty())
         {
             qWarning() << "There are no available Server Locations!";
             return {};
         }
 
-        // Ensure we never select an offline region
-        auto isAllowed = [&isAllowedBase](const Location &loc) {
-            return !loc.offline() && isAllowedBase(loc);
-        };
-
-        // Find the nearest matching server that's safe for auto and not geo.
-        auto itResult = std::find_if(_locations.begin(), _locations.end(),
-            [&isAllowed](const auto &pLocation)
-            {
-                return pLocation && pLocation->autoSafe() &&
-                    !pLocation->geoLocated() && isAllowed(*pLocation);
-            });
-        if(itResult != _locations.end())
-            return *itResult;
-
-        // No matching locations are safe for auto and not geo.  Prefer auto
-        // safe; allow geo.
-        itResult = std::find_if(_locations.begin(), _locations.end(),
-            [&isAllowed](const auto &pLocation)
-            {
-                return pLocation && pLocation->autoSafe() && isAllowed(*pLocation);
-            });
-        if(itResult != _locations.end())
-            return *itResult;
-
-        // No auto-safe location is allowed.  Prefer a non-geo location.
-        itResult = std::find_if(_locations.begin(), _locations.end(),
-            [&isAllowed](const auto &pLocation)
-            {
-                return pLocation && !pLocation->geoLocated() && isAllowed(*pLocation);
-            });
-        if(itResult != _locations.end())
-            return *itResult;
-
-        // Allow any location regardless of auto/geo.
-        itResult = std::find_if(_locations.begin(), _locations.end(),
-            [&isAllowed](const auto &pLocation)
+        for(const auto &tier : _tiers)
+        {
+            for(const auto &pLocation : tier)
             {
-                return pLocation && isAllowed(*pLocation);
-            });
-        if(itResult != _locations.end())
-            return *itResult;
+                if(isAllowed(*pLocation))
+                    return pLocation;
+            }
+        }
 
         // Nothing is allowed by context.  Caller can fall back to
         // getBestLocation() if possible.
         return {};
     }
 
-    QSharedPointer<const Location> getBestLocation() const
+    QSharedPointer<const Location> getBestLocation() const;
+
+private:
+    // Tiers of the selection algorithm, in order of preference
+    enum Tier : std::size_t
     {
-        // No context criterion, just use a default predicate.
-        return getBestMatchingLocation([](const Location &){return true;});
-    }
+        AutoSafeNonGeo,
+        AutoSafeGeo,
+        NonGeo,
+        Geo,
+        TierCount
+    };
+
+    // Orders locations by selection score, then ID
+    struct CompareScores
+    {
+        bool operator()(const QSharedPointer<const Location> &pFirst,
+                        const QSharedPointer<const Location> &pSecond) const;
+    };
+    using RankedSet = std::set<QSharedPointer<const Location>, CompareScores>;
+
+    static Tier locationTier(const Location &location);
+    void insert(const QSharedPointer<const Location> &pLocation);
+    void erase(const QSharedPointer<const Location> &pLocation);
 
 private:
-    std::vector<QSharedPointer<const Location>> _locations;
+    std::array<RankedSet, TierCount> _tiers;
+    // The location objects currently indexed (including offline locations,
+    // which aren't in any tier), by ID
+    LocationsById _rankedLocations;
 };
 
 #endif
@@ -54,6 +54,55 @@ public:
     JsonField(quint64, sent, {})
 };
 
+// An entry from the daemon's bandwidth history - either one raw sample or a
+// rollup of samples (see BandwidthHistory in the daemon).
+class COMMON_EXPORT BandwidthSample : public NativeJsonObject
+{
+    Q_OBJECT
+public:
+    BandwidthSample() {}
+    BandwidthSample(quint64 seqVal, qint64 timestampVal, qint64 durationVal,
+                    quint64 receivedVal, quint64 sentVal)
+    {
+        seq(seqVal);
+        timestamp(timestampVal);
+        duration(durationVal);
+        received(receivedVal);
+        sent(sentVal);
+    }
+    BandwidthSample(const BandwidthSample &other) {*this = other;}
+    BandwidthSample &operator=(const BandwidthSample &other)
+    {
+        seq(other.seq());
+        timestamp(other.timestamp());
+        duration(other.duration());
+        received(other.received());
+        sent(other.sent());
+        return *this;
+    }
+    bool operator==(const BandwidthSample &other) const
+    {
+        return seq() == other.seq() && timestamp() == other.timestamp() &&
+            duration() == other.duration() && received() == other.received() &&
+            sent() == other.sent();
+    }
+    bool operator!=(const BandwidthSample &other) const
+    {
+        return !(*this == other);
+    }
+
+    // Sequence number - consecutive within each resolution, used to detect
+    // missed samples and to request a window of history
+    JsonField(quint64, seq, {})
+    // Start of the interval, in ms since system startup (monotonic, same
+    // clock as connectionTimestamp), and its length in ms
+    JsonField(qint64, timestamp, {})
+    JsonField(qint64, duration, {})
+    // Bytes received and sent in the interval
+    JsonField(quint64, received, {})
+    JsonField(quint64, sent, {})
+};
+
 // Transport settings that might vary due to automatic failover.
 class COMMON_EXPORT Transport : public NativeJsonObject
 {
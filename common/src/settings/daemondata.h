@@ -101,6 +101,10 @@ public:
     // daemon is started, but any new measurements will replace the cached
     // values.
     JsonField(LatencyMap, modernLatencies, {})
+    // Jitter and loss of the latency measurements (by location ID).  Like
+    // modernLatencies, these are restored at startup and replaced by new
+    // measurements.
+    JsonField(LatencyQualityMap, modernLatencyQuality, {})
 
     // Cached regions lists.  This is the exact JSON content from the actual
     // regions list; it hasn't been digested or interpreted by the daemon.  This
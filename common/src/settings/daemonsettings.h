@@ -226,6 +226,11 @@ public:
     // when the VPN is disconnected
     JsonField(bool, enableBackgroundLatencyChecks, true)
 
+    // Number of servers measured in each region (at most).  With more than 1,
+    // each server's latency is tracked, and connections try the fastest
+    // healthy servers first.  1 measures one random server per region.
+    JsonField(uint, latencyServersPerRegion, 1)
+
     // Whether to show in-app communication messages to the user
     JsonField(bool, showAppMessages, true)
 
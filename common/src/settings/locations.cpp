@@ -19,6 +19,8 @@
 #include "../common.h"
 #include "locations.h"
 #include <QRandomGenerator>
+#include <algorithm>
+#include <array>
 #include <kapps_core/src/corejson.h>
 #include <nlohmann/json.hpp>
 
@@ -85,9 +87,36 @@ quint16 Server::randomServicePort(Service service) const
     return ports[idx];
 }
 
+namespace
+{
+    // Weights used by Location::selectionScore().  Jitter is weighted so a
+    // location that's erratic by a few ms isn't preferred over a slightly
+    // slower stable one; loss adds up to a large fixed penalty, since losing
+    // pings on the tunnel is worse than any reasonable latency difference.
+    const double selectionJitterWeight{2.0};
+    const double selectionLossPenalty{500.0};
+}
+
+bool json_cast(const QJsonValue &from, LatencyQuality &to)
+{
+    const auto &arr = from.toArray();
+    if(arr.size() != 2 || !arr[0].isDouble() || !arr[1].isDouble())
+        return false;
+    to.jitter = arr[0].toDouble();
+    to.loss = arr[1].toDouble();
+    return true;
+}
+
+bool json_cast(const LatencyQuality &from, QJsonValue &to)
+{
+    to = QJsonArray{from.jitter, from.loss};
+    return true;
+}
+
 Location::Location(std::shared_ptr<const kapps::regions::Region> pImpl,
-                   nullable_t<double> latency)
-    : _pImpl{std::move(pImpl)}, _latency{std::move(latency)}
+                   nullable_t<double> latency, LatencyQuality latencyQuality)
+    : _pImpl{std::move(pImpl)}, _latency{std::move(latency)},
+      _latencyQuality{latencyQuality}
 {
     Q_ASSERT(_pImpl);   // Ensured by caller
     // Wrap the kapps::regions::Server objects with our Server wrapper; the idea
@@ -99,6 +128,60 @@ Location::Location(std::shared_ptr<const kapps::regions::Region> pImpl,
         Q_ASSERT(pServer);  // Guaranteed by kapps::regions::Region
         _servers.emplace_back(pServer->shared_from_this());
     }
+    buildServerIndex();
+}
+
+Location::Location(const Location &other, nullable_t<double> latency,
+                   LatencyQuality latencyQuality,
+                   std::vector<QString> serverRanking,
+                   nullable_t<double> predictedLatency)
+    : _pImpl{other._pImpl}, _latency{std::move(latency)},
+      _latencyQuality{latencyQuality},
+      _predictedLatency{std::move(predictedLatency)},
+      _serverRanking{std::move(serverRanking)}, _servers{other._servers},
+      _pServerIndex{other._pServerIndex}
+{
+    if(_serverRanking == other._serverRanking)
+        return;
+
+    // Restore the regions list order, then move the ranked servers to the
+    // front.  The sort is stable so unranked servers keep their order.
+    std::unordered_map<QString, std::size_t> ranks;
+    ranks.reserve(_serverRanking.size());
+    for(std::size_t i=0; i<_serverRanking.size(); ++i)
+        ranks.emplace(_serverRanking[i], i);
+
+    _servers.clear();
+    for(const auto &pServer : _pImpl->servers())
+        _servers.emplace_back(pServer->shared_from_this());
+    auto rankOf = [&ranks](const Server &server)
+    {
+        auto itRank = ranks.find(server.ip());
+        return itRank == ranks.end() ? ranks.size() : itRank->second;
+    };
+    std::stable_sort(_servers.begin(), _servers.end(),
+        [&rankOf](const Server &first, const Server &second)
+        {
+            return rankOf(first) < rankOf(second);
+        });
+    buildServerIndex();
+}
+
+nullable_t<double> Location::selectionScore() const
+{
+    if(_latency)
+        return selectionScore(_latency.get(), _latencyQuality);
+    // There's no jitter for a predicted latency, but the location might have
+    // lost pings (it might not have replied yet at all)
+    if(_predictedLatency)
+        return _predictedLatency.get() + selectionLossPenalty * _latencyQuality.loss;
+    return {};
+}
+
+double Location::selectionScore(double latency, const LatencyQuality &quality)
+{
+    return latency + selectionJitterWeight * quality.jitter +
+        selectionLossPenalty * quality.loss;
 }
 
 QString Location::dedicatedIp() const
@@ -110,104 +193,120 @@ QString Location::dedicatedIp() const
     return qs::toQString(_pImpl->dipAddress().toString());
 }
 
-template<class PredicateFuncT>
-std::size_t Location::countServersFor(const PredicateFuncT &predicate) const
+struct Location::ServerIndex
 {
-    std::size_t matches = 0;
-    for(const auto &server : servers())
+    // Servers with each service, indexed by Service
+    std::array<ServerPositions, ServiceCount> byService;
+    // Servers with each service and port - keys are from portKey()
+    std::unordered_map<quint32, ServerPositions> byPort;
+    // Servers with any VPN service
+    ServerPositions vpn;
+    // All ports offered for each service, indexed by Service
+    std::array<DescendingPortSet, ServiceCount> ports;
+
+    static quint32 portKey(Service service, quint16 port)
     {
-        if(predicate(server))
-            ++matches;
+        return (static_cast<quint32>(service) << 16) | port;
     }
-    return matches;
-}
+};
 
-template<class PredicateFuncT>
-const Server *Location::randomServerFor(const PredicateFuncT &predicate) const
+namespace
 {
-    // This implementation is O(N) in the number of servers in the region.  It
-    // could be O(1) if we kept separate lists of the servers that have each
-    // service / port, but the number of servers offered per region isn't very
-    // large.
-
-    // Count the matching servers
-    std::size_t matches = countServersFor(predicate);
+    const std::array<Service, ServiceCount> allServices
+    {
+        Service::OpenVpnTcp,
+        Service::OpenVpnUdp,
+        Service::WireGuard,
+        Service::Shadowsocks,
+        Service::Meta
+    };
+
+    std::size_t serviceIndex(Service service)
+    {
+        return static_cast<std::size_t>(service);
+    }
+}
 
-    if(matches >= 1)
+void Location::buildServerIndex()
+{
+    auto pIndex = std::make_shared<ServerIndex>();
+    for(std::uint32_t i=0; i<_servers.size(); ++i)
     {
-        std::size_t idx = QRandomGenerator::global()->bounded(static_cast<quint32>(matches));
-        // Count off that index among the matching servers
-        for(const auto &server : servers())
+        const Server &server = _servers[i];
+        bool vpnService = false;
+        for(Service service : allServices)
         {
-            if(predicate(server))
+            const auto &ports = server.servicePorts(service);
+            if(ports.empty())
+                continue;
+            if(service == Service::OpenVpnTcp || service == Service::OpenVpnUdp ||
+               service == Service::WireGuard)
+            {
+                vpnService = true;
+            }
+            pIndex->byService[serviceIndex(service)].push_back(i);
+            pIndex->ports[serviceIndex(service)].insert(ports.begin(), ports.end());
+            for(quint16 port : ports)
             {
-                if(idx == 0)
-                    return &server;
-                --idx;
+                // A server could list a port more than once; only index it
+                // once
+                auto &portServers = pIndex->byPort[ServerIndex::portKey(service, port)];
+                if(portServers.empty() || portServers.back() != i)
+                    portServers.push_back(i);
             }
         }
+        if(vpnService)
+            pIndex->vpn.push_back(i);
     }
-
-    // No servers match
-    return nullptr;
+    _pServerIndex = std::move(pIndex);
 }
 
-template<class PredicateFuncT>
-const Server *Location::serverWithIndexFor(std::size_t desiredIndex, const PredicateFuncT &predicate) const
+auto Location::serversWithService(Service service) const -> const ServerPositions &
 {
-    // This implementation is O(N) in the number of servers in the region.  It
-    // could be O(1) if we kept separate lists of the servers that have each
-    // service / port, but the number of servers offered per region isn't very
-    // large.
+    return _pServerIndex->byService[serviceIndex(service)];
+}
 
-    // Count the matching servers
-    std::size_t matches = countServersFor(predicate);
+auto Location::serversWithPort(Service service, quint16 port) const -> const ServerPositions &
+{
+    static const ServerPositions none;
+    auto itPort = _pServerIndex->byPort.find(ServerIndex::portKey(service, port));
+    return itPort == _pServerIndex->byPort.end() ? none : itPort->second;
+}
 
-    if(matches >= 1)
-    {
-        std::size_t idx = 0;
-        // Count off that index among the matching servers
-        for(const auto &server : servers())
-        {
-            if(predicate(server))
-            {
-                if(idx == desiredIndex)
-                    return &server;
-                ++idx;
-            }
-        }
-    }
+const Server *Location::randomServerIn(const ServerPositions &positions) const
+{
+    if(positions.empty())
+        return nullptr;
+    auto idx = QRandomGenerator::global()->bounded(static_cast<quint32>(positions.size()));
+    return &_servers[positions[idx]];
+}
 
-    // No servers match
-    return nullptr;
+const Server *Location::serverWithIndexIn(std::size_t desiredIndex,
+                                          const ServerPositions &positions) const
+{
+    if(desiredIndex >= positions.size())
+        return nullptr;
+    return &_servers[positions[desiredIndex]];
 }
 
 bool Location::hasService(Service service) const
 {
-    for(const auto &server : servers())
-    {
-        if(server.hasService(service))
-            return true;
-    }
-    return false;
+    return !serversWithService(service).empty();
 }
 
 const Server *Location::randomIcmpLatencyServer() const
 {
-    return randomServerFor([](const Server &server)
-    {
-        return server.hasVpnService();
-    });
+    return randomServerIn(_pServerIndex->vpn);
 }
 
 const Server *Location::randomServerForService(Service service) const
 {
-    return randomServerFor([service](const Server &server){return server.hasService(service);});
+    return randomServerIn(serversWithService(service));
 }
 
 const Server *Location::randomServerForPort(Service service, quint16 port) const
 {
-    return randomServerFor([service, port](const Server &server){return server.hasPort(service, port);});
+    return randomServerIn(serversWithPort(service, port));
 }
 
 const Server *Location::randomServer(Service service, quint16 tryPort) const
@@ -226,18 +325,16 @@ const Server *Location::randomServer(Service service, quint16 tryPort) const
 
 DescendingPortSet Location::allPortsForService(Service service) const
 {
-    DescendingPortSet ports;
-    allPortsForService(service, ports);
-    return ports;
+    return _pServerIndex->ports[serviceIndex(service)];
 }
 
 void Location::allPortsForService(Service service, DescendingPortSet &ports) const
 {
-    for(const auto &server : servers())
-    {
-        const auto &serverPorts{server.servicePorts(service)};
-        ports.insert(serverPorts.begin(), serverPorts.end());
-    }
+    const auto &servicePorts = _pServerIndex->ports[serviceIndex(service)];
+    // Both sets are in the same order, so hinting the end makes this linear
+    // when appending to an empty set
+    for(quint16 port : servicePorts)
+        ports.insert(ports.end(), port);
 }
 
 const Server *Location::serverWithIndex(std::size_t index, Service service, quint16 tryPort) const
@@ -259,22 +356,22 @@ const Server *Location::serverWithIndex(std::size_t index, Service service, quin
 
 const Server *Location::serverWithIndexForPort(std::size_t index, Service service, quint16 port) const
 {
-    return serverWithIndexFor(index, [service, port](const Server &server){return server.hasPort(service, port);});
+    return serverWithIndexIn(index, serversWithPort(service, port));
 }
 
 const Server *Location::serverWithIndexForService(std::size_t index, Service service) const
 {
-    return serverWithIndexFor(index, [service](const Server &server){return server.hasService(service);});
+    return serverWithIndexIn(index, serversWithService(service));
 }
 
 std::size_t Location::countServersForService(Service service) const
 {
-    return countServersFor([service](const Server &server){return server.hasService(service);});
+    return serversWithService(service).size();
 }
 
 std::size_t Location::countServersForPort(Service service, quint16 port) const
 {
-    return countServersFor([service, port](const Server &server){return server.hasPort(service, port);});
+    return serversWithPort(service, port).size();
 }
 
 ServiceLocations::ServiceLocations(QSharedPointer<const Location> pChosenLocation,
@@ -23,8 +23,10 @@
 #include "../json.h"
 #include <kapps_regions/src/region.h>
 #include <kapps_regions/src/regiondisplay.h>
+#include <memory>
 #include <set>
 #include <unordered_map>
+#include <vector>
 
 // These are the services advertised by the regions list that are used by Desktop.
 enum class Service
@@ -37,6 +39,8 @@ enum class Service
     // the modern infrastructure.
     Meta,
 };
+// Number of Service values
+const std::size_t ServiceCount{static_cast<std::size_t>(Service::Meta) + 1};
 
 // The available connection ports are listed and attempted in descending order.
 // This is subtle, but it generally places the ports that feel more natural at
@@ -131,6 +135,27 @@ private:
     std::shared_ptr<const kapps::regions::Server> _pImpl;
 };
 
+// Measurements of the latency's consistency to a location, in addition to the
+// latency itself.  Both are 0 if they haven't been measured.
+struct LatencyQuality
+{
+    // Smoothed variation between consecutive round trip times (ms)
+    double jitter{0};
+    // Fraction of recent latency pings that were lost (0-1)
+    double loss{0};
+
+    bool operator==(const LatencyQuality &other) const
+    {
+        return jitter == other.jitter && loss == other.loss;
+    }
+    bool operator!=(const LatencyQuality &other) const {return !(*this == other);}
+};
+
+// LatencyQuality is stored for every location, so it's persisted compactly as
+// an array - [jitter, loss].
+COMMON_EXPORT bool json_cast(const QJsonValue &from, LatencyQuality &to);
+COMMON_EXPORT bool json_cast(const LatencyQuality &from, QJsonValue &to);
+
 // Location describes a single location, which can contain any number of servers
 // and services.  Some services may not be present in some regions at all.
 //
@@ -145,7 +170,19 @@ class COMMON_EXPORT Location
 {
 public:
     Location(std::shared_ptr<const kapps::regions::Region> pImpl,
-             nullable_t<double> latency);
+             nullable_t<double> latency, LatencyQuality latencyQuality = {});
+    // Copy an existing Location with a new latency.  This shares the
+    // underlying region and servers, so it's used to apply latency updates
+    // without rebuilding the region from the regions list.
+    //
+    // serverRanking optionally lists server IPs in order of preference (the
+    // fastest healthy servers first); see serverRanking().  predictedLatency
+    // is an estimate used until the latency is measured; see
+    // predictedLatency().
+    Location(const Location &other, nullable_t<double> latency,
+             LatencyQuality latencyQuality,
+             std::vector<QString> serverRanking = {},
+             nullable_t<double> predictedLatency = {});
 
     bool operator==(const Location &other) const
     {
@@ -154,6 +191,8 @@ public:
             geoLocated() == other.geoLocated() &&
             autoSafe() == other.autoSafe() &&
             latency() == other.latency() &&
+            latencyQuality() == other.latencyQuality() &&
+            predictedLatency() == other.predictedLatency() &&
             servers() == other.servers() &&
             dedicatedIp() == other.dedicatedIp() &&
             offline() == other.offline() &&
@@ -175,9 +214,25 @@ public:
     // available for manual selection, etc.
     bool autoSafe() const {return _pImpl->autoSafe();}
 
-    // Latency is recorded for the whole region.  Eventually we may start
-    // measuring individual servers in the nearest regions.
+    // Latency is recorded for the whole region.  When several servers are
+    // measured per region, this is the latency to the fastest one.
     nullable_t<double> latency() const {return _latency;}
+    // Jitter and loss of the latency measurements
+    const LatencyQuality &latencyQuality() const {return _latencyQuality;}
+    // Latency estimated from the region's distance to the client (see
+    // LatencyPredictor), only for locations that haven't been measured yet.
+    // This isn't shown to the user; it's only used to select locations until
+    // measurements arrive.
+    nullable_t<double> predictedLatency() const {return _predictedLatency;}
+    // Score used to select the best location automatically - lower is better.
+    // This is the latency, penalized by jitter and loss so an unstable
+    // location isn't preferred over a slightly slower stable one.  The
+    // predicted latency is used if the location hasn't been measured; unknown
+    // if neither is known.
+    nullable_t<double> selectionScore() const;
+    // Score for a measured latency with the given quality, as used by
+    // selectionScore()
+    static double selectionScore(double latency, const LatencyQuality &quality);
 
     // The available servers in this region.  These are all grouped together,
     // not separated by type, because servers could contain any combination of
@@ -196,8 +251,18 @@ public:
     // have the least latency when using the same server for both).  The client
     // must be prepared for the possibility that there might be no servers with
     // both services, though.
+    //
+    // Servers in serverRanking() come first, in that order, followed by the
+    // others in the order given by the regions list.  Connections try servers
+    // in this order (see serverWithIndex()), so the fastest measured server is
+    // tried first.
     kapps::core::ArraySlice<const Server> servers() const {return _servers;}
 
+    // IPs of the servers that have been measured individually and are healthy
+    // (responding to pings), fastest first.  Empty if servers aren't measured
+    // individually.
+    const std::vector<QString> &serverRanking() const {return _serverRanking;}
+
     // For a dedicated IP region, the dedicated IP address is provided.  This is
     // empty for normal regions.
     //
@@ -223,15 +288,23 @@ public:
     bool hasShadowsocks() const {return _pImpl->hasService(kapps::regions::Service::Shadowsocks);}
 
 private:
-    // Count the servers that satisfy a predicate
-    template<class PredicateFuncT>
-    std::size_t countServersFor(const PredicateFuncT &predicate) const;
-    // Get a random server that satisfies a predicate
-    template<class PredicateFuncT>
-    const Server *randomServerFor(const PredicateFuncT &predicate) const;
-
-    template<class PredicateFuncT>
-    const Server *serverWithIndexFor(std::size_t desiredIndex, const PredicateFuncT &predicate) const;
+    // Indexes of the servers offering each service and port, and the ports
+    // offered by the location; defined in locations.cpp
+    struct ServerIndex;
+    // Positions of servers in _servers
+    using ServerPositions = std::vector<std::uint32_t>;
+
+    // Build _pServerIndex from _servers
+    void buildServerIndex();
+    // Find the servers with a service, or with a service and port (empty if
+    // there are none)
+    const ServerPositions &serversWithService(Service service) const;
+    const ServerPositions &serversWithPort(Service service, quint16 port) const;
+    // Get a random server from a list of positions
+    const Server *randomServerIn(const ServerPositions &positions) const;
+    // Get the server with a given index in a list of positions
+    const Server *serverWithIndexIn(std::size_t desiredIndex,
+                                    const ServerPositions &positions) const;
 
 public:
     // Check if a given service is available in this location (whether any
@@ -283,7 +356,14 @@ public:
 private:
     std::shared_ptr<const kapps::regions::Region> _pImpl;
     nullable_t<double> _latency;
+    LatencyQuality _latencyQuality;
+    nullable_t<double> _predictedLatency;
+    std::vector<QString> _serverRanking;
     std::vector<Server> _servers;
+    // Built once for each order of _servers, and shared by copies of this
+    // Location with the same order, so selecting servers and finding ports
+    // doesn't have to examine every server.
+    std::shared_ptr<const ServerIndex> _pServerIndex;
 };
 
 // Compare QSharedPointer<Location>s by value; used by ServiceLocations
@@ -299,6 +379,9 @@ inline bool compareLocationsValue(const QSharedPointer<const Location> &pFirst,
 
 using LocationsById = std::unordered_map<std::string, QSharedPointer<const Location>>;
 using LatencyMap = std::unordered_map<QString, double>;
+using LatencyQualityMap = std::unordered_map<QString, LatencyQuality>;
+// Server rankings (see Location::serverRanking()) by location ID
+using ServerRankingMap = std::unordered_map<QString, std::vector<QString>>;
 
 // Locations for a given country, sorted by latency (ties broken by id).
 class COMMON_EXPORT CountryLocations
@@ -0,0 +1,145 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include <common/src/common.h>
+#line SOURCE_FILE("bandwidthhistory.cpp")
+
+#include "bandwidthhistory.h"
+#include <algorithm>
+
+namespace
+{
+    const qint64 minuteMs{60 * 1000};
+    const qint64 hourMs{60 * minuteMs};
+}
+
+BandwidthHistory::Ring::Ring(std::size_t capacity)
+    : _entries(std::max<std::size_t>(capacity, 1)), _begin{0}, _size{0}
+{
+}
+
+auto BandwidthHistory::Ring::operator[](std::size_t i) const -> const Entry &
+{
+    Q_ASSERT(i < _size);
+    return _entries[(_begin + i) % _entries.size()];
+}
+
+void BandwidthHistory::Ring::push(const Entry &entry)
+{
+    if(_size < _entries.size())
+    {
+        _entries[(_begin + _size) % _entries.size()] = entry;
+        ++_size;
+    }
+    else
+    {
+        // Full - replace the oldest entry
+        _entries[_begin] = entry;
+        _begin = (_begin + 1) % _entries.size();
+    }
+}
+
+void BandwidthHistory::Ring::clear()
+{
+    _begin = 0;
+    _size = 0;
+}
+
+BandwidthHistory::BandwidthHistory(std::size_t sampleCapacity,
+                                   std::size_t minuteCapacity,
+                                   std::size_t hourCapacity)
+    : _levels{{{Ring{sampleCapacity}, 0, {}, 1},
+               {Ring{minuteCapacity}, minuteMs, {}, 1},
+               {Ring{hourCapacity}, hourMs, {}, 1}}}
+{
+}
+
+void BandwidthHistory::rollUp(Resolution resolution, qint64 timestamp,
+                              quint64 received, quint64 sent)
+{
+    Level &rollupLevel = level(resolution);
+    Q_ASSERT(rollupLevel._period > 0);
+
+    qint64 intervalStart = timestamp - (timestamp % rollupLevel._period);
+
+    // If this belongs to a later interval than the open rollup, the open
+    // rollup is complete.  (Intervals with no samples at all are skipped.)
+    if(rollupLevel._open && rollupLevel._open->timestamp != intervalStart)
+    {
+        Entry completed = rollupLevel._open.get();
+        rollupLevel._open.clear();
+        completed.seq = rollupLevel._nextSeq++;
+        rollupLevel._ring.push(completed);
+
+        if(resolution == Resolution::Minute)
+        {
+            rollUp(Resolution::Hour, completed.timestamp, completed.received,
+                   completed.sent);
+        }
+    }
+
+    if(!rollupLevel._open)
+        rollupLevel._open.emplace(Entry{0, intervalStart, rollupLevel._period, 0, 0});
+    rollupLevel._open->received += received;
+    rollupLevel._open->sent += sent;
+}
+
+auto BandwidthHistory::add(qint64 timestamp, quint64 received, quint64 sent)
+    -> const Entry &
+{
+    qint64 duration = _lastSampleTime ? std::max<qint64>(timestamp - _lastSampleTime.get(), 0) : 0;
+    _lastSampleTime = timestamp;
+
+    Level &sampleLevel = level(Resolution::Sample);
+    sampleLevel._ring.push({sampleLevel._nextSeq++, timestamp - duration,
+                            duration, received, sent});
+
+    // Samples are attributed to the minute in which they were taken
+    rollUp(Resolution::Minute, timestamp, received, sent);
+
+    return sampleLevel._ring[sampleLevel._ring.size()-1];
+}
+
+void BandwidthHistory::clear()
+{
+    for(auto &rollupLevel : _levels)
+    {
+        rollupLevel._ring.clear();
+        rollupLevel._open.clear();
+    }
+    _lastSampleTime.clear();
+}
+
+auto BandwidthHistory::window(Resolution resolution, quint64 afterSeq,
+                              std::size_t maxCount) const
+    -> std::vector<Entry>
+{
+    const Ring &ring = level(resolution)._ring;
+
+    // Sequence numbers are consecutive within the ring, so the first entry to
+    // return can be found directly
+    std::size_t begin = 0;
+    if(ring.size() > 0 && afterSeq >= ring[0].seq)
+        begin = static_cast<std::size_t>(std::min<quint64>(afterSeq - ring[0].seq + 1, ring.size()));
+    begin = std::max(begin, ring.size() - std::min(ring.size(), maxCount));
+
+    std::vector<Entry> entries;
+    entries.reserve(ring.size() - begin);
+    for(std::size_t i = begin; i < ring.size(); ++i)
+        entries.push_back(ring[i]);
+    return entries;
+}
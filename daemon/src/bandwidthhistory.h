@@ -0,0 +1,148 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include <common/src/common.h>
+#line HEADER_FILE("bandwidthhistory.h")
+
+#ifndef BANDWIDTHHISTORY_H
+#define BANDWIDTHHISTORY_H
+
+#include <array>
+#include <vector>
+
+// BandwidthHistory keeps the VPN connection's bandwidth measurements at
+// several resolutions - each raw sample reported by the VPN method, plus
+// per-minute and per-hour rollups.
+//
+// Each resolution is a fixed-capacity ring; once it fills, each new entry
+// replaces the oldest one, so adding a sample is O(1) regardless of how much
+// history is kept.
+class BandwidthHistory
+{
+public:
+    enum class Resolution
+    {
+        // Each measurement reported by the VPN method
+        Sample,
+        // Rollups of the samples in each minute
+        Minute,
+        // Rollups of the minutes in each hour
+        Hour,
+        Count
+    };
+
+    struct Entry
+    {
+        // Sequence number within this resolution.  Increases by 1 for each
+        // entry and is not reset by clear(), so clients can tell whether they
+        // missed any entries.
+        quint64 seq;
+        // Start of the interval covered by this entry - ms since system startup
+        // (monotonic, same clock as StateModel::connectionTimestamp)
+        qint64 timestamp;
+        // Length of the interval in ms.  For the first sample after clear(),
+        // this is 0 since the start of the interval isn't known.
+        qint64 duration;
+        // Bytes received and sent during this interval
+        quint64 received;
+        quint64 sent;
+    };
+
+private:
+    // Fixed-capacity ring of entries
+    class Ring
+    {
+    public:
+        explicit Ring(std::size_t capacity);
+
+    public:
+        std::size_t size() const {return _size;}
+        std::size_t capacity() const {return _entries.size();}
+        // Index 0 is the oldest entry
+        const Entry &operator[](std::size_t i) const;
+        // Add an entry, replacing the oldest entry if the ring is full
+        void push(const Entry &entry);
+        void clear();
+
+    private:
+        std::vector<Entry> _entries;
+        // Index of the oldest entry in _entries
+        std::size_t _begin;
+        std::size_t _size;
+    };
+
+    struct Level
+    {
+        Ring _ring;
+        // Length of a rollup interval in ms; 0 for the raw samples
+        qint64 _period;
+        // Rollup that's currently accumulating; it's added to _ring once a
+        // sample arrives for a later interval
+        nullable_t<Entry> _open;
+        quint64 _nextSeq;
+    };
+
+public:
+    // Default capacities - one hour of raw samples at a 1-second stats
+    // interval, one day of minutes, and 30 days of hours.
+    enum : std::size_t
+    {
+        DefaultSampleCapacity = 3600,
+        DefaultMinuteCapacity = 24*60,
+        DefaultHourCapacity = 30*24,
+    };
+
+public:
+    BandwidthHistory(std::size_t sampleCapacity = DefaultSampleCapacity,
+                     std::size_t minuteCapacity = DefaultMinuteCapacity,
+                     std::size_t hourCapacity = DefaultHourCapacity);
+
+private:
+    Level &level(Resolution resolution) {return _levels[static_cast<std::size_t>(resolution)];}
+    const Level &level(Resolution resolution) const {return _levels[static_cast<std::size_t>(resolution)];}
+
+    // Add an interval to a rollup level.  If this completes the open rollup,
+    // it's added to the ring and rolled up into the next level.
+    void rollUp(Resolution resolution, qint64 timestamp, quint64 received,
+                quint64 sent);
+
+public:
+    // Add a sample taken at 'timestamp' with the bytes transferred since the
+    // last sample.  Returns the new sample.
+    const Entry &add(qint64 timestamp, quint64 received, quint64 sent);
+
+    // Discard all entries (including open rollups).  Sequence numbers continue
+    // from where they left off.
+    void clear();
+
+    // Get the number of completed entries at a resolution
+    std::size_t size(Resolution resolution) const {return level(resolution)._ring.size();}
+
+    // Get completed entries with a sequence number greater than 'afterSeq',
+    // oldest first.  If there are more than 'maxCount', the newest 'maxCount'
+    // entries are returned.  Rollups that are still accumulating are not
+    // included.
+    std::vector<Entry> window(Resolution resolution, quint64 afterSeq,
+                              std::size_t maxCount) const;
+
+private:
+    std::array<Level, static_cast<std::size_t>(Resolution::Count)> _levels;
+    // Time of the last sample - used to find the duration of the next sample
+    nullable_t<qint64> _lastSampleTime;
+};
+
+#endif
@@ -44,6 +44,7 @@
 #include <QNetworkProxy>
 #include <QJsonDocument>
 #include <chrono>
+#include <limits>
 #include <QFileInfo>
 #include <QDir>
 #include <QDateTime>
@@ -91,6 +92,100 @@ namespace
     // Resource paths for IP Address
     const QString ipLookupResource{QStringLiteral("api/client/status")};
 
+    // Large or frequently-changing DaemonData properties are persisted in
+    // their own files rather than in data.json, so a change to one (like a
+    // latency update) doesn't rewrite the others (like the cached regions
+    // lists).  Everything else is in data.json.
+    const PropertyWriter::SplitFile splitDataFiles[]
+    {
+        {"modernLatencies", "latencies.json"},
+        {"modernLatencyQuality", "latency_quality.json"},
+        {"cachedModernRegionsList", "regions.json"},
+        {"cachedModernShadowsocksList", "shadowsocks.json"},
+        {"modernRegionMeta", "regions_meta.json"},
+    };
+    const char *const dataMainFilename = "data.json";
+
+    // StateModel properties that can be sent to clients as patches - these
+    // are large, and most changes (like latency updates) only change a small
+    // part of them.
+    const char *const deltaStateProperties[]
+    {
+        "availableLocations",
+        "groupedLocations",
+        "vpnLocations",
+        "shadowsocksLocations",
+    };
+
+    // Count the nodes in a JSON value, stopping once the count exceeds limit.
+    // This is used to estimate sizes without serializing the values.
+    std::size_t countJsonNodes(const clientjson::json &value, std::size_t limit)
+    {
+        std::size_t count = 1;
+        if(value.is_structured())
+        {
+            for(const auto &child : value)
+            {
+                if(count > limit)
+                    break;
+                count += countJsonNodes(child, limit - count);
+            }
+        }
+        return count;
+    }
+
+    // Estimate the size of a JSON patch - each operation plus the nodes in its
+    // value (if it has one)
+    std::size_t estimatePatchSize(const clientjson::json &patch)
+    {
+        std::size_t size = 0;
+        for(const auto &operation : patch)
+        {
+            ++size;
+            auto itValue = operation.find("value");
+            if(itValue != operation.end())
+                size += countJsonNodes(*itValue, std::numeric_limits<std::size_t>::max());
+        }
+        return size;
+    }
+
+    // Number of measurements provided in StateModel::intervalMeasurements
+    const std::size_t maxIntervalMeasurements{32};
+
+    // Clients that negotiate an RPC encoding do so with their first message,
+    // optionally preceded by setSubscription, and the initial data are sent
+    // once that's done.  A client whose first message is anything else
+    // receives the initial data in JSON right away (see
+    // ClientConnection::initialDataDue()).  This timeout only applies to
+    // clients that don't send anything else after connecting; there's no way to
+    // tell whether they will negotiate.
+    const std::chrono::milliseconds initialDataTimeout{250};
+
+    // Merge the properties from a "data" notification into a snapshot of all
+    // data.  Sections other than the data objects themselves (like "patches")
+    // are ignored.
+    void mergeDataChanges(QJsonObject &snapshot, const QJsonObject &changes)
+    {
+        for(const auto &section : {QStringLiteral("data"),
+                                   QStringLiteral("account"),
+                                   QStringLiteral("settings"),
+                                   QStringLiteral("state")})
+        {
+            auto itChanges = changes.find(section);
+            if(itChanges == changes.end())
+                continue;
+            const QJsonObject &sectionChanges = itChanges.value().toObject();
+            if(sectionChanges.isEmpty())
+                continue;
+            // Take the section out of the snapshot so it isn't shared while
+            // it's modified
+            QJsonObject properties = snapshot.take(section).toObject();
+            for(auto itProperty = sectionChanges.begin(); itProperty != sectionChanges.end(); ++itProperty)
+                properties.insert(itProperty.key(), itProperty.value());
+            snapshot.insert(section, std::move(properties));
+        }
+    }
+
     // Old default debug logging setting, 1.0 (and earlier) until 1.2-beta.2
     const QStringList debugLogging10{QStringLiteral("*.debug=true"),
                                      QStringLiteral("qt*.debug=false"),
@@ -252,7 +347,6 @@ Daemon::Daemon(QObject* parent)
     , _checkInstallFeatureFlags{false}
     , _server(nullptr)
     , _methodRegistry(new LocalMethodRegistry(this))
-    , _rpc(new RemoteNotificationInterface(this))
     , _connection(new VPNConnection(this))
     , _environment{_state}
     , _apiClient{}
@@ -272,6 +366,8 @@ Daemon::Daemon(QObject* parent)
                             publicIpLoadInterval, publicIpRefreshInterval}
     , _snoozeTimer(this)
     , _pendingSerializations(0)
+    , _dataMainDirty{false}
+    , _dataWriter{Path::DaemonSettingsDir}
 {
 #ifdef PIA_CRASH_REPORTING
     initCrashReporting(false);
@@ -306,7 +402,24 @@ Daemon::Daemon(QObject* parent)
     });
 
     // Load settings if they exist
-    bool dataFileRead = readProperties(_data, Path::DaemonSettingsDir, "data.json");
+    bool dataFileRead = readProperties(_data, Path::DaemonSettingsDir, dataMainFilename);
+    // Load the DaemonData properties that are stored in separate files.  If
+    // any don't exist yet (such as when upgrading from a version that stored
+    // everything in data.json), write them out on the next serialization, and
+    // rewrite data.json to remove them.
+    QSet<QString> missingDataFiles = PropertyWriter::findMissingSplitFiles(
+        Path::DaemonSettingsDir, splitDataFiles);
+    for(const auto &splitFile : splitDataFiles)
+    {
+        if(!missingDataFiles.contains(QString::fromLatin1(splitFile.pProperty)))
+            readProperties(_data, Path::DaemonSettingsDir, splitFile.pFilename);
+    }
+    if(dataFileRead && !missingDataFiles.empty())
+    {
+        _pendingDataChanges.unite(missingDataFiles);
+        _dataMainDirty = true;
+        _pendingSerializations |= 1;
+    }
     // Load account.json.  If it doesn't exist, write it out now so we can set
     // its permissions.
     if(!readProperties(_account, Path::DaemonSettingsDir, "account.json"))
@@ -438,6 +551,7 @@ Daemon::Daemon(QObject* parent)
     _methodRegistry->add(RPC_METHOD(applySettings).defaultArguments(false));
     _methodRegistry->add(RPC_METHOD(resetSettings));
     _methodRegistry->add(RPC_METHOD(getCountryBestRegion));
+    _methodRegistry->add(RPC_METHOD(getBandwidthHistory));
     _methodRegistry->add(RPC_METHOD(addDedicatedIp));
     _methodRegistry->add(RPC_METHOD(removeDedicatedIp));
     _methodRegistry->add(RPC_METHOD(dismissDedicatedIpChange));
@@ -452,6 +566,10 @@ Daemon::Daemon(QObject* parent)
     _methodRegistry->add(RPC_METHOD(sendServiceQualityEvents));
     _methodRegistry->add(RPC_METHOD(notifyClientActivate));
     _methodRegistry->add(RPC_METHOD(notifyClientDeactivate));
+    _methodRegistry->add(RPC_METHOD(setDataDeltas));
+    _methodRegistry->add(RPC_METHOD(setRpcEncoding));
+    _methodRegistry->add(RPC_METHOD(setSubscription));
+    _methodRegistry->add(RPC_METHOD(setLatencyPriorityLocations));
     _methodRegistry->add(RPC_METHOD(emailLogin));
     _methodRegistry->add(RPC_METHOD(setToken));
     _methodRegistry->add(RPC_METHOD(login));
@@ -512,6 +630,8 @@ Daemon::Daemon(QObject* parent)
 
     connect(&_modernLatencyTracker, &LatencyTracker::newMeasurements, this,
             &Daemon::newLatencyMeasurements);
+    connect(&_modernLatencyTracker, &LatencyTracker::serverRankingsChanged, this,
+            &Daemon::newServerRankings);
     // No locations are loaded yet - they're loaded when the daemon activates
 
     connect(&_portForwarder, &PortForwarder::portForwardUpdated, this,
@@ -555,6 +675,7 @@ Daemon::Daemon(QObject* parent)
 
         _environment.reload();
 
+        _modernLatencyTracker.setServersPerLocation(_settings.latencyServersPerRegion());
         if(_settings.enableBackgroundLatencyChecks())
             _modernLatencyTracker.start();
 
@@ -650,6 +771,11 @@ Daemon::Daemon(QObject* parent)
                 else
                     _modernLatencyTracker.stop();
             });
+    connect(&_settings, &DaemonSettings::latencyServersPerRegionChanged, this,
+            [this]()
+            {
+                _modernLatencyTracker.setServersPerLocation(_settings.latencyServersPerRegion());
+            });
 
     connect(&_updateDownloader, &UpdateDownloader::updateRefreshed, this,
             &Daemon::onUpdateRefreshed);
@@ -932,9 +1058,8 @@ void Daemon::RPC_resetSettings()
 
 QString Daemon::RPC_getCountryBestRegion(const QString &country)
 {
-    NearestLocations nearest{_state.availableLocations()};
     const auto &countryLower = country.toLower();
-    const auto &pBestInCountry = nearest.getBestMatchingLocation(
+    const auto &pBestInCountry = _nearestLocations.getBestMatchingLocation(
         [&](const Location &loc)
         {
             auto pRegionDisplay = _state.regionsMetadata().getRegionDisplay(loc.id().toStdString());
@@ -1225,6 +1350,42 @@ void DiagnosticsFile::writeText(const QString &title, QString text)
     logPart(title, commandTime);
 }
 
+QJsonValue Daemon::RPC_getBandwidthHistory(const QString &resolution,
+                                           qint64 afterSeq, int maxCount)
+{
+    using Resolution = BandwidthHistory::Resolution;
+
+    Resolution historyResolution;
+    if(resolution == QStringLiteral("sample"))
+        historyResolution = Resolution::Sample;
+    else if(resolution == QStringLiteral("minute"))
+        historyResolution = Resolution::Minute;
+    else if(resolution == QStringLiteral("hour"))
+        historyResolution = Resolution::Hour;
+    else
+    {
+        qWarning() << "Invalid bandwidth history resolution" << resolution;
+        throw Error{HERE, Error::Code::JsonRPCInvalidRequest};
+    }
+
+    if(afterSeq < 0 || maxCount <= 0)
+    {
+        qWarning() << "Invalid bandwidth history window" << afterSeq << maxCount;
+        throw Error{HERE, Error::Code::JsonRPCInvalidRequest};
+    }
+
+    QJsonArray samples;
+    for(const auto &entry : _connection->bandwidthHistory().window(historyResolution,
+                                                                   static_cast<quint64>(afterSeq),
+                                                                   static_cast<std::size_t>(maxCount)))
+    {
+        samples.push_back(BandwidthSample{entry.seq, entry.timestamp,
+                                          entry.duration, entry.received,
+                                          entry.sent}.toJsonObject());
+    }
+    return samples;
+}
+
 QJsonValue Daemon::RPC_writeDiagnostics()
 {
     // Diagnostics can only be written when debug logging is enabled
@@ -1448,6 +1609,141 @@ void Daemon::RPC_notifyClientDeactivate()
         emit daemonDeactivated();
 }
 
+void Daemon::RPC_setDataDeltas(bool enable)
+{
+    ClientConnection *pClient = ClientConnection::getInvokingClient();
+
+    if(!pClient)
+    {
+        qWarning() << "Invalid invoking client in client RPC";
+        return;
+    }
+
+    if(pClient->getDataDeltas() == enable)
+        return;
+
+    qInfo() << "Client" << pClient << (enable ? "enabled" : "disabled")
+        << "data deltas";
+    if(enable)
+    {
+        // Send any pending changes now, so the client's state matches the
+        // baseline that patches will be generated from.
+        flushDataChanges();
+
+        // Start maintaining the baseline if this is the first delta client
+        if(!hasDataDeltaClients())
+        {
+            for(const auto &property : deltaStateProperties)
+            {
+                try
+                {
+                    _deltaBaseline[property] = _state.getProperty(property);
+                }
+                catch(const std::exception &ex)
+                {
+                    // This property will be sent in full next time
+                    qWarning() << "Unable to serialize property" << property
+                        << "-" << ex.what();
+                }
+            }
+        }
+        pClient->setDataDeltas(true);
+    }
+    else
+    {
+        pClient->setDataDeltas(false);
+        if(!hasDataDeltaClients())
+            _deltaBaseline.clear();
+        // Resend everything so the client is synchronized again
+        postDataSnapshot(*pClient);
+    }
+}
+
+void Daemon::RPC_setRpcEncoding(const QString &encoding)
+{
+    ClientConnection *pClient = ClientConnection::getInvokingClient();
+
+    if(!pClient)
+    {
+        qWarning() << "Invalid invoking client in client RPC";
+        return;
+    }
+
+    if(encoding == QStringLiteral("cbor"))
+        pClient->setEncoding(JsonRPCEncoding::Cbor);
+    else if(encoding == QStringLiteral("json"))
+        pClient->setEncoding(JsonRPCEncoding::Json);
+    else
+        throw JsonRPCInvalidParamsError(HERE, "unknown encoding");
+
+    qInfo() << "Client" << pClient << "selected RPC encoding" << encoding;
+    sendInitialData(*pClient);
+}
+
+void Daemon::RPC_setSubscription(const QJsonValue &subscription)
+{
+    ClientConnection *pClient = ClientConnection::getInvokingClient();
+
+    if(!pClient)
+    {
+        qWarning() << "Invalid invoking client in client RPC";
+        return;
+    }
+
+    nullable_t<DataSubscription> newSubscription;
+    if(subscription.isObject())
+        newSubscription.emplace(subscription.toObject());
+    else if(!subscription.isNull())
+        throw JsonRPCInvalidParamsError(HERE, "invalid subscription");
+
+    qInfo() << "Client" << pClient << "subscribed to"
+        << (newSubscription ? "selected properties" : "all properties");
+
+    if(pClient->getInitialDataSent())
+    {
+        // Send pending changes with the old subscription, then the snapshot
+        // with the new subscription.  Properties that weren't subscribed before
+        // may have changed, and the snapshot is consistent with the changes
+        // sent so far (including the patch baseline).
+        flushDataChanges();
+        pClient->_subscription = std::move(newSubscription);
+        postDataSnapshot(*pClient);
+    }
+    else
+    {
+        // The initial data will be filtered with this subscription.  Keep
+        // waiting for the client to negotiate an encoding, the subscription is
+        // sent before setRpcEncoding.
+        pClient->_subscription = std::move(newSubscription);
+        pClient->deferInitialData();
+    }
+}
+
+void Daemon::RPC_setLatencyPriorityLocations(const QJsonArray &locationIds)
+{
+    ClientConnection *pClient = ClientConnection::getInvokingClient();
+
+    if(!pClient)
+    {
+        qWarning() << "Invalid invoking client in client RPC";
+        return;
+    }
+
+    std::vector<QString> newLocations;
+    newLocations.reserve(static_cast<std::size_t>(locationIds.size()));
+    for(const auto &locationId : locationIds)
+    {
+        if(!locationId.isString())
+            throw JsonRPCInvalidParamsError(HERE, "invalid location ID");
+        newLocations.push_back(locationId.toString());
+    }
+
+    qInfo() << "Client" << pClient << "set" << newLocations.size()
+        << "latency priority locations";
+    pClient->_latencyPriorityLocations = std::move(newLocations);
+    updateLatencyPriorities();
+}
+
 Async<void> Daemon::RPC_emailLogin(const QString &email)
 {
     mustBeAwake(); // If this runs, the system must be awake
@@ -1748,7 +2044,6 @@ void Daemon::start()
 
     _server = new LocalSocketIPCServer(this);
     connect(_server, &IPCServer::newConnection, this, &Daemon::clientConnected);
-    connect(_rpc, &RemoteNotificationInterface::messageReady, _server, &IPCServer::sendMessageToAllClients);
     _server->listen();
 
     connect(&_account, &DaemonAccount::loggedInChanged, this, [this]() {
@@ -1803,6 +2098,12 @@ void Daemon::clientConnected(IPCConnection* connection)
     // Transient clients so this does not affect isActive().
     connect(client, &ClientConnection::disconnected, this, [this, client, connection]() {
         _clients.remove(connection);
+        // Stop maintaining the delta baseline if it's no longer needed
+        if(client->getDataDeltas() && !hasDataDeltaClients())
+            _deltaBaseline.clear();
+        // Stop prioritizing this client's locations
+        if(!client->getLatencyPriorityLocations().empty())
+            updateLatencyPriorities();
         qInfo() << "Client" << client << "disconnected, total client count now"
             << _clients.size() << "- have active client:" << hasActiveClient();
 
@@ -1837,6 +2138,46 @@ void Daemon::clientConnected(IPCConnection* connection)
         }
     });
 
+    connect(client, &ClientConnection::initialDataDue, this, [this, client]()
+    {
+        sendInitialData(*client);
+    });
+}
+
+void Daemon::sendInitialData(ClientConnection &client)
+{
+    if(client.getInitialDataSent())
+        return;
+
+    client._initialDataSent = true;
+    postDataSnapshot(client);
+}
+
+void Daemon::postDataSnapshot(ClientConnection &client)
+{
+    DataNotification &snapshot = getDataSnapshot();
+    if(const DataSubscription *pSubscription = client.getSubscription())
+    {
+        // Subscriptions are usually small, just filter and encode the snapshot
+        // for this client
+        DataNotification filtered{pSubscription->filter(_dataSnapshot)};
+        client.postEncoded(filtered.encoded(client.getEncoding()));
+    }
+    else
+        client.postEncoded(snapshot.encoded(client.getEncoding()));
+}
+
+void Daemon::flushDataChanges()
+{
+    if(!_dataChanges.empty() || !_accountChanges.empty() ||
+       !_settingsChanges.empty() || !_stateChanges.empty())
+    {
+        notifyChanges();
+    }
+}
+
+QJsonObject Daemon::getAllData() const
+{
     QJsonObject all;
     all.insert(QStringLiteral("data"), _data.toJsonObject());
     QJsonObject accountJsonObj = _account.toJsonObject();
@@ -1854,7 +2195,17 @@ void Daemon::clientConnected(IPCConnection* connection)
         KAPPS_CORE_WARNING() << "Unable to serialize state:" << ex.what();
     }
     all.insert(QStringLiteral("state"), stateJson);
-    client->post(QStringLiteral("data"), all);
+    return all;
+}
+
+bool Daemon::hasDataDeltaClients() const
+{
+    for(const auto &pClient : _clients)
+    {
+        if(pClient->getDataDeltas())
+            return true;
+    }
+    return false;
 }
 
 QJsonObject getProperties(const NativeJsonObject& object, const QSet<QString>& properties)
@@ -1897,11 +2248,66 @@ QJsonObject getProperties(const JsonState<clientjson::json> &object,
     return {};
 }
 
+QJsonObject Daemon::getStatePatches(const std::unordered_set<std::string> &changes,
+                                    std::unordered_set<std::string> &patched)
+{
+    clientjson::json patches = clientjson::json::object();
+    for(const auto &property : deltaStateProperties)
+    {
+        if(changes.count(property) == 0)
+            continue;
+        try
+        {
+            clientjson::json value = _state.getProperty(property);
+            auto itBaseline = _deltaBaseline.find(property);
+            if(itBaseline != _deltaBaseline.end())
+            {
+                clientjson::json patch = clientjson::json::diff(itBaseline->second, value);
+                // Use the patch only if it's smaller than the value itself - a
+                // large change like a new regions list is sent in full.  Sizes
+                // are estimated by node count; the value is only counted up to
+                // the patch size, so this is proportional to the patch.
+                std::size_t patchSize = estimatePatchSize(patch);
+                if(countJsonNodes(value, patchSize) > patchSize)
+                {
+                    patches.emplace(property, std::move(patch));
+                    patched.insert(property);
+                }
+            }
+            _deltaBaseline[property] = std::move(value);
+        }
+        catch(const std::exception &ex)
+        {
+            // The full value can't be sent either; serialize the baseline again
+            // next time
+            qWarning() << "Unable to generate patch for property" << property
+                << "-" << ex.what();
+            _deltaBaseline.erase(property);
+        }
+    }
+
+    if(patched.empty())
+        return {};
+    try
+    {
+        return adaptNljToQt(patches);
+    }
+    catch(const std::exception &ex)
+    {
+        // The baseline has already been updated, but the clients haven't
+        // received the changes.  Send the values in full.
+        qWarning() << "Unable to serialize patches -" << ex.what();
+        patched.clear();
+    }
+    return {};
+}
+
 void Daemon::notifyChanges()
 {
     QJsonObject all;
     if (!_dataChanges.empty())
     {
+        _pendingDataChanges.unite(_dataChanges);
         all.insert(QStringLiteral("data"), getProperties(_data, std::exchange(_dataChanges, {})));
         _pendingSerializations |= 1;
     }
@@ -1921,12 +2327,130 @@ void Daemon::notifyChanges()
         all.insert(QStringLiteral("settings"), getProperties(_settings, std::exchange(_settingsChanges, {})));
         _pendingSerializations |= 4;
     }
-    if (!_stateChanges.empty())
+    QJsonObject statePatches;
+    std::unordered_set<std::string> patchedState;
+    std::unordered_set<std::string> stateChanges = std::exchange(_stateChanges, {});
+    if (!stateChanges.empty() && hasDataDeltaClients())
+        statePatches = getStatePatches(stateChanges, patchedState);
+
+    // If there are no patches, all clients get the same message
+    if (patchedState.empty())
+    {
+        if (!stateChanges.empty())
+            all.insert(QStringLiteral("state"), getProperties(_state, stateChanges));
+        updateDataSnapshot(all, {});
+        serialize();
+        postDataChanges(all, all);
+        return;
+    }
+
+    // Otherwise, delta clients get the patched properties as patches, and other
+    // clients get complete values.
+    QJsonObject deltaAll{all};
+    std::unordered_set<std::string> unpatchedState;
+    for (const auto &property : stateChanges)
     {
-        all.insert(QStringLiteral("state"), getProperties(_state, std::exchange(_stateChanges, {})));
+        if (patchedState.count(property) == 0)
+            unpatchedState.insert(property);
     }
+    if (!unpatchedState.empty())
+        deltaAll.insert(QStringLiteral("state"), getProperties(_state, unpatchedState));
+    deltaAll.insert(QStringLiteral("patches"),
+                    QJsonObject{{QStringLiteral("state"), statePatches}});
+
+    bool hasFullClients = false;
+    for (const auto &pClient : _clients)
+        hasFullClients = hasFullClients || !pClient->getDataDeltas();
+    if (hasFullClients)
+    {
+        all.insert(QStringLiteral("state"), getProperties(_state, stateChanges));
+        updateDataSnapshot(all, {});
+    }
+    else
+        updateDataSnapshot(deltaAll, patchedState);
+
     serialize();
-    _rpc->post(QStringLiteral("data"), all);
+    postDataChanges(all, deltaAll);
+}
+
+void Daemon::postDataChanges(const QJsonObject &all, const QJsonObject &deltaAll)
+{
+    // Clients with the same subscription and the same delta setting receive
+    // the same message, which is filtered and encoded once.
+    struct Variant
+    {
+        bool deltas;
+        const DataSubscription *pSubscription;
+        // Null if none of the changes are subscribed
+        nullable_t<DataNotification> notification;
+    };
+    std::vector<Variant> variants;
+
+    for (const auto &pClient : _clients)
+    {
+        // The client gets these changes in the initial data if it hasn't
+        // received them yet
+        if (!pClient->getInitialDataSent())
+            continue;
+
+        bool deltas = pClient->getDataDeltas();
+        const DataSubscription *pSubscription = pClient->getSubscription();
+        auto itVariant = std::find_if(variants.begin(), variants.end(),
+            [&](const Variant &variant)
+            {
+                if(variant.deltas != deltas)
+                    return false;
+                if(!variant.pSubscription || !pSubscription)
+                    return variant.pSubscription == pSubscription;
+                return *variant.pSubscription == *pSubscription;
+            });
+        if (itVariant == variants.end())
+        {
+            const QJsonObject &changes = deltas ? deltaAll : all;
+            QJsonObject filtered = pSubscription ? pSubscription->filter(changes) : changes;
+            variants.push_back({deltas, pSubscription, {}});
+            itVariant = std::prev(variants.end());
+            if (!filtered.isEmpty())
+                itVariant->notification.emplace(filtered);
+        }
+
+        if (itVariant->notification)
+            pClient->postEncoded(itVariant->notification->encoded(pClient->getEncoding()));
+    }
+}
+
+void Daemon::updateDataSnapshot(const QJsonObject &changes,
+                                const std::unordered_set<std::string> &staleState)
+{
+    // Nothing to do if the snapshot hasn't been built yet
+    if(_dataSnapshot.isEmpty())
+        return;
+
+    // Clear the message first so the snapshot isn't shared when it's modified
+    _dataSnapshotMessage.clear();
+    mergeDataChanges(_dataSnapshot, changes);
+    _dataSnapshotStaleState.insert(staleState.begin(), staleState.end());
+}
+
+DataNotification &Daemon::getDataSnapshot()
+{
+    if(_dataSnapshot.isEmpty())
+    {
+        _dataSnapshot = getAllData();
+        _dataSnapshotStaleState.clear();
+        _dataSnapshotMessage.clear();
+    }
+    else if(!_dataSnapshotStaleState.empty())
+    {
+        _dataSnapshotMessage.clear();
+        QJsonObject changes{{QStringLiteral("state"),
+            getProperties(_state, std::exchange(_dataSnapshotStaleState, {}))}};
+        mergeDataChanges(_dataSnapshot, changes);
+    }
+
+    if(!_dataSnapshotMessage)
+        _dataSnapshotMessage.emplace(_dataSnapshot);
+    return *_dataSnapshotMessage;
 }
 
 void Daemon::serialize()
@@ -1936,7 +2460,7 @@ void Daemon::serialize()
         if (!_serializationTimer.isActive())
         {
             if (_pendingSerializations & 1)
-                writeProperties(_data.toJsonObject(), Path::DaemonSettingsDir, "data.json");
+                serializeData();
             if (_pendingSerializations & 2)
                 writeProperties(_account.toJsonObject(), Path::DaemonSettingsDir, "account.json");
             if (_pendingSerializations & 4)
@@ -1951,6 +2475,17 @@ void Daemon::serialize()
     }
 }
 
+void Daemon::serializeData()
+{
+    // Building the QJsonObject is cheap even with the large cached regions
+    // lists, since those are already QJsonObjects (the data are shared).  The
+    // text serialization and file writes happen on PropertyWriter's thread.
+    _dataWriter.queueSplitWrite(_data.toJsonObject(), dataMainFilename,
+                                splitDataFiles,
+                                std::exchange(_pendingDataChanges, {}),
+                                std::exchange(_dataMainDirty, false));
+}
+
 struct IpResult
 {
     QString address;    // VPN IP address
@@ -2371,26 +2906,66 @@ void Daemon::vpnByteCountsChanged()
 {
     _state.bytesReceived(_connection->bytesReceived());
     _state.bytesSent(_connection->bytesSent());
-    _state.intervalMeasurements(_connection->intervalMeasurements());
+
+    const auto &history = _connection->bandwidthHistory();
+    using Resolution = BandwidthHistory::Resolution;
+
+    std::deque<IntervalBandwidth> intervals;
+    for(const auto &sample : history.window(Resolution::Sample, 0, maxIntervalMeasurements))
+        intervals.push_back({sample.received, sample.sent});
+    _state.intervalMeasurements(std::move(intervals));
+
+    std::vector<BandwidthSample> latest;
+    for(const auto &sample : history.window(Resolution::Sample, 0, 1))
+    {
+        latest.push_back({sample.seq, sample.timestamp, sample.duration,
+                          sample.received, sample.sent});
+    }
+    _state.latestBandwidthSamples(std::move(latest));
 }
 
-void Daemon::newLatencyMeasurements(const LatencyTracker::Latencies &measurements)
+void Daemon::newLatencyMeasurements(const LatencyTracker::Measurements &measurements)
 {
     SCOPE_LOGGING_CATEGORY("daemon.latency");
 
     LatencyMap newLatencies;
     newLatencies = _data.modernLatencies();
+    LatencyQualityMap newQuality;
+    newQuality = _data.modernLatencyQuality();
 
     for(const auto &measurement : measurements)
     {
-        newLatencies[measurement.first] = static_cast<double>(msec(measurement.second));
+        const LatencyHistory::Stats &stats = measurement.second;
+        // If a location has never replied, keep the last known latency (if
+        // any), but do record the loss
+        if(stats.latency)
+            newLatencies[measurement.first] = static_cast<double>(msec(stats.latency.get()));
+        newQuality[measurement.first] = {static_cast<double>(msec(stats.jitter)),
+                                         stats.loss};
     }
 
     _data.modernLatencies(newLatencies);
+    _data.modernLatencyQuality(newQuality);
 
-    // Rebuild the locations, including the grouped locations and location
-    // choices, since the latencies changed
-    rebuildActiveLocations();
+    // Update the locations, including the grouped locations and location
+    // choices, since the latencies changed.  The regions list itself hasn't
+    // changed, so there's no need to rebuild it.
+    updateLocationLatencies();
+}
+
+void Daemon::newServerRankings(const LatencyTracker::ServerRankings &rankings)
+{
+    SCOPE_LOGGING_CATEGORY("daemon.latency");
+
+    for(const auto &ranking : rankings)
+    {
+        if(ranking.second.empty())
+            _serverRankings.erase(ranking.first);
+        else
+            _serverRankings[ranking.first] = ranking.second;
+    }
+
+    updateLocationLatencies();
 }
 
 void Daemon::portForwardUpdated(int port)
@@ -2399,9 +2974,13 @@ void Daemon::portForwardUpdated(int port)
     _state.forwardedPort(port);
 }
 
-void Daemon::applyBuiltLocations(LocationsById newLocations,
-                                 kapps::regions::Metadata metadata)
+void Daemon::applyAvailableLocations()
 {
+    // Estimate the latency of locations that haven't been measured yet from
+    // their distance, so "auto" can select a nearby location before the first
+    // measurements finish (or before new regions are measured).
+    applyPredictedLatencies(_builtLocations, _state.regionsMetadata());
+
     // The LatencyTrackers still ping all locations, so we have latency
     // measurements if the locations are re-enabled, but remove them from
     // availableLocations and groupedLocations so all parts of the program will
@@ -2413,8 +2992,8 @@ void Daemon::applyBuiltLocations(LocationsById newLocations,
     LocationsById nonGeoLocations;
     if(!_settings.includeGeoOnly())
     {
-        nonGeoLocations.reserve(newLocations.size());
-        for(const auto &locEntry : newLocations)
+        nonGeoLocations.reserve(_builtLocations.size());
+        for(const auto &locEntry : _builtLocations)
         {
             if(locEntry.second && !locEntry.second->geoLocated())
                 nonGeoLocations[locEntry.first] = locEntry.second;
@@ -2422,8 +3001,8 @@ void Daemon::applyBuiltLocations(LocationsById newLocations,
         _state.availableLocations(std::move(nonGeoLocations));
     }
     else
-        _state.availableLocations(std::move(newLocations));
-    _state.regionsMetadata(std::move(metadata));
+        _state.availableLocations(_builtLocations);
+    _nearestLocations.update(_state.availableLocations());
 
     // Update the grouped locations from the new stored locations
     std::vector<CountryLocations> groupedLocations;
@@ -2434,6 +3013,14 @@ void Daemon::applyBuiltLocations(LocationsById newLocations,
                           dedicatedIpLocations);
     _state.groupedLocations(std::move(groupedLocations));
     _state.dedicatedIpLocations(std::move(dedicatedIpLocations));
+}
+
+void Daemon::applyBuiltLocations(LocationsById newLocations,
+                                 kapps::regions::Metadata metadata)
+{
+    _builtLocations = std::move(newLocations);
+    _state.regionsMetadata(std::move(metadata));
+    applyAvailableLocations();
 
     // Find the closest expiration time for any dedicated IP, and find the most
     // recent dedicated IP change
@@ -2516,7 +3103,8 @@ bool Daemon::rebuildModernLocations(const QJsonObject &regionsObj,
                                                  shadowsocksObj,
                                                  metadataObj,
                                                  _account.dedicatedIps(),
-                                                 _settings.manualServer());
+                                                 _settings.manualServer(),
+                                                 _data.modernLatencyQuality());
 
         // Like the legacy list, if no regions are found, treat this as an error
         // and keep the data we have (which might still be usable).
@@ -2527,6 +3115,11 @@ bool Daemon::rebuildModernLocations(const QJsonObject &regionsObj,
             return false;
         }
 
+        // Apply the server rankings we have so far; the servers in the new
+        // list are mostly the same
+        applyLocationLatencies(newLocations.first, _data.modernLatencies(),
+                               _data.modernLatencyQuality(), _serverRankings);
+
         // Apply the modern locations to the modern latency tracker
         _modernLatencyTracker.updateLocations(newLocations.first);
 
@@ -2549,6 +3142,28 @@ void Daemon::rebuildActiveLocations()
                            _data.modernRegionMeta());
 }
 
+void Daemon::updateLocationLatencies()
+{
+    // If nothing has been built yet, there's nothing to update; do a full
+    // build (this is also what would happen if the cached regions list was
+    // unusable, in which case this has no effect)
+    if(_builtLocations.empty())
+    {
+        rebuildActiveLocations();
+        return;
+    }
+
+    // If no latencies actually changed, there's nothing else to do
+    if(!applyLocationLatencies(_builtLocations, _data.modernLatencies(),
+                               _data.modernLatencyQuality(), _serverRankings))
+        return;
+
+    // The regions, metadata, DIPs, and ports are all unchanged; just update
+    // the locations and anything that depends on the latency ordering.
+    applyAvailableLocations();
+    calculateLocationPreferences();
+}
+
 void Daemon::shadowsocksRegionsLoaded(const QJsonDocument &shadowsocksRegionsJsonDoc)
 {
     const auto &shadowsocksRegionsObj = shadowsocksRegionsJsonDoc.array();
@@ -2746,6 +3361,9 @@ void Daemon::onNetworksChanged(const std::vector<NetworkConnection> &networks)
 
     queueApplyFirewallRules();
     _connection->updateNetwork(originalNetwork());
+
+    // Latency measurements from the old network may not be accurate
+    _modernLatencyTracker.networkChanged();
 }
 
 void Daemon::refreshAccountInfo()
@@ -3450,9 +4068,7 @@ void Daemon::upgradeSettings(bool existingSettingsFile)
 void Daemon::calculateLocationPreferences()
 {
     // Pick the best location
-    NearestLocations nearest{_state.availableLocations()};
-
-    QSharedPointer<const Location> pVpnBest{nearest.getNearestSafeVpnLocation(_settings.portForward())};
+    QSharedPointer<const Location> pVpnBest{_nearestLocations.getNearestSafeVpnLocation(_settings.portForward())};
 
     // Find the user's chosen location (nullptr if it's 'auto' or doesn't exist)
     const auto &locationId = _settings.location();
@@ -3494,8 +4110,8 @@ void Daemon::calculateLocationPreferences()
         else
         {
             // If no SS locations are known, this is set to nullptr
-            pSsBest = nearest.getBestMatchingLocation(
-                [](auto loc){ return loc.hasService(Service::Shadowsocks); });
+            pSsBest = _nearestLocations.getBestMatchingLocation(
+                [](const Location &loc){ return loc.hasService(Service::Shadowsocks); });
         }
 
         // Determine the next SS location
@@ -3506,6 +4122,33 @@ void Daemon::calculateLocationPreferences()
                          std::move(pVpnNext)});
     _state.shadowsocksLocations({std::move(pSsChosen), std::move(pSsBest),
                                  std::move(pSsNext)});
+
+    updateLatencyPriorities();
+}
+
+void Daemon::updateLatencyPriorities()
+{
+    std::unordered_set<QString> priorityIds;
+    auto addLocation = [&](const QSharedPointer<const Location> &pLocation)
+    {
+        if(pLocation)
+            priorityIds.insert(pLocation->id());
+    };
+
+    // Current and possible selections
+    addLocation(_state.vpnLocations().chosenLocation());
+    addLocation(_state.vpnLocations().bestLocation());
+    addLocation(_state.shadowsocksLocations().chosenLocation());
+    addLocation(_state.shadowsocksLocations().bestLocation());
+    addLocation(_state.connectedConfig().vpnLocation());
+    // Connected clients' favorites and recents
+    for(const ClientConnection *pClient : _clients)
+    {
+        for(const auto &locationId : pClient->getLatencyPriorityLocations())
+            priorityIds.insert(locationId);
+    }
+
+    _modernLatencyTracker.setPriorityLocations(std::move(priorityIds));
 }
 
 void Daemon::onUpdateRefreshed(const Update &availableUpdate,
@@ -3943,12 +4586,87 @@ void Daemon::traceMemory()
 #endif
 }
 
+DataSubscription::DataSubscription(const QJsonObject &subscription)
+{
+    auto parseProperties = [](const QJsonValue &value)
+    {
+        if(!value.isArray())
+            throw JsonRPCInvalidParamsError(HERE, "invalid subscription properties");
+        QSet<QString> properties;
+        for(const auto &property : value.toArray())
+        {
+            if(!property.isString())
+                throw JsonRPCInvalidParamsError(HERE, "invalid subscription property");
+            properties.insert(property.toString());
+        }
+        return properties;
+    };
+
+    for(auto itObject = subscription.begin(); itObject != subscription.end(); ++itObject)
+    {
+        const QJsonValue &value = itObject.value();
+        if(value.isBool() && value.toBool())
+            _objects.insert(itObject.key(), {true, {}});
+        else if(value.isObject())
+        {
+            _objects.insert(itObject.key(),
+                {true, parseProperties(value.toObject().value(QStringLiteral("except")))});
+        }
+        else
+            _objects.insert(itObject.key(), {false, parseProperties(value)});
+    }
+}
+
+QJsonObject DataSubscription::filter(const QJsonObject &data) const
+{
+    QJsonObject result;
+    for(auto itSection = data.begin(); itSection != data.end(); ++itSection)
+    {
+        // Patches are grouped by object like the properties themselves
+        if(itSection.key() == QStringLiteral("patches"))
+        {
+            QJsonObject patches = filter(itSection.value().toObject());
+            if(!patches.isEmpty())
+                result.insert(itSection.key(), patches);
+            continue;
+        }
+
+        auto itObject = _objects.find(itSection.key());
+        if(itObject == _objects.end())
+            continue;
+
+        const QJsonObject &properties = itSection.value().toObject();
+        QJsonObject filtered;
+        if(itObject->except)
+        {
+            filtered = properties;
+            for(const auto &property : itObject->properties)
+                filtered.remove(property);
+        }
+        else
+        {
+            for(const auto &property : itObject->properties)
+            {
+                auto itProperty = properties.find(property);
+                if(itProperty != properties.end())
+                    filtered.insert(property, itProperty.value());
+            }
+        }
+        if(!filtered.isEmpty())
+            result.insert(itSection.key(), filtered);
+    }
+    return result;
+}
+
 ClientConnection::ClientConnection(IPCConnection *connection, LocalMethodRegistry* registry, QObject *parent)
     : QObject(parent)
     , _connection(connection)
     , _rpc(new ServerSideInterface(registry, this))
     , _active(false)
     , _killed(false)
+    , _dataDeltas(false)
+    , _initialDataSent(false)
+    , _initialDataDeferred(false)
     , _state(Connected)
 {
     auto setDisconnected = [this]() {
@@ -3972,11 +4690,27 @@ ClientConnection::ClientConnection(IPCConnection *connection, LocalMethodRegistr
       qInfo() << "Received message from client" << this;
       auto cleanup = raii_sentinel([]{_invokingClient = nullptr;});
       _rpc->processMessage(msg);
+      // If this message didn't negotiate an encoding, and it wasn't one that
+      // may precede the negotiation, the client isn't going to negotiate.
+      if(!_initialDataSent && !std::exchange(_initialDataDeferred, false))
+          emit initialDataDue();
     });
     connect(_rpc, &ServerSideInterface::messageReady, _connection, &IPCConnection::sendMessage);
+
+    QTimer::singleShot(initialDataTimeout, this, [this]()
+    {
+        if(!_initialDataSent)
+            emit initialDataDue();
+    });
 }
 ClientConnection* ClientConnection::_invokingClient = nullptr;
 
+void ClientConnection::postEncoded(const QByteArray &msg)
+{
+    if (_connection)
+        _connection->sendMessage(msg);
+}
+
 void ClientConnection::kill()
 {
     if (_state < Disconnecting)
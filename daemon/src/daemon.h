@@ -27,12 +27,14 @@
 #include <common/src/settings/daemondata.h>
 #include "model/state.h"
 #include <common/src/settings/daemonsettings.h>
+#include <common/src/locations.h>
 #include <common/src/async.h>
 #include "environment.h"
 #include <common/src/jsonrpc.h>
 #include "latencytracker.h"
 #include "networkmonitor.h"
 #include "portforwarder.h"
+#include "propertywriter.h"
 #include "socksserverthread.h"
 #include "updatedownloader.h"
 #include "servicequality.h"
@@ -53,6 +55,62 @@ class LocalMethodRegistry;
 class ServerSideInterface;
 
 
+// A "data" notification that's sent to several clients.  It's encoded at most
+// once for each encoding, no matter how many clients receive it.
+class DataNotification
+{
+public:
+    explicit DataNotification(const QJsonObject &data)
+        : _request{buildJsonRPCRequest(QJsonValue::Undefined,
+                                       QStringLiteral("data"),
+                                       QJsonArray{data})}
+    {}
+
+    const QByteArray &encoded(JsonRPCEncoding encoding)
+    {
+        QByteArray &msg = _encoded[static_cast<int>(encoding)];
+        if(msg.isEmpty())
+            msg = encodeJsonRPCMessage(_request, encoding);
+        return msg;
+    }
+
+private:
+    QJsonObject _request;
+    QByteArray _encoded[2];
+};
+
+// The properties that a client receives in "data" notifications (see
+// Daemon::RPC_setSubscription()).
+class DataSubscription
+{
+public:
+    // Parse a subscription object from a client.  Throws if it isn't valid.
+    explicit DataSubscription(const QJsonObject &subscription);
+
+    bool operator==(const DataSubscription &other) const {return _objects == other._objects;}
+
+    // Filter "data" (or the patches it contains) to the subscribed
+    // properties.  Returns an empty object if no properties are subscribed.
+    QJsonObject filter(const QJsonObject &data) const;
+
+private:
+    struct ObjectProperties
+    {
+        // If set, all properties except these are subscribed.  Otherwise,
+        // only these properties are subscribed.
+        bool except;
+        QSet<QString> properties;
+
+        bool operator==(const ObjectProperties &other) const
+        {
+            return except == other.except && properties == other.properties;
+        }
+    };
+
+    // Objects that aren't present aren't sent at all
+    QHash<QString, ObjectProperties> _objects;
+};
+
 // Contains all information about a particular connected client.
 //
 class ClientConnection : public QObject
@@ -96,10 +154,44 @@ public:
 
     bool getKilled() const {return _killed;}
 
+    // Whether the client accepts JSON patches for large state properties in
+    // "data" notifications (see Daemon::RPC_setDataDeltas()).
+    bool getDataDeltas() const {return _dataDeltas;}
+    void setDataDeltas(bool dataDeltas) {_dataDeltas = dataDeltas;}
+
+    // Encoding used for messages sent to the client (see
+    // Daemon::RPC_setRpcEncoding())
+    JsonRPCEncoding getEncoding() const {return _rpc->encoding();}
+    void setEncoding(JsonRPCEncoding encoding) {_rpc->setEncoding(encoding);}
+
+    // Properties subscribed by the client, or nullptr if the client receives
+    // all properties (see Daemon::RPC_setSubscription())
+    const DataSubscription *getSubscription() const {return _subscription ? &*_subscription : nullptr;}
+
+    // Locations measured frequently for this client (see
+    // Daemon::RPC_setLatencyPriorityLocations())
+    const std::vector<QString> &getLatencyPriorityLocations() const {return _latencyPriorityLocations;}
+
+    // Whether the initial "data" notification has been sent.  Changes aren't
+    // sent until then, they're included in the initial data.
+    bool getInitialDataSent() const {return _initialDataSent;}
+
+    // The message being processed may precede the client's encoding
+    // negotiation (see Daemon::RPC_setSubscription()); don't emit
+    // initialDataDue() for it, wait for the next message.
+    void deferInitialData() {_initialDataDeferred = true;}
+
+    // Send a message that was already encoded with getEncoding()
+    void postEncoded(const QByteArray &msg);
+
     void kill();
 
 signals:
     void disconnected();
+    // The initial data should be sent now - the client sent a message that
+    // didn't negotiate an encoding, or didn't send anything before the
+    // timeout.  Not emitted once getInitialDataSent() is set.
+    void initialDataDue();
 
 private:
     IPCConnection* _connection;
@@ -110,6 +202,11 @@ private:
     // active client connection unexpectedly exits, this affects the way the
     // daemon remains active (invalidClientExit vs. killedClient)
     bool _killed;
+    bool _dataDeltas;
+    nullable_t<DataSubscription> _subscription;
+    std::vector<QString> _latencyPriorityLocations;
+    bool _initialDataSent;
+    bool _initialDataDeferred;
     State _state;
 
 };
@@ -286,6 +383,17 @@ protected:
     // replaced with proper country selections.
     QString RPC_getCountryBestRegion(const QString &country);
 
+    // Get a window of the bandwidth history for the current connection.
+    // 'resolution' is "sample", "minute", or "hour".  Returns the entries
+    // with a sequence number greater than 'afterSeq' (oldest first, as
+    // BandwidthSample objects), limited to the newest 'maxCount' entries.
+    // Pass 0 for afterSeq to get the newest entries.
+    //
+    // Clients use this with StateModel::latestBandwidthSamples to keep their
+    // own history without receiving all of it with every sample.
+    QJsonValue RPC_getBandwidthHistory(const QString &resolution,
+                                       qint64 afterSeq, int maxCount);
+
     // Diagnostics
     QJsonValue RPC_writeDiagnostics();
     void RPC_writeDummyLogs();
@@ -303,6 +411,44 @@ protected:
     void RPC_notifyClientActivate();
     void RPC_notifyClientDeactivate();
 
+    // Enable or disable JSON patches in "data" notifications for the invoking
+    // client.  When enabled, changes to large state properties (the location
+    // lists) may be sent as RFC 6902 patches in a "patches" object instead of
+    // the complete value, like:
+    //   {"state": {...}, "patches": {"state": {"availableLocations": [...]}}}
+    //
+    // Disabling deltas sends the complete state to the client again, clients
+    // use this to resynchronize if a patch can't be applied.
+    void RPC_setDataDeltas(bool enable);
+
+    // Select the encoding used for messages sent to the invoking client -
+    // "json" or "cbor".  Clients that support CBOR call this when they
+    // connect; the initial data are sent in the selected encoding.  Clients
+    // that don't call this receive JSON.
+    void RPC_setRpcEncoding(const QString &encoding);
+
+    // Limit the properties sent to the invoking client in "data"
+    // notifications, for clients that only need a few properties (like most
+    // CLI commands).  The subscription object lists the properties for each
+    // object that the client wants:
+    //   {
+    //     "state": ["connectionState", "vpnLocations"], // only these properties
+    //     "settings": true, // all properties
+    //     "data": {"except": ["modernLatencies"]} // all except these
+    //   }
+    // Objects that aren't listed aren't sent at all.  null restores the
+    // default, which sends all properties.
+    //
+    // If the client had already received the initial data, it's sent again
+    // for the new subscription.
+    void RPC_setSubscription(const QJsonValue &subscription);
+
+    // Set the locations measured frequently for the invoking client - its
+    // favorite and recent locations, which are client settings.  The priority
+    // locations are the union of all connected clients' locations (see
+    // updateLatencyPriorities()).
+    void RPC_setLatencyPriorityLocations(const QJsonArray &locationIds);
+
     // Sleep-related events for robust macOS sleep
     // Notify the daemon that the system is about to go to sleep
     void RPC_systemSleep();
@@ -389,8 +535,34 @@ public slots:
 
 private:
     void clientConnected(IPCConnection* connection);
+    // Get all data, account, settings, and state to send to a client
+    QJsonObject getAllData() const;
+    // Merge changes sent to clients into _dataSnapshot.  State properties in
+    // staleState were only sent as patches and are read again later.
+    void updateDataSnapshot(const QJsonObject &changes,
+                            const std::unordered_set<std::string> &staleState);
+    // Get the snapshot of all data (see _dataSnapshot)
+    DataNotification &getDataSnapshot();
+    // Send the initial data to a client if it hasn't received them yet
+    void sendInitialData(ClientConnection &client);
+    // Send the data snapshot to a client (filtered by its subscription)
+    void postDataSnapshot(ClientConnection &client);
+    // Send changes from notifyChanges() to clients.  all contains the complete
+    // values of all changes, deltaAll is sent to clients that accept deltas.
+    void postDataChanges(const QJsonObject &all, const QJsonObject &deltaAll);
+    // Send any changes that haven't been sent yet
+    void flushDataChanges();
+    // Whether any connected client accepts data deltas
+    bool hasDataDeltaClients() const;
+    // Generate patches for the changed delta-eligible state properties and
+    // update _deltaBaseline.  Properties that were patched are added to
+    // patched; others need to be sent in full.
+    QJsonObject getStatePatches(const std::unordered_set<std::string> &changes,
+                                std::unordered_set<std::string> &patched);
     void notifyChanges();
     void serialize();
+    // Queue writes for DaemonData files affected by _pendingDataChanges
+    void serializeData();
     Async<void> loadVpnIp();
     void vpnStateChanged(VPNConnection::State state,
                          VPNConnection::State oldState,
@@ -401,7 +573,8 @@ private:
                          const nullable_t<Transport> &actualTransport);
     void vpnError(const Error& error);
     void vpnByteCountsChanged();
-    void newLatencyMeasurements(const LatencyTracker::Latencies &measurements);
+    void newLatencyMeasurements(const LatencyTracker::Measurements &measurements);
+    void newServerRankings(const LatencyTracker::ServerRankings &rankings);
     void portForwardUpdated(int port);
 
     // Store new locations built from one of the regions lists and update
@@ -409,6 +582,11 @@ private:
     void applyBuiltLocations(LocationsById newLocations,
                              kapps::regions::Metadata metadata);
 
+    // Update availableLocations, groupedLocations, and dedicatedIpLocations
+    // from _builtLocations.  Used both for a full rebuild and when only
+    // latencies have changed.
+    void applyAvailableLocations();
+
     // Build the locations list from the modern regions list.  Returns true if
     // the new locations list is not empty, meaning the new data can be cached.
     // The new locations are also applied.
@@ -421,10 +599,16 @@ private:
                                 const QJsonObject &metadataObj);
 
     // Rebuild either the legacy or modern locations from the cached data,
-    // depending on the infrastructure setting.  Used when latencies are updated
-    // or when initially building the regions list.
+    // depending on the infrastructure setting.  Used when initially building
+    // the regions list, or when DIPs or settings affecting the locations
+    // change.
     void rebuildActiveLocations();
 
+    // Apply the latencies from DaemonData to the locations that were already
+    // built, without re-parsing the regions list.  Falls back to
+    // rebuildActiveLocations() if no locations have been built yet.
+    void updateLocationLatencies();
+
     // Handle region list results from JsonRefresher
     void shadowsocksRegionsLoaded(const QJsonDocument &shadowsocksRegionsJsonDoc);
     void modernRegionsLoaded(const QJsonDocument &modernRegionsJsonDoc);
@@ -470,6 +654,10 @@ private:
     // settings are changed that affect the location preferences.  (Latency and
     // region list changes result in rebuilding the entire region list.)
     void calculateLocationPreferences();
+    // Tell LatencyTracker which locations to measure frequently - the current
+    // selections, and the clients' favorites and recents.  Called by
+    // calculateLocationPreferences() and when the clients' locations change.
+    void updateLatencyPriorities();
     // Rebuild the chosen/best/next location selections (without rebuilding the
     // entire list).  Used when data changes that affect the location
     // selections.
@@ -528,7 +716,6 @@ protected:
     IPCServer* _server;
     QHash<IPCConnection*, ClientConnection*> _clients;
     LocalMethodRegistry* _methodRegistry;
-    RemoteNotificationInterface* _rpc;
 
     VPNConnection* _connection;
 
@@ -556,6 +743,19 @@ protected:
     Environment _environment;
     ApiClient _apiClient;
 
+    // All locations from the last full build, including geo locations even if
+    // they are hidden by includeGeoOnly.  Retained so latency updates can be
+    // applied without rebuilding the whole regions list.
+    LocationsById _builtLocations;
+    // Server rankings from LatencyTracker when several servers are measured
+    // per region.  These are applied to the built locations so connections try
+    // the fastest servers first.  They're not persisted; server lists change
+    // frequently, and the servers are measured again quickly.
+    ServerRankingMap _serverRankings;
+    // Available locations ranked for automatic selection; updated with the
+    // available locations so only changed locations are re-ranked.
+    NearestLocations _nearestLocations;
+
     LatencyTracker _modernLatencyTracker;
     PortForwarder _portForwarder;
     JsonRefresher _modernRegionRefresher, _modernRegionMetaRefresher,
@@ -572,9 +772,30 @@ protected:
     QSet<QString> _accountChanges;
     QSet<QString> _settingsChanges;
     std::unordered_set<std::string> _stateChanges;
+    // Last values sent to clients for the state properties that can be sent as
+    // patches.  Only maintained while a client accepts data deltas.
+    std::unordered_map<std::string, clientjson::json> _deltaBaseline;
+    // Snapshot of all data sent to clients, used for the initial data sent to
+    // new clients.  It's built the first time it's needed, and each
+    // notifyChanges() merges in the changes it sent.  The encoded message is
+    // kept until the next change, so a burst of short-lived clients (like CLI
+    // invocations) doesn't serialize everything for each client.
+    QJsonObject _dataSnapshot;
+    // State properties that were only sent as patches since the snapshot was
+    // last used; they're read again from _state when it's next used.
+    std::unordered_set<std::string> _dataSnapshotStaleState;
+    nullable_t<DataNotification> _dataSnapshotMessage;
 
     unsigned int _pendingSerializations;
+    // DaemonData properties changed since the last serialization; determines
+    // which of the DaemonData files are rewritten
+    QSet<QString> _pendingDataChanges;
+    // Set to rewrite data.json even if none of its properties changed - used
+    // to remove properties migrated to their own files
+    bool _dataMainDirty;
     QTimer _serializationTimer;
+    // Writes DaemonData files on a worker thread
+    PropertyWriter _dataWriter;
 
     QTimer _accountRefreshTimer;
     QTimer _dedicatedIpRefreshTimer;
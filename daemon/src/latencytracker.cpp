@@ -21,6 +21,8 @@
 
 #include "latencytracker.h"
 #include <algorithm>
+#include <cmath>
+#include <tuple>
 #include <QRandomGenerator>
 
 #if defined(Q_OS_WIN)
@@ -31,32 +33,91 @@
 
 namespace
 {
+    // Locations are measured at most this often; priority locations are
+    // measured this often.
     const std::chrono::minutes latencyRefreshInterval{1};
+    // Backed-off locations are still measured at least this often
+    const std::chrono::minutes latencyMaxInterval{32};
+    // Refreshes can occur slightly early due to timer imprecision, so
+    // locations that will be due within this time are measured.
+    const std::chrono::seconds latencyScheduleSlack{15};
+    // Number of "auto" candidates measured on every refresh, in addition to
+    // the priority locations
+    const std::size_t latencyAutoCandidates{5};
+    // A new measurement is "stable" if the latency changed by at most this
+    // much, or by this fraction of the previous latency (whichever is larger)
+    const std::chrono::milliseconds stableLatencyChange{5};
+    const double stableLatencyRatio{0.1};
+    // A location is "distant" if its latency is more than this multiple of
+    // the best candidate's latency
+    const double distantLatencyFactor{2.0};
+    // Delay for a full sweep after the network changes; coalesces several
+    // changes and lets the new network settle
+    const std::chrono::seconds networkChangeSweepDelay{2};
+    // Limit on the number of servers measured per location
+    const std::size_t maxServersPerLocation{8};
+    // Servers losing more than this fraction of pings are not ranked, so
+    // connections try them last
+    const double maxHealthyServerLoss{0.5};
     const std::chrono::seconds latencyEchoTimeout{10};
     const std::chrono::milliseconds latencyBatchInterval{100};
 
-    //The number of measurements that LatencyHistory stores
-    const int measurementHistoryCount{5};
+    // Gains of the moving averages computed by LatencyHistory.  Measurements
+    // are only taken once per minute, so these are higher than TCP's RTT
+    // estimator (1/8) to adapt in a few minutes.
+    const double latencyAverageGain{0.25};
+    const double jitterAverageGain{0.25};
 
     RegisterMetaType<std::chrono::milliseconds> rxChronoMilliseconds;
     RegisterMetaType<LatencyTracker::Latencies> rxLatencies;
+    RegisterMetaType<LatencyTracker::Measurements> rxMeasurements;
+    RegisterMetaType<LatencyTracker::ServerResults> rxServerResults;
+    RegisterMetaType<LatencyTracker::ServerRankings> rxServerRankings;
 
-    // Select a ping address for a location when using ICMP pings.  A server is
-    // selected randomly.  If no server can be selected, this returns a
-    // PingLocation with an empty echoIp/echoPort.
-    quint32 selectIcmpPingAddress(const QSharedPointer<const Location> &pLocation)
+    quint32 serverIcmpPingAddress(const Server &server)
     {
-        const Server *pLatencyServer{};
-        if(pLocation)
-            pLatencyServer = pLocation->randomIcmpLatencyServer();
-
-        quint32 address{0};
         bool addressOk{false};
-        if(pLatencyServer)
-            address = QHostAddress{pLatencyServer->ip()}.toIPv4Address(&addressOk);
-        if(addressOk)
-            return address;
-        return 0;
+        quint32 address = QHostAddress{server.ip()}.toIPv4Address(&addressOk);
+        return addressOk ? address : 0;
+    }
+
+    // Select ping addresses for a location when using ICMP pings.  Up to
+    // 'count' servers are selected randomly from the servers with a VPN
+    // service (see Location::randomIcmpLatencyServer()).  If no server can be
+    // selected, this returns an empty vector.
+    std::vector<quint32> selectIcmpPingAddresses(const QSharedPointer<const Location> &pLocation,
+                                                 std::size_t count)
+    {
+        std::vector<quint32> addresses;
+        if(!pLocation)
+            return addresses;
+
+        if(count <= 1)
+        {
+            const Server *pLatencyServer = pLocation->randomIcmpLatencyServer();
+            quint32 address = pLatencyServer ? serverIcmpPingAddress(*pLatencyServer) : 0;
+            if(address)
+                addresses.push_back(address);
+            return addresses;
+        }
+
+        for(const auto &server : pLocation->servers())
+        {
+            quint32 address{0};
+            if(server.hasVpnService() && (address = serverIcmpPingAddress(server)))
+                addresses.push_back(address);
+        }
+        // Take a random sample if there are more servers than that
+        if(addresses.size() > count)
+        {
+            for(std::size_t i=0; i<count; ++i)
+            {
+                auto remaining = static_cast<quint32>(addresses.size() - i);
+                std::swap(addresses[i], addresses[i + QRandomGenerator::global()->bounded(remaining)]);
+            }
+            addresses.resize(count);
+        }
+        return addresses;
     }
 
 #if defined(Q_OS_WIN)
@@ -67,141 +128,378 @@ namespace
         CLASS_LOGGING_CATEGORY("latency");
 
     public:
-        // Create WinIcmpBatchPinger with the locations to be pinged.
-        // WinIcmpBatchPinger will insert all locations that were successfully
-        // pinged into pendingReplies (values are the location IDs).  Ports are
-        // always 0 for WinIcmpBatchPinger since it uses ICMP.
+        // Create WinIcmpBatchPinger with the locations to be pinged (up to
+        // serversPerLocation servers each).  WinIcmpBatchPinger will insert
+        // all servers that were successfully pinged into pendingReplies
+        // (values are the location IDs).  Ports are always 0 for
+        // WinIcmpBatchPinger since it uses ICMP.
         WinIcmpBatchPinger(const std::vector<QSharedPointer<const Location>> &locations,
+                           std::size_t serversPerLocation,
                            PendingRepliesMap &pendingReplies,
                            std::chrono::milliseconds timeout);
     };
 
     WinIcmpBatchPinger::WinIcmpBatchPinger(const std::vector<QSharedPointer<const Location>> &locations,
+                                           std::size_t serversPerLocation,
                                            PendingRepliesMap &pendingReplies,
                                            std::chrono::milliseconds timeout)
     {
         //Ping each location.
         for(const auto &pLocation : locations)
         {
-            quint32 echoAddr = selectIcmpPingAddress(pLocation);
-            QPointer<WinIcmpEcho> pEcho;
-            if(echoAddr && (pEcho = WinIcmpEcho::send(echoAddr, timeout)))
+            const auto &echoAddrs = selectIcmpPingAddresses(pLocation, serversPerLocation);
+            if(echoAddrs.empty())
+                ++_failedCount;
+            for(quint32 echoAddr : echoAddrs)
             {
-                // Pinged this location, put it in the pending replies.
-                pendingReplies[HostPortKey{QHostAddress{echoAddr}, 0}] = pLocation->id();
-
-                connect(pEcho.data(), &WinIcmpEcho::receivedReply, this,
-                        [this](quint32 address)
-                        {
-                            emit receivedResponse(QHostAddress{address}, 0);
-                        });
+                QPointer<WinIcmpEcho> pEcho = WinIcmpEcho::send(echoAddr, timeout);
+                if(pEcho)
+                {
+                    // Pinged this server, put it in the pending replies.
+                    pendingReplies[HostPortKey{QHostAddress{echoAddr}, 0}] = pLocation->id();
+                    ++_sentCount;
+
+                    connect(pEcho.data(), &WinIcmpEcho::receivedReply, this,
+                            [this](quint32 address, std::chrono::milliseconds roundTrip)
+                            {
+                                emit receivedResponse(QHostAddress{address}, 0, roundTrip);
+                            });
+                }
+                else
+                    ++_failedCount;
             }
         }
     }
 
 #else
     // Implementation of BatchPinger using ICMP echoes via raw sockets using PosixPing
+    //
+    // Requests are sent in paced bursts using PosixPing::sendEchoRequests(),
+    // so a large batch needs only a few system calls and doesn't overflow the
+    // socket's send buffer.
     class PosixIcmpBatchPinger : public BatchPinger
     {
         Q_OBJECT
         CLASS_LOGGING_CATEGORY("latency");
 
     public:
-        // Create PosixIcmpBatchPinger with the locations to be pinged.
-        // PosixIcmpBatchPinger will insert all locations that were successfully
-        // pinged into pendingReplies (values are the location IDs).  Ports are
-        // always 0 for PosixIcmpBatchPinger since it uses ICMP.
+        // Create PosixIcmpBatchPinger with the locations to be pinged (up to
+        // serversPerLocation servers each).  PosixIcmpBatchPinger inserts all
+        // servers that have a ping address into pendingReplies immediately
+        // (values are the location IDs); servers are removed again if the
+        // request can't be sent.  Ports are always 0 for PosixIcmpBatchPinger
+        // since it uses ICMP.
+        //
+        // Up to burstSize requests are sent at once, then the next burst is
+        // sent after burstInterval elapses.
         PosixIcmpBatchPinger(const std::vector<QSharedPointer<const Location>> &locations,
-                             PendingRepliesMap &pendingReplies);
+                             std::size_t serversPerLocation,
+                             PendingRepliesMap &pendingReplies,
+                             std::size_t burstSize,
+                             std::chrono::milliseconds burstInterval);
+
+    private:
+        // Send the next burst of requests; stops the burst timer when all
+        // requests have been sent.
+        void sendBurst();
 
     private:
+        PendingRepliesMap &_pendingReplies;
+        std::size_t _burstSize;
+        // Addresses to ping; the ones before _nextAddress have been sent (or
+        // failed).
+        std::vector<quint32> _addresses;
+        std::size_t _nextAddress;
+        QTimer _burstTimer;
         PosixPing _ping;
     };
 
     PosixIcmpBatchPinger::PosixIcmpBatchPinger(const std::vector<QSharedPointer<const Location>> &locations,
-                                               PendingRepliesMap &pendingReplies)
+                                               std::size_t serversPerLocation,
+                                               PendingRepliesMap &pendingReplies,
+                                               std::size_t burstSize,
+                                               std::chrono::milliseconds burstInterval)
+        : _pendingReplies{pendingReplies}, _burstSize{std::max<std::size_t>(burstSize, 1)},
+          _nextAddress{0}
     {
-        //Ping each location.
+        _addresses.reserve(locations.size() * serversPerLocation);
         for(const auto &pLocation : locations)
         {
-            quint32 echoAddr = selectIcmpPingAddress(pLocation);
-            if(echoAddr && _ping.sendEchoRequest(echoAddr))
+            const auto &echoAddrs = selectIcmpPingAddresses(pLocation, serversPerLocation);
+            if(echoAddrs.empty())
+                ++_failedCount;
+            for(quint32 echoAddr : echoAddrs)
             {
-                // Pinged this location, put it in the pending replies.
-                pendingReplies[HostPortKey{QHostAddress{echoAddr}, 0}] = pLocation->id();
+                // Locations could share a ping address; only ping it once
+                auto emplaceResult = _pendingReplies.emplace(HostPortKey{QHostAddress{echoAddr}, 0},
+                                                             pLocation->id());
+                if(emplaceResult.second)
+                    _addresses.push_back(echoAddr);
             }
         }
 
         connect(&_ping, &PosixPing::receivedReply, this,
-                [this](quint32 addr)
+                [this](quint32 addr, std::chrono::microseconds roundTrip)
                 {
-                    receivedResponse(QHostAddress{addr}, 0);
+                    receivedResponse(QHostAddress{addr}, 0, roundTrip);
                 });
+
+        _burstTimer.setInterval(burstInterval.count());
+        connect(&_burstTimer, &QTimer::timeout, this, &PosixIcmpBatchPinger::sendBurst);
+
+        // Send the first burst now, so pendingReplies reflects any requests
+        // that failed immediately.  Start the timer if there's more to send.
+        sendBurst();
+        if(_nextAddress < _addresses.size())
+            _burstTimer.start();
+    }
+
+    void PosixIcmpBatchPinger::sendBurst()
+    {
+        std::size_t burstEnd = std::min(_nextAddress + _burstSize, _addresses.size());
+        while(_nextAddress < burstEnd)
+        {
+            auto result = _ping.sendEchoRequests(&_addresses[_nextAddress],
+                                                 burstEnd - _nextAddress);
+            _nextAddress += result.sent;
+            _sentCount += result.sent;
+
+            // If the socket's buffer is full, try the rest of this burst again
+            // on the next interval
+            if(result.wouldBlock)
+                break;
+
+            // Otherwise, if a request failed, drop that address and continue
+            // with the rest of the burst
+            if(_nextAddress < burstEnd)
+            {
+                _pendingReplies.erase(HostPortKey{QHostAddress{_addresses[_nextAddress]}, 0});
+                ++_failedCount;
+                ++_nextAddress;
+            }
+        }
+
+        if(_nextAddress >= _addresses.size())
+            _burstTimer.stop();
     }
 
 #endif
 }
 
-std::chrono::milliseconds LatencyHistory::updateLatency(std::chrono::milliseconds newMeasurement)
+LatencyHistory::LatencyHistory()
+    : _samples{}, _nextSample{0}, _sampleCount{0}, _lostCount{0}, _jitter{0}
+{
+}
+
+void LatencyHistory::addSample(const Sample &sample)
+{
+    //If the ring is full, the sample being replaced drops out of the loss
+    //ratio.
+    if(_sampleCount == _samples.size())
+    {
+        if(_samples[_nextSample].lost)
+            --_lostCount;
+    }
+    else
+        ++_sampleCount;
+
+    _samples[_nextSample] = sample;
+    if(sample.lost)
+        ++_lostCount;
+    _nextSample = (_nextSample + 1) % _samples.size();
+}
+
+auto LatencyHistory::addMeasurement(std::chrono::milliseconds roundTrip) -> Stats
 {
-    //If we already have the maximum number of entries, discard the oldest one.
-    if(_lastMeasurements.size() >= measurementHistoryCount)
+    addSample({roundTrip, false});
+
+    //Moving averages reduce the effect of anomalous measurements at either end
+    //of the spectrum, while still following a change in the route.
+    double roundTripMs = static_cast<double>(roundTrip.count());
+    if(_latency)
+        _latency = _latency.get() + latencyAverageGain * (roundTripMs - _latency.get());
+    else
+        _latency = roundTripMs;
+
+    if(_lastRoundTrip)
     {
-        _lastMeasurements.pop_front();
+        double delta = std::abs(roundTripMs - static_cast<double>(_lastRoundTrip->count()));
+        _jitter += jitterAverageGain * (delta - _jitter);
     }
+    _lastRoundTrip = roundTrip;
 
-    //Store the new one.
-    _lastMeasurements.push_back(newMeasurement);
+    return stats();
+}
 
-    //Compute the average latency over these measurements.
-    //An average is probably the best way to aggregate these (as opposed to min/
-    //max/etc.), because it'll reduce the effect of anomalous measurements at
-    //either end of the spectrum.
-    std::chrono::milliseconds sum = std::accumulate(_lastMeasurements.begin(),
-                                                    _lastMeasurements.end(),
-                                                    std::chrono::milliseconds{0});
+auto LatencyHistory::addLoss() -> Stats
+{
+    addSample({{}, true});
+    return stats();
+}
 
-    return sum / _lastMeasurements.size();
+auto LatencyHistory::stats() const -> Stats
+{
+    Stats result{{}, std::chrono::milliseconds{std::lround(_jitter)}, 0.0};
+    if(_latency)
+        result.latency.emplace(std::lround(_latency.get()));
+    if(_sampleCount)
+        result.loss = static_cast<double>(_lostCount) / static_cast<double>(_sampleCount);
+    return result;
+}
+
+LatencySchedule::LatencySchedule()
+    : _interval{latencyRefreshInterval}
+{
+}
+
+bool LatencySchedule::isDue(Clock::time_point now, bool priority) const
+{
+    if(!_lastMeasured)
+        return true;
+    Clock::duration interval = priority ? Clock::duration{latencyRefreshInterval} : _interval;
+    return now + latencyScheduleSlack >= _lastMeasured.get() + interval;
+}
+
+void LatencySchedule::addResult(const LatencyHistory::Stats &previous,
+                                const LatencyHistory::Stats &current,
+                                bool priority, bool distant)
+{
+    // Priority locations don't use the interval, but reset it so they're
+    // measured frequently if they stop being a priority
+    bool backOff{false};
+    if(!priority)
+    {
+        if(distant)
+            backOff = true;
+        else if(previous.latency && current.latency && current.loss == 0.0)
+        {
+            auto change = std::abs(current.latency->count() - previous.latency->count());
+            auto stableChange = std::max<double>(stableLatencyChange.count(),
+                                                 stableLatencyRatio * previous.latency->count());
+            backOff = change <= stableChange;
+        }
+    }
+
+    if(backOff)
+        _interval = std::min<Clock::duration>(_interval * 2, latencyMaxInterval);
+    else
+        _interval = latencyRefreshInterval;
+}
+
+void LatencySchedule::reset()
+{
+    _lastMeasured.clear();
+    _interval = latencyRefreshInterval;
 }
 
 LatencyTracker::LatencyTracker()
+    : _serversPerLocation{1}, _pingPacing{}, _counters{}
 {
     _measureTrigger.setInterval(std::chrono::milliseconds(latencyRefreshInterval).count());
     connect(&_measureTrigger, &QTimer::timeout, this,
             &LatencyTracker::onMeasureTrigger);
+    _sweepTrigger.setInterval(std::chrono::milliseconds(networkChangeSweepDelay).count());
+    _sweepTrigger.setSingleShot(true);
+    connect(&_sweepTrigger, &QTimer::timeout, this,
+            &LatencyTracker::onSweepTrigger);
 }
 
 void LatencyTracker::onMeasureTrigger()
 {
-    //Measure all known addresses (if there are any)
-    //This vector of PingLocations could in principle be built with _locations
-    //and stored, but it shouldn't be a significant cost to just build it here.
-    std::vector<QSharedPointer<const Location>> measureLocations;
-    measureLocations.reserve(_locations.size());
-    for(auto itLocation = _locations.begin(); itLocation != _locations.end();
-        ++itLocation)
+    measureDueLocations();
+}
+
+void LatencyTracker::onSweepTrigger()
+{
+    qInfo() << "Measuring all" << _locations.size()
+        << "locations after network change";
+    ++_counters.sweeps;
+    for(auto &locationEntry : _locations)
+        locationEntry.second.schedule.reset();
+    measureDueLocations();
+}
+
+void LatencyTracker::updateCandidates()
+{
+    // Rank candidates the way the "auto" location is selected - by
+    // Location::selectionScore() - so the locations likely to be selected are
+    // the ones measured most often.
+    struct Candidate
+    {
+        double score;
+        std::chrono::milliseconds latency;
+        QString locationId;
+    };
+    std::vector<Candidate> candidates;
+    candidates.reserve(_locations.size());
+    for(const auto &locationEntry : _locations)
     {
-        measureLocations.push_back(itLocation->second.pLocation);
+        const auto &pLocation = locationEntry.second.pLocation;
+        const auto &stats = locationEntry.second.latency.stats();
+        if(stats.latency && pLocation && pLocation->autoSafe() &&
+           !pLocation->geoLocated() && !pLocation->offline())
+        {
+            LatencyQuality quality;
+            quality.jitter = static_cast<double>(stats.jitter.count());
+            quality.loss = stats.loss;
+            double score = Location::selectionScore(static_cast<double>(stats.latency->count()),
+                                                    quality);
+            candidates.push_back({score, stats.latency.get(), locationEntry.first});
+        }
     }
-    beginMeasurement(measureLocations);
+
+    std::size_t candidateCount = std::min(candidates.size(), latencyAutoCandidates);
+    std::partial_sort(candidates.begin(), candidates.begin() + candidateCount,
+                      candidates.end(),
+                      [](const Candidate &first, const Candidate &second)
+                      {
+                          return std::tie(first.score, first.locationId) <
+                              std::tie(second.score, second.locationId);
+                      });
+    _autoCandidates.clear();
+    _bestLatency.clear();
+    for(std::size_t i=0; i<candidateCount; ++i)
+    {
+        _autoCandidates.insert(candidates[i].locationId);
+        if(!_bestLatency || candidates[i].latency < _bestLatency.get())
+            _bestLatency = candidates[i].latency;
+    }
+}
+
+bool LatencyTracker::isPriority(const QString &locationId) const
+{
+    return _priorityLocations.count(locationId) ||
+        _autoCandidates.count(locationId);
+}
+
+void LatencyTracker::scheduleResult(const QString &locationId,
+                                    LocationData &location,
+                                    const LatencyHistory::Stats &previous)
+{
+    const auto &current = location.latency.stats();
+    // A location that has never replied is treated as distant - it's probably
+    // unreachable from this network
+    bool distant = !current.latency ||
+        (_bestLatency && current.latency->count() > distantLatencyFactor * _bestLatency->count());
+    location.schedule.addResult(previous, current, isPriority(locationId), distant);
 }
 
 void LatencyTracker::onNewMeasurements(const Latencies &measurements)
 {
-    Latencies aggregatedMeasurements;
+    Measurements aggregatedMeasurements;
     aggregatedMeasurements.reserve(measurements.size());
     for(const auto &measurement : measurements)
     {
         // Find this location
         auto itLocation = _locations.find(measurement.first);
-        // If it was found, store it and get the new aggregated value.  If it's
-        // no longer present, there's nothing to do.
+        // If it was found, store it and get the new statistics.  If it's no
+        // longer present, there's nothing to do.
         if(itLocation != _locations.end())
         {
-            // Store the new latency measurement, and get the current aggregate
-            // value.
-            auto aggregateLatency = itLocation->second.latency.updateLatency(measurement.second);
-            aggregatedMeasurements.push_back({measurement.first, aggregateLatency});
+            auto previous = itLocation->second.latency.stats();
+            auto stats = itLocation->second.latency.addMeasurement(measurement.second);
+            scheduleResult(measurement.first, itLocation->second, previous);
+            aggregatedMeasurements.push_back({measurement.first, stats});
         }
     }
 
@@ -209,23 +507,101 @@ void LatencyTracker::onNewMeasurements(const Latencies &measurements)
         emit newMeasurements(aggregatedMeasurements);
 }
 
-void LatencyTracker::measureNewLocations()
+void LatencyTracker::onLostReplies(const QStringList &locationIds)
 {
-    std::vector<QSharedPointer<const Location>> newLocations;
+    Measurements aggregatedMeasurements;
+    aggregatedMeasurements.reserve(locationIds.size());
+    for(const auto &locationId : locationIds)
+    {
+        auto itLocation = _locations.find(locationId);
+        if(itLocation != _locations.end())
+        {
+            auto previous = itLocation->second.latency.stats();
+            auto stats = itLocation->second.latency.addLoss();
+            scheduleResult(locationId, itLocation->second, previous);
+            aggregatedMeasurements.push_back({locationId, stats});
+        }
+    }
+
+    if(!aggregatedMeasurements.empty())
+        emit newMeasurements(aggregatedMeasurements);
+}
 
+std::vector<QString> LatencyTracker::rankServers(const LocationData &location) const
+{
+    std::vector<std::pair<std::chrono::milliseconds, QString>> healthyServers;
+    healthyServers.reserve(location.servers.size());
+    for(const auto &serverEntry : location.servers)
+    {
+        auto stats = serverEntry.second.stats();
+        if(stats.latency && stats.loss <= maxHealthyServerLoss)
+            healthyServers.push_back({stats.latency.get(), serverEntry.first});
+    }
+    // Ties are broken by IP so the ranking is stable
+    std::sort(healthyServers.begin(), healthyServers.end());
+
+    std::vector<QString> ranking;
+    ranking.reserve(healthyServers.size());
+    for(auto &server : healthyServers)
+        ranking.push_back(std::move(server.second));
+    return ranking;
+}
+
+void LatencyTracker::onServerResults(const ServerResults &results)
+{
+    // Ignore results from a batch started before servers stopped being
+    // tracked
+    if(_serversPerLocation <= 1)
+        return;
+
+    std::unordered_set<QString> updatedLocations;
+    for(const auto &result : results)
+    {
+        auto itLocation = _locations.find(result.locationId);
+        if(itLocation == _locations.end())
+            continue;
+        auto &history = itLocation->second.servers[result.address];
+        if(result.roundTrip)
+            history.addMeasurement(result.roundTrip.get());
+        else
+            history.addLoss();
+        updatedLocations.insert(result.locationId);
+    }
+
+    ServerRankings rankings;
+    rankings.reserve(updatedLocations.size());
+    for(const auto &locationId : updatedLocations)
+        rankings.push_back({locationId, rankServers(_locations.at(locationId))});
+
+    if(!rankings.empty())
+        emit serverRankingsChanged(rankings);
+}
+
+void LatencyTracker::measureDueLocations()
+{
+    updateCandidates();
+
+    auto now = LatencySchedule::Clock::now();
+    std::vector<QSharedPointer<const Location>> dueLocations;
     for(auto &locationEntry : _locations)
     {
-        //If this location hasn't been attempted yet, ping it now.
-        if(!locationEntry.second.pingAttempted)
+        if(locationEntry.second.schedule.isDue(now, isPriority(locationEntry.first)))
         {
-            locationEntry.second.pingAttempted = true;
-            newLocations.push_back(locationEntry.second.pLocation);
+            locationEntry.second.schedule.measured(now);
+            dueLocations.push_back(locationEntry.second.pLocation);
         }
     }
 
-    if(!newLocations.empty())
+    std::size_t deferred = _locations.size() - dueLocations.size();
+    _counters.probes += dueLocations.size();
+    _counters.deferred += deferred;
+
+    if(!dueLocations.empty())
     {
-        beginMeasurement(newLocations);
+        qInfo() << "Measuring" << dueLocations.size() << "/" << _locations.size()
+            << "locations - total probes:" << _counters.probes << "deferred:"
+            << _counters.deferred << "sweeps:" << _counters.sweeps;
+        beginMeasurement(dueLocations);
     }
 }
 
@@ -248,10 +624,16 @@ void LatencyTracker::beginMeasurement(const std::vector<QSharedPointer<const Loc
             //Create a LatencyBatch; parent it to this object so it is cleaned up if
             //LatencyTracker is destroyed
             LatencyBatch *pNewBatch = new LatencyBatch{locations,
-                                                       &_measurementThread.objectOwner()};
+                                                       &_measurementThread.objectOwner(),
+                                                       _serversPerLocation,
+                                                       _pingPacing};
             //Forward newMeasurements signals from this new batch
             connect(pNewBatch, &LatencyBatch::newMeasurements, this,
                     &LatencyTracker::onNewMeasurements);
+            connect(pNewBatch, &LatencyBatch::lostReplies, this,
+                    &LatencyTracker::onLostReplies);
+            connect(pNewBatch, &LatencyBatch::serverResults, this,
+                    &LatencyTracker::onServerResults);
         });
     }
 }
@@ -268,10 +650,10 @@ void LatencyTracker::updateLocations(const LocationsById &serverLocations)
     for(const auto &location : serverLocations)
     {
         QString idQstr{QString::fromStdString(location.first)};
-        // Create the location.  No pings have been attempted yet if we don't
-        // find this location in oldLocations
+        // Create the location.  It's due immediately if we don't find this
+        // location in oldLocations
         auto &newLocation = _locations[idQstr];
-        newLocation = {location.second, {}, false};
+        newLocation = {location.second, {}, {}, {}};
 
         // Did we have this location before?
         auto itOldLocation = oldLocations.find(idQstr);
@@ -279,15 +661,70 @@ void LatencyTracker::updateLocations(const LocationsById &serverLocations)
         {
             //It existed, so preserve its latency measurements
             newLocation.latency = std::move(itOldLocation->second.latency);
-            //Preserve pingAttempted
-            newLocation.pingAttempted = itOldLocation->second.pingAttempted;
+            //Preserve its schedule
+            newLocation.schedule = itOldLocation->second.schedule;
+            //Preserve the measurements of servers that are still present
+            auto &oldServers = itOldLocation->second.servers;
+            if(!oldServers.empty() && location.second)
+            {
+                for(const auto &server : location.second->servers())
+                {
+                    auto itOldServer = oldServers.find(server.ip());
+                    if(itOldServer != oldServers.end())
+                        newLocation.servers.insert(std::move(*itOldServer));
+                }
+            }
         }
     }
 
     //If measurements are enabled, trigger a new measurement for the new
     //locations.  Otherwise, leave them in _locations to be attempted later.
     if(_measureTrigger.isActive())
-        measureNewLocations();
+        measureDueLocations();
+}
+
+void LatencyTracker::setPriorityLocations(std::unordered_set<QString> locationIds)
+{
+    _priorityLocations = std::move(locationIds);
+}
+
+void LatencyTracker::networkChanged()
+{
+    if(_measureTrigger.isActive())
+        _sweepTrigger.start();
+}
+
+void LatencyTracker::setServersPerLocation(std::size_t count)
+{
+    count = std::max<std::size_t>(1, std::min(count, maxServersPerLocation));
+    if(count == _serversPerLocation)
+        return;
+
+    qInfo() << "Measuring up to" << count << "servers per location";
+    _serversPerLocation = count;
+    if(_serversPerLocation > 1)
+        return;
+
+    // Servers aren't tracked any more, clear the rankings
+    ServerRankings rankings;
+    for(auto &locationEntry : _locations)
+    {
+        if(!locationEntry.second.servers.empty())
+        {
+            locationEntry.second.servers.clear();
+            rankings.push_back({locationEntry.first, {}});
+        }
+    }
+    if(!rankings.empty())
+        emit serverRankingsChanged(rankings);
+}
+
+void LatencyTracker::setPingPacing(const PingPacing &pacing)
+{
+    _pingPacing = pacing;
+    _pingPacing.burstSize = std::max<std::size_t>(_pingPacing.burstSize, 1);
+    qInfo() << "Sending ICMP pings in bursts of" << _pingPacing.burstSize
+        << "every" << _pingPacing.burstInterval.count() << "ms";
 }
 
 void LatencyTracker::start()
@@ -296,8 +733,8 @@ void LatencyTracker::start()
     {
         qInfo() << "Starting background latency checks";
         _measureTrigger.start();
-        //Trigger measurements for anything that hasn't been measured yet
-        measureNewLocations();
+        //Trigger measurements for anything that's due
+        measureDueLocations();
     }
 }
 
@@ -305,24 +742,28 @@ void LatencyTracker::stop()
 {
     qInfo() << "Stopping background latency checks";
     _measureTrigger.stop();
+    _sweepTrigger.stop();
 }
 
 LatencyBatch::LatencyBatch(const std::vector<QSharedPointer<const Location>> &locations,
-                           QObject *pParent)
-    : QObject{pParent}
+                           QObject *pParent, std::size_t serversPerLocation,
+                           const PingPacing &pacing)
+    : QObject{pParent}, _serversPerLocation{std::max<std::size_t>(serversPerLocation, 1)}
 {
     _batchTimer.setInterval(std::chrono::milliseconds(latencyBatchInterval).count());
     _batchTimer.setSingleShot(true);
     connect(&_batchTimer, &QTimer::timeout, this,
             &LatencyBatch::onBatchElapsed);
 
-    //Start the timer before sending the ping packets
-    _timeSincePing.start();
-
 #if defined(Q_OS_WIN)
-    _pPinger.reset(new WinIcmpBatchPinger{locations, _pendingReplies, latencyEchoTimeout});
+    _pPinger.reset(new WinIcmpBatchPinger{locations, _serversPerLocation,
+                                          _pendingReplies, latencyEchoTimeout});
+    Q_UNUSED(pacing);
 #else
-    _pPinger.reset(new PosixIcmpBatchPinger{locations, _pendingReplies});
+    _pPinger.reset(new PosixIcmpBatchPinger{locations, _serversPerLocation,
+                                            _pendingReplies,
+                                            pacing.burstSize,
+                                            pacing.burstInterval});
 #endif
 
     connect(_pPinger.get(), &BatchPinger::receivedResponse, this,
@@ -353,10 +794,23 @@ void LatencyBatch::emitBatchedMeasurements()
     }
 }
 
-void LatencyBatch::onReceivedResponse(const QHostAddress &address, quint16 port)
+void LatencyBatch::emitServerResults()
+{
+    if(_serversPerLocation > 1)
+    {
+        // Servers that haven't replied are lost
+        for(const auto &replyEntry : _pendingReplies)
+            _serverResults.push_back({replyEntry.second, replyEntry.first.first.toString(), {}});
+        if(!_serverResults.empty())
+            emit serverResults(_serverResults);
+        _serverResults.clear();
+    }
+}
+
+void LatencyBatch::onReceivedResponse(const QHostAddress &address, quint16 port,
+                                      std::chrono::microseconds roundTrip)
 {
-    // Get the roundtrip latency measurement.
-    std::chrono::milliseconds roundtripLatency{_timeSincePing.elapsed()};
+    auto roundtripLatency = std::chrono::duration_cast<std::chrono::milliseconds>(roundTrip);
 
     //Look up this host in the pending replies.  Look for any possible
     //equivalent address - for example, an IPv4 address could now be represented
@@ -377,9 +831,19 @@ void LatencyBatch::onReceivedResponse(const QHostAddress &address, quint16 port)
     if(itHostPendingReply == _pendingReplies.end())
         return;
 
-    // Store a measurement for this host
-    _batchedMeasurements.push_back({itHostPendingReply->second,
-                                    roundtripLatency});
+    // Store a measurement for this location if it's the first reply from the
+    // location (the fastest server)
+    if(_measuredLocations.insert(itHostPendingReply->second).second)
+    {
+        _batchedMeasurements.push_back({itHostPendingReply->second,
+                                        roundtripLatency});
+    }
+    if(_serversPerLocation > 1)
+    {
+        _serverResults.push_back({itHostPendingReply->second,
+                                  itHostPendingReply->first.first.toString(),
+                                  roundtripLatency});
+    }
 
     //This host has been measured, so remove it from _pendingReplies
     _pendingReplies.erase(itHostPendingReply);
@@ -393,6 +857,7 @@ void LatencyBatch::onReceivedResponse(const QHostAddress &address, quint16 port)
         // to clear out _batchedMeasurements to ensure that the measurements
         // aren't emitted twice.
         emitBatchedMeasurements();
+        emitServerResults();
 
         //Destroy this LatencyBatch
         deleteLater();
@@ -408,21 +873,34 @@ void LatencyBatch::onReceivedResponse(const QHostAddress &address, quint16 port)
 
 void LatencyBatch::onTimeoutElapsed()
 {
+    qInfo() << "Latency batch sent" << _pPinger->sentCount() << "requests,"
+        << _pPinger->failedCount() << "failed," << _pendingReplies.size()
+        << "lost";
     if(_pendingReplies.size() > 0)
     {
         qDebug() << "Did not receive echoes from" << _pendingReplies.size()
                  << "addresses";
     }
 
+    // A location is only lost if none of its servers replied
+    QStringList lostLocationIds;
+    lostLocationIds.reserve(_pendingReplies.size());
     for(const auto &replyEntry : _pendingReplies)
     {
-        qInfo() << "Location" << replyEntry.second
-                << "did not respond to latency ping";
+        if(_measuredLocations.insert(replyEntry.second).second)
+        {
+            qInfo() << "Location" << replyEntry.second
+                    << "did not respond to latency ping";
+            lostLocationIds.push_back(replyEntry.second);
+        }
     }
 
-    // Nothing left to do.  Emit any remaining measurements, then destroy this
-    // LatencyBatch
+    // Nothing left to do.  Emit any remaining measurements and the lost
+    // replies, then destroy this LatencyBatch
     emitBatchedMeasurements();
+    if(!lostLocationIds.isEmpty())
+        emit lostReplies(lostLocationIds);
+    emitServerResults();
     deleteLater();
 }
 
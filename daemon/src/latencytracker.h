@@ -22,11 +22,12 @@
 #include <common/src/settings/locations.h>
 #include "vpn.h"
 #include <QObject>
-#include <QElapsedTimer>
 #include <QHostAddress>
 #include <QTimer>
 #include <QUdpSocket>
+#include <array>
 #include <chrono>
+#include <unordered_set>
 
 namespace std
 {
@@ -54,25 +55,120 @@ struct HashPair
 // values are the associated location IDs.
 using PendingRepliesMap = std::unordered_map<HostPortKey, QString, HashPair>;
 
-//LatencyHistory queues up latency measurements for a particular remote host.
-//As measurements are taken, they're queued up in LatencyHistory, which
-//computes a latency value based on those measurements.
+//Pacing of the ICMP echo requests sent by a LatencyBatch.  Requests are sent
+//in bursts of up to burstSize requests, with burstInterval between bursts.
+//Pacing the requests avoids filling the socket's send buffer, and avoids a
+//flood of replies arriving at the same time (which could be queued or dropped
+//by the local network and skew measurements).
+//
+//This only applies to the POSIX ICMP implementation; on Windows,
+//IcmpSendEcho2() queues the requests itself.
+struct PingPacing
+{
+    std::size_t burstSize{8};
+    std::chrono::milliseconds burstInterval{20};
+};
+
+//LatencyHistory keeps the recent latency measurements for a particular remote
+//host, including pings that were lost, and computes statistics from them:
+// - latency - exponentially weighted moving average of the round trip times
+// - jitter - moving average of the difference between consecutive round trips
+//   (like RFC 3550 interarrival jitter)
+// - loss - fraction of the recent pings that were lost
+//
+//The recent results are held in a fixed-size ring, so recording a result never
+//allocates or shifts the older results.
 class LatencyHistory
 {
     CLASS_LOGGING_CATEGORY("latency");
 
 public:
-    //Add a new measurement and calculate the current latency based on all
-    //recent measurements.
-    std::chrono::milliseconds updateLatency(std::chrono::milliseconds newMeasurement);
+    // Number of recent results used to compute the loss ratio
+    enum : std::size_t { HistorySize = 10 };
+
+    struct Stats
+    {
+        // Smoothed latency - unknown if no replies have been received
+        nullable_t<std::chrono::milliseconds> latency;
+        std::chrono::milliseconds jitter;
+        // Fraction of recent pings lost, 0-1
+        double loss;
+    };
 
 private:
-    //The last few measurements are stored here.  Qt doesn't have a deque,
-    //which would probably be ideal, but a QList should be OK.  It'll still have
-    //to copy the entire array when we run out of space in the back of its
-    //buffer, but it'll probably do better than a vector since it won't have to
-    //do it every time we delete something from the front.
-    QList<std::chrono::milliseconds> _lastMeasurements;
+    struct Sample
+    {
+        std::chrono::milliseconds roundTrip;
+        bool lost;
+    };
+
+public:
+    LatencyHistory();
+
+public:
+    //Add a new measurement and return the updated statistics.
+    Stats addMeasurement(std::chrono::milliseconds roundTrip);
+    //Record a ping that was not answered and return the updated statistics.
+    Stats addLoss();
+
+    Stats stats() const;
+
+private:
+    void addSample(const Sample &sample);
+
+private:
+    //The last few results are stored here; _nextSample is the position of the
+    //next result (the oldest one once the ring is full).
+    std::array<Sample, HistorySize> _samples;
+    std::size_t _nextSample;
+    std::size_t _sampleCount;
+    std::size_t _lostCount;
+    //Moving averages (ms) - the latency is unknown until a reply is received
+    nullable_t<double> _latency;
+    double _jitter;
+    //The last round trip measured, used to compute jitter
+    nullable_t<std::chrono::milliseconds> _lastRoundTrip;
+};
+
+//LatencySchedule decides when a location should be measured next.  Locations
+//that are likely to be used are measured on every refresh, but others are
+//backed off exponentially while their latency is stable or much higher than
+//the best locations' latency, which saves a lot of probes and wakeups.
+//
+//Times are provided by the caller so the schedule can be tested without
+//waiting.
+class LatencySchedule
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+public:
+    //A new schedule is due immediately, with the minimum interval.
+    LatencySchedule();
+
+public:
+    //Whether the location should be measured now.  Priority locations are
+    //always measured at the minimum interval.
+    bool isDue(Clock::time_point now, bool priority) const;
+    //A measurement was started for this location.
+    void measured(Clock::time_point now) {_lastMeasured = now;}
+    //A measurement result was received - adjust the interval.  previous and
+    //current are the location's statistics before and after the result.
+    //"distant" indicates that the location's latency is much higher than the
+    //best locations.
+    void addResult(const LatencyHistory::Stats &previous,
+                   const LatencyHistory::Stats &current, bool priority,
+                   bool distant);
+    //Make the location due immediately with the minimum interval (used when
+    //the network changes, so all old measurements are suspect).
+    void reset();
+
+    //The current interval for non-priority measurements
+    Clock::duration interval() const {return _interval;}
+
+private:
+    nullable_t<Clock::time_point> _lastMeasured;
+    Clock::duration _interval;
 };
 
 //LatencyTracker takes measurements of the latency to each location's "ping"
@@ -87,6 +183,16 @@ private:
 //This means that if a location's ping address changes (which usually happens
 //when we refresh the server list), the measurements from the old address carry
 //over to the new address.
+//
+//Optionally, several servers can be measured in each location (see
+//setServersPerLocation()).  Then, the location's latency is the latency to the
+//fastest server, and each server's latency is tracked so the healthy servers
+//can be ranked - the ranking is emitted in the serverRankingsChanged signal.
+//
+//Each location is measured according to its LatencySchedule.  The priority
+//locations given by Daemon (favorites, recents, current selections) and the
+//best few candidates for "auto" are measured on every refresh; the others are
+//backed off.  A full sweep is measured shortly after the network changes.
 class LatencyTracker : public QObject
 {
     Q_OBJECT
@@ -98,13 +204,43 @@ private:
         QSharedPointer<const Location> pLocation;
         LatencyHistory latency;
         //Locations can sit in _locations without having been attempted if
-        //measurements are not enabled.
-        bool pingAttempted;
+        //measurements are not enabled; they're due immediately.
+        LatencySchedule schedule;
+        //Per-server latency when several servers are measured per location;
+        //keys are server IPs.
+        std::unordered_map<QString, LatencyHistory> servers;
+    };
+
+public:
+    //Counters showing the effect of the measurement schedule
+    struct Counters
+    {
+        //Pings sent to locations
+        quint64 probes;
+        //Pings skipped because the location was not due yet (each time a
+        //refresh occurs)
+        quint64 deferred;
+        //Full sweeps due to network changes
+        quint64 sweeps;
     };
 
 public:
     // Group of latency measurements - location IDs and latency values.
     using Latencies = std::vector<QPair<QString, std::chrono::milliseconds>>;
+    // Group of updated latency statistics - location IDs and statistics.
+    using Measurements = std::vector<QPair<QString, LatencyHistory::Stats>>;
+    // Result of pinging one server when several servers are measured per
+    // location - the round trip is unknown if the server did not respond.
+    struct ServerResult
+    {
+        QString locationId;
+        QString address;
+        nullable_t<std::chrono::milliseconds> roundTrip;
+    };
+    using ServerResults = std::vector<ServerResult>;
+    // Updated server rankings - location IDs and the healthy servers' IPs,
+    // fastest first (see Location::serverRanking()).
+    using ServerRankings = std::vector<QPair<QString, std::vector<QString>>>;
 
 public:
     // LatencyTracker begins with measurements stopped - call start() to enable
@@ -112,21 +248,43 @@ public:
     LatencyTracker();
 
 signals:
-    // This signal is emitted whenever new measurements have been taken.
+    // This signal is emitted whenever new measurements have been taken, or
+    // pings have been lost.  The statistics for each affected location are
+    // provided.
     //
     // (Note that moc requires redundant qualifications of nested types)
-    void newMeasurements(const LatencyTracker::Latencies &measurements);
+    void newMeasurements(const LatencyTracker::Measurements &measurements);
+
+    // The server rankings have changed for some locations.  An empty ranking
+    // means the location's servers aren't measured individually any more.
+    void serverRankingsChanged(const LatencyTracker::ServerRankings &rankings);
 
 private slots:
     //Trigger a new latency measurement
     void onMeasureTrigger();
+    //Measure all locations after a network change
+    void onSweepTrigger();
     //Measurements were taken by a LatencyBatch
     void onNewMeasurements(const Latencies &measurements);
+    //Pings were not answered in a LatencyBatch
+    void onLostReplies(const QStringList &locationIds);
+    //Per-server results from a LatencyBatch
+    void onServerResults(const ServerResults &results);
 
 private:
-    //Begin a measurement for all locations in _locations that haven't been
-    //attempted yet
-    void measureNewLocations();
+    //Update the "auto" candidates and the best latency after measurements
+    //change
+    void updateCandidates();
+    //Whether a location is measured at the minimum interval
+    bool isPriority(const QString &locationId) const;
+    //Record a result in a location's schedule
+    void scheduleResult(const QString &locationId, LocationData &location,
+                        const LatencyHistory::Stats &previous);
+    //Rank a location's healthy servers by latency
+    std::vector<QString> rankServers(const LocationData &location) const;
+
+    //Begin a measurement for all locations in _locations that are due
+    void measureDueLocations();
 
     //Begin a new measurement for a group of locations
     void beginMeasurement(const std::vector<QSharedPointer<const Location>> &locations);
@@ -139,11 +297,29 @@ public:
     //measured whenever measurements are re-enabled.
     void updateLocations(const LocationsById &serverLocations);
 
+    //Set the locations that are likely to be used (favorites, recents,
+    //current selections, etc.).  These are measured on every refresh.
+    void setPriorityLocations(std::unordered_set<QString> locationIds);
+
+    //The network has changed - previous measurements may no longer be
+    //accurate, so all locations are measured again shortly (several network
+    //changes in quick succession only cause one sweep).
+    void networkChanged();
+
+    //Set the maximum number of servers measured in each location (limited to
+    //1-8).  With 1, one random server is measured in each location, and
+    //servers aren't tracked individually.
+    void setServersPerLocation(std::size_t count);
+
+    //Set the pacing of ICMP echo requests (the burst size is at least 1).
+    //Applies to measurements started after this call.
+    void setPingPacing(const PingPacing &pacing);
+
     //Enable latency measurements.
     //
     //If they were already enabled, this has no effect.  If they weren't
-    //enabled, and new locations have been added since they were last enabled,
-    //a measurement is started immediately for those locations.
+    //enabled, a measurement is started immediately for locations that are due
+    //(including new locations added since they were last enabled).
     void start();
 
     //Stop latency measurements.  If they were already stopped, this has no
@@ -153,6 +329,8 @@ public:
     //in progress.)
     void stop();
 
+    const Counters &counters() const {return _counters;}
+
 private:
     // Measurement batches are executed on this thread.
     RunningWorkerThread _measurementThread;
@@ -160,6 +338,8 @@ private:
     //servers.  This timer is running if and only if measurements have been
     //started.
     QTimer _measureTrigger;
+    //Delays a full sweep after a network change
+    QTimer _sweepTrigger;
     //All locations received from the last call to updateLocations() are
     //held here.  The rest of the location list isn't stored; we only keep track
     //of the distinct addresses that are pinged.
@@ -169,10 +349,25 @@ private:
     //Values are LocationData objects, which contain the location's ping address
     //and its LatencyHistory.
     std::unordered_map<QString, LocationData> _locations;
+    //Priority locations from Daemon
+    std::unordered_set<QString> _priorityLocations;
+    //The best few candidates for automatic selection, by
+    //Location::selectionScore()
+    std::unordered_set<QString> _autoCandidates;
+    //The lowest latency of any auto candidate, if any have been measured
+    nullable_t<std::chrono::milliseconds> _bestLatency;
+    //Maximum servers measured per location
+    std::size_t _serversPerLocation;
+    //Pacing of ICMP echo requests in new batches
+    PingPacing _pingPacing;
+    Counters _counters;
 };
 
 Q_DECLARE_METATYPE(std::chrono::milliseconds);
 Q_DECLARE_METATYPE(LatencyTracker::Latencies);
+Q_DECLARE_METATYPE(LatencyTracker::Measurements);
+Q_DECLARE_METATYPE(LatencyTracker::ServerResults);
+Q_DECLARE_METATYPE(LatencyTracker::ServerRankings);
 
 // BatchPinger is an interface to measure latency to a batch of servers using
 // different methods.  There is a UDP echo implementation of this interface for
@@ -189,23 +384,41 @@ class BatchPinger : public QObject
 public:
     virtual ~BatchPinger() = default;
 
+public:
+    // Number of requests that have been sent so far
+    std::size_t sentCount() const {return _sentCount;}
+    // Number of locations or servers that couldn't be pinged (no address
+    // could be selected, or the request couldn't be sent)
+    std::size_t failedCount() const {return _failedCount;}
+
 signals:
-    // A server has responded.
+    // A server has responded.  The pinger measures the round trip time for each
+    // request individually, so it doesn't depend on when the request was sent
+    // in the batch or on how long the response waited to be processed.
     // It's possible that the BatchPinger could receive spurious replies from
     // hosts that weren't pinged in this batch; the receiver of this signal
     // should ignore these.
-    void receivedResponse(const QHostAddress &address, quint16 port);
+    void receivedResponse(const QHostAddress &address, quint16 port,
+                          std::chrono::microseconds roundTrip);
+
+protected:
+    std::size_t _sentCount{0};
+    std::size_t _failedCount{0};
 };
 
 // LatencyBatch represents one batch of latency measurements.
 // LatencyTracker creates a batch each time it needs to measure latency to one or
 // more servers.
 //
-// LatencyBatch sends UDP packets to each configured address, then waits for
-// echos until the timeout time elapses.  When a reply is received, it
-// calculates the measured latency.  Groups of measurements are emitted in the
+// LatencyBatch sends pings to each configured address, then waits for echos
+// until the timeout time elapses.  When a reply is received, the BatchPinger
+// provides the measured latency.  Groups of measurements are emitted in the
 // newMeasurements signal, which LatencyTracker forwards on.
 //
+// If several servers are pinged per location, the first reply from each
+// location is its measurement (the fastest server), and the results for each
+// server are emitted in the serverResults signal when the batch finishes.
+//
 // Once all measurements are received, or if the timeout time elapses,
 // LatencyBatch destroys itself.
 class LatencyBatch : public QObject
@@ -217,9 +430,16 @@ public:
     using Latencies = LatencyTracker::Latencies;
 
 public:
-    //Create LatencyBatch with the locations that will be checked.
+    //Create LatencyBatch with the locations that will be checked.  Up to
+    //serversPerLocation servers are pinged in each location, and the requests
+    //are paced according to pacing.
     LatencyBatch(const std::vector<QSharedPointer<const Location>> &locations,
-                 QObject *pParent);
+                 QObject *pParent, std::size_t serversPerLocation = 1,
+                 const PingPacing &pacing = {});
+
+public:
+    // Number of echo requests sent so far
+    std::size_t sentCount() const {return _pPinger->sentCount();}
 
 signals:
     // This signal is emitted when new measurements have been calculated.
@@ -231,19 +451,27 @@ signals:
     // also can't figure out a type alias)
     void newMeasurements(const LatencyTracker::Latencies &measurements);
 
+    // This signal is emitted when the timeout elapses, with the locations that
+    // were pinged but did not respond (if there are any).
+    void lostReplies(const QStringList &locationIds);
+
+    // This signal is emitted once when the batch finishes if more than one
+    // server was pinged per location, with the result for each server pinged.
+    void serverResults(const LatencyTracker::ServerResults &results);
+
 private:
     void emitBatchedMeasurements();
+    // Emit the server results (if servers are being tracked)
+    void emitServerResults();
 
 private:
-    void onReceivedResponse(const QHostAddress &address, quint16 port);
+    void onReceivedResponse(const QHostAddress &address, quint16 port,
+                            std::chrono::microseconds roundTrip);
     void onTimeoutElapsed();
     // The batch timer has elapsed, process the batched measurements
     void onBatchElapsed();
 
 private:
-    //This timer measures the elapsed time since the pings were sent, which is
-    //used to calculate latency when the echoes are received.
-    QElapsedTimer _timeSincePing;
     //This map holds the addresses that we haven't heard echoes from yet.
     //Values are the location IDs that we received in the constructor.
     PendingRepliesMap _pendingReplies;
@@ -256,6 +484,13 @@ private:
     QTimer _batchTimer;
     // These are the latency measurements we've received in this batch.
     Latencies _batchedMeasurements;
+    std::size_t _serversPerLocation;
+    // Locations that have replied - only the first reply is the location's
+    // measurement
+    std::unordered_set<QString> _measuredLocations;
+    // Results for each server that replied so far (when serversPerLocation >
+    // 1)
+    LatencyTracker::ServerResults _serverResults;
 };
 
 //Get other QHostAddress values that are semantically equivalent to this one.
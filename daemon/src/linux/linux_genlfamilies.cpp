@@ -61,66 +61,6 @@ namespace
     };
 
     NlctrlAttrs nlctrlAttrs;
-
-    // Iterable view of an attribute containing nested objects.  Iterates
-    // nlattr values.
-    class NestedNlattrView
-    {
-    public:
-        class Iterator
-        {
-        public:
-            Iterator() : _pInnerAttr{nullptr} {} // End iterator
-            Iterator(libnl::nlattr &nestedAttr)
-                : _pInnerAttr{reinterpret_cast<libnl::nlattr*>(libnl::nla_data(&nestedAttr))},
-                  _remaining{libnl::nla_len(&nestedAttr)}
-            {
-                checkEnd();
-            }
-
-        private:
-            // After getting a new _pInnerAttr (either initially or from
-            // ::nla_next()), make sure it's readable with ::nla_ok() - if not,
-            // nulls out _pInnerAttr.
-            void checkEnd()
-            {
-                // If there isn't room for a single attribute, we're already
-                // done, become an end iterator
-                if(_pInnerAttr && !libnl::nla_ok(_pInnerAttr, _remaining))
-                    _pInnerAttr = nullptr;
-            }
-
-        public:
-            bool operator==(const Iterator &other) const {return _pInnerAttr == other._pInnerAttr;}
-            bool operator!=(const Iterator &other) const {return !(*this == other);}
-
-            Iterator &operator++()
-            {
-                if(_pInnerAttr)
-                {
-                    _pInnerAttr = libnl::nla_next(_pInnerAttr, &_remaining);
-                    checkEnd();
-                }
-                return *this;
-            }
-            libnl::nlattr &operator*() const {return *_pInnerAttr;}
-
-        private:
-            libnl::nlattr *_pInnerAttr;    // Current inner attribute; nullptr at end
-            // Remaining data from outer attribute - needed for nla_next().
-            // Does not affect comparisons.
-            int _remaining;
-        };
-
-    public:
-        NestedNlattrView(libnl::nlattr &nestedAttr) : _nestedAttr{nestedAttr} {}
-
-        Iterator begin() {return {_nestedAttr};}
-        Iterator end() {return {};}
-
-    private:
-        libnl::nlattr &_nestedAttr;
-    };
 }
 
 LinuxGenlFamilies::LinuxGenlFamilies()
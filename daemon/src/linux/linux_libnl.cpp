@@ -112,6 +112,8 @@ namespace libnl
         loadLibnl(nla_data);
         loadLibnl(nla_get_u16);
         loadLibnl(nla_get_u32);
+        loadLibnl(nla_get_u64);
+        loadLibnl(nla_put_string);
         loadLibnl(nla_put_u32);
         loadLibnl(nla_len);
         loadLibnl(nla_next);
@@ -185,6 +187,8 @@ namespace libnl
     LIBNL_FUNC(nla_data);
     LIBNL_FUNC(nla_get_u16);
     LIBNL_FUNC(nla_get_u32);
+    LIBNL_FUNC(nla_get_u64);
+    LIBNL_FUNC(nla_put_string);
     LIBNL_FUNC(nla_put_u32);
     LIBNL_FUNC(nla_len);
     LIBNL_FUNC(nla_next);
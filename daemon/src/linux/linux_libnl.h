@@ -163,6 +163,8 @@ namespace libnl
     LIBNL_FUNC(nla_data);
     LIBNL_FUNC(nla_get_u16);
     LIBNL_FUNC(nla_get_u32);
+    LIBNL_FUNC(nla_get_u64);
+    LIBNL_FUNC(nla_put_string);
     LIBNL_FUNC(nla_put_u32);
     LIBNL_FUNC(nla_len);
     LIBNL_FUNC(nla_next);
@@ -0,0 +1,239 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#line SOURCE_FILE("linux_splicerelay.cpp")
+
+#include "linux_splicerelay.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace
+{
+    // Maximum bytes in flight in each direction.  This is also the most data
+    // moved by one splice() call.
+    const std::size_t relayPipeCapacity{64 * 1024};
+
+    // Once one side closes, the other has this long to finish sending and
+    // close too (the same timeout SocksConnection applies when it relays)
+    const std::chrono::seconds closeTimeout{5};
+}
+
+SpliceRelay::SpliceRelay(kapps::core::PosixFd clientSocket,
+                         kapps::core::PosixFd targetSocket,
+                         std::chrono::milliseconds idleTimeout)
+    : _clientSocket{std::move(clientSocket)},
+      _targetSocket{std::move(targetSocket)},
+      _pipeCapacity{relayPipeCapacity}, _valid{false}
+{
+    _clientSocket.applyNonblock();
+    _targetSocket.applyNonblock();
+    _outbound.sourceFd = _clientSocket.get();
+    _outbound.destFd = _targetSocket.get();
+    _inbound.sourceFd = _targetSocket.get();
+    _inbound.destFd = _clientSocket.get();
+
+    if(!initDirection(_outbound, "outbound") || !initDirection(_inbound, "inbound"))
+    {
+        _clientSocket.close();
+        _targetSocket.close();
+        return;
+    }
+
+    _closeTimer.setSingleShot(true);
+    _closeTimer.setInterval(msec(closeTimeout));
+    _closeTimer.callOnTimeout(this, [this]()
+    {
+        qWarning() << "Closing relay due to timeout after one side closed";
+        finish();
+    });
+
+    _idleTimer.setSingleShot(true);
+    _idleTimer.setInterval(msec(idleTimeout));
+    _idleTimer.callOnTimeout(this, [this]()
+    {
+        qInfo() << "Closing idle relay";
+        finish();
+    });
+    _idleTimer.start();
+
+    _valid = true;
+    // Move any data that are already waiting.  This is queued so the owner can
+    // connect to finished() first.
+    QMetaObject::invokeMethod(this, [this]()
+    {
+        pump(_outbound, "outbound");
+        pump(_inbound, "inbound");
+    }, Qt::QueuedConnection);
+}
+
+bool SpliceRelay::initDirection(Direction &direction, const char *traceName)
+{
+    try
+    {
+        direction.pipe = kapps::core::createPipe();
+    }
+    catch(const std::exception &ex)
+    {
+        qWarning() << "Unable to create" << traceName << "relay pipe -" << ex.what();
+        return false;
+    }
+    direction.pipe.readEnd.applyNonblock();
+    direction.pipe.writeEnd.applyNonblock();
+
+    // Bound the data in flight.  If the pipe can't be resized, it has the
+    // default capacity, which is still bounded; just don't exceed
+    // relayPipeCapacity.
+    int pipeSize = ::fcntl(direction.pipe.writeEnd.get(), F_SETPIPE_SZ,
+                           static_cast<int>(relayPipeCapacity));
+    if(pipeSize < 0)
+    {
+        qWarning() << "Unable to size" << traceName << "relay pipe -" << errno;
+        pipeSize = ::fcntl(direction.pipe.writeEnd.get(), F_GETPIPE_SZ);
+    }
+    if(pipeSize > 0)
+        _pipeCapacity = std::min(_pipeCapacity, static_cast<std::size_t>(pipeSize));
+
+    direction.pSourceNotifier.emplace(direction.sourceFd, QSocketNotifier::Type::Read);
+    direction.pSourceNotifier->setEnabled(false);
+    connect(direction.pSourceNotifier.ptr(), &QSocketNotifier::activated, this,
+            [this, &direction, traceName](){pump(direction, traceName);});
+    direction.pDestNotifier.emplace(direction.destFd, QSocketNotifier::Type::Write);
+    direction.pDestNotifier->setEnabled(false);
+    connect(direction.pDestNotifier.ptr(), &QSocketNotifier::activated, this,
+            [this, &direction, traceName](){pump(direction, traceName);});
+    return true;
+}
+
+void SpliceRelay::pump(Direction &direction, const char *traceName)
+{
+    if(!_valid || direction.done)
+        return;
+
+    bool progress{true};
+    while(progress)
+    {
+        progress = false;
+
+        // Fill the pipe from the source, as long as there's room
+        if(!direction.sourceEof && !direction.pipeFull &&
+           direction.inFlight < _pipeCapacity)
+        {
+            ssize_t spliced;
+            NO_EINTR(spliced = ::splice(direction.sourceFd, nullptr,
+                                        direction.pipe.writeEnd.get(), nullptr,
+                                        _pipeCapacity - direction.inFlight,
+                                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+            if(spliced > 0)
+            {
+                direction.inFlight += static_cast<std::size_t>(spliced);
+                progress = true;
+            }
+            else if(spliced == 0)
+            {
+                qInfo() << "Source closed" << traceName << "connection with"
+                    << direction.inFlight << "bytes in flight";
+                direction.sourceEof = true;
+                progress = true;
+            }
+            else if(errno != EAGAIN)
+            {
+                qWarning() << "Unable to read" << traceName << "data -" << errno;
+                finish();
+                return;
+            }
+            else if(direction.inFlight > 0)
+            {
+                // Either the source has no data or the pipe is full; an empty
+                // source would just wait for the destination anyway, so assume
+                // the pipe is full
+                direction.pipeFull = true;
+            }
+        }
+
+        // Drain the pipe into the destination
+        if(direction.inFlight > 0)
+        {
+            ssize_t spliced;
+            NO_EINTR(spliced = ::splice(direction.pipe.readEnd.get(), nullptr,
+                                        direction.destFd, nullptr,
+                                        direction.inFlight,
+                                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+            if(spliced > 0)
+            {
+                direction.inFlight -= static_cast<std::size_t>(spliced);
+                direction.relayedBytes += static_cast<quint64>(spliced);
+                direction.pipeFull = false;
+                progress = true;
+                _idleTimer.start();
+            }
+            else if(spliced < 0 && errno != EAGAIN)
+            {
+                qWarning() << "Unable to write" << traceName << "data -" << errno;
+                finish();
+                return;
+            }
+        }
+    }
+
+    if(direction.sourceEof && direction.inFlight == 0)
+    {
+        // Everything from the source has been delivered; pass along the
+        // half-close
+        direction.done = true;
+        direction.pSourceNotifier->setEnabled(false);
+        direction.pDestNotifier->setEnabled(false);
+        ::shutdown(direction.destFd, SHUT_WR);
+        qInfo() << "Finished" << traceName << "direction after"
+            << direction.relayedBytes << "bytes";
+        if(_outbound.done && _inbound.done)
+            finish();
+        else
+            _closeTimer.start();
+        return;
+    }
+
+    // Wait for the source only while there's room in the pipe, and for the
+    // destination only while data remain in it
+    direction.pSourceNotifier->setEnabled(!direction.sourceEof &&
+                                          !direction.pipeFull &&
+                                          direction.inFlight < _pipeCapacity);
+    direction.pDestNotifier->setEnabled(direction.inFlight > 0);
+}
+
+void SpliceRelay::finish()
+{
+    if(!_valid)
+        return;
+    _valid = false;
+    _closeTimer.stop();
+    _idleTimer.stop();
+
+    qInfo() << "Relay finished -" << _outbound.relayedBytes << "bytes outbound,"
+        << _inbound.relayedBytes << "bytes inbound";
+    for(Direction *pDirection : {&_outbound, &_inbound})
+    {
+        pDirection->pSourceNotifier->setEnabled(false);
+        pDirection->pDestNotifier->setEnabled(false);
+    }
+    _clientSocket.close();
+    _targetSocket.close();
+    emit finished();
+}
@@ -0,0 +1,122 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#line HEADER_FILE("linux_splicerelay.h")
+
+#ifndef LINUX_SPLICERELAY_H
+#define LINUX_SPLICERELAY_H
+
+#include <kapps_core/src/posix/posix_objects.h>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <chrono>
+
+// SpliceRelay relays data between two connected TCP sockets with splice(),
+// through a pipe in each direction, so relayed data never pass through user
+// space.  SocksConnection hands its sockets to a SpliceRelay once the SOCKS
+// handshake is complete.
+//
+// At most relayPipeCapacity bytes are in flight in each direction.  When a
+// pipe is full (the destination isn't accepting data), the relay stops reading
+// from the source until the pipe drains, so backpressure reaches the sender
+// instead of buffering without bound.
+//
+// When one side closes its connection, the other side's write half is shut
+// down once all data from the closed side have been delivered, and the other
+// side then has a few seconds to close too.  finished() is emitted when both
+// directions are done, if an error or that timeout occurs, or if the
+// connection is idle for too long.
+class SpliceRelay : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("splicerelay")
+
+private:
+    // One direction of the relay - data read from sourceFd are spliced into
+    // the pipe, then from the pipe into destFd.
+    struct Direction
+    {
+        int sourceFd;
+        int destFd;
+        kapps::core::PosixPipe pipe;
+        // Notifiers for the source being readable and the destination being
+        // writable; each is enabled only when the relay is waiting for it
+        nullable_t<QSocketNotifier> pSourceNotifier;
+        nullable_t<QSocketNotifier> pDestNotifier;
+        // Bytes currently held in the pipe
+        std::size_t inFlight{0};
+        // Whether the last splice from the source failed with EAGAIN while data
+        // were in flight.  The pipe can be full before inFlight reaches its
+        // capacity (the kernel accounts for it in pages, not bytes), so the
+        // source isn't read again until some data drain to the destination.
+        bool pipeFull{false};
+        // Total bytes delivered to destFd
+        quint64 relayedBytes{0};
+        // Whether the source has reached EOF; the direction is done once the
+        // pipe drains after that
+        bool sourceEof{false};
+        bool done{false};
+    };
+
+public:
+    // Create SpliceRelay with two connected socket descriptors; SpliceRelay
+    // takes ownership of both.  If the relay can't be set up, it's invalid
+    // (see valid()) and the sockets are closed.
+    //
+    // The relay finishes if no data are relayed in either direction for
+    // idleTimeout.
+    SpliceRelay(kapps::core::PosixFd clientSocket,
+                kapps::core::PosixFd targetSocket,
+                std::chrono::milliseconds idleTimeout);
+
+public:
+    // Whether the relay was set up successfully.  If not, finished() will not
+    // be emitted.
+    bool valid() const {return _valid;}
+    // Bytes relayed from the client to the target and from the target to the
+    // client
+    quint64 outboundBytes() const {return _outbound.relayedBytes;}
+    quint64 inboundBytes() const {return _inbound.relayedBytes;}
+
+private:
+    bool initDirection(Direction &direction, const char *traceName);
+    // Move as much data as possible in one direction, then wait for the
+    // source or destination as needed
+    void pump(Direction &direction, const char *traceName);
+    // Close both sockets and emit finished()
+    void finish();
+
+signals:
+    void finished();
+
+private:
+    kapps::core::PosixFd _clientSocket, _targetSocket;
+    Direction _outbound, _inbound;
+    // Started when one direction is done; the relay finishes if the other
+    // direction isn't done soon
+    QTimer _closeTimer;
+    // Restarted whenever data are relayed; the relay finishes if it elapses
+    QTimer _idleTimer;
+    // Capacity of each pipe, at most relayPipeCapacity (the kernel may round
+    // the requested size up)
+    std::size_t _pipeCapacity;
+    bool _valid;
+};
+
+#endif
@@ -0,0 +1,574 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include <common/src/common.h>
+#line SOURCE_FILE("linux_wgstats.cpp")
+
+#include "linux_wgstats.h"
+#include "linux_nlcache.h"
+#include "linux_genlfamilies.h"
+#include "linux_libnl.h"
+#include <QMetaObject>
+#include <linux/wireguard.h>
+#include <linux/time_types.h>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace
+{
+    // Attribute validation definitions for the parts of WG_CMD_GET_DEVICE that
+    // we read.  Everything else is left as NLA_UNSPEC and skipped.
+    class WgAttrs
+    {
+    public:
+        WgAttrs() : _deviceAttrs{}, _peerAttrs{}
+        {
+            for(auto &policy : _deviceAttrs)
+                policy.type = NLA_UNSPEC;
+            for(auto &policy : _peerAttrs)
+                policy.type = NLA_UNSPEC;
+
+            _deviceAttrs[WGDEVICE_A_PEERS].type = NLA_NESTED;
+
+            _peerAttrs[WGPEER_A_PUBLIC_KEY].minlen = WG_KEY_LEN;
+            _peerAttrs[WGPEER_A_LAST_HANDSHAKE_TIME].minlen = sizeof(__kernel_timespec);
+            _peerAttrs[WGPEER_A_RX_BYTES].type = NLA_U64;
+            _peerAttrs[WGPEER_A_TX_BYTES].type = NLA_U64;
+        }
+
+    public:
+        // Like NlctrlAttrs, these are non-const only because libnl wants
+        // non-const pointers to the nla_policy array
+        constexpr auto &deviceAttrs() {return _deviceAttrs;}
+        constexpr auto &peerAttrs() {return _peerAttrs;}
+
+    private:
+        std::array<nla_policy, WGDEVICE_A_MAX+1> _deviceAttrs;
+        std::array<nla_policy, WGPEER_A_MAX+1> _peerAttrs;
+    };
+
+    WgAttrs wgAttrs;
+
+    static_assert(std::tuple_size<decltype(LinuxWgStats::PeerStats::_publicKey)>::value == WG_KEY_LEN,
+                  "PeerStats key must match WireGuard key length");
+
+    // Messages written to the worker's control socket
+    enum CtrlMsg : unsigned char
+    {
+        CtrlRequest,
+        CtrlAbandon,
+    };
+
+    // Netlink socket for the "wireguard" generic family.  Requests device dumps
+    // and collects the compact peer stats from the reply.
+    class WgStatsSock : public LinuxNlNtfSock
+    {
+    public:
+        explicit WgStatsSock(int wgProtocol);
+
+    public:
+        int wgProtocol() const {return _wgProtocol;}
+        // Whether a dump has been requested and hasn't completed yet
+        bool dumpRequested() const {return _dump.requested();}
+        // Whether a requested dump has completed; the results can be taken with
+        // takePeers()
+        bool dumpComplete() const {return _dump.complete();}
+
+        // Request a dump of the given interface.  A dump can't already be
+        // requested.
+        void requestDump(const QByteArray &interfaceName);
+        // Abandon the current dump request - used when the kernel rejects the
+        // request, or the main thread abandons it.
+        void abandonDump() {_dump.abandon();}
+        // Take the peers from a completed dump, and reset for the next request.
+        std::vector<LinuxWgStats::PeerStats> takePeers() {return _dump.takePeers();}
+
+    private:
+        virtual int handleMsg(libnl::nl_msg *pMsg) override;
+        virtual int handleFinish(libnl::nl_msg *pMsg) override;
+
+    private:
+        int _wgProtocol;
+        LinuxWgStats::DumpTracker _dump;
+    };
+
+    WgStatsSock::WgStatsSock(int wgProtocol)
+        : LinuxNlNtfSock{NETLINK_GENERIC}, _wgProtocol{wgProtocol}
+    {
+    }
+
+    void WgStatsSock::requestDump(const QByteArray &interfaceName)
+    {
+        Q_ASSERT(!_dump.requested());
+
+        // WG_CMD_GET_DEVICE only supports dumps, the device is selected with
+        // WGDEVICE_A_IFNAME.  There's no way to ask for a subset of the
+        // attributes, so the peers are filtered while parsing.
+        NlUniquePtr<libnl::nl_msg> pDumpMsg{libnl::nlmsg_alloc()};
+        LibnlError::checkPtr(pDumpMsg, HERE, "Could not allocate WG_CMD_GET_DEVICE message");
+        libnl::genlmsg_put(pDumpMsg.get(), NL_AUTO_PORT, NL_AUTO_SEQ, _wgProtocol,
+                           0, NLM_F_DUMP, WG_CMD_GET_DEVICE, WG_GENL_VERSION);
+        auto putErr = libnl::nla_put_string(pDumpMsg.get(), WGDEVICE_A_IFNAME,
+                                            interfaceName.data());
+        LibnlError::checkRet(putErr, HERE, "Could not add WGDEVICE_A_IFNAME");
+        sendAuto(pDumpMsg.get());
+
+        // sendAuto() assigned the sequence number; the replies echo it
+        _dump.begin(libnl::nlmsg_hdr(pDumpMsg.get())->nlmsg_seq);
+    }
+
+    int WgStatsSock::handleMsg(libnl::nl_msg *pMsg)
+    {
+        Q_ASSERT(pMsg); // Guarantee by libnl
+
+        libnl::nlmsghdr *pHeader = libnl::nlmsg_hdr(pMsg);
+        libnl::genlmsghdr *pGenHeader = libnl::genlmsg_hdr(pHeader);
+
+        LibnlError::verify(pHeader->nlmsg_type == _wgProtocol, HERE, "Unexpected netlink message type");
+        LibnlError::verify(pGenHeader->version == WG_GENL_VERSION, HERE, "Unsupported wireguard genl version");
+
+        // Ignore anything that isn't part of a requested dump (DumpTracker
+        // ignores replies to an abandoned dump)
+        if(pGenHeader->cmd != WG_CMD_GET_DEVICE)
+            return NL_OK;
+
+        _dump.handleMessage(*pHeader);
+        return NL_OK;
+    }
+
+    int WgStatsSock::handleFinish(libnl::nl_msg *pMsg)
+    {
+        Q_ASSERT(pMsg); // Guarantee by libnl
+
+        _dump.handleDone(*libnl::nlmsg_hdr(pMsg));
+        return NL_OK;
+    }
+}
+
+void LinuxWgStats::DumpParser::parseMessage(libnl::nlmsghdr &header)
+{
+    std::array<libnl::nlattr*, wgAttrs.deviceAttrs().size()> attrs;
+    auto parseErr = libnl::nlmsg_parse(&header, GENL_HDRLEN, attrs.data(),
+                                       attrs.size()-1,
+                                       wgAttrs.deviceAttrs().data());
+    LibnlError::checkRet(parseErr, HERE, "Could not parse WG_CMD_GET_DEVICE message");
+
+    if(attrs[WGDEVICE_A_PEERS])
+    {
+        for(libnl::nlattr &peerAttr : NestedNlattrView{*attrs[WGDEVICE_A_PEERS]})
+            parsePeer(peerAttr);
+    }
+}
+
+void LinuxWgStats::DumpParser::parsePeer(libnl::nlattr &peerAttr)
+{
+    std::array<libnl::nlattr*, wgAttrs.peerAttrs().size()> peerAttrs;
+    auto parseErr = libnl::nla_parse_nested(peerAttrs.data(), peerAttrs.size()-1,
+                                            &peerAttr, wgAttrs.peerAttrs().data());
+    LibnlError::checkRet(parseErr, HERE, "Could not parse WireGuard peer");
+    if(!peerAttrs[WGPEER_A_PUBLIC_KEY])
+        throw LibnlError{HERE, "WireGuard peer did not have a public key"};
+
+    LinuxWgStats::PeerStats peer{};
+    std::memcpy(peer._publicKey.data(), libnl::nla_data(peerAttrs[WGPEER_A_PUBLIC_KEY]),
+                peer._publicKey.size());
+
+    // If a peer's allowed IPs don't fit in one message, the kernel repeats
+    // the peer in the next message with just the public key and the
+    // remaining allowed IPs.  Those continuations don't have anything we
+    // need.
+    if(!_peers.empty() && _peers.back()._publicKey == peer._publicKey)
+        return;
+
+    if(peerAttrs[WGPEER_A_RX_BYTES])
+        peer._rxBytes = libnl::nla_get_u64(peerAttrs[WGPEER_A_RX_BYTES]);
+    if(peerAttrs[WGPEER_A_TX_BYTES])
+        peer._txBytes = libnl::nla_get_u64(peerAttrs[WGPEER_A_TX_BYTES]);
+    if(peerAttrs[WGPEER_A_LAST_HANDSHAKE_TIME])
+    {
+        __kernel_timespec handshake{};
+        std::memcpy(&handshake, libnl::nla_data(peerAttrs[WGPEER_A_LAST_HANDSHAKE_TIME]),
+                    sizeof(handshake));
+        peer._lastHandshakeSec = handshake.tv_sec;
+        peer._lastHandshakeNsec = handshake.tv_nsec;
+    }
+
+    _peers.push_back(peer);
+}
+
+void LinuxWgStats::DumpTracker::begin(std::uint32_t seq)
+{
+    Q_ASSERT(!_requested);
+    _requested = true;
+    _complete = false;
+    _seq = seq;
+    _parser.clear();
+}
+
+void LinuxWgStats::DumpTracker::abandon()
+{
+    _requested = false;
+    _complete = false;
+    _parser.clear();
+}
+
+bool LinuxWgStats::DumpTracker::isCurrent(const libnl::nlmsghdr &header) const
+{
+    return _requested && !_complete && header.nlmsg_seq == _seq;
+}
+
+void LinuxWgStats::DumpTracker::handleMessage(libnl::nlmsghdr &header)
+{
+    if(isCurrent(header))
+        _parser.parseMessage(header);
+}
+
+void LinuxWgStats::DumpTracker::handleDone(const libnl::nlmsghdr &header)
+{
+    if(isCurrent(header))
+        _complete = true;
+}
+
+auto LinuxWgStats::DumpTracker::takePeers() -> std::vector<PeerStats>
+{
+    Q_ASSERT(_complete);
+    _requested = false;
+    _complete = false;
+    return _parser.takePeers();
+}
+
+class LinuxWgStats::Worker
+{
+private:
+    enum PollIdx : std::size_t
+    {
+        CtrlSocket,
+        GenlFamiliesSocket,
+        WgSocket,
+        Count
+    };
+
+public:
+    // As with LinuxNl::Worker, the parent reference is only used to queue
+    // results back to the main thread.
+    //
+    // Worker takes ownership of the control socket.
+    Worker(LinuxWgStats &parent, QByteArray interfaceName,
+           kapps::core::PosixFd ctrlSocket);
+
+private:
+    // Queue a result back to the main thread.
+    void postResult(Result result, std::vector<PeerStats> peers);
+
+    // Receive requests from the main thread.  Returns false if the control
+    // socket was closed (the worker should terminate).
+    bool receiveCtrl(short &revents);
+    // Receive generic family changes; creates or destroys the wireguard
+    // socket if the family appears, disappears, or changes.
+    void receiveGenlFamilies(short &revents);
+    // Receive results from the wireguard socket
+    void receiveWg(short &revents);
+    // Send a pending request if possible
+    void sendPendingRequest();
+
+public:
+    // Wait for events to be signaled, then receive them.
+    // If the control socket is closed, this returns false to terminate the
+    // event loop.  Otherwise, returns true to continue the event loop.
+    bool receive();
+
+private:
+    LinuxWgStats &_parent;
+    QByteArray _interfaceName;
+    std::array<pollfd, PollIdx::Count> _pollCfgs;
+    kapps::core::PosixFd _ctrlSocket;
+    // Cache of generic netlink families - used to find the wireguard family
+    // (the module might not be loaded until the interface is created)
+    LinuxGenlFamilies _genlFamilies;
+    // Socket for the wireguard family - nullptr when the family isn't present
+    std::unique_ptr<WgStatsSock> _pWgSock;
+    // Whether a request was received from the main thread that hasn't been
+    // sent to the kernel yet.
+    bool _requestPending;
+};
+
+LinuxWgStats::Worker::Worker(LinuxWgStats &parent, QByteArray interfaceName,
+                             kapps::core::PosixFd ctrlSocket)
+    : _parent{parent}, _interfaceName{std::move(interfaceName)}, _pollCfgs{},
+      _ctrlSocket{std::move(ctrlSocket)}, _requestPending{false}
+{
+    _pollCfgs[PollIdx::CtrlSocket].fd = _ctrlSocket.get();
+    _pollCfgs[PollIdx::GenlFamiliesSocket].fd = _genlFamilies.getFd();
+    _pollCfgs[PollIdx::WgSocket].fd = kapps::core::PosixFd::Invalid;   // Set when the family is found
+
+    for(auto &cfg : _pollCfgs)
+    {
+        cfg.events = POLLIN;
+        cfg.revents = 0;
+    }
+}
+
+void LinuxWgStats::Worker::postResult(Result result, std::vector<PeerStats> peers)
+{
+    // Capture the parent reference in the lambda, not this
+    auto &localParent = _parent;
+    QMetaObject::invokeMethod(&localParent,
+        [&localParent, result, peers = std::move(peers)]()
+        {
+            localParent.statsReceived(result, peers);
+        }, Qt::QueuedConnection);
+}
+
+bool LinuxWgStats::Worker::receiveCtrl(short &revents)
+{
+    if(!revents)
+        return true;
+    revents = 0;
+
+    // Drain all messages; any number of requests are satisfied by one dump.
+    unsigned char msgs[16];
+    ssize_t readResult{};
+    NO_EINTR(readResult = ::read(_ctrlSocket.get(), msgs, sizeof(msgs)));
+    if(readResult <= 0)
+    {
+        qInfo() << "WireGuard stats worker exiting:" << readResult << errno;
+        return false;
+    }
+
+    for(ssize_t i=0; i<readResult; ++i)
+    {
+        if(msgs[i] == CtrlAbandon)
+        {
+            // The main thread gave up on the request in flight; requests
+            // received before this were part of it.  If the kernel replies
+            // later, DumpTracker ignores the replies.
+            _requestPending = false;
+            if(_pWgSock && _pWgSock->dumpRequested())
+            {
+                qWarning() << "Abandoning WireGuard stats dump for"
+                    << _interfaceName;
+                _pWgSock->abandonDump();
+            }
+        }
+        else
+            _requestPending = true;
+    }
+    return true;
+}
+
+void LinuxWgStats::Worker::receiveGenlFamilies(short &revents)
+{
+    if(!revents)
+        return;
+
+    _genlFamilies.receive(revents);
+    revents = 0;
+
+    const auto *pWgFamily = _genlFamilies.getFamily(QStringLiteral(WG_GENL_NAME));
+
+    // If the family is gone or its ID changed, destroy the socket.  If a dump
+    // was in flight, it won't complete.
+    if(_pWgSock && (!pWgFamily || pWgFamily->_protocol != _pWgSock->wgProtocol()))
+    {
+        if(_pWgSock->dumpRequested())
+        {
+            qWarning() << "WireGuard family was removed during stats request";
+            postResult(Result::DeviceLost, {});
+        }
+        _pWgSock.reset();
+        _pollCfgs[PollIdx::WgSocket].fd = kapps::core::PosixFd::Invalid;
+    }
+
+    if(!_pWgSock && pWgFamily)
+    {
+        qInfo() << "Creating WireGuard stats socket (protocol"
+            << pWgFamily->_protocol << ")";
+        _pWgSock.reset(new WgStatsSock{pWgFamily->_protocol});
+        _pollCfgs[PollIdx::WgSocket].fd = _pWgSock->getFd();
+    }
+}
+
+void LinuxWgStats::Worker::receiveWg(short &revents)
+{
+    if(!revents)
+        return;
+
+    if(_pWgSock)
+    {
+        try
+        {
+            _pWgSock->receive(revents);
+        }
+        catch(const LibnlError &ex)
+        {
+            // The kernel rejects the dump if the interface doesn't exist (or
+            // isn't a WireGuard interface).  Anything else is unexpected and
+            // terminates the worker.
+            if(ex.libnlCode() != NLE_NODEV && ex.libnlCode() != NLE_OPNOTSUPP)
+                throw;
+            qWarning() << "Can't find WireGuard device" << _interfaceName
+                << "for stats -" << ex;
+            // If the dump was already abandoned, nothing is waiting for this
+            if(_pWgSock->dumpRequested())
+            {
+                _pWgSock->abandonDump();
+                postResult(Result::DeviceLost, {});
+            }
+        }
+
+        if(_pWgSock->dumpComplete())
+            postResult(Result::Success, _pWgSock->takePeers());
+    }
+    revents = 0;
+}
+
+void LinuxWgStats::Worker::sendPendingRequest()
+{
+    if(!_requestPending)
+        return;
+
+    // Wait for the initial family dump; we don't know whether the wireguard
+    // family exists until then.
+    if(!_genlFamilies.ready())
+        return;
+
+    _requestPending = false;
+
+    if(!_pWgSock)
+    {
+        qWarning() << "Can't get stats for" << _interfaceName
+            << "- wireguard family does not exist";
+        postResult(Result::DeviceLost, {});
+        return;
+    }
+
+    // If a dump is already in flight, its result satisfies this request too.
+    if(_pWgSock->dumpRequested())
+        return;
+
+    _pWgSock->requestDump(_interfaceName);
+}
+
+bool LinuxWgStats::Worker::receive()
+{
+    errno = 0;
+    if(::poll(_pollCfgs.data(), _pollCfgs.size(), -1) >= 0)
+    {
+        // Process family changes and results before new requests.  If the
+        // wireguard module was just loaded when the interface was created, the
+        // family notification was queued before the request was sent.
+        receiveGenlFamilies(_pollCfgs[PollIdx::GenlFamiliesSocket].revents);
+        receiveWg(_pollCfgs[PollIdx::WgSocket].revents);
+        if(!receiveCtrl(_pollCfgs[PollIdx::CtrlSocket].revents))
+            return false;
+        sendPendingRequest();
+    }
+    else if(errno != EINTR)
+    {
+        qError() << "Terminating WireGuard stats worker due to poll error:" << errno;
+        throw std::runtime_error{"WireGuard stats worker poll error"};
+    }
+
+    return true;
+}
+
+void LinuxWgStats::runOnWorkerThread(LinuxWgStats *pThis, QByteArray interfaceName,
+                                     kapps::core::PosixFd ctrlSocket)
+{
+    // As in LinuxNl, only use pThis to queue results back to the main thread.
+    try
+    {
+        Worker worker{*pThis, std::move(interfaceName), std::move(ctrlSocket)};
+        while(worker.receive());
+        // Normal termination
+        return;
+    }
+    catch(const LibnlError &ex)
+    {
+        qWarning() << "WireGuard stats thread terminating -" << ex;
+    }
+    catch(const std::exception &ex)
+    {
+        qWarning() << "WireGuard stats thread terminating -" << ex.what();
+    }
+
+    // Tell the main thread that stats are no longer available, including any
+    // request that might have been in flight.
+    QMetaObject::invokeMethod(pThis,
+        [pThis]()
+        {
+            pThis->statsReceived(Result::Unavailable, {});
+        }, Qt::QueuedConnection);
+}
+
+LinuxWgStats::LinuxWgStats(const QByteArray &interfaceName)
+{
+    int ctrlSockets[2]{kapps::core::PosixFd::Invalid, kapps::core::PosixFd::Invalid};
+    auto spResult = ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ctrlSockets);
+    kapps::core::PosixFd workerSocket{ctrlSockets[0]};
+    _workerCtrlSocket = kapps::core::PosixFd{ctrlSockets[1]};
+    if(spResult || !workerSocket || !_workerCtrlSocket)
+    {
+        qError() << "Couldn't create WireGuard stats control socket:"
+            << spResult << errno;
+        _workerCtrlSocket = {};
+        return;
+    }
+
+    _workerThread = std::thread{&LinuxWgStats::runOnWorkerThread, this,
+                                interfaceName, std::move(workerSocket)};
+}
+
+LinuxWgStats::~LinuxWgStats()
+{
+    // Closing the control socket terminates the worker
+    _workerCtrlSocket = {};
+    if(_workerThread.joinable())
+        _workerThread.join();
+}
+
+void LinuxWgStats::request()
+{
+    unsigned char req = CtrlRequest;
+    ssize_t sent{-1};
+    // MSG_NOSIGNAL - the worker may have terminated and closed its end
+    if(_workerCtrlSocket)
+        NO_EINTR(sent = ::send(_workerCtrlSocket.get(), &req, sizeof(req), MSG_NOSIGNAL));
+    if(sent != sizeof(req))
+    {
+        qWarning() << "WireGuard stats worker is not running";
+        QMetaObject::invokeMethod(this,
+            [this]()
+            {
+                statsReceived(Result::Unavailable, {});
+            }, Qt::QueuedConnection);
+    }
+}
+
+void LinuxWgStats::abandonRequest()
+{
+    unsigned char msg = CtrlAbandon;
+    ssize_t sent{-1};
+    if(_workerCtrlSocket)
+        NO_EINTR(sent = ::send(_workerCtrlSocket.get(), &msg, sizeof(msg), MSG_NOSIGNAL));
+    // If the worker isn't running, there's nothing to abandon
+    if(sent != sizeof(msg))
+        qWarning() << "WireGuard stats worker is not running";
+}
@@ -0,0 +1,166 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#ifndef LINUX_WGSTATS_H
+#define LINUX_WGSTATS_H
+
+#include <common/src/common.h>
+#include <kapps_core/src/posix/posix_objects.h>
+#include <array>
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct nlattr;
+struct nlmsghdr;
+
+// LinuxWgStats polls statistics for a WireGuard kernel interface using the
+// "wireguard" generic netlink family.
+//
+// Like LinuxNl, the netlink sockets are serviced on a worker thread, so the
+// main thread never blocks on netlink.  Only the peer attributes needed for
+// connection statistics are retained - the public key, transfer counters, and
+// last handshake time - everything else in the kernel's reply (allowed IPs,
+// endpoints, keys, etc.) is skipped.
+class LinuxWgStats : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Compact statistics for one peer
+    struct PeerStats
+    {
+        std::array<std::uint8_t, 32> _publicKey;
+        std::uint64_t _rxBytes;
+        std::uint64_t _txBytes;
+        // Last handshake time (CLOCK_REALTIME); 0 if no handshake has occurred
+        std::int64_t _lastHandshakeSec;
+        std::int64_t _lastHandshakeNsec;
+    };
+
+    enum class Result
+    {
+        // Stats were read successfully
+        Success,
+        // The interface does not exist (or the wireguard family is not
+        // present)
+        DeviceLost,
+        // The stats worker has failed and won't be able to provide any more
+        // stats.  Callers should fall back to another method.
+        Unavailable,
+    };
+    Q_ENUM(Result);
+
+    // DumpParser collects the peer stats from the WG_CMD_GET_DEVICE messages
+    // of one dump.  It's separate from the netlink socket so the parsing can
+    // be tested with canned messages.  libnl must be loaded.
+    class DumpParser
+    {
+    public:
+        // Parse the peers from one WG_CMD_GET_DEVICE message (the generic
+        // netlink header follows the netlink header).  Throws LibnlError if
+        // the message is malformed.
+        void parseMessage(nlmsghdr &header);
+        // Take the peers parsed so far, and reset for the next dump
+        std::vector<PeerStats> takePeers() {return std::exchange(_peers, {});}
+        void clear() {_peers.clear();}
+
+    private:
+        void parsePeer(nlattr &peerAttr);
+
+    private:
+        std::vector<PeerStats> _peers;
+    };
+
+    // DumpTracker follows the dump requested from the kernel and collects its
+    // peers with DumpParser.  Replies are matched to the dump by sequence
+    // number, so a dump that was abandoned doesn't affect the next one if its
+    // replies arrive late.
+    class DumpTracker
+    {
+    public:
+        // Whether a dump has been requested and hasn't been taken or abandoned
+        bool requested() const {return _requested;}
+        // Whether the requested dump has completed; the results can be taken
+        // with takePeers()
+        bool complete() const {return _complete;}
+        // Begin a dump that was requested with this sequence number.  A dump
+        // can't already be requested.
+        void begin(std::uint32_t seq);
+        // Abandon the current dump, if any
+        void abandon();
+        // Handle a WG_CMD_GET_DEVICE message; ignored unless it's part of the
+        // current dump.  Throws LibnlError if the message is malformed.
+        void handleMessage(nlmsghdr &header);
+        // Handle the NLMSG_DONE message ending a dump
+        void handleDone(const nlmsghdr &header);
+        // Take the peers from a completed dump, and reset for the next request
+        std::vector<PeerStats> takePeers();
+
+    private:
+        bool isCurrent(const nlmsghdr &header) const;
+
+    private:
+        bool _requested{false};
+        bool _complete{false};
+        std::uint32_t _seq{0};
+        DumpParser _parser;
+    };
+
+private:
+    // An object of this class is created on the worker thread to operate the
+    // netlink sockets.
+    class Worker;
+
+    // Worker thread procedure; operates the netlink sockets and queues calls to
+    // statsReceived() with results.  Catches exceptions and gracefully
+    // terminates the thread.
+    static void runOnWorkerThread(LinuxWgStats *pThis, QByteArray interfaceName,
+                                  kapps::core::PosixFd ctrlSocket);
+
+public:
+    // Start the worker thread for the given interface name.  libnl must
+    // already have been loaded (libnl::load()).
+    explicit LinuxWgStats(const QByteArray &interfaceName);
+    ~LinuxWgStats();
+
+public:
+    // Request the current stats.  statsReceived() is emitted on the main
+    // thread with the result.  Requests made while a request is already in
+    // flight are satisfied by that request's result.
+    void request();
+    // Abandon the request in flight, if any - used when the caller gives up
+    // waiting for it.  The next request() starts a new dump instead of
+    // waiting for the abandoned one.
+    void abandonRequest();
+
+signals:
+    // Emitted with the result of a request().  'peers' is empty unless result
+    // is Success.
+    void statsReceived(Result result, const std::vector<PeerStats> &peers);
+
+private:
+    std::thread _workerThread;
+    // Control socket used to signal the worker thread (the worker owns the
+    // other end of the socket pair).  A byte is written to request stats or to
+    // abandon a request; closing it terminates the worker thread.  This is
+    // invalid if the worker couldn't be started.
+    kapps::core::PosixFd _workerCtrlSocket;
+};
+
+#endif
@@ -20,10 +20,17 @@
 #line SOURCE_FILE("wireguardkernelbackend.cpp")
 
 #include "wireguardkernelbackend.h"
+#include "linux_libnl.h"
 #include <cstring>
 #include "brand.h"
 #include <common/src/exec.h>
 
+namespace
+{
+    // Time allowed for the stats worker to respond to a request
+    const std::chrono::seconds statusTimeout{5};
+}
+
 void WireguardKernelBackend::cleanup()
 {
     // - This is called before attempting to connect too in case there were
@@ -42,6 +49,33 @@ void WireguardKernelBackend::cleanup()
 WireguardKernelBackend::WireguardKernelBackend()
     : _created{false}
 {
+    _statusTimeout.setSingleShot(true);
+    _statusTimeout.setInterval(msec(statusTimeout));
+    connect(&_statusTimeout, &QTimer::timeout, this, [this]()
+    {
+        Async<WgDevPtr> pTask;
+        pTask.swap(_pStatusTask);
+        if(!pTask)
+            return;
+        qWarning() << "WireGuard stats worker did not respond within"
+            << traceMsec(statusTimeout);
+        // Don't let the next request join the stalled dump
+        if(_pStats)
+            _pStats->abandonRequest();
+        pTask->reject(Error{HERE, Error::Code::TaskTimedOut});
+    });
+
+    if(libnl::load())
+    {
+        _pStats.reset(new LinuxWgStats{QByteArray{interfaceName.data(),
+                                                  interfaceName.size()}});
+        connect(_pStats.get(), &LinuxWgStats::statsReceived, this,
+                &WireguardKernelBackend::onStatsReceived);
+    }
+    else
+    {
+        qWarning() << "Can't poll WireGuard stats asynchronously, failed to load libnl";
+    }
 }
 
 WireguardKernelBackend::~WireguardKernelBackend()
@@ -87,7 +121,7 @@ auto WireguardKernelBackend::createInterface(wg_device &wgDev,
     return Async<std::shared_ptr<NetworkAdapter>>::resolve(std::make_shared<NetworkAdapter>(interfaceName));
 }
 
-auto WireguardKernelBackend::getStatus() -> Async<WgDevPtr>
+auto WireguardKernelBackend::getStatusSync() -> Async<WgDevPtr>
 {
     wg_device *pDevRaw{nullptr};
     int err = ::wg_get_device(&pDevRaw, interfaceName.data());
@@ -105,6 +139,64 @@ auto WireguardKernelBackend::getStatus() -> Async<WgDevPtr>
     return Async<WgDevPtr>::resolve(pDev);
 }
 
+auto WireguardKernelBackend::getStatus() -> Async<WgDevPtr>
+{
+    if(!_pStats)
+        return getStatusSync();
+
+    if(!_pStatusTask)
+    {
+        _pStatusTask = Async<WgDevPtr>::create();
+        _statusTimeout.start();
+        _pStats->request();
+    }
+    return _pStatusTask;
+}
+
+void WireguardKernelBackend::onStatsReceived(LinuxWgStats::Result result,
+                                             const std::vector<LinuxWgStats::PeerStats> &peers)
+{
+    Async<WgDevPtr> pTask;
+    pTask.swap(_pStatusTask);
+    if(!pTask)
+        return; // Nothing was waiting for this result (or it timed out)
+    _statusTimeout.stop();
+
+    switch(result)
+    {
+        case LinuxWgStats::Result::Success:
+        {
+            // Build a device with just the stats that were polled
+            auto pDev = std::make_shared<WgDevStatus>();
+            std::strncpy(pDev->device().name, interfaceName.data(),
+                         sizeof(pDev->device().name)-1);
+            for(const auto &peerStats : peers)
+            {
+                wg_peer peer{};
+                peer.flags = WGPEER_HAS_PUBLIC_KEY;
+                std::memcpy(peer.public_key, peerStats._publicKey.data(),
+                            sizeof(peer.public_key));
+                peer.last_handshake_time.tv_sec = peerStats._lastHandshakeSec;
+                peer.last_handshake_time.tv_nsec = peerStats._lastHandshakeNsec;
+                peer.rx_bytes = peerStats._rxBytes;
+                peer.tx_bytes = peerStats._txBytes;
+                pDev->addPeer(peer);
+            }
+            pTask->resolve(WgDevPtr{pDev, &pDev->device()});
+            break;
+        }
+        case LinuxWgStats::Result::DeviceLost:
+            pTask->reject(Error{HERE, Error::Code::WireguardDeviceLost});
+            break;
+        case LinuxWgStats::Result::Unavailable:
+            qWarning() << "WireGuard stats worker is unavailable, polling synchronously";
+            // We're in a signal from the stats worker, destroy it later
+            _pStats.release()->deleteLater();
+            pTask->resolve(getStatusSync());
+            break;
+    }
+}
+
 Async<void> WireguardKernelBackend::shutdown()
 {
     // There's no asynchronous shutdown to do for the kernel backend; the
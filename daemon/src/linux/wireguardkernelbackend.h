@@ -24,10 +24,15 @@
 
 #include "../wireguardbackend.h"
 #include "../vpn.h"
+#include "linux_wgstats.h"
 
 // WireguardKernelBackend is a backend Wireguard implementation using the Linux
 // kernel module.  It uses embeddable-wg-library to configure the interface
 // using Netlink.
+//
+// Stats are polled on a worker thread with LinuxWgStats.  If libnl isn't
+// available (or the worker fails), this falls back to embeddable-wg-library,
+// which blocks the main thread while polling.
 class WireguardKernelBackend : public WireguardBackend
 {
     Q_OBJECT
@@ -49,10 +54,23 @@ public:
     virtual Async<WgDevPtr> getStatus() override;
     virtual Async<void> shutdown() override;
 
+private:
+    // Get the status synchronously using embeddable-wg-library
+    Async<WgDevPtr> getStatusSync();
+    void onStatsReceived(LinuxWgStats::Result result,
+                         const std::vector<LinuxWgStats::PeerStats> &peers);
+
 private:
     // Whether we have created an interface - just indicates whether we should
     // do cleanup at destruction
     bool _created;
+    // Stats worker - nullptr if it's not available
+    std::unique_ptr<LinuxWgStats> _pStats;
+    // Pending status request from getStatus() - requests made while one is
+    // pending share the same result
+    Async<WgDevPtr> _pStatusTask;
+    // Rejects _pStatusTask if the stats worker doesn't respond
+    QTimer _statusTimeout;
 };
 
 #endif
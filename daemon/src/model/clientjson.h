@@ -101,6 +101,8 @@ struct serializer<Location>
             {"geoLocated", l.geoLocated()},
             {"autoSafe", l.autoSafe()},
             {"latency", l.latency()},
+            {"jitter", l.latencyQuality().jitter},
+            {"loss", l.latencyQuality().loss},
             {"dedicatedIp", l.dedicatedIp()},
             {"offline", l.offline()},
             {"hasShadowsocks", l.hasShadowsocks()}
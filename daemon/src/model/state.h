@@ -324,6 +324,12 @@ public:
     //
     // When not connected, this is an empty array.
     JsonProperty(std::deque<IntervalBandwidth>, intervalMeasurements);
+    // The newest bandwidth sample while connected to the VPN (empty when not
+    // connected).  Clients that keep their own history, like dashboards,
+    // append this as it changes and use RPC_getBandwidthHistory() to fetch
+    // older entries or fill gaps (indicated by the sequence number) - this
+    // avoids sending the whole history with every sample.
+    JsonProperty(std::vector<BandwidthSample>, latestBandwidthSamples);
     // Timestamp when the VPN connection was established - ms since system
     // startup, using a monotonic clock.  0 if we are not connected.
     //
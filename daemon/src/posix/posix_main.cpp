@@ -143,6 +143,10 @@ int main(int argc, char** argv)
         return 0;
     }
     Logger logSingleton{Path::DaemonLogFile};
+    // Write the daemon log asynchronously, so threads that log don't block on
+    // file writes
+    logSingleton.setAsyncWrites(true);
+    logSingleton.setCompressedRotation(true);
 
     setUidAndGid();
 
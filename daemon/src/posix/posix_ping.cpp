@@ -28,25 +28,103 @@
 #include <unistd.h>
 #include <netinet/ip.h>
 #include <fcntl.h>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+    // Packets are read into buffers of this size - ICMP echo replies are small
+    enum : std::size_t { ReceiveBufferSize = 2048 };
+#if defined(Q_OS_LINUX)
+    // Number of packets read at once with recvmmsg()
+    enum : unsigned { ReceiveBatchSize = 16 };
+#endif
+    // Echoes that haven't received a reply after this long are discarded, so
+    // they can't be matched by a later reply once the sequence numbers wrap
+    // around.  This is at least as long as any caller waits for a reply
+    // (LatencyTracker waits 10 seconds).
+    const std::chrono::seconds echoExpiration{10};
+    // Expired echoes are pruned at most this often
+    const std::chrono::seconds echoPruneInterval{1};
+
+    std::chrono::nanoseconds timespecDiff(const timespec &begin, const timespec &end)
+    {
+        return std::chrono::seconds{end.tv_sec - begin.tv_sec} +
+            std::chrono::nanoseconds{end.tv_nsec - begin.tv_nsec};
+    }
+}
 
 PosixPing::PosixPing()
-    : _identifier{static_cast<quint16>(QRandomGenerator::global()->bounded(std::numeric_limits<quint16>::max()))},
+    : _socketType{SocketType::Raw},
+      _identifier{static_cast<quint16>(QRandomGenerator::global()->bounded(std::numeric_limits<quint16>::max()))},
       _nextSequence{0}
 {
-    // Unit tests don't run as root, so we can't actually do the ICMP pings.  We
-    // still want to test the bulk of LatencyTracker, so mimic the pings just by
-    // triggering phony measurements in unit tests.
+#if defined(Q_OS_LINUX)
+    // Prefer an unprivileged ICMP datagram socket ("ping socket").  The kernel
+    // only permits these for groups in net.ipv4.ping_group_range, which is
+    // checked when the socket is opened.  The kernel picks the echo
+    // identifier and only delivers replies matching it, so we aren't woken up
+    // for unrelated ICMP traffic.
+    _icmpSocket = kapps::core::PosixFd{::socket(PF_INET, SOCK_DGRAM, IPPROTO_ICMP)};
+    if(_icmpSocket)
+    {
+        // Bind now so the kernel assigns the identifier; it overwrites the
+        // identifier in each request with this value.
+        sockaddr_in local{};
+        local.sin_family = AF_INET;
+        socklen_t localLen = sizeof(local);
+        if(::bind(_icmpSocket.get(), reinterpret_cast<sockaddr*>(&local), sizeof(local)) < 0 ||
+           ::getsockname(_icmpSocket.get(), reinterpret_cast<sockaddr*>(&local), &localLen) < 0)
+        {
+            qWarning() << "Failed to bind ICMP datagram socket:" << errno;
+            _icmpSocket = {};
+        }
+        else
+        {
+            _socketType = SocketType::Datagram;
+            _identifier = ntohs(local.sin_port);
+            qInfo() << "Using ICMP datagram socket with identifier" << _identifier;
+        }
+    }
+    else
+    {
+        qInfo() << "Can't open ICMP datagram socket, using raw socket:" << errno;
+    }
+#endif
+
+    // Unit tests don't run as root, so we can't open a raw socket.  If ping
+    // sockets aren't permitted either, the pings are mocked by triggering
+    // phony measurements - we still want to test the bulk of LatencyTracker.
 #ifndef UNIT_TEST
-    _icmpSocket = kapps::core::PosixFd{::socket(PF_INET, SOCK_RAW, IPPROTO_ICMP)};
     if(!_icmpSocket)
     {
-        qWarning() << "Failed to open ICMP socket:" << errno;
+        _icmpSocket = kapps::core::PosixFd{::socket(PF_INET, SOCK_RAW, IPPROTO_ICMP)};
+        if(!_icmpSocket)
+        {
+            qWarning() << "Failed to open ICMP socket:" << errno;
+            return;
+        }
+
+        int val = 1;
+        if (setsockopt(_icmpSocket.get(), IPPROTO_IP,
+                       IP_HDRINCL, &val, sizeof(val)) < 0) {
+          qWarning() << "Failed to set IP_HDRINCL flag on ICMP socket";
+        }
     }
+#endif
+    if(!_icmpSocket)
+        return;
 
+    // Have the kernel timestamp received packets.  If this fails, replies are
+    // timestamped when they're read instead.
     int val = 1;
-    if (setsockopt(_icmpSocket.get(), IPPROTO_IP,
-                   IP_HDRINCL, &val, sizeof(val)) < 0) {
-      qWarning() << "Failed to set IP_HDRINCL flag on ICMP socket";
+#if defined(Q_OS_LINUX)
+    if(setsockopt(_icmpSocket.get(), SOL_SOCKET, SO_TIMESTAMPNS, &val, sizeof(val)) < 0)
+#else
+    if(setsockopt(_icmpSocket.get(), SOL_SOCKET, SO_TIMESTAMP, &val, sizeof(val)) < 0)
+#endif
+    {
+        qWarning() << "Failed to enable receive timestamps on ICMP socket:" << errno;
     }
 
     // apply NONBLOCK flag
@@ -56,7 +134,6 @@ PosixPing::PosixPing()
     _pReadNotifier.emplace(_icmpSocket.get(), QSocketNotifier::Type::Read);
     connect(_pReadNotifier.ptr(), &QSocketNotifier::activated, this,
             &PosixPing::onReadyRead);
-#endif
 }
 
 quint16 PosixPing::calcChecksum(const quint8 *data, std::size_t len) const
@@ -82,29 +159,11 @@ quint16 PosixPing::calcChecksum(const quint8 *data, std::size_t len) const
     return ~static_cast<quint16>(accum);
 }
 
-bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFragment)
+void PosixPing::buildEchoRequest(quint8 *pRawPacket, quint32 address,
+                                 quint16 sequence, int payloadSize) const
 {
-#ifdef UNIT_TEST
-    // Fake this in unit tests since we can't send real ICMP pings when not run
-    // as root.
-    // Unit tests use the IPv4 documentation range to test a lack of response,
-    // so check for that too (but act like a request was sent with no reply).
-    if((address & 0xFFFFFF00) != 0xC0000200)    // 192.0.2.0/24
-    {
-        qInfo() << "Mocking ping to" << QHostAddress{address};
-        QTimer::singleShot(30, this, [this, address]{emit receivedReply(address);});
-    }
-    return true;
-#endif
-    if(!_icmpSocket)
-        return false; // Can't do anything, failed to open raw socket - traced earlier
-
-    // Build an ICMP echo request packet.
     int rawPacketSize = sizeof(IcmpEcho) + payloadSize + sizeof(struct ip);
     int packetSize = sizeof(IcmpEcho) + payloadSize;
-    std::vector<std::uint8_t> rawPacket;
-    rawPacket.resize(rawPacketSize);
-    quint8* pRawPacket = rawPacket.data();
     quint8* packet = pRawPacket + sizeof(struct ip);
     IcmpEcho *pEcho = reinterpret_cast<IcmpEcho*>(packet);
     struct ip *ip = reinterpret_cast<struct ip *>(pRawPacket);
@@ -128,9 +187,8 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
     pEcho->code = 0;
     pEcho->checksum = 0;
     pEcho->identifier = htons(_identifier);
-    pEcho->sequence = htons(_nextSequence);
+    pEcho->sequence = htons(sequence);
 
-    ++_nextSequence;
     // The default payload on Mac/Linux is 56 bytes from 0x00 - 0x37.  The first
     // few bytes are replaced with a timestamp.
     for(int i = 0; i < payloadSize; ++i)
@@ -156,12 +214,102 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
     // Compute the checksum.  Add into a 32-bit accumulator, then fold the
     // carries in.
     pEcho->checksum = calcChecksum(packet, packetSize);
+}
+
+std::size_t PosixPing::ipHeaderSize() const
+{
+    // Datagram sockets don't include the IP header when sending or receiving
+    return _socketType == SocketType::Raw ? sizeof(struct ip) : 0;
+}
+
+bool PosixPing::shouldMockEcho(quint32 address) const
+{
+#ifdef UNIT_TEST
+    // Loopback pings are real if a socket could be opened
+    return !_icmpSocket || (address & 0xFF000000) != 0x7F000000;   // 127.0.0.0/8
+#else
+    Q_UNUSED(address);
+    return false;
+#endif
+}
 
+void PosixPing::pruneExpiredEchoes()
+{
+    auto now = std::chrono::steady_clock::now();
+    if(now < _nextPrune)
+        return;
+    _nextPrune = now + echoPruneInterval;
+
+    for(auto itPending = _pendingEchoes.begin(); itPending != _pendingEchoes.end(); )
+    {
+        if(now - itPending->second.sendSteadyTime >= echoExpiration)
+            itPending = _pendingEchoes.erase(itPending);
+        else
+            ++itPending;
+    }
+}
+
+PosixPing::PendingEcho PosixPing::beginEcho(quint32 address) const
+{
+    PendingEcho pending{address, {}, std::chrono::steady_clock::now()};
+    clock_gettime(CLOCK_REALTIME, &pending.sendTime);
+    return pending;
+}
+
+void PosixPing::mockEchoReply(quint32 address)
+{
+    // Fake this in unit tests since we can't send real ICMP pings when not run
+    // as root, except to loopback using a datagram socket.
+    // Unit tests use the IPv4 documentation range to test a lack of response,
+    // so check for that too (but act like a request was sent with no reply).
+    if((address & 0xFFFFFF00) != 0xC0000200)    // 192.0.2.0/24
+    {
+        qInfo() << "Mocking ping to" << QHostAddress{address};
+        QTimer::singleShot(30, this, [this, address]
+        {
+            emit receivedReply(address, std::chrono::milliseconds{30});
+        });
+    }
+}
+
+bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFragment)
+{
+    if(shouldMockEcho(address))
+    {
+        mockEchoReply(address);
+        return true;
+    }
+    if(!_icmpSocket)
+        return false; // Can't do anything, failed to open socket - traced earlier
+
+    // Build an ICMP echo request packet.
+    int rawPacketSize = sizeof(IcmpEcho) + payloadSize + sizeof(struct ip);
+    std::vector<std::uint8_t> rawPacket;
+    rawPacket.resize(rawPacketSize);
+    quint8* pRawPacket = rawPacket.data();
+    struct ip *ip = reinterpret_cast<struct ip *>(pRawPacket);
+    quint16 sequence = _nextSequence++;
+    buildEchoRequest(pRawPacket, address, sequence, payloadSize);
+
+#if !defined(Q_OS_MAC)
+    // Prior IP_MTU_DISCOVER value if it was changed for this request
+    int priorPmtuDisc{-1};
+#endif
     if (!allowFragment) {
 #if defined(Q_OS_MAC)
         ip->ip_off = IP_DF;
 #else
+        // Datagram sockets don't send our IP header, the socket option applies
+        // to both.  The socket is shared with the latency pings, which must
+        // still be allowed to fragment, so the option is restored after
+        // sending.
         ip->ip_off = htons(IP_DF);
+        socklen_t priorLen = sizeof(priorPmtuDisc);
+        if(getsockopt(_icmpSocket.get(), IPPROTO_IP, IP_MTU_DISCOVER, &priorPmtuDisc, &priorLen))
+        {
+            qWarning() << "Failed to get PMTU discovery mode of ICMP socket";
+            return false;
+        }
         int val = IP_PMTUDISC_DO;
         int err = setsockopt(_icmpSocket.get(), IPPROTO_IP, IP_MTU_DISCOVER, &val, sizeof(val));
         if (err) {
@@ -174,13 +322,28 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
     // Write the packet
     sockaddr_in to;
     to.sin_family = AF_INET;
-    to.sin_port = 0;    // Not used for ICMP raw socket
+    to.sin_port = 0;    // Not used for ICMP sockets
     to.sin_addr.s_addr = htonl(address);
-    auto sent = ::sendto(_icmpSocket.get(), pRawPacket, rawPacketSize, 0,
-                         reinterpret_cast<sockaddr*>(&to), sizeof(to));
+    std::size_t headerSize = ipHeaderSize();
+    rawPacketSize -= static_cast<int>(headerSize);
+    pruneExpiredEchoes();
+    PendingEcho pending = beginEcho(address);
+    auto sent = ::sendto(_icmpSocket.get(), pRawPacket + headerSize,
+                         rawPacketSize, 0, reinterpret_cast<sockaddr*>(&to),
+                         sizeof(to));
+    int sendErr = errno;
+#if !defined(Q_OS_MAC)
+    if(priorPmtuDisc >= 0 &&
+       setsockopt(_icmpSocket.get(), IPPROTO_IP, IP_MTU_DISCOVER, &priorPmtuDisc,
+                  sizeof(priorPmtuDisc)))
+    {
+        qWarning() << "Failed to restore PMTU discovery mode of ICMP socket -"
+            << errno;
+    }
+#endif
     if(sent < 0)
     {
-        if(errno == EWOULDBLOCK)
+        if(sendErr == EWOULDBLOCK)
         {
             qWarning() << "Failed to ping" << QHostAddress{address}.toString()
                 << "- would have blocked";
@@ -188,7 +351,7 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
         else
         {
             qWarning() << "Failed to ping" << QHostAddress{address}.toString()
-                << "-" << errno;
+                << "-" << sendErr;
         }
         return false;
     }
@@ -199,11 +362,219 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
         return false;
     }
 
+    _pendingEchoes[sequence] = pending;
     return true;
 }
 
+auto PosixPing::sendEchoRequests(const quint32 *pAddresses, std::size_t count)
+    -> SendResult
+{
+    if(std::any_of(pAddresses, pAddresses + count,
+                   [this](quint32 address){return shouldMockEcho(address);}))
+    {
+        for(std::size_t i=0; i<count; ++i)
+            mockEchoReply(pAddresses[i]);
+        return {count, false};
+    }
+    if(!_icmpSocket)
+        return {0, false};
+
+    // Build all the packets in the reusable send buffer
+    const std::size_t rawPacketSize = sizeof(IcmpEcho) + BatchPayloadSize + sizeof(struct ip);
+    if(_sendBuffer.size() < rawPacketSize * count)
+        _sendBuffer.resize(rawPacketSize * count);
+    std::vector<sockaddr_in> destinations(count);
+    for(std::size_t i=0; i<count; ++i)
+    {
+        buildEchoRequest(&_sendBuffer[rawPacketSize * i], pAddresses[i],
+                         static_cast<quint16>(_nextSequence + i), BatchPayloadSize);
+        destinations[i].sin_family = AF_INET;
+        destinations[i].sin_port = 0;
+        destinations[i].sin_addr.s_addr = htonl(pAddresses[i]);
+    }
+
+    // Skip the IP header for datagram sockets
+    const std::size_t headerSize = ipHeaderSize();
+    const std::size_t sendPacketSize = rawPacketSize - headerSize;
+    pruneExpiredEchoes();
+    PendingEcho pending = beginEcho(0);
+    std::size_t sent{0};
+    int sendErr{0};
+#if defined(Q_OS_LINUX)
+    std::vector<iovec> iovecs(count);
+    std::vector<mmsghdr> messages(count);
+    for(std::size_t i=0; i<count; ++i)
+    {
+        iovecs[i] = {&_sendBuffer[rawPacketSize * i + headerSize], sendPacketSize};
+        messages[i].msg_hdr.msg_name = &destinations[i];
+        messages[i].msg_hdr.msg_namelen = sizeof(destinations[i]);
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    int result = ::sendmmsg(_icmpSocket.get(), messages.data(), count, 0);
+    if(result < 0)
+        sendErr = errno;
+    else
+        sent = static_cast<std::size_t>(result);
+#else
+    // There's no sendmmsg() on macOS, send one packet at a time
+    for(; sent < count; ++sent)
+    {
+        auto result = ::sendto(_icmpSocket.get(),
+                               &_sendBuffer[rawPacketSize * sent + headerSize],
+                               sendPacketSize, 0,
+                               reinterpret_cast<sockaddr*>(&destinations[sent]),
+                               sizeof(destinations[sent]));
+        if(result < 0)
+        {
+            sendErr = errno;
+            break;
+        }
+    }
+#endif
+
+    // Sequence numbers are only used for the packets that were sent; the rest
+    // are built again if they're retried
+    for(std::size_t i=0; i<sent; ++i)
+    {
+        pending.address = pAddresses[i];
+        _pendingEchoes[_nextSequence++] = pending;
+    }
+
+    bool wouldBlock = sendErr == EAGAIN || sendErr == EWOULDBLOCK;
+    if(sent < count && sendErr && !wouldBlock)
+    {
+        qWarning() << "Failed to ping" << QHostAddress{pAddresses[sent]}.toString()
+            << "-" << sendErr;
+    }
+    return {sent, wouldBlock};
+}
+
+timespec PosixPing::getReceiveTime(msghdr &message) const
+{
+    for(cmsghdr *pCmsg = CMSG_FIRSTHDR(&message); pCmsg;
+        pCmsg = CMSG_NXTHDR(&message, pCmsg))
+    {
+        if(pCmsg->cmsg_level != SOL_SOCKET)
+            continue;
+#if defined(Q_OS_LINUX)
+        if(pCmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            timespec receiveTime;
+            std::memcpy(&receiveTime, CMSG_DATA(pCmsg), sizeof(receiveTime));
+            return receiveTime;
+        }
+#else
+        if(pCmsg->cmsg_type == SCM_TIMESTAMP)
+        {
+            timeval receiveTime;
+            std::memcpy(&receiveTime, CMSG_DATA(pCmsg), sizeof(receiveTime));
+            return {receiveTime.tv_sec, receiveTime.tv_usec * 1000};
+        }
+#endif
+    }
+
+    timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now;
+}
+
 void PosixPing::onReadyRead()
 {
+    // Read everything that's available now - when many replies arrive at once,
+    // this avoids waiting for the event loop between each one.  Measurements
+    // use the kernel receive timestamps, so they aren't affected by how long
+    // the replies waited to be read.
+    struct ReceiveBuffer
+    {
+        alignas(std::uint32_t) std::array<quint8, ReceiveBufferSize> packet;
+        alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(timespec))> control;
+        sockaddr_in source;
+        iovec iov;
+    };
+
+#if defined(Q_OS_LINUX)
+    std::array<ReceiveBuffer, ReceiveBatchSize> buffers;
+    std::array<mmsghdr, ReceiveBatchSize> messages;
+    while(true)
+    {
+        for(unsigned i=0; i<ReceiveBatchSize; ++i)
+        {
+            buffers[i].iov = {buffers[i].packet.data(), buffers[i].packet.size()};
+            messages[i] = {};
+            messages[i].msg_hdr.msg_name = &buffers[i].source;
+            messages[i].msg_hdr.msg_namelen = sizeof(buffers[i].source);
+            messages[i].msg_hdr.msg_iov = &buffers[i].iov;
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_control = buffers[i].control.data();
+            messages[i].msg_hdr.msg_controllen = buffers[i].control.size();
+        }
+
+        int count = ::recvmmsg(_icmpSocket.get(), messages.data(),
+                               ReceiveBatchSize, MSG_DONTWAIT, nullptr);
+        if(count < 0)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+                qWarning() << "Failed to read from ICMP socket - err:" << errno;
+            return;
+        }
+
+        for(int i=0; i<count; ++i)
+        {
+            processPacket(buffers[i].packet.data(), messages[i].msg_len,
+                          buffers[i].source,
+                          getReceiveTime(messages[i].msg_hdr));
+        }
+
+        // If the batch wasn't filled, nothing else is queued
+        if(count < static_cast<int>(ReceiveBatchSize))
+            return;
+    }
+#else
+    // There's no recvmmsg() on macOS, read one packet at a time
+    ReceiveBuffer buffer;
+    while(true)
+    {
+        buffer.iov = {buffer.packet.data(), buffer.packet.size()};
+        msghdr message{};
+        message.msg_name = &buffer.source;
+        message.msg_namelen = sizeof(buffer.source);
+        message.msg_iov = &buffer.iov;
+        message.msg_iovlen = 1;
+        message.msg_control = buffer.control.data();
+        message.msg_controllen = buffer.control.size();
+
+        auto read = ::recvmsg(_icmpSocket.get(), &message, MSG_DONTWAIT);
+        if(read < 0)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+                qWarning() << "Failed to read from ICMP socket - err:" << errno;
+            return;
+        }
+        processPacket(buffer.packet.data(), static_cast<std::size_t>(read),
+                      buffer.source, getReceiveTime(message));
+    }
+#endif
+}
+
+void PosixPing::processPacket(const quint8 *pPacket, std::size_t read,
+                              const sockaddr_in &source,
+                              const timespec &receiveTime)
+{
+    // Datagram sockets receive just the ICMP message; the source is provided
+    // by recvmsg()
+    if(_socketType == SocketType::Datagram)
+    {
+        if(read < sizeof(IcmpEcho))
+        {
+            qWarning() << "Read incomplete ICMP message of" << read
+                << "bytes, expected" << sizeof(IcmpEcho) << "bytes";
+            return;
+        }
+        processIcmp(pPacket, read, ntohl(source.sin_addr.s_addr), receiveTime);
+        return;
+    }
+
     struct Ipv4
     {
         quint8 version_ihl;    // Version and IP header length
@@ -218,24 +589,14 @@ void PosixPing::onReadyRead()
         quint32 dest;
     };
 
-    alignas(Ipv4) std::array<quint8, 2048> packet;
-    auto read = recv(_icmpSocket.get(), packet.data(), packet.size(), 0);
-    if(read < 0)
-    {
-        // Shouldn't happen, socket said it was ready
-        qWarning() << "Failed to read from ICMP socket -" << read << "- err:"
-            << errno;
-        return;
-    }
-
-    if(static_cast<std::size_t>(read) < sizeof(Ipv4))
+    if(read < sizeof(Ipv4))
     {
         qWarning() << "Read incomplete packet of" << read << "bytes, expected"
             << sizeof(Ipv4) << "bytes";
         return;
     }
 
-    const Ipv4 *pIpHdr = reinterpret_cast<const Ipv4*>(packet.data());
+    const Ipv4 *pIpHdr = reinterpret_cast<const Ipv4*>(pPacket);
 
     // Ignore the packet length from the IP header - the kernel has already
     // manipulated it (converted to host byte order and subtracted header
@@ -248,7 +609,7 @@ void PosixPing::onReadyRead()
     }
 
     std::size_t headerBytes = (pIpHdr->version_ihl & 0x0F) * 4;
-    if(headerBytes < 20 || static_cast<std::size_t>(read) < headerBytes ||
+    if(headerBytes < 20 || read < headerBytes ||
        read - headerBytes < sizeof(IcmpEcho))
     {
         qWarning() << "Invalid IP header length:" << headerBytes
@@ -263,15 +624,22 @@ void PosixPing::onReadyRead()
         return;
     }
 
+    processIcmp(pPacket + headerBytes, read - headerBytes, ntohl(pIpHdr->src),
+                receiveTime);
+}
+
+void PosixPing::processIcmp(const quint8 *pIcmp, std::size_t len,
+                            quint32 source, const timespec &receiveTime)
+{
     // Check ICMP checksum
-    if(calcChecksum(packet.data() + headerBytes, read - headerBytes))
+    if(calcChecksum(pIcmp, len))
     {
         qWarning() << "Received corrupt ICMP packet from"
-            << QHostAddress{ntohl(pIpHdr->src)}.toString();
+            << QHostAddress{source}.toString();
     }
 
     // Find the ICMP header
-    const IcmpEcho *pEchoReply = reinterpret_cast<const IcmpEcho*>(packet.data() + headerBytes);
+    const IcmpEcho *pEchoReply = reinterpret_cast<const IcmpEcho*>(pIcmp);
     // If it's not an echo reply, not ours, etc., just ignore it.
     if(pEchoReply->type != 0 || pEchoReply->code != 0 ||
        ntohs(pEchoReply->identifier) != _identifier)
@@ -280,6 +648,36 @@ void PosixPing::onReadyRead()
         return;
     }
 
+    // Find the request for this reply.  If there isn't one, this is a
+    // duplicate, or the reply arrived after the request expired (see
+    // pruneExpiredEchoes()).
+    auto itPending = _pendingEchoes.find(ntohs(pEchoReply->sequence));
+    if(itPending == _pendingEchoes.end())
+        return;
+    // The reply must come from the host that was pinged.  Sequence numbers are
+    // shared by all hosts, a stray reply from another host (like a late reply
+    // to an expired request after the sequence numbers wrapped) would otherwise
+    // attribute its round trip to the wrong host.  Keep waiting for the real
+    // reply.
+    if(itPending->second.address != source)
+    {
+        qWarning() << "Ignoring echo reply" << ntohs(pEchoReply->sequence)
+            << "from" << QHostAddress{source}.toString() << "- request was sent to"
+            << QHostAddress{itPending->second.address}.toString();
+        return;
+    }
+    PendingEcho pending = itPending->second;
+    _pendingEchoes.erase(itPending);
+
+    // The kernel timestamp must be between sending the request and now.  If
+    // it's not, the system clock changed - use the steady clock instead, which
+    // includes the time that the reply waited to be read.
+    std::chrono::nanoseconds readRoundTrip{std::chrono::steady_clock::now() - pending.sendSteadyTime};
+    std::chrono::nanoseconds roundTrip{timespecDiff(pending.sendTime, receiveTime)};
+    if(roundTrip < std::chrono::nanoseconds::zero() || roundTrip > readRoundTrip)
+        roundTrip = readRoundTrip;
+
     // It's our reply - emit the response.
-    emit receivedReply(ntohl(pIpHdr->src));
+    emit receivedReply(source,
+                       std::chrono::duration_cast<std::chrono::microseconds>(roundTrip));
 }
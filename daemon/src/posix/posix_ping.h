@@ -22,13 +22,27 @@
 #include <common/src/common.h>
 #include <kapps_core/src/posix/posix_objects.h>
 #include <QSocketNotifier>
+#include <chrono>
+#include <ctime>
+#include <unordered_map>
+#include <vector>
+
+struct msghdr;
+struct sockaddr_in;
 
 // Open an ICMP socket and send pings on Mac/Linux.
-// An identifier is chosen randomly when the object is created; responses are
+//
+// On Linux, an unprivileged ICMP datagram socket is used if the system permits
+// it (net.ipv4.ping_group_range); the kernel assigns the identifier and only
+// delivers our replies.  Otherwise, a raw socket is used (requiring root), an
+// identifier is chosen randomly when the object is created, and responses are
 // detected based on that identifier.
 //
-// It is possible (but unlikely) that duplicate or spurious responses could be
-// emitted if they happen to have that identifier.
+// Each echo's send time is stored by its sequence number, and replies are
+// timestamped by the kernel when they're received, so the round trip time
+// doesn't include any delay in processing the reply.  Replies that don't match
+// an outstanding echo request are ignored.  Requests that don't receive a reply
+// are discarded after a timeout, before their sequence numbers can be reused.
 class PosixPing : public QObject
 {
     Q_OBJECT
@@ -37,7 +51,10 @@ private:
     enum
     {
         // Size of payload included in echoes
-        PayloadSize = 56
+        PayloadSize = 56,
+        // Size of payload used by sendEchoRequests() (the default for
+        // sendEchoRequest())
+        BatchPayloadSize = 32,
     };
     struct IcmpEcho
     {
@@ -47,31 +64,107 @@ private:
         quint16 identifier;
         quint16 sequence;
     };
+    // Kind of socket used to send pings
+    enum class SocketType
+    {
+        // Raw socket - we send and receive IP headers, and all ICMP packets
+        // are received
+        Raw,
+        // ICMP datagram socket - the kernel handles IP headers and filters
+        // replies by identifier
+        Datagram,
+    };
+    // An echo request that hasn't received a reply yet
+    struct PendingEcho
+    {
+        quint32 address;
+        // Time the request was sent, both on the system clock (to compare to
+        // kernel receive timestamps) and on the steady clock (in case the
+        // system clock changes)
+        timespec sendTime;
+        std::chrono::steady_clock::time_point sendSteadyTime;
+    };
+
+public:
+    // Result of sendEchoRequests()
+    struct SendResult
+    {
+        // Number of requests sent.  Requests are sent in order, so these are
+        // the first addresses given.
+        std::size_t sent;
+        // If some requests weren't sent, whether that's because the socket
+        // would have blocked (they can be retried later).  Otherwise, the next
+        // request failed.
+        bool wouldBlock;
+    };
 
 public:
     PosixPing();
 
+public:
+    // Whether an unprivileged datagram socket is being used (unit tests use
+    // this to check whether real loopback pings are possible)
+    bool usingDatagramSocket() const {return _socketType == SocketType::Datagram;}
+
 private:
     quint16 calcChecksum(const quint8 *data, std::size_t len) const;
+    // Build an echo request, including the IP header, in pRawPacket.  The
+    // packet is allowed to fragment.
+    void buildEchoRequest(quint8 *pRawPacket, quint32 address, quint16 sequence,
+                          int payloadSize) const;
+    // Size of the IP header included in sent packets - 0 for datagram sockets
+    std::size_t ipHeaderSize() const;
+    // Whether a ping to this address should be mocked (in unit tests)
+    bool shouldMockEcho(quint32 address) const;
+    // Discard pending echoes that have been waiting longer than the
+    // expiration time; called before sending
+    void pruneExpiredEchoes();
+    // Get the pending echo data for a request being sent now
+    PendingEcho beginEcho(quint32 address) const;
+    // Mock a reply in unit tests
+    void mockEchoReply(quint32 address);
 
 public:
     // Send an ICMP echo request.  If a reply is received, it will be signaled
     // with receivedReply().
-    bool sendEchoRequest(quint32 address, int payloadSize = 32, bool allowFragment = true);
+    bool sendEchoRequest(quint32 address, int payloadSize = BatchPayloadSize,
+                         bool allowFragment = true);
+
+    // Send echo requests to several addresses with as few system calls as
+    // possible (using sendmmsg() on Linux).  The packets are built in a buffer
+    // that's reused for each call.
+    SendResult sendEchoRequests(const quint32 *pAddresses, std::size_t count);
 
 private:
+    // Get the time that a message was received from its kernel timestamp, or
+    // the current time if it has no timestamp.
+    timespec getReceiveTime(msghdr &message) const;
+    // Process one received packet
+    void processPacket(const quint8 *pPacket, std::size_t len,
+                       const sockaddr_in &source, const timespec &receiveTime);
+    // Process a received ICMP message (after the IP header, if any)
+    void processIcmp(const quint8 *pIcmp, std::size_t len, quint32 source,
+                     const timespec &receiveTime);
+    // Read all the packets that are available
     void onReadyRead();
 
 signals:
-    void receivedReply(quint32 address);
+    void receivedReply(quint32 address, std::chrono::microseconds roundTrip);
 
 private:
     kapps::core::PosixFd _icmpSocket;
     // Have to delay construction of this notifier until we have set up the
     // ICMP socket.
     nullable_t<QSocketNotifier> _pReadNotifier;
+    SocketType _socketType;
     quint16 _identifier;
     quint16 _nextSequence;
+    // Echoes that haven't received a reply, by sequence number
+    std::unordered_map<quint16, PendingEcho> _pendingEchoes;
+    // Next time that expired echoes will be pruned
+    std::chrono::steady_clock::time_point _nextPrune;
+    // Buffer used to build packets for sendEchoRequests()
+    std::vector<quint8> _sendBuffer;
 };
 
 #endif
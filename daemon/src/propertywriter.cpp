@@ -0,0 +1,121 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#include <common/src/common.h>
+#line SOURCE_FILE("propertywriter.cpp")
+
+#include "propertywriter.h"
+#include <QFile>
+#include <QJsonDocument>
+#include <QSaveFile>
+
+PropertyWriter::PropertyWriter(Path dir)
+    : _dir{std::move(dir)}, _writeQueued{false}
+{
+}
+
+PropertyWriter::~PropertyWriter()
+{
+    // Complete any queued writes before the worker thread exits
+    flush();
+}
+
+void PropertyWriter::queueWrite(const char *filename, QJsonObject object)
+{
+    Q_ASSERT(filename);
+
+    std::unique_lock<std::mutex> lock{_pendingMutex};
+    _pending[QString::fromUtf8(filename)] = std::move(object);
+    if(_writeQueued)
+        return; // Already queued, will pick up the new content
+
+    _writeQueued = true;
+    lock.unlock();
+    _worker.queueOnThread([this](){writePending();});
+}
+
+QSet<QString> PropertyWriter::findMissingSplitFiles(const Path &dir,
+    kapps::core::ArraySlice<const SplitFile> splitFiles)
+{
+    QSet<QString> missing;
+    for(const auto &splitFile : splitFiles)
+    {
+        if(!QFile::exists(dir / splitFile.pFilename))
+            missing.insert(QString::fromLatin1(splitFile.pProperty));
+    }
+    return missing;
+}
+
+void PropertyWriter::queueSplitWrite(QJsonObject object, const char *mainFilename,
+                                     kapps::core::ArraySlice<const SplitFile> splitFiles,
+                                     QSet<QString> changes, bool mainDirty)
+{
+    for(const auto &splitFile : splitFiles)
+    {
+        QString property = QString::fromLatin1(splitFile.pProperty);
+        QJsonValue value = object.take(property);
+        // Only rewrite this file if the property changed
+        if(changes.remove(property))
+        {
+            QJsonObject fileJson;
+            fileJson.insert(property, std::move(value));
+            queueWrite(splitFile.pFilename, std::move(fileJson));
+        }
+    }
+
+    // Rewrite the main file if anything else changed
+    if(mainDirty || !changes.empty())
+        queueWrite(mainFilename, std::move(object));
+}
+
+void PropertyWriter::flush()
+{
+    // Writes are processed in order on the worker thread, so once this
+    // synchronous call completes, everything queued before it has completed.
+    _worker.invokeOnThread([this](){writePending();});
+}
+
+void PropertyWriter::writePending()
+{
+    std::map<QString, QJsonObject> pending;
+    {
+        std::unique_lock<std::mutex> lock{_pendingMutex};
+        pending.swap(_pending);
+        _writeQueued = false;
+    }
+
+    if(pending.empty())
+        return;
+
+    Path dir{_dir.mkpath()};
+    for(const auto &file : pending)
+    {
+        // QSaveFile writes to a temporary file, then flushes it to disk and
+        // renames it over the target in commit()
+        QSaveFile saveFile{dir / file.first};
+        if(!saveFile.open(QIODevice::WriteOnly | QIODevice::Text) ||
+           saveFile.write(QJsonDocument{file.second}.toJson(QJsonDocument::Compact)) <= 0 ||
+           !saveFile.commit())
+        {
+            qCritical() << "Unable to write" << file.first << "-" << saveFile.errorString();
+        }
+        else
+            qDebug() << "Successfully wrote" << file.first;
+    }
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#ifndef PROPERTYWRITER_H
+#define PROPERTYWRITER_H
+
+#include <common/src/common.h>
+#include <common/src/thread.h>
+#include <common/src/builtin/path.h>
+#include <kapps_core/src/stringslice.h>
+#include <QJsonObject>
+#include <QSet>
+#include <mutex>
+#include <map>
+
+// PropertyWriter writes JSON property files on a worker thread.  The caller
+// provides a QJsonObject (which is cheap to copy, the data are shared), and
+// the text serialization, write, and atomic replacement of the file all occur
+// on the worker thread.
+//
+// Writes are coalesced per file - if a file is queued again before the worker
+// has written it, only the newest content is written.  Each file is written
+// to a temporary file, flushed to disk, and then renamed over the original, so
+// a crash or power loss leaves either the old or new content, never a partial
+// file.
+//
+// Any writes still queued when PropertyWriter is destroyed are completed
+// before the destructor returns.
+class PropertyWriter : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("json.settings");
+
+public:
+    // A property that is stored in its own file, rather than in the main file
+    // of an object (see queueSplitWrite()).
+    struct SplitFile
+    {
+        const char *pProperty;
+        const char *pFilename;
+    };
+
+    // Find the split properties whose files don't exist in dir yet, such as
+    // after upgrading from a version that stored everything in the main file.
+    // Writing these with queueSplitWrite() (with mainDirty set) migrates them
+    // out of the main file.
+    static QSet<QString> findMissingSplitFiles(const Path &dir,
+        kapps::core::ArraySlice<const SplitFile> splitFiles);
+
+public:
+    // All files are written in dir (which is created if needed).
+    PropertyWriter(Path dir);
+    ~PropertyWriter();
+
+public:
+    // Queue a write of a property file.  filename must be a string literal (or
+    // otherwise remain valid for the life of PropertyWriter).
+    void queueWrite(const char *filename, QJsonObject object);
+
+    // Queue writes for an object whose properties are split across several
+    // files.  Each split property is written to its own file if it's in
+    // 'changes', and it is never written to the main file.  The main file is
+    // written if any other property is in 'changes', or if mainDirty is set
+    // (which is used to remove migrated properties from it).
+    void queueSplitWrite(QJsonObject object, const char *mainFilename,
+                         kapps::core::ArraySlice<const SplitFile> splitFiles,
+                         QSet<QString> changes, bool mainDirty);
+
+    // Wait for all currently-queued writes to complete.
+    void flush();
+
+private:
+    // Write all pending files - called on the worker thread
+    void writePending();
+
+private:
+    Path _dir;
+    // Files queued to be written and their content, keyed by file name;
+    // guarded by _pendingMutex
+    std::mutex _pendingMutex;
+    std::map<QString, QJsonObject> _pending;
+    // Whether writePending() has been queued to the worker thread, but has not
+    // yet taken the pending files; guarded by _pendingMutex
+    bool _writeQueued;
+    RunningWorkerThread _worker;
+};
+
+#endif
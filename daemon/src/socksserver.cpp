@@ -25,9 +25,12 @@
 #include <QCryptographicHash>
 #include <QNetworkProxy>
 
-// For SO_BINDTODEVICE
+// For SO_BINDTODEVICE and SO_REUSEPORT, and dup() to hand off sockets to
+// SpliceRelay
 #ifdef Q_OS_LINUX
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
 #endif
 
 namespace
@@ -207,22 +210,35 @@ namespace
 // added since the username is prefix-matched.
 const QByteArray SocksConnection::username = QByteArrayLiteral(BRAND_CODE "_");
 
-SocksServer::SocksServer(QHostAddress bindAddress, QString bindInterface)
+// The API proxy only carries the daemon's own API requests, so these are
+// generous.  Idle connections are closed so abandoned keep-alive connections
+// don't count against the limit forever.
+const SocksServer::Limits SocksServer::defaultLimits{128, std::chrono::minutes{2}};
+
+SocksServer::SocksServer(QHostAddress bindAddress, QString bindInterface,
+                         Limits limits, quint16 sharedPort,
+                         QByteArray sharedPassword)
     : _bindAddress{std::move(bindAddress)},
-      _bindInterface{bindInterface}
+      _bindInterface{bindInterface}, _limits{limits}, _connectionCount{0}
 {
     Q_ASSERT(_bindAddress.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol);
+    Q_ASSERT(_limits.maxConnections > 0);
 
-    if(_server.listen(QHostAddress::SpecialAddress::LocalHost))
+    if(listen(sharedPort))
     {
         Q_ASSERT(_server.serverPort()); // Should have assigned a port if listen succeeded
         qInfo() << "Started API proxy on port" << _server.serverPort();
         connect(&_server, &QTcpServer::newConnection, this, &SocksServer::onNewConnection);
 
-        // Generate a password.  The SocksServer port is reachable by any
-        // application, but we only intend to use it from the daemon.
-        quint64 passwordData = QRandomGenerator::global()->generate64();
-        _password = QByteArray::fromRawData(reinterpret_cast<const char*>(&passwordData), sizeof(passwordData)).toHex();
+        if(sharedPassword.isEmpty())
+        {
+            // Generate a password.  The SocksServer port is reachable by any
+            // application, but we only intend to use it from the daemon.
+            quint64 passwordData = QRandomGenerator::global()->generate64();
+            _password = QByteArray::fromRawData(reinterpret_cast<const char*>(&passwordData), sizeof(passwordData)).toHex();
+        }
+        else
+            _password = std::move(sharedPassword);
         // Use the hash of the password for validation; see SocksConnection
         QCryptographicHash hash{QCryptographicHash::Algorithm::Sha256};
         hash.addData(_password);
@@ -235,6 +251,53 @@ SocksServer::SocksServer(QHostAddress bindAddress, QString bindInterface)
     }
 }
 
+SocksServer::~SocksServer()
+{
+    // The connections are destroyed along with _server; stop tracking them
+    // first, this object is no longer intact by then
+    for(QTcpSocket *pSocket : _server.findChildren<QTcpSocket*>(QString{}, Qt::FindDirectChildrenOnly))
+        disconnect(pSocket, nullptr, this, nullptr);
+}
+
+bool SocksServer::listen(quint16 port)
+{
+#ifdef Q_OS_LINUX
+    int listener = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listener < 0)
+    {
+        qWarning() << "Unable to create API proxy listening socket -" << errno;
+        return false;
+    }
+
+    int reusePort{1};
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if(::setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &reusePort, sizeof(reusePort)) ||
+       ::bind(listener, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) ||
+       ::listen(listener, SOMAXCONN))
+    {
+        qWarning() << "Unable to listen on API proxy port" << port << "-" << errno;
+        ::close(listener);
+        return false;
+    }
+
+    // QTcpServer takes ownership of the socket
+    if(!_server.setSocketDescriptor(listener))
+    {
+        ::close(listener);
+        return false;
+    }
+    return true;
+#else
+    // Ports can't be shared on other platforms; SocksServerThread only creates
+    // one server
+    Q_ASSERT(port == 0);
+    return _server.listen(QHostAddress::SpecialAddress::LocalHost, port);
+#endif
+}
+
 void SocksServer::updateBindAddress(QHostAddress bindAddress, QString bindInterface)
 {
     // Checked by caller
@@ -245,23 +308,56 @@ void SocksServer::updateBindAddress(QHostAddress bindAddress, QString bindInterf
 
 void SocksServer::onNewConnection()
 {
-    while(auto pNewConnection = _server.nextPendingConnection())
+    while(_connectionCount < _limits.maxConnections)
     {
+        auto pNewConnection = _server.nextPendingConnection();
+        if(!pNewConnection)
+            return;
+
         // SocksConnection manages its own lifetime; it becomes parented to the
         // new QTcpSocket.
-        new SocksConnection{*pNewConnection, _passwordHash, _bindAddress, _bindInterface};
+        new SocksConnection{*pNewConnection, _passwordHash, _bindAddress,
+                            _bindInterface, _limits.idleTimeout};
+        ++_connectionCount;
+        connect(pNewConnection, &QObject::destroyed, this, &SocksServer::onConnectionClosed);
+    }
+
+    if(_server.isListening() && _server.hasPendingConnections())
+    {
+        // Leave further connections in the backlog until some close
+        qWarning() << "API proxy reached limit of" << _limits.maxConnections
+            << "connections, pausing";
+        _server.pauseAccepting();
+    }
+}
+
+void SocksServer::onConnectionClosed()
+{
+    Q_ASSERT(_connectionCount > 0);
+    --_connectionCount;
+    if(_connectionCount == _limits.maxConnections - 1)
+    {
+        // Take any connections that were already accepted, and resume
+        // accepting (no effect if we hadn't paused)
+        onNewConnection();
+        if(_connectionCount < _limits.maxConnections)
+            _server.resumeAccepting();
     }
 }
 
 SocksConnection::SocksConnection(QTcpSocket &socksSocket,
                                  QByteArray passwordHash,
                                  QHostAddress bindAddress,
-                                 QString bindInterface)
+                                 QString bindInterface,
+                                 std::chrono::milliseconds idleTimeout)
     : QObject{&socksSocket}, _socksSocket{socksSocket},
       _passwordHash{std::move(passwordHash)},
       _bindAddress{std::move(bindAddress)},
       _bindInterface{std::move(bindInterface)},
       _state{State::ReceiveAuthMethodsHeader}, _nextMessageBytes{2}
+#ifdef Q_OS_LINUX
+      , _relayStartQueued{false}
+#endif
 {
     // By default QTcpSocket will try to use a system proxy, if configured.
     // This virtually never makes sense for these connections, since we're on
@@ -277,6 +373,11 @@ SocksConnection::SocksConnection(QTcpSocket &socksSocket,
     connect(&_targetSocket, &QTcpSocket::readyRead, this, &SocksConnection::onTargetReadyRead);
     connect(&_targetSocket, &QTcpSocket::errorOccurred, this, &SocksConnection::onTargetError);
     connect(&_targetSocket, &QTcpSocket::disconnected, this, &SocksConnection::onTargetDisconnected);
+#ifdef Q_OS_LINUX
+    // Try to start the relay once the QTcpSockets' write buffers drain
+    connect(&_socksSocket, &QTcpSocket::bytesWritten, this, &SocksConnection::queueRelayStart);
+    connect(&_targetSocket, &QTcpSocket::bytesWritten, this, &SocksConnection::queueRelayStart);
+#endif
 
     _abortTimer.setSingleShot(true);
     _abortTimer.setInterval(msec(std::chrono::seconds(5)));
@@ -287,12 +388,22 @@ SocksConnection::SocksConnection(QTcpSocket &socksSocket,
         abortConnection();
     });
 
+    _idleTimer.setSingleShot(true);
+    _idleTimer.setInterval(msec(idleTimeout));
+    _idleTimer.callOnTimeout(this, [this]()
+    {
+        qInfo() << "API proxy:" << this << "Closing idle connection in state"
+            << traceEnum(_state);
+        abortConnection();
+    });
+
     // Time out if initial negotiation isn't completed
     _abortTimer.start();
 }
 
 void SocksConnection::abortConnection()
 {
+    _idleTimer.stop();
     _socksSocket.abort();
     _targetSocket.abort();  // No effect if not connected
     _state = State::Closed;
@@ -363,6 +474,7 @@ void SocksConnection::forwardData(QTcpSocket &source, QTcpSocket &dest,
     auto data = source.readAll();
     if(!data.isEmpty())
     {
+        _idleTimer.start();
         auto size = dest.write(data);
         if(size != data.size())
         {
@@ -373,6 +485,83 @@ void SocksConnection::forwardData(QTcpSocket &source, QTcpSocket &dest,
     }
 }
 
+void SocksConnection::tryStartRelay()
+{
+#ifdef Q_OS_LINUX
+    _relayStartQueued = false;
+    if(_state != State::Connected)
+        return;
+
+    // Data that QTcpSocket has already read or hasn't written yet can't be
+    // relayed by splice(); keep relaying with the QTcpSockets until they're
+    // flushed.
+    if(_socksSocket.bytesAvailable() > 0 || _socksSocket.bytesToWrite() > 0 ||
+       _targetSocket.bytesAvailable() > 0 || _targetSocket.bytesToWrite() > 0)
+    {
+        return;
+    }
+
+    // Duplicate the descriptors for the relay; closing the QTcpSockets then
+    // just releases Qt's descriptors without closing the connections.
+    kapps::core::PosixFd socksFd{::dup(static_cast<int>(_socksSocket.socketDescriptor()))};
+    kapps::core::PosixFd targetFd{::dup(static_cast<int>(_targetSocket.socketDescriptor()))};
+    if(!socksFd || !targetFd)
+    {
+        qWarning() << "API proxy:" << this << "Unable to hand off sockets to relay -"
+            << errno << "- continue relaying with QTcpSocket";
+        // Don't try again, it's unlikely to succeed
+        disconnect(&_socksSocket, &QTcpSocket::bytesWritten, this, nullptr);
+        disconnect(&_targetSocket, &QTcpSocket::bytesWritten, this, nullptr);
+        return;
+    }
+    socksFd.applyClOExec();
+    targetFd.applyClOExec();
+
+    _pRelay.emplace(std::move(socksFd), std::move(targetFd),
+                    std::chrono::milliseconds{_idleTimer.interval()});
+    if(!_pRelay->valid())
+    {
+        // The relay closed the duplicates; the QTcpSockets are still intact
+        qWarning() << "API proxy:" << this << "Unable to start relay - continue relaying with QTcpSocket";
+        _pRelay.clear();
+        disconnect(&_socksSocket, &QTcpSocket::bytesWritten, this, nullptr);
+        disconnect(&_targetSocket, &QTcpSocket::bytesWritten, this, nullptr);
+        return;
+    }
+
+    qInfo() << "API proxy:" << this << "Relaying with splice()";
+    _state = State::Relaying;
+    _idleTimer.stop();
+    // The QTcpSockets no longer handle the connections; stop observing them
+    // and release their descriptors.  The SOCKS QTcpSocket is kept until the
+    // relay finishes, since it owns this SocksConnection.
+    _socksSocket.disconnect(this);
+    _targetSocket.disconnect(this);
+    _socksSocket.abort();
+    _targetSocket.abort();
+
+    connect(_pRelay.ptr(), &SpliceRelay::finished, this, [this]()
+    {
+        qInfo() << "API proxy:" << this << "Relay finished -"
+            << _pRelay->outboundBytes() << "bytes outbound,"
+            << _pRelay->inboundBytes() << "bytes inbound";
+        _state = State::Closed;
+        _socksSocket.deleteLater();
+    });
+#endif
+}
+
+void SocksConnection::queueRelayStart()
+{
+#ifdef Q_OS_LINUX
+    if(_state != State::Connected || _relayStartQueued)
+        return;
+    _relayStartQueued = true;
+    QMetaObject::invokeMethod(this, &SocksConnection::tryStartRelay,
+                              Qt::QueuedConnection);
+#endif
+}
+
 void SocksConnection::onSocksReadyRead()
 {
     while(true)
@@ -659,6 +848,7 @@ void SocksConnection::processSocksData()
             break;
         case State::Connected:
             forwardData(_socksSocket, _targetSocket, QStringLiteral("outbound"));
+            queueRelayStart();
             break;
         default:
         case State::SocksDisconnecting:
@@ -710,6 +900,7 @@ void SocksConnection::onSocksDisconnected()
         case State::Connected:
             // This is normal, SOCKS side has shut down the connection.
             _state = State::TargetDisconnecting;
+            _idleTimer.stop();
             _targetSocket.disconnectFromHost(); // Flushes data
             _abortTimer.start();
             break;
@@ -743,6 +934,7 @@ void SocksConnection::onTargetConnected()
         case State::Connecting:
         {
             _state = State::Connected;
+            _idleTimer.start();
             // Send the success reply to the SOCKS connection
             QByteArray response{ConnectResponseMsg::Length, 0};
             response[ConnectResponseMsg::Version] = SocksVersion;
@@ -769,6 +961,8 @@ void SocksConnection::onTargetConnected()
             // Could also have aborted in the first forwardData() call
             if(_state == State::Connected)
                 forwardData(_targetSocket, _socksSocket, QStringLiteral("inbound"));
+            // Hand off to the relay once everything buffered is flushed
+            queueRelayStart();
 
             break;
         }
@@ -855,6 +1049,7 @@ void SocksConnection::onTargetReadyRead()
             break;
         case State::Connected:
             forwardData(_targetSocket, _socksSocket, QStringLiteral("inbound"));
+            queueRelayStart();
             break;
         case State::SocksDisconnecting:
         case State::TargetDisconnecting:
@@ -892,6 +1087,7 @@ void SocksConnection::onTargetDisconnected()
         case State::Connected:
             // This is normal, target side has shut down the connection.
             _state = State::SocksDisconnecting;
+            _idleTimer.stop();
             _socksSocket.disconnectFromHost(); // Flushes data
             _abortTimer.start();
             break;
@@ -25,18 +25,48 @@
 #include <QTcpServer>
 #include <QTcpSocket>
 #include <QTimer>
+#include <chrono>
+
+#ifdef Q_OS_LINUX
+#include "linux/linux_splicerelay.h"
+#endif
 
 // SocksServer runs a minimal TCP SOCKS5 server that forwards connections
 // through the VPN interface.  This is used to route QNetworkAccessManager-based
 // requests through the VPN even when it is not used as the default gateway.
+//
+// Several SocksServers can share one port on Linux, each on its own thread (see
+// SocksServerThread); the kernel distributes incoming connections among them
+// with SO_REUSEPORT.
 class SocksServer : public QObject
 {
     Q_OBJECT
 
+public:
+    // Limits applied to the connections accepted by one SocksServer
+    struct Limits
+    {
+        // Maximum concurrent connections.  Once this is reached, the server
+        // stops accepting connections until one closes (new connections wait
+        // in the listen backlog).
+        int maxConnections;
+        // Connections are closed if no data are relayed in either direction
+        // for this long after connecting
+        std::chrono::milliseconds idleTimeout;
+    };
+    static const Limits defaultLimits;
+
 public:
     // Create SocksServer with the VPN IP address that it will bind to for
     // outgoing connections.  This must be a valid IPv4 address. Also provide he interface the socket will bind to.
-    SocksServer(QHostAddress bindAddress, QString bindInterface);
+    //
+    // To share a port with an existing SocksServer (Linux only), pass its port
+    // and password.  Otherwise, the server listens on a new port and generates
+    // a password.
+    SocksServer(QHostAddress bindAddress, QString bindInterface,
+                Limits limits = defaultLimits, quint16 sharedPort = 0,
+                QByteArray sharedPassword = {});
+    ~SocksServer();
 
 public:
     // Get the port that the server is listening on.  If this returns 0, the
@@ -50,15 +80,24 @@ public:
     // Update the bind address - the new address must be a valid IPv4 address.
     void updateBindAddress(QHostAddress bindAddress, QString bindInterface);
 
+    // Number of connections currently open
+    int connectionCount() const {return _connectionCount;}
+
 private:
+    // Listen on localhost.  On Linux, the listening socket allows the port to
+    // be shared with other SocksServers.
+    bool listen(quint16 port);
     void onNewConnection();
+    void onConnectionClosed();
 
 private:
     QHostAddress _bindAddress;
     QString _bindInterface;
+    Limits _limits;
     QTcpServer _server;
     QByteArray _password;
     QByteArray _passwordHash;
+    int _connectionCount;
 };
 
 // SocksConnection handles a single connection established to the SocksServer.
@@ -100,6 +139,10 @@ public:
         Connecting,
         // We are connected, relay data from both sides
         Connected,
+        // On Linux, the sockets have been handed off to a SpliceRelay, which
+        // relays data from both sides until both close.  Occurs from Connected
+        // once all data buffered by the QTcpSockets have been forwarded.
+        Relaying,
         // Waiting for the SOCKS connection to disconnect.  Occurs if the target
         // disconnects after successfully connecting, or if we send a failure to
         // the SOCKS side without having connected.
@@ -125,8 +168,11 @@ public:
     //
     // SocksConnection also destroys the QTcpSocket (and consequently, itself)
     // if the connection is closed.
+    //
+    // Once connected, the connection is closed if it's idle for idleTimeout.
     SocksConnection(QTcpSocket &socksSocket, QByteArray passwordHash,
-                    QHostAddress bindAddress, QString bindInterface);
+                    QHostAddress bindAddress, QString bindInterface,
+                    std::chrono::milliseconds idleTimeout);
 
 private:
     // Close the TCP connection(s) immediately without sending any failure
@@ -157,6 +203,14 @@ private:
     // application data).  Used by onSocksReadyRead().
     void processSocksData();
 
+    // In the Connected state on Linux, hand off both sockets to a SpliceRelay
+    // if the QTcpSockets have no buffered data left.  Otherwise, nothing
+    // happens, and this is tried again once the buffers are flushed.
+    void tryStartRelay();
+    // Queue a call to tryStartRelay(); the QTcpSockets are closed when the
+    // relay starts, which isn't safe during their signals.
+    void queueRelayStart();
+
     void onSocksReadyRead();
     void onSocksError(QTcpSocket::SocketError socketError);
     void onSocksDisconnected();
@@ -183,10 +237,20 @@ private:
     // - If either side disconnects, the other side has 5 seconds to recieve any
     //   remaining data and disconnect
     QTimer _abortTimer;
+    // In the Connected state, the connection is aborted if no data are
+    // forwarded before this timer elapses.  (In the Relaying state, the
+    // SpliceRelay has its own idle timeout.)
+    QTimer _idleTimer;
     // In Receive* states, the number of bytes in the next message.  In other
     // states, 0.
     qint64 _nextMessageBytes;
     QTcpSocket _targetSocket;
+#ifdef Q_OS_LINUX
+    // Whether a call to tryStartRelay() is queued
+    bool _relayStartQueued;
+    // In the Relaying state, the relay that owns both sockets' descriptors
+    nullable_t<SpliceRelay> _pRelay;
+#endif
 };
 
 #endif
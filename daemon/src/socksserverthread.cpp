@@ -20,10 +20,38 @@
 #line SOURCE_FILE("socksserverthread.cpp")
 
 #include "socksserverthread.h"
+#include <QThread>
 
-SocksServerThread::SocksServerThread()
-    : _port{0}
+namespace
 {
+    // Most worker threads used by default; the API proxy doesn't carry enough
+    // traffic to benefit from more
+    const unsigned maxDefaultWorkers{4};
+}
+
+unsigned SocksServerThread::defaultWorkerCount()
+{
+#ifdef Q_OS_LINUX
+    int idealThreads = QThread::idealThreadCount();
+    if(idealThreads < 1)
+        return 1;
+    return std::min(static_cast<unsigned>(idealThreads), maxDefaultWorkers);
+#else
+    return 1;
+#endif
+}
+
+SocksServerThread::SocksServerThread(unsigned workerCount,
+                                     SocksServer::Limits limits)
+    : _limits{limits}, _port{0}
+{
+#ifndef Q_OS_LINUX
+    // Ports can't be shared by several servers
+    workerCount = 1;
+#endif
+    _workers.resize(std::max(workerCount, 1u));
+    for(auto &worker : _workers)
+        worker.pThread.reset(new RunningWorkerThread{});
 }
 
 void SocksServerThread::start(QHostAddress bindAddress, QString bindInterface)
@@ -31,26 +59,27 @@ void SocksServerThread::start(QHostAddress bindAddress, QString bindInterface)
     // Checked by caller
     Q_ASSERT(bindAddress.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol);
 
-    _thread.invokeOnThread([&]()
+    Worker &firstWorker = _workers.front();
+    firstWorker.pThread->invokeOnThread([&]()
     {
-        if(_pSocksServer)
+        if(firstWorker.pSocksServer)
         {
             qInfo() << "Updating SOCKS server bind address to" << bindAddress;
             // Set the new bind address.  It does not seem possible to actually
             // reach this since the proxy is stopped when we leave the Connected
             // state, but this is here just in case.
-            _pSocksServer->updateBindAddress(bindAddress, bindInterface);
+            firstWorker.pSocksServer->updateBindAddress(bindAddress, bindInterface);
         }
         else
         {
-            _pSocksServer = new SocksServer{bindAddress, bindInterface};
-            _pSocksServer->setParent(&_thread.objectOwner());
-            _port = _pSocksServer->port();
-            _password = _pSocksServer->password();
+            firstWorker.pSocksServer = new SocksServer{bindAddress, bindInterface, _limits};
+            firstWorker.pSocksServer->setParent(&firstWorker.pThread->objectOwner());
+            _port = firstWorker.pSocksServer->port();
+            _password = firstWorker.pSocksServer->password();
             if(!_port)
             {
                 qWarning() << "Unable to start SOCKS server";
-                delete _pSocksServer.data();
+                delete firstWorker.pSocksServer.data();
             }
             else
             {
@@ -59,21 +88,53 @@ void SocksServerThread::start(QHostAddress bindAddress, QString bindInterface)
             }
         }
     });
+
+    if(!_port)
+        return;
+
+    // Start (or update) the servers sharing the port on the other workers.  If
+    // any can't start, the others still serve the port.
+    for(auto itWorker = std::next(_workers.begin()); itWorker != _workers.end(); ++itWorker)
+    {
+        Worker &worker = *itWorker;
+        worker.pThread->invokeOnThread([&]()
+        {
+            if(worker.pSocksServer)
+            {
+                worker.pSocksServer->updateBindAddress(bindAddress, bindInterface);
+                return;
+            }
+
+            worker.pSocksServer = new SocksServer{bindAddress, bindInterface,
+                                                  _limits, _port, _password};
+            worker.pSocksServer->setParent(&worker.pThread->objectOwner());
+            if(!worker.pSocksServer->port())
+            {
+                qWarning() << "Unable to start additional SOCKS server on port" << _port;
+                delete worker.pSocksServer.data();
+            }
+        });
+    }
 }
 
 void SocksServerThread::stop()
 {
-    _thread.invokeOnThread([&]()
+    bool wasRunning{false};
+    for(auto &worker : _workers)
     {
-        if(_pSocksServer)
-        {
-            qInfo() << "Stopping SOCKS server";
-            delete _pSocksServer.data();
-            _port = 0;
-        }
-        else
+        worker.pThread->invokeOnThread([&]()
         {
-            qInfo() << "SOCKS server was not running, nothing to stop";
-        }
-    });
+            if(worker.pSocksServer)
+            {
+                delete worker.pSocksServer.data();
+                wasRunning = true;
+            }
+        });
+    }
+    _port = 0;
+
+    if(wasRunning)
+        qInfo() << "Stopped SOCKS server";
+    else
+        qInfo() << "SOCKS server was not running, nothing to stop";
 }
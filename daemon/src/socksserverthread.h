@@ -25,15 +25,29 @@
 #include "socksserver.h"
 #include <common/src/thread.h>
 #include <QPointer>
+#include <memory>
+#include <vector>
 
-// SocksServerThread just runs a SocksServer on a worker thread.  The server can
-// be started and stopped.
+// SocksServerThread runs SocksServers on worker threads.  The servers can be
+// started and stopped.
+//
+// On Linux, a SocksServer runs on each of several worker threads, all sharing
+// one port, so connections are distributed among the threads instead of all
+// being handled on one thread.  Other platforms use one worker thread.
 class SocksServerThread : public QObject
 {
     Q_OBJECT
 
 public:
-    SocksServerThread();
+    // Default number of worker threads for this platform
+    static unsigned defaultWorkerCount();
+
+public:
+    // Create SocksServerThread with the given number of worker threads (at
+    // least 1; ignored on platforms that don't support shared ports) and the
+    // limits applied by each worker's SocksServer.
+    SocksServerThread(unsigned workerCount = defaultWorkerCount(),
+                      SocksServer::Limits limits = SocksServer::defaultLimits);
 
 public:
     // Start the SOCKS server, or update the bind address if it is already
@@ -48,8 +62,14 @@ public:
     const QByteArray &password() const {return _password;}
 
 private:
-    RunningWorkerThread _thread;
-    QPointer<SocksServer> _pSocksServer;
+    struct Worker
+    {
+        std::unique_ptr<RunningWorkerThread> pThread;
+        QPointer<SocksServer> pSocksServer;
+    };
+
+    std::vector<Worker> _workers;
+    SocksServer::Limits _limits;
     quint16 _port;
     QByteArray _password;
 };
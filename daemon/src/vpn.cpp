@@ -33,6 +33,7 @@
 #include <QFile>
 #include <QTextStream>
 #include <QTcpSocket>
+#include <QUdpSocket>
 #include <QTimer>
 #include <QHostInfo>
 #include <QRandomGenerator>
@@ -64,9 +65,6 @@ static std::initializer_list<const char*> g_connectionSettingNames = {
 
 namespace
 {
-    // Maximum number of measurements in _intervalMeasurements
-    const std::size_t g_maxMeasurementIntervals{32};
-
     // This seed is run by PIA Ops, this is used in addition to hnsd's
     // hard-coded seeds.  It has a static IP address but it's also resolvable
     // as hsd.londontrustmedia.com.
@@ -99,6 +97,18 @@ namespace
     // Timeout for preferred transport before starting to try alternate transports
     const std::chrono::seconds preferredTransportTimeout{30};
 
+    // Number of transports probed concurrently by a TransportRace, including
+    // the preferred transport
+    const std::size_t transportRaceWidth{4};
+
+    // Time allowed for transport probes to respond
+    const std::chrono::seconds transportProbeTimeout{3};
+
+    // OpenVPN opcode for a client's initial hard reset packet
+    // (P_CONTROL_HARD_RESET_CLIENT_V2), and the length of a session ID
+    const quint8 openvpnHardResetClientV2{7};
+    const int openvpnSessionIdLength{8};
+
     // Maximum time between bytecount intervals, if the interval exceeds this
     // limit we abandon the connection.  This is intended to detect waking from
     // sleep; see updateByteCounts()
@@ -330,7 +340,8 @@ TransportSelector::TransportSelector(const std::chrono::seconds &transportTimeou
       _lastUsed{QStringLiteral("udp"), 0}, _alternates{},
       _nextAlternate{0}, _startAlternates{-1}, _transportTimeout{transportTimeout},
       _serverIndex{0},
-      _triedAllServers{false}
+      _triedAllServers{false},
+      _raceStarted{false}
 {
 }
 
@@ -373,6 +384,9 @@ void TransportSelector::reset(const QString &protocol, uint port,
     _lastLocalAddress.clear();
     _serverIndex = 0;
     _triedAllServers = false;
+    _raceStarted = false;
+    _raceWinner.clear();
+    _raceWinnerIp.clear();
 
     if(useAlternates)
     {
@@ -430,6 +444,10 @@ const Server *TransportSelector::beginAttempt(const Location &location,
         _nextAlternate = 0;
         _startAlternates.setRemainingTime(msec(_transportTimeout));
         _useAlternateNext = false;
+        // Race again on the new network; an earlier winner is meaningless now
+        _raceStarted = false;
+        _raceWinner.clear();
+        _raceWinnerIp.clear();
     }
 
     delayNext = true;
@@ -453,7 +471,29 @@ const Server *TransportSelector::beginAttempt(const Location &location,
     // - we failed to detect a local IP address for the connection (this means
     //   we are not connected to a network right now, and we don't want to
     //   attempt an alternate transport with "any" local address)
-    if((!_triedAllServers && serverCount > 1) || _alternates.empty() || !_startAlternates.hasExpired() ||
+    //
+    // ...unless a race found an alternate transport that is reachable when the
+    // preferred transport wasn't, then try that one right away.
+    if(_raceWinner && !_lastLocalAddress.isNull())
+    {
+        _lastUsed = *_raceWinner;
+        _raceWinner.clear();
+        // Use the server that was probed if it's still in this location
+        Service service{Service::OpenVpnUdp};
+        if(_lastUsed.protocol() == QStringLiteral("tcp"))
+            service = Service::OpenVpnTcp;
+        for(const auto &server : location.servers())
+        {
+            if(server.ip() == _raceWinnerIp && server.hasPort(service, _lastUsed.port()))
+            {
+                pSelectedServer = &server;
+                break;
+            }
+        }
+        // Then continue with the preferred transport and alternates as usual
+        _useAlternateNext = false;
+    }
+    else if((!_triedAllServers && serverCount > 1) || _alternates.empty() || !_startAlternates.hasExpired() ||
        _lastLocalAddress.isNull())
     {
         _lastUsed = _selected;
@@ -506,6 +546,252 @@ const Server *TransportSelector::beginAttempt(const Location &location,
     return pSelectedServer;
 }
 
+std::vector<Transport> TransportSelector::beginRace(const Server &server,
+                                                   std::size_t count)
+{
+    std::vector<Transport> candidates;
+    if(_raceStarted || _alternates.empty() || count == 0)
+        return candidates;
+    _raceStarted = true;
+
+    // Resolve the port for this server and add the transport, unless the
+    // server doesn't have it or it's already a candidate (the alternates
+    // include "default" ports that may duplicate a listed port)
+    auto addCandidate = [&](Transport transport)
+    {
+        Service service{Service::OpenVpnUdp};
+        if(transport.protocol() == QStringLiteral("tcp"))
+            service = Service::OpenVpnTcp;
+        if(transport.port() == 0)
+            transport.port(server.defaultServicePort(service));
+        else if(!server.hasPort(service, transport.port()))
+            return;
+        if(transport.port() != 0 &&
+           std::find(candidates.begin(), candidates.end(), transport) == candidates.end())
+        {
+            candidates.push_back(std::move(transport));
+        }
+    };
+
+    addCandidate(_selected);
+    // The race's first candidate is the preferred transport, so an alternate
+    // mustn't take its place.  If this server doesn't offer the selected port,
+    // prefer the server's default port for the selected protocol.
+    if(candidates.empty() && _selected.port() != 0)
+    {
+        qInfo() << "Server" << server.ip() << "does not offer preferred port"
+            << _selected.port() << "- racing its default"
+            << _selected.protocol() << "port instead";
+        addCandidate(Transport{_selected.protocol(), 0});
+    }
+    // If it doesn't have the selected protocol at all, there's no preferred
+    // transport to race against
+    if(candidates.empty())
+    {
+        qInfo() << "Server" << server.ip() << "does not offer preferred protocol"
+            << _selected.protocol() << "- not racing transports";
+        return candidates;
+    }
+
+    // The alternates list the selected protocol first; take them from each
+    // protocol in turn
+    std::vector<const Transport*> sameProtocol, otherProtocol;
+    for(const auto &alternate : _alternates)
+    {
+        if(alternate.protocol() == _selected.protocol())
+            sameProtocol.push_back(&alternate);
+        else
+            otherProtocol.push_back(&alternate);
+    }
+    std::size_t i{0};
+    while(candidates.size() < count &&
+          (i < sameProtocol.size() || i < otherProtocol.size()))
+    {
+        if(i < sameProtocol.size())
+            addCandidate(*sameProtocol[i]);
+        if(i < otherProtocol.size() && candidates.size() < count)
+            addCandidate(*otherProtocol[i]);
+        ++i;
+    }
+
+    return candidates;
+}
+
+void TransportSelector::raceWon(const Transport &transport,
+                                const QString &serverIp)
+{
+    // The preferred transport is reachable; keep trying it as usual.  A
+    // "default" preferred port matches the server's default port, which
+    // _lastPreferred was resolved to.
+    if(transport.protocol() == _selected.protocol() &&
+       (transport.port() == _selected.port() ||
+        (_selected.port() == 0 && transport.port() == _lastPreferred.port())))
+    {
+        qInfo() << "Preferred transport" << transport.protocol()
+            << transport.port() << "won the transport race";
+        return;
+    }
+
+    qInfo() << "Alternate transport" << transport.protocol() << transport.port()
+        << "won the transport race on" << serverIp << "- trying it next";
+    _raceWinner = transport;
+    _raceWinnerIp = serverIp;
+}
+
+TransportRace::TransportRace()
+    : _preferredPending{false}
+{
+    _timeout.setSingleShot(true);
+    _timeout.setInterval(msec(transportProbeTimeout));
+    connect(&_timeout, &QTimer::timeout, this, [this]()
+    {
+        if(_alternateWinner)
+        {
+            qInfo() << "Preferred transport" << _preferred.protocol()
+                << _preferred.port() << "did not respond to" << _serverIp
+                << "within" << traceMsec(transportProbeTimeout);
+            finish(*_alternateWinner);
+            return;
+        }
+        qInfo() << "No transport responded to" << _serverIp << "within"
+            << traceMsec(transportProbeTimeout);
+        abort();
+    });
+}
+
+TransportRace::~TransportRace()
+{
+    abort();
+}
+
+void TransportRace::start(const QHostAddress &serverIp,
+                          const std::vector<Transport> &transports,
+                          const QHostAddress &localAddress)
+{
+    abort();
+
+    _serverIp = serverIp;
+    _preferred = transports.empty() ? Transport{} : transports.front();
+    _preferredPending = !transports.empty();
+    _alternateWinner.clear();
+    const QHostAddress bindAddress{localAddress.isNull() ? QHostAddress{QHostAddress::AnyIPv4} : localAddress};
+
+    for(const auto &transport : transports)
+    {
+        if(transport.protocol() == QStringLiteral("tcp"))
+        {
+            QTcpSocket *pSocket = new QTcpSocket{this};
+            _probes.push_back(pSocket);
+            connect(pSocket, &QTcpSocket::connected, this,
+                    [this, transport](){probeResponded(transport);});
+            connect(pSocket, &QTcpSocket::errorOccurred, this,
+                    [this, transport](){probeFailed(transport);});
+            if(!localAddress.isNull())
+                pSocket->bind(localAddress);
+            pSocket->connectToHost(serverIp, static_cast<quint16>(transport.port()));
+        }
+        else
+        {
+            QUdpSocket *pSocket = new QUdpSocket{this};
+            _probes.push_back(pSocket);
+            if(!pSocket->bind(bindAddress))
+            {
+                qWarning() << "Unable to bind UDP probe for port"
+                    << transport.port() << "-" << pSocket->errorString();
+                probeFailed(transport);
+                continue;
+            }
+            // An unconnected UDP socket usually doesn't report errors, so
+            // a blocked UDP probe generally just times out
+            connect(pSocket, &QUdpSocket::errorOccurred, this,
+                    [this, transport](){probeFailed(transport);});
+            connect(pSocket, &QUdpSocket::readyRead, this, [this, pSocket, transport]()
+            {
+                while(pSocket->hasPendingDatagrams())
+                {
+                    QHostAddress sender;
+                    pSocket->readDatagram(nullptr, 0, &sender);
+                    if(sender.isEqual(_serverIp, QHostAddress::TolerantConversion))
+                    {
+                        probeResponded(transport);
+                        return;
+                    }
+                }
+            });
+
+            // Hard reset with a random session ID, no acks, and packet ID 0.
+            // The server answers with P_CONTROL_HARD_RESET_SERVER_V2.
+            QByteArray hardReset;
+            hardReset.reserve(1 + openvpnSessionIdLength + 1 + 4);
+            hardReset.append(static_cast<char>(openvpnHardResetClientV2 << 3));
+            for(int i=0; i<openvpnSessionIdLength; ++i)
+                hardReset.append(static_cast<char>(QRandomGenerator::global()->bounded(256)));
+            hardReset.append('\0');
+            hardReset.append(4, '\0');
+            pSocket->writeDatagram(hardReset, serverIp, static_cast<quint16>(transport.port()));
+        }
+    }
+
+    qInfo() << "Racing" << _probes.size() << "transports to" << serverIp;
+    _timeout.start();
+}
+
+void TransportRace::abort()
+{
+    _timeout.stop();
+    for(QAbstractSocket *pSocket : _probes)
+    {
+        pSocket->disconnect(this);
+        pSocket->abort();
+        pSocket->deleteLater();
+    }
+    _probes.clear();
+}
+
+void TransportRace::probeResponded(const Transport &transport)
+{
+    // Ignore a probe completing after the race has ended
+    if(_probes.empty())
+        return;
+
+    if(transport == _preferred || !_preferredPending)
+    {
+        finish(transport);
+        return;
+    }
+
+    // Give the preferred transport until the probe timeout to respond
+    if(!_alternateWinner)
+    {
+        qInfo() << "Alternate transport" << transport.protocol()
+            << transport.port() << "responded on" << _serverIp
+            << "- waiting for preferred transport" << _preferred.protocol()
+            << _preferred.port();
+        _alternateWinner = transport;
+    }
+}
+
+void TransportRace::probeFailed(const Transport &transport)
+{
+    if(_probes.empty() || transport != _preferred || !_preferredPending)
+        return;
+
+    qInfo() << "Preferred transport" << transport.protocol()
+        << transport.port() << "failed on" << _serverIp;
+    _preferredPending = false;
+    if(_alternateWinner)
+        finish(*_alternateWinner);
+}
+
+void TransportRace::finish(const Transport &transport)
+{
+    qInfo() << "Transport" << transport.protocol() << transport.port()
+        << "won the race on" << _serverIp;
+    QString serverIp{_serverIp.toString()};
+    abort();
+    emit won(transport, serverIp);
+}
+
 QHostAddress ConnectionConfig::parseIpv4Host(const QString &host)
 {
     // The proxy address must be a literal IPv4 address, we cannot
@@ -877,6 +1163,12 @@ VPNConnection::VPNConnection(QObject* parent)
         });
     connect(&_resolverRunner, &ResolverRunner::hnsdSyncFailure, this, &VPNConnection::hnsdSyncFailure);
 
+    connect(&_transportRace, &TransportRace::won, this,
+        [this](const Transport &transport, const QString &serverIp)
+        {
+            _transportSelector.raceWon(transport, serverIp);
+        });
+
     // The succeeded/failed signals from _shadowsocksRunner are ignored.  It
     // rarely fails, particularly since it does not do much of anything until we
     // try to make a connection through it.  Most failures would be covered by
@@ -1066,6 +1358,7 @@ void VPNConnection::disconnectVPN()
     {
         _connectingConfig = {};
         _connectingServer = {};
+        _transportRace.abort();
         setState(State::Disconnecting);
         if (_method && _method->state() < VPNMethod::State::Exiting)
             _method->shutdown();
@@ -1265,12 +1558,14 @@ void VPNConnection::doConnect()
                                  _connectingConfig.automaticTransport(),
                                  _connectingConfig.vpnLocation()->allPortsForService(Service::OpenVpnUdp),
                                  _connectingConfig.vpnLocation()->allPortsForService(Service::OpenVpnTcp));
+        // Any race in progress was for the prior connection sequence
+        _transportRace.abort();
     }
 
     // Reset traffic counters since we have a new process
     _lastReceivedByteCount = 0;
     _lastSentByteCount = 0;
-    _intervalMeasurements.clear();
+    _bandwidthHistory.clear();
     emit byteCountsChanged();
 
     // Reset any running connect timer, just in case
@@ -1337,6 +1632,21 @@ void VPNConnection::doConnect()
 
     _connectingServer = *pVpnServer;
 
+    // Race the preferred and alternate transports on this server while the
+    // attempt proceeds, so a reachable alternate can be used for the next
+    // attempt if the preferred transport is blocked.  This only happens at the
+    // beginning of a connection sequence or after a network change; see
+    // TransportSelector::beginRace().
+    if(_connectingConfig.method() == ConnectionConfig::Method::OpenVPN)
+    {
+        const auto raceTransports{_transportSelector.beginRace(*pVpnServer, transportRaceWidth)};
+        if(!raceTransports.empty())
+        {
+            _transportRace.start(QHostAddress{pVpnServer->ip()}, raceTransports,
+                                 QHostAddress{QString::fromStdString(netScan.ipAddress())});
+        }
+    }
+
     switch(_connectingConfig.method())
     {
         case ConnectionConfig::Method::OpenVPN:
@@ -1575,7 +1885,7 @@ void VPNConnection::setState(State state)
         if(state == State::Disconnected)
         {
             // We have completely disconnected, drop the measurement intervals.
-            _intervalMeasurements.clear();
+            _bandwidthHistory.clear();
             emit byteCountsChanged();
 
             // Stop shadowsocks if it was running.
@@ -1663,13 +1973,13 @@ void VPNConnection::updateByteCounts(quint64 received, quint64 sent)
     _receivedByteCount += intervalReceived;
     _sentByteCount += intervalSent;
 
-    // If we've reached the maximum number of measurements, discard one before
-    // adding a new one
-    if(_intervalMeasurements.size() == g_maxMeasurementIntervals)
-        _intervalMeasurements.pop_front();
-    _intervalMeasurements.push_back({intervalReceived, intervalSent});
+    // Use the same monotonic clock as the connection timestamp
+    QElapsedTimer monotonicTimer;
+    monotonicTimer.start();
+    _bandwidthHistory.add(monotonicTimer.msecsSinceReference(), intervalReceived,
+                          intervalSent);
 
-    // The interval measurements always change even if the perpetual totals do
+    // The bandwidth history always changes even if the perpetual totals do
     // not (we added a 0,0 entry).
     emit byteCountsChanged();
 
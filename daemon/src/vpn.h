@@ -26,10 +26,12 @@
 #include <common/src/settings/daemonsettings.h>
 #include "model/state.h"
 #include "processrunner.h"
+#include "bandwidthhistory.h"
 #include <common/src/vpnstate.h>
 #include <common/src/elapsedtime.h>
 #include <common/src/async.h>
 
+#include <QAbstractSocket>
 #include <QDateTime>
 #include <QDeadlineTimer>
 #include <QElapsedTimer>
@@ -209,6 +211,22 @@ public:
     const Server *beginAttempt(const Location &location, const QHostAddress &localAddress,
                                bool &delayNext);
 
+    // Get the transports to race with reachability probes (see TransportRace)
+    // on a given server - the preferred transport, followed by up to count-1
+    // alternates, alternating between protocols so a blocked protocol doesn't
+    // occupy every probe.  Ports are resolved for this server.
+    //
+    // This returns the candidates only once for each connection sequence or
+    // network change; it's empty if a race was already started or there are no
+    // alternates (and thus nothing to learn from a race).
+    std::vector<Transport> beginRace(const Server &server, std::size_t count);
+
+    // A reachability probe to serverIp succeeded with this transport (see
+    // TransportRace::won()).  If it's an alternate, it's used for the next
+    // attempt; the other alternates still wait for the preferred transport
+    // timeout as usual.  If the preferred transport won, this has no effect.
+    void raceWon(const Transport &transport, const QString &serverIp);
+
 private:
     // The selected transport, based on the user's current settings.  This port
     // may be 0 if "default" is selected.
@@ -228,6 +246,73 @@ private:
     std::chrono::seconds  _transportTimeout;
     std::size_t _serverIndex;
     bool _triedAllServers;
+    // Whether beginRace() has provided candidates since the last reset or
+    // network change
+    bool _raceStarted;
+    // Alternate transport (and the server it was probed on) that won a race,
+    // used for the next attempt
+    nullable_t<Transport> _raceWinner;
+    QString _raceWinnerIp;
+};
+
+// TransportRace probes a few transports on a server concurrently, and reports
+// the one that should be used.  This finds a working transport on networks
+// that block the preferred transport much faster than trying alternates one
+// connection attempt at a time.
+//
+// The first transport given is the preferred transport.  An alternate that
+// responds first isn't reported until the preferred transport's probe fails
+// or the probe timeout elapses, so a preferred transport that is just a bit
+// slower isn't abandoned.
+//
+// The probes are lightweight - a TCP handshake for TCP transports, and an
+// OpenVPN hard reset packet for UDP transports (the server responds with its
+// own hard reset).  Neither establishes a session.
+class TransportRace : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("transportrace")
+
+public:
+    TransportRace();
+    ~TransportRace();
+
+public:
+    // Start a race to serverIp.  Any race in progress is aborted.  If
+    // localAddress is not null, the probes are bound to it, like the
+    // connection attempts using alternate transports (see
+    // TransportSelector::lastLocalAddress()).
+    void start(const QHostAddress &serverIp, const std::vector<Transport> &transports,
+               const QHostAddress &localAddress);
+    // Abort the current race, if any.  won() will not be emitted for it.
+    void abort();
+
+private:
+    void probeResponded(const Transport &transport);
+    void probeFailed(const Transport &transport);
+    // End the race and emit won() for this transport
+    void finish(const Transport &transport);
+
+signals:
+    // The preferred transport if it responded, otherwise the first alternate
+    // to respond once the preferred probe has failed or timed out.  Emitted at
+    // most once per race; the race ends when a transport wins or the probe
+    // timeout elapses.
+    void won(const Transport &transport, const QString &serverIp);
+
+private:
+    QHostAddress _serverIp;
+    // The preferred transport (the first one given to start()), and whether
+    // its probe is still pending
+    Transport _preferred;
+    bool _preferredPending;
+    // The first alternate that responded while the preferred probe was still
+    // pending
+    nullable_t<Transport> _alternateWinner;
+    // Sockets for the probes in the current race (owned by this object; these
+    // are deleted later since a race can end in a socket's signal)
+    std::vector<QAbstractSocket*> _probes;
+    QTimer _timeout;
 };
 
 // ConnectionConfig examines the current settings and determines how we will
@@ -542,7 +627,7 @@ public:
     State state() const { return _state; }
     quint64 bytesReceived() const { return _receivedByteCount; }
     quint64 bytesSent() const { return _sentByteCount; }
-    const std::deque<IntervalBandwidth> &intervalMeasurements() const {return _intervalMeasurements;}
+    const BandwidthHistory &bandwidthHistory() const {return _bandwidthHistory;}
     void activateMACE ();
 
     bool needsReconnect();
@@ -678,6 +763,9 @@ private:
     // zero.
     int _connectionAttemptCount;
     TransportSelector _transportSelector;
+    // Races alternate transports when a connection sequence begins (or the
+    // network changes), so a reachable one can be tried right away
+    TransportRace _transportRace;
     // When connecting with Shadowsocks, this is the server IP selected.
     // VPNConnection selects a server when starting the proxy, but it passes the
     // IP to the VPNMethod to set up routes.
@@ -687,8 +775,8 @@ private:
     quint64 _receivedByteCount, _sentByteCount;
     // Last traffic counts received from the current OpenVPN process
     quint64 _lastReceivedByteCount, _lastSentByteCount;
-    // Interval measurements for the current OpenVPN process
-    std::deque<IntervalBandwidth> _intervalMeasurements;
+    // Bandwidth measurements for the current OpenVPN process
+    BandwidthHistory _bandwidthHistory;
     // Time since the last bytecount measurement - if it comes in after the
     // abandon deadline, we assume the connection is lost and terminate it.  See
     // updateByteCounts().
@@ -256,7 +256,7 @@ void WinIcmpEcho::onEventActivated()
 
     quint32 replyAddr = ntohl(pReplyData->Address);
     if(pReplyData->Status == IP_SUCCESS)
-        emit receivedReply(replyAddr);
+        emit receivedReply(replyAddr, std::chrono::milliseconds{pReplyData->RoundTripTime});
     else if(shouldTraceIcmpError(pReplyData->Status))
     {
         qWarning() << "Received error from ICMP echo to"
@@ -25,6 +25,7 @@
 #include <common/src/win/win_util.h>
 #include <QPointer>
 #include <QWinEventNotifier>
+#include <chrono>
 #include <vector>
 #include <kapps_core/src/winapi.h>
 
@@ -62,8 +63,9 @@ private:
     void onEventActivated();
 
 signals:
-    // Emitted when the reply is received.
-    void receivedReply(quint32 address);
+    // Emitted when the reply is received, with the round trip time measured
+    // by the system.
+    void receivedReply(quint32 address, std::chrono::milliseconds roundTrip);
     void receivedError(int errCode);
 
 private:
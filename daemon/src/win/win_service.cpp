@@ -59,6 +59,10 @@ static void serviceMain(int argc, wchar_t** argv)
 
         Path::initializePostApp();
         Logger logSingleton{Path::DaemonLogFile};
+        // Write the daemon log asynchronously, so threads that log don't block on
+        // file writes
+        logSingleton.setAsyncWrites(true);
+        logSingleton.setCompressedRotation(true);
 
         WinService service;
         QObject::connect(&service, &Daemon::started, [&service]
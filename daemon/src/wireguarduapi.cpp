@@ -22,8 +22,8 @@
 #include "wireguarduapi.h"
 #include "wireguardbackend.h"
 #include <unordered_map>
-#include <cstdlib>
-#include <type_traits>
+#include <algorithm>
+#include <cstring>
 
 #if defined(Q_OS_WIN)
     #include <WinSock2.h>   // htonl(), etc.
@@ -118,20 +118,21 @@ namespace Uapi
         {protocolVersion, Key::ProtocolVersion},
     };
 
-    template<>
-    long long strToLonglong(const char *str, char **end, int base)
+    // Look up a key without copying it - QLatin1String is just a view
+    // of the slice's data
+    bool findKey(kapps::core::StringSlice name, Key &key)
     {
-        return std::strtoll(str, end, base);
-    }
-    template<>
-    unsigned long long strToLonglong(const char *str, char **end, int base)
-    {
-        return std::strtoull(str, end, base);
+        auto itKeyMatch = lookupKey.find(QLatin1String{name.data(),
+            static_cast<qsizetype>(name.size())});
+        if(itKeyMatch == lookupKey.end())
+            return false;
+        key = itKeyMatch->second;
+        return true;
     }
 
     // Parse a Wireguard key.  Does not alter the key if the value can't be
     // parsed.
-    void parseWireguardKey(const QLatin1String &value, wg_key &key)
+    void parseWireguardKey(kapps::core::StringSlice value, wg_key &key)
     {
         static_assert(CHAR_BIT == 8, "Assumed 8-bit chars");
 
@@ -145,9 +146,8 @@ namespace Uapi
             throw Error{HERE, Error::Code::Unknown};
         }
 
-        auto parseNibble = [](QLatin1Char lc) -> quint8
+        auto parseNibble = [](char c) -> quint8
         {
-            char c = lc.toLatin1();
             if(c >= '0' && c <= '9')
                 return static_cast<quint8>(c - '0');
             if(c >= 'a' && c <= 'f')
@@ -162,37 +162,38 @@ namespace Uapi
         std::copy(std::begin(parsed), std::end(parsed), std::begin(key));
     }
 
-    // Copy a non-null-terminated IP address and parse it with inet_pton()
-    void copyParseIp(int af, const char *begin, const char *end, void *dst)
+    // Copy a non-null-terminated IP address to the stack and parse it with
+    // inet_pton()
+    void copyParseIp(int af, kapps::core::StringSlice value, void *dst)
     {
         static_assert(INET6_ADDRSTRLEN >= INET_ADDRSTRLEN, "Unexpected address str lengths");
         char address[INET6_ADDRSTRLEN]{};
-        if(end - begin >= static_cast<int>(sizeof(address)))
+        if(value.size() >= sizeof(address))
             throw Error{HERE, Error::Code::Unknown};    // Address too long
-        std::copy(begin, end, std::begin(address));
+        std::copy(value.begin(), value.end(), std::begin(address));
         if(::inet_pton(af, address, dst) != 1)
             throw Error{HERE, Error::Code::Unknown};    // Address invalid
     }
 
     // Parse a peer endpoint - parses to either addr4 or addr6.
-    void parsePeerEndpoint(const QLatin1String &value, wg_peer &peer)
+    void parsePeerEndpoint(kapps::core::StringSlice value, wg_peer &peer)
     {
         // The permitted formats are:
         //  IPv4: IP:port
         //  IPv6: [IP]:port
-        if(!value.isEmpty() && value[0] == '[')
+        if(value.starts_with('['))
         {
-            auto itIpv6End = std::find(value.begin(), value.end(), ']');
+            auto ipv6EndPos = value.find(']');
             // Must be present, and must be followed by ':'
-            if(itIpv6End == value.end())
+            if(ipv6EndPos == kapps::core::StringSlice::npos)
                 throw Error{HERE, Error::Code::Unknown};
-            auto itColon = itIpv6End + 1;
-            if(itColon == value.end() || *itColon != ':')
+            auto colonPos = ipv6EndPos + 1;
+            if(colonPos >= value.size() || value[colonPos] != ':')
                 throw Error{HERE, Error::Code::Unknown};
 
             in6_addr addr6{};
-            copyParseIp(AF_INET6, value.data()+1, itIpv6End, &addr6);
-            uint16_t port = parseInt<uint16_t>(value.mid(static_cast<int>(itColon - value.begin() + 1)));
+            copyParseIp(AF_INET6, value.substr(1, ipv6EndPos-1), &addr6);
+            uint16_t port = parseInt<uint16_t>(value.substr(colonPos+1));
             // Parse succeeded, store back
             peer.endpoint.addr6.sin6_family = AF_INET6;
             peer.endpoint.addr6.sin6_port = htons(port);
@@ -200,13 +201,13 @@ namespace Uapi
         }
         else
         {
-            auto itColon = std::find(value.begin(), value.end(), ':');
-            if(itColon == value.end())
+            auto colonPos = value.find(':');
+            if(colonPos == kapps::core::StringSlice::npos)
                 throw Error{HERE, Error::Code::Unknown};
 
             in_addr addr4;
-            copyParseIp(AF_INET, value.data(), itColon, &addr4);
-            uint16_t port = parseInt<uint16_t>(value.mid(static_cast<int>(itColon - value.begin() + 1)));
+            copyParseIp(AF_INET, value.substr(0, colonPos), &addr4);
+            uint16_t port = parseInt<uint16_t>(value.substr(colonPos+1));
             // Parse succeeded
             peer.endpoint.addr4.sin_family = AF_INET;
             peer.endpoint.addr4.sin_port = htons(port);
@@ -214,26 +215,27 @@ namespace Uapi
         }
     }
 
-    void parseAllowedIp(const QLatin1String &value, wg_allowedip &ip)
+    void parseAllowedIp(kapps::core::StringSlice value, wg_allowedip &ip)
     {
         // The permitted formats is:
         //  IP/cidr
         // (for both IPv4 and IPv6)
-        auto itSlash = std::find(value.begin(), value.end(), '/');
-        if(itSlash == value.end())
+        auto slashPos = value.find('/');
+        if(slashPos == kapps::core::StringSlice::npos)
             throw Error{HERE, Error::Code::Unknown};
-        uint8_t cidr = parseInt<uint8_t>(value.mid(static_cast<int>(itSlash - value.begin() + 1)));
-        if(std::find(value.begin(), itSlash, ':') != itSlash)
+        uint8_t cidr = parseInt<uint8_t>(value.substr(slashPos+1));
+        auto address = value.substr(0, slashPos);
+        if(address.contains(':'))
         {
             in6_addr addr6;
-            copyParseIp(AF_INET6, value.begin(), itSlash, &addr6);
+            copyParseIp(AF_INET6, address, &addr6);
             ip.family = AF_INET6;
             ip.ip6 = addr6;
         }
         else
         {
             in_addr addr4;
-            copyParseIp(AF_INET, value.begin(), itSlash, &addr4);
+            copyParseIp(AF_INET, address, &addr4);
             ip.family = AF_INET;
             ip.ip4 = addr4;
         }
@@ -344,6 +346,92 @@ namespace Uapi
         message += '\n';
     }
 
+    ResponseParser::ResponseParser()
+        : _lineStart{0}, _end{0}, _discarding{false}
+    {
+    }
+
+    kapps::core::ArraySlice<char> ResponseParser::writableSpace()
+    {
+        // Move the partial line (if any) to the front of the buffer.  This is
+        // at most one line, and usually only a few bytes.
+        if(_lineStart > 0)
+        {
+            std::memmove(_buffer.data(), _buffer.data() + _lineStart,
+                         _end - _lineStart);
+            _end -= _lineStart;
+            _lineStart = 0;
+        }
+
+        // If the buffer is still full, a single line has filled it.  Discard
+        // it; the remainder will be skipped when its line break arrives.
+        if(_end == _buffer.size())
+        {
+            qWarning() << "Discarding IPC line longer than" << _buffer.size()
+                << "bytes";
+            _end = 0;
+            _discarding = true;
+        }
+
+        return {_buffer.data() + _end, _buffer.size() - _end};
+    }
+
+    void ResponseParser::commit(std::size_t count)
+    {
+        Q_ASSERT(count <= _buffer.size() - _end);  // Ensured by caller
+        _end += count;
+    }
+
+    bool ResponseParser::next(Line &line)
+    {
+        const char *pBufferEnd = _buffer.data() + _end;
+        while(_lineStart < _end)
+        {
+            const char *pLineBegin = _buffer.data() + _lineStart;
+            const char *pLineEnd = std::find(pLineBegin, pBufferEnd, '\n');
+            if(pLineEnd == pBufferEnd)
+                return false;   // Partial line, wait for more data
+
+            kapps::core::StringSlice text{pLineBegin, pLineEnd};
+            _lineStart = static_cast<std::size_t>(pLineEnd + 1 - _buffer.data());
+
+            if(_discarding)
+            {
+                // This is the end of a line that was too long, skip it
+                _discarding = false;
+                continue;
+            }
+
+            if(text.ends_with('\r'))
+                text = text.substr(0, text.size()-1);
+
+            // Empty lines indicate the end of a message
+            if(text.empty())
+            {
+                line = {};
+                return true;
+            }
+
+            // Split on '='
+            auto keyEndPos = text.find('=');
+            if(keyEndPos == kapps::core::StringSlice::npos)
+            {
+                qWarning() << "Invalid IPC line:" << qs::toQString(text);
+                continue;
+            }
+
+            line.type = LineType::Value;
+            line.name = text.substr(0, keyEndPos);
+            line.value = text.substr(keyEndPos+1);
+            if(!findKey(line.name, line.key))
+            {
+                qWarning() << "Unknown key in IPC line:" << qs::toQString(text);
+                continue;
+            }
+            return true;
+        }
+        return false;
+    }
 }
 
 WireguardIpc::WireguardIpc(std::shared_ptr<QLocalSocket> pIpcSocket)
@@ -351,10 +439,7 @@ WireguardIpc::WireguardIpc(std::shared_ptr<QLocalSocket> pIpcSocket)
 {
     Q_ASSERT(_pIpcSocket); // Ensured by caller
     connect(_pIpcSocket.get(), &QLocalSocket::readyRead, this,
-            [this]()
-            {
-                _ipcLineBuffer.append(_pIpcSocket->readAll());
-            });
+            &WireguardIpc::readIpcData);
     // The disconnected() and error() signals are handled with queued
     // connections since it's not safe to destroy the socket during its signals.
     connect(_pIpcSocket.get(), &QLocalSocket::disconnected, this,
@@ -382,9 +467,8 @@ WireguardIpc::WireguardIpc(std::shared_ptr<QLocalSocket> pIpcSocket)
     // connection immediately after QLocalSocket is notified of the last read
     // completion, which will generate a disconnect error.  If we were to queue
     // data in any way, it would deserialize those events, and the connection
-    // could be aborted before we process all the data.
-    connect(&_ipcLineBuffer, &LineBuffer::lineComplete, this,
-            &WireguardIpc::processLine);
+    // could be aborted before we process all the data.  (Lines are processed
+    // directly in readIpcData().)
 }
 
 WireguardIpc::~WireguardIpc()
@@ -394,47 +478,45 @@ WireguardIpc::~WireguardIpc()
     _pIpcSocket->disconnect(this);
 }
 
-void WireguardIpc::processLine(const QByteArray &line)
+void WireguardIpc::readIpcData()
+{
+    Q_ASSERT(_pIpcSocket);  // Class invariant
+    // Read directly into the parser's buffer and process lines in place;
+    // nothing is allocated per read or per line.
+    Uapi::ResponseParser::Line line;
+    while(true)
+    {
+        auto space = _parser.writableSpace();
+        auto read = _pIpcSocket->read(space.data(),
+                                      static_cast<qint64>(space.size()));
+        if(read <= 0)
+            break;
+        _parser.commit(static_cast<std::size_t>(read));
+        while(_parser.next(line))
+            processLine(line);
+    }
+}
+
+void WireguardIpc::processLine(const Uapi::ResponseParser::Line &line)
 {
     if(_finished)
     {
         // Don't expect data after the blank line
-        qWarning() << "Received unexpected line after finished:" << line.size()
-            << "bytes";
+        qWarning() << "Received unexpected line after finished";
         return;
     }
 
-    // Empty lines indicate the end of a message
-    if(line.isEmpty())
+    if(line.type == Uapi::ResponseParser::LineType::End)
     {
-        // Emit finish() asynchronously - QLocalSocket and LineBuffer do not
-        // expect to be destroyed during their signals.  Set _finished to ignore
-        // errors that occur from a susequent disconnect, or any excess data.
+        // Emit finish() asynchronously - QLocalSocket does not expect to be
+        // destroyed during its signals.  Set _finished to ignore errors that
+        // occur from a susequent disconnect, or any excess data.
         _finished = true;
         QMetaObject::invokeMethod(this, &WireguardIpc::finish,
                                   Qt::ConnectionType::QueuedConnection);
     }
     else
-    {
-        // Split on '='
-        auto keyEndIdx = line.indexOf('=');
-        if(keyEndIdx < 0 || keyEndIdx >= line.size())
-        {
-            qWarning() << "Invalid IPC line:" << line.data();
-            return;
-        }
-
-        QLatin1String key{line.data(), line.data()+keyEndIdx};
-        QLatin1String value{line.data()+keyEndIdx+1, line.data()+line.size()};
-        auto itKeyMatch = Uapi::lookupKey.find(key);
-        if(itKeyMatch == Uapi::lookupKey.end())
-        {
-            qWarning() << "Unknown key in IPC line:" << line.data();
-            return;
-        }
-
-        emit receivedValue(itKeyMatch->second, value);
-    }
+        emit receivedValue(line.key, line.value);
 }
 
 bool WireguardIpc::writeIpcRequest(const QByteArray &message)
@@ -555,17 +637,17 @@ WireguardConfigDeviceTask::WireguardConfigDeviceTask(std::shared_ptr<QLocalSocke
         });
 }
 
-void WireguardConfigDeviceTask::receiveValue(Uapi::Key key, const QLatin1String &value)
+void WireguardConfigDeviceTask::receiveValue(Uapi::Key key, kapps::core::StringSlice value)
 {
     if(!isPending())
     {
-        qWarning() << "Unexpected IPC value:" << traceEnum(key) << "-" << value
+        qWarning() << "Unexpected IPC value:" << traceEnum(key) << "-" << qs::toQString(value)
             << "for finished IPC task";
     }
     else if(key != Uapi::Key::ErrNo)
     {
         qWarning() << "Unexpected key type:" << traceEnum(key) << "-"
-            << value;
+            << qs::toQString(value);
         reject(Error{HERE, Error::Code::Unknown});
     }
     else
@@ -627,14 +709,14 @@ void WireguardDeviceStatusTask::ensureHasPeer()
     }
 }
 
-void WireguardDeviceStatusTask::applyValue(Uapi::Key key, const QLatin1String &value)
+void WireguardDeviceStatusTask::applyValue(Uapi::Key key, kapps::core::StringSlice value)
 {
     Q_ASSERT(_pDev);    // Class invariant
     switch(key)
     {
         default:
             qWarning() << "Unexpected key type:" << traceEnum(key) << "-"
-                << value;
+                << qs::toQString(value);
             throw Error{HERE, Error::Code::Unknown};
         case Uapi::Key::ErrNo:
             _errno = Uapi::parseInt<int>(value);
@@ -710,7 +792,7 @@ void WireguardDeviceStatusTask::applyValue(Uapi::Key key, const QLatin1String &v
     }
 }
 
-void WireguardDeviceStatusTask::receiveValue(Uapi::Key key, const QLatin1String &value)
+void WireguardDeviceStatusTask::receiveValue(Uapi::Key key, kapps::core::StringSlice value)
 {
     try
     {
@@ -718,7 +800,7 @@ void WireguardDeviceStatusTask::receiveValue(Uapi::Key key, const QLatin1String
     }
     catch(const Error &err)
     {
-        qWarning() << "Invalid IPC value:" << traceEnum(key) << "-" << value
+        qWarning() << "Invalid IPC value:" << traceEnum(key) << "-" << qs::toQString(value)
             << "error:" << err;
     }
 }
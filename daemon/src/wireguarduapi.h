@@ -23,9 +23,10 @@
 #define WIREGUARDUAPI_H
 
 #include <common/src/async.h>
-#include <common/src/linebuffer.h>
 #include "wireguardbackend.h"
+#include <kapps_core/src/stringslice.h>
 #include <QLocalSocket>
+#include <array>
 #include <memory>
 #include <deque>
 
@@ -36,68 +37,33 @@ namespace Uapi
     // Parsing and request formatting support - mainly only useful to
     // Wireguard UAPI implementation, but also covered by unit tests.
 
-    // Use either std::strtoll() or std::strtoull() based on result type
-    template<class LonglongT>
-    LonglongT strToLonglong(const char *, char **, int);
-    template<>
-    long long strToLonglong(const char *str, char **end, int base);
-    template<>
-    unsigned long long strToLonglong(const char *str, char **end, int base);
-
-    // Make a target type signed or unsigned based on a compile-time flag
-    template<class IntT, bool sign>
-    class WithSigned;
+    // Parse to any integral type (signed or unsigned).  Throws if the value
+    // cannot be parsed or is out of range for IntT.
+    //
+    // Unlike strtoll(), the value does not need to be null-terminated, so this
+    // can parse directly from a received line without copying it.  '-' is not
+    // permitted for unsigned types, and leading whitespace or '+' is not
+    // permitted (UAPI never sends those).
     template<class IntT>
-    class WithSigned<IntT, true>
+    IntT parseInt(kapps::core::StringSlice value)
     {
-    public:
-        using type = std::make_signed_t<IntT>;
-    };
-    template<class IntT>
-    class WithSigned<IntT, false>
-    {
-    public:
-        using type = std::make_unsigned_t<IntT>;
-    };
-
-    // Copy signed-ness of one integer type to another.  'type' is signed TargetT if
-    // SourceT is signed, unsigned TargetT otherwise.
-    template<class TargetT, class SourceT>
-    class SignedAs : public WithSigned<TargetT, std::is_signed<SourceT>::value> {};
-
-    // Parse to a signed or unsigned long long; throws if the value cannot be
-    // parsed (format is invalid).
-    // Currently, if the value is out of range, the minimum/max for the
-    // long long type is returned.  '-' is allowed even for parsing unsigned,
-    // the result is still negated.  (strtoll()/strtoull() provide these
-    // behaviors.)
-    template<class LonglongT>
-    LonglongT parseLonglong(const QLatin1String &value)
-    {
-        char *end{nullptr};
-        LonglongT result = strToLonglong<LonglongT>(value.data(), &end, 10);
-        // Must consume the entire string
-        if(end != value.data() + value.size())
+        try
+        {
+            return kapps::core::parseInteger<IntT>(value);
+        }
+        catch(const std::exception &)
+        {
+            // Value not traced - this might be used for sensitive values
             throw Error{HERE, Error::Code::Unknown};
-        return result;
+        }
     }
 
-    // Parse to any integral type (signed or unsigned).  Throws if the value cannot
-    // be parsed.
-    template<class IntT>
-    IntT parseInt(const QLatin1String &value)
-    {
-        auto result = parseLonglong<typename SignedAs<long long, IntT>::type>(value);
-        if(result < std::numeric_limits<IntT>::min() || result > std::numeric_limits<IntT>::max())
-            throw Error{HERE, Error::Code::Unknown};    // Out of range
-        return static_cast<IntT>(result);
-    }
     // Parse a Wireguard key.  Does not alter the key if the value can't be
     // parsed.
-    void parseWireguardKey(const QLatin1String &value, wg_key &key);
+    void parseWireguardKey(kapps::core::StringSlice value, wg_key &key);
     // Parse a peer endpoint - parses to either addr4 or addr6.
-    void parsePeerEndpoint(const QLatin1String &value, wg_peer &endpoint);
-    void parseAllowedIp(const QLatin1String &value, wg_allowedip &ip);
+    void parsePeerEndpoint(kapps::core::StringSlice value, wg_peer &endpoint);
+    void parseAllowedIp(kapps::core::StringSlice value, wg_allowedip &ip);
 
     // Append an IP address to a request
     void appendIp(QByteArray &message, const in_addr &value);
@@ -114,6 +80,60 @@ namespace Uapi
                        const sockaddr_in6 &value);
     void appendRequest(QByteArray &message, const QLatin1String &key,
                        const wg_allowedip &value);
+
+    // Streaming parser for UAPI responses.
+    //
+    // Data are read from the socket directly into a fixed buffer (see
+    // writableSpace() and commit()), then next() splits complete lines in
+    // place.  Keys and values are returned as slices of the buffer, so nothing
+    // is allocated per line; the slices remain valid until the next call to
+    // writableSpace().
+    //
+    // UAPI lines are short (the longest are keys and IPv6 endpoints), so a
+    // line that doesn't fit in the buffer is traced and discarded.
+    class ResponseParser
+    {
+    public:
+        enum class LineType
+        {
+            Value,  // A key=value line
+            End,    // A blank line, which ends the response
+        };
+
+        struct Line
+        {
+            LineType type{LineType::End};
+            Key key{};
+            // The raw key and value text; both empty for LineType::End
+            kapps::core::StringSlice name, value;
+        };
+
+        // Size of the receive buffer; this is also the longest line accepted
+        static constexpr std::size_t BufferSize = 4096;
+
+    public:
+        ResponseParser();
+
+    public:
+        // Get the free space at the end of the buffer to read more data into.
+        // This moves any partial line to the front of the buffer, which
+        // invalidates slices returned by next().  Never returns an empty slice.
+        kapps::core::ArraySlice<char> writableSpace();
+        // Indicate that 'count' bytes were written to the last writableSpace()
+        void commit(std::size_t count);
+        // Get the next complete line.  Returns false if no complete line is
+        // buffered.  Lines that can't be parsed, or that have unknown keys,
+        // are traced and skipped.
+        bool next(Line &line);
+
+    private:
+        std::array<char, BufferSize> _buffer;
+        // Start of the next line to be parsed, and end of the valid data
+        std::size_t _lineStart, _end;
+        // Set when a line exceeded the buffer; the remainder of that line is
+        // discarded when its line break is received.
+        bool _discarding;
+    };
 }
 
 // Interface to the different tasks used to implement IPC results.
@@ -128,7 +148,8 @@ public:
     ~WireguardIpc();
 
 private:
-    void processLine(const QByteArray &line);
+    void readIpcData();
+    void processLine(const Uapi::ResponseParser::Line &line);
 
 public:
     // Send the IPC request in 'message'.  Returns true if it's sent
@@ -136,8 +157,9 @@ public:
     bool writeIpcRequest(const QByteArray &message);
 
 signals:
-    // A key=value line was received
-    void receivedValue(Uapi::Key key, const QLatin1String &value);
+    // A key=value line was received.  'value' refers to the receive buffer,
+    // it is only valid during the signal.
+    void receivedValue(Uapi::Key key, kapps::core::StringSlice value);
     // Finish the task (received a blank line)
     void finish();
     // Abort the task due to loss of the IPC connection.  Not emitted after
@@ -146,7 +168,7 @@ signals:
 
 private:
     std::shared_ptr<QLocalSocket> _pIpcSocket;
-    LineBuffer _ipcLineBuffer;
+    Uapi::ResponseParser _parser;
     // This flag is set once we receive a blank line.
     // - The finish() signal is queued (see processLine()), so this ensures we
     //   don't process anything after the blank (it would not be ordered
@@ -168,7 +190,7 @@ public:
                               const wg_device &wgDev);
 
 private:
-    void receiveValue(Uapi::Key key, const QLatin1String &value);
+    void receiveValue(Uapi::Key key, kapps::core::StringSlice value);
 
 private:
     WireguardIpc _ipc;
@@ -195,8 +217,8 @@ private:
     void ensureHasPeer();
 
 public:
-    void applyValue(Uapi::Key key, const QLatin1String &value);
-    void receiveValue(Uapi::Key key, const QLatin1String &value);
+    void applyValue(Uapi::Key key, kapps::core::StringSlice value);
+    void receiveValue(Uapi::Key key, kapps::core::StringSlice value);
 
 private:
     WireguardIpc _ipc;
@@ -21,6 +21,7 @@
 #include <QUrl>
 #include <QDateTime>
 #include <common/src/builtin/path.h>
+#include <common/src/builtin/logrotator.h>
 #include "reporthelper.h"
 
 QByteArray PayloadBuilder::payloadZipContent() const
@@ -201,4 +202,16 @@ void PayloadBuilder::addLogFile(const QString &fullPath)
     if(QFile::exists(fullPath + oldFileSuffix)) {
         addLogFile(fullPath + oldFileSuffix);
     }
+
+    // Compressed generations are already complete xz files, copy them into
+    // the payload as-is rather than decompressing them into logs.txt
+    for(int generation = 1; ; ++generation) {
+        QFileInfo generationFi(LogRotator::generationPath(fullPath, generation));
+        if(!generationFi.exists())
+            break;
+        _combinedLogFile->write(QStringLiteral("\n/PIA_PART/%1\nCompressed, see logs/%1\n")
+                                .arg(generationFi.fileName()).toUtf8());
+        addFileToPayload(generationFi.filePath(),
+                         QStringLiteral("logs/%1").arg(generationFi.fileName()));
+    }
 }
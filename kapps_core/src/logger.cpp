@@ -22,6 +22,7 @@
 #include <unordered_map>
 #include <cstdio>
 #include <cstdarg>
+#include <atomic>
 
 namespace kapps { namespace core {
 
@@ -89,22 +90,138 @@ namespace
 
 namespace log
 {
+    // A parsed filter rule - see setFilterRules()
+    struct FilterRule
+    {
+        // Category pattern, without the wildcards
+        std::string _pattern;
+        bool _wildcardStart;
+        bool _wildcardEnd;
+        // Mask of levels this rule applies to (see levelBit())
+        std::uint32_t _levels;
+        bool _enable;
+    };
+
+    // Number of bits used for the level mask in LogCategory::_filterCache;
+    // the rule generation occupies the remaining bits.
+    enum : std::uint32_t
+    {
+        FilterLevelBits = 8,
+        FilterLevelMask = (1u << FilterLevelBits) - 1,
+        FilterAllLevels = FilterLevelMask,
+    };
+
+    std::uint32_t levelBit(LogMessage::Level level)
+    {
+        return 1u << static_cast<unsigned>(level);
+    }
+
     struct LogData
     {
-        // Mutex protection all parts of LogData
+        // Mutex protecting _pCallback and _filterRules
         std::mutex _dataMutex;
         // Current log callback
         std::shared_ptr<LogCallback> _pCallback;
-        // Whether logging is enabled
-        bool _enabled;
+        // Current filter rules
+        std::vector<FilterRule> _filterRules;
+        // Whether logging is enabled - read without locking _dataMutex, since
+        // this is checked for every log message.
+        std::atomic<bool> _enabled;
+        // Generation of the filter rules - incremented each time they change,
+        // so categories know to re-evaluate their cached filter state.  Starts
+        // at 1 so an unevaluated cache (0) never matches.
+        std::atomic<std::uint32_t> _filterGeneration;
     };
 
     LogData &logData()
     {
-        static LogData _data{};
+        static LogData _data{{}, {}, {}, {false}, {1}};
         return _data;
     }
 
+    // Parse a Qt-style filter rule.  Returns false if the rule is not valid.
+    bool parseFilterRule(StringSlice rule, FilterRule &parsed)
+    {
+        // Trim whitespace
+        auto isSpace = [](char c){return c == ' ' || c == '\t' || c == '\r';};
+        while(!rule.empty() && isSpace(rule.front()))
+            rule = rule.substr(1);
+        while(!rule.empty() && isSpace(rule.back()))
+            rule = rule.substr(0, rule.size()-1);
+
+        auto eqPos = rule.find('=');
+        if(eqPos == StringSlice::npos)
+            return false;
+        StringSlice value = rule.substr(eqPos+1);
+        if(value == "true")
+            parsed._enable = true;
+        else if(value == "false")
+            parsed._enable = false;
+        else
+            return false;
+
+        StringSlice pattern = rule.substr(0, eqPos);
+        parsed._levels = FilterAllLevels;
+        static const std::pair<StringSlice, LogMessage::Level> levelSuffixes[]
+        {
+            {".debug", LogMessage::Level::Debug},
+            {".info", LogMessage::Level::Info},
+            {".warning", LogMessage::Level::Warning},
+            {".critical", LogMessage::Level::Error},
+        };
+        for(const auto &suffix : levelSuffixes)
+        {
+            if(pattern.ends_with(suffix.first))
+            {
+                parsed._levels = levelBit(suffix.second);
+                pattern = pattern.substr(0, pattern.size() - suffix.first.size());
+                break;
+            }
+        }
+
+        parsed._wildcardStart = pattern.starts_with('*');
+        if(parsed._wildcardStart)
+            pattern = pattern.substr(1);
+        parsed._wildcardEnd = pattern.ends_with('*');
+        if(parsed._wildcardEnd)
+            pattern = pattern.substr(0, pattern.size()-1);
+        // Wildcards are only permitted at the beginning and end
+        if(pattern.contains('*'))
+            return false;
+        parsed._pattern = pattern.to_string();
+        return true;
+    }
+
+    bool ruleMatches(const FilterRule &rule, const StringSlice &name)
+    {
+        StringSlice pattern{rule._pattern};
+        if(rule._wildcardStart && rule._wildcardEnd)
+            return name.contains(pattern);
+        if(rule._wildcardStart)
+            return name.ends_with(pattern);
+        if(rule._wildcardEnd)
+            return name.starts_with(pattern);
+        return name == pattern;
+    }
+
+    // Evaluate the filter rules for a category; returns the mask of enabled
+    // levels.  Requires _dataMutex.
+    std::uint32_t evaluateFilterRules(const LogData &data, const StringSlice &name)
+    {
+        std::uint32_t enabledLevels = FilterAllLevels;
+        for(const auto &rule : data._filterRules)
+        {
+            if(!ruleMatches(rule, name))
+                continue;
+            if(rule._enable)
+                enabledLevels |= rule._levels;
+            else
+                enabledLevels &= ~rule._levels;
+        }
+        // Fatal messages are always enabled
+        return enabledLevels | levelBit(LogMessage::Level::Fatal);
+    }
+
     void init(std::shared_ptr<LogCallback> pCallback)
     {
         auto &data = logData();
@@ -115,27 +232,74 @@ namespace log
 
     void enableLogging(bool enable)
     {
-        auto &data = logData();
-        mutex_lock l{data._dataMutex};
-
-        data._enabled = enable;
+        logData()._enabled.store(enable, std::memory_order_relaxed);
     }
 
     bool loggingEnabled()
     {
+        return logData()._enabled.load(std::memory_order_relaxed);
+    }
+
+    void setFilterRules(const std::vector<std::string> &rules)
+    {
+        std::vector<FilterRule> parsedRules;
+        parsedRules.reserve(rules.size());
+        for(const auto &rule : rules)
+        {
+            FilterRule parsed{};
+            if(parseFilterRule(rule, parsed))
+                parsedRules.push_back(std::move(parsed));
+        }
+
         auto &data = logData();
         mutex_lock l{data._dataMutex};
+        data._filterRules = std::move(parsedRules);
+        // Invalidate all cached filter states.  The generation wraps around
+        // within the bits available in the cache, skipping 0.
+        std::uint32_t nextGen = (data._filterGeneration.load(std::memory_order_relaxed) + 1)
+            & (~std::uint32_t{0} >> FilterLevelBits);
+        if(nextGen == 0)
+            nextGen = 1;
+        data._filterGeneration.store(nextGen, std::memory_order_relaxed);
+    }
+
+    bool levelEnabled(const LogCategory &category, LogMessage::Level level)
+    {
+        auto &data = logData();
+        if(!data._enabled.load(std::memory_order_relaxed))
+            return false;
 
-        return data._enabled;
+        std::uint32_t generation = data._filterGeneration.load(std::memory_order_relaxed);
+        std::uint32_t cache = category.filterCache().load(std::memory_order_relaxed);
+        if((cache >> FilterLevelBits) != generation)
+        {
+            // Rules changed (or were never evaluated for this category),
+            // evaluate them now.  This happens at most once per category per
+            // rule change.
+            mutex_lock l{data._dataMutex};
+            generation = data._filterGeneration.load(std::memory_order_relaxed);
+            cache = (generation << FilterLevelBits) |
+                evaluateFilterRules(data, category.name());
+            category.filterCache().store(cache, std::memory_order_relaxed);
+        }
+
+        return cache & levelBit(level);
     }
 
     void write(LogMessage msg)
     {
-        auto &data = logData();
-        mutex_lock l{data._dataMutex};
+        std::shared_ptr<LogCallback> pCallback;
+        {
+            auto &data = logData();
+            mutex_lock l{data._dataMutex};
+            pCallback = data._pCallback;
+        }
 
-        if(data._pCallback)
-            data._pCallback->write(std::move(msg));
+        // Invoke the callback without holding _dataMutex, so writing a message
+        // doesn't block other threads checking filters or formatting messages.
+        // The callback is responsible for its own synchronization.
+        if(pCallback)
+            pCallback->write(std::move(msg));
         // Otherwise, discard the message.  We could consider counting discarded
         // messages and tracing that count when a callback is installed to
         // validate that we're not missing tracing during initialization.
@@ -343,8 +507,9 @@ LogWriter::LogWriter(SourceLocation loc, LogMessage::Level level,
       _category{pManualCategory ? *pManualCategory : loc.category()},
       _spacesEnabled{true}, _spaceBeforeNext{false}
 {
-    // Skip the message entirely if logging is not enabled
-    if(log::loggingEnabled())
+    // Skip the message entirely if logging is not enabled, or if this category
+    // and level are filtered out
+    if(log::levelEnabled(_category, _level))
     {
         _pMsg.emplace(std::ios_base::out);
     }
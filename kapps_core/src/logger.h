@@ -33,6 +33,8 @@
 #include <vector>
 #include <unordered_set>
 #include <type_traits>
+#include <atomic>
+#include <cstdint>
 
 // **********
 // * Logger *
@@ -202,10 +204,10 @@ private:
 // should almost always be string literals - the string must outlive the
 // LogCategory.
 //
-// Currently this is just emitted in logs - there is no way to filter individual
-// categories, etc.  However, for consistency with Qt categories and for
-// possible future expansion, category names should generally be "dotted label"
-// identifiers following these rules:
+// Categories are emitted in logs, and messages can be filtered by category and
+// level with log::setFilterRules() (using the same rule format as Qt logging
+// categories).  For consistency with Qt categories, category names should
+// generally be "dotted label" identifiers following these rules:
 //
 // - Use alphanumerics and basic punctuation like dash(-) / underscore (_),
 //   avoid other characters (especially asterisk(*), space, or equal(=), these
@@ -222,6 +224,13 @@ public:
     LogCategory(const LogModule &module, const StringSlice &name) : _pModule{&module}, _name{name} {}
     // Define a LogCategory by looking up the default module for a file
     LogCategory(const StringSlice &refFile, const StringSlice &name);
+    // The filter cache isn't copied, the copy evaluates the filter rules again
+    LogCategory(const LogCategory &other)
+        : _pModule{other._pModule}, _name{other._name}, _filterCache{0}
+    {}
+
+private:
+    LogCategory &operator=(const LogCategory &) = delete;
 
 public:
     // operator() is used in the manualLogCategory() lookup; if
@@ -241,9 +250,17 @@ public:
         os << '.' << name();
     }
 
+    // Get the cached filter state for this category; see log::levelEnabled().
+    // This can be read/written from any thread.
+    std::atomic<std::uint32_t> &filterCache() const {return _filterCache;}
+
 private:
     const LogModule *_pModule;
     StringSlice _name;
+    // Cached result of evaluating the filter rules for this category - the
+    // rule generation in the upper bits, and a mask of enabled levels in the
+    // low bits.  0 indicates the rules haven't been evaluated yet.
+    mutable std::atomic<std::uint32_t> _filterCache{0};
 };
 
 // Specifies a specific location in a source file - used for trace references
@@ -355,6 +372,27 @@ namespace log
     void KAPPS_CORE_EXPORT enableLogging(bool enable);
     bool KAPPS_CORE_EXPORT loggingEnabled();
 
+    // Set the category filter rules.  These use the same format as Qt logging
+    // rules, one rule per entry:
+    //    <category>[.<level>]=true|false
+    //
+    // The category can begin and/or end with '*' as a wildcard; the level is
+    // one of 'debug', 'info', 'warning', or 'critical' (critical applies to
+    // the Error level).  If no level is given, the rule applies to all levels.
+    // Later rules take precedence over earlier rules.  Levels that don't match
+    // any rule are enabled.  Fatal messages are never filtered.  Invalid rules
+    // are ignored.
+    //
+    // Rules are matched against the category name (not including the module).
+    void KAPPS_CORE_EXPORT setFilterRules(const std::vector<std::string> &rules);
+
+    // Check whether messages at a particular level are enabled for a category,
+    // considering both loggingEnabled() and the filter rules.  The result is
+    // cached in the category, so this is just a few relaxed atomic loads in
+    // the common case; it's checked before rendering any log message.
+    bool KAPPS_CORE_EXPORT levelEnabled(const LogCategory &category,
+                                        LogMessage::Level level);
+
 
     // A stringstream used to construct log messages.  This just allows
     // specializations of operator<<() to be defined in the kapps::core::log
@@ -470,7 +508,8 @@ class KAPPS_CORE_EXPORT LogWriter
 {
 public:
     // When creating a LogWriter, it checks whether logging is currently
-    // enabled.  If it isn't, then the message is not rendered - calls to
+    // enabled for this category and level (see log::levelEnabled()).  If it
+    // isn't, then the message is not rendered - calls to
     // operator<<(std::ostream &, <value>) are skipped.  See the logging macros
     // below for more details.
     //
@@ -627,7 +666,8 @@ template<typename... Args> static inline const ::kapps::core::LogCategory *manua
 // logging will cause crashes, etc., and minimizes fragile macro trickery.)
 //
 // Although the parameters are always evaluated, the actual rendering of the
-// message is skipped if logging is disabled, which should eliminate most of the
+// message is skipped if logging is disabled (or if the message's category and
+// level are filtered out by log::setFilterRules()), which should eliminate most of the
 // performance impact of logging when disabled without fragility/trickery in the
 // macros themselves.  If a log message does have an unavoidable performance,
 // make sure the hard work is done by operator<<() rather than by the
@@ -0,0 +1,190 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#include "stringredactor.h"
+#include <algorithm>
+#include <deque>
+
+namespace kapps { namespace core {
+
+StringRedactor::StringRedactor()
+{
+    _states.push_back({{}, rootState, rootState, noPattern, 0});
+    _rootNext.fill(rootState);
+}
+
+StringRedactor::StringRedactor(std::vector<Redaction> redactions)
+    : StringRedactor{}
+{
+    _redactions.reserve(redactions.size());
+
+    // Build the trie of all patterns
+    for(auto &redaction : redactions)
+    {
+        if(redaction.first.empty())
+            continue;
+
+        StateIdx state = rootState;
+        for(char c : redaction.first)
+        {
+            auto uc = static_cast<unsigned char>(c);
+            StateIdx next = findChild(state, uc);
+            if(next == rootState)
+            {
+                next = static_cast<StateIdx>(_states.size());
+                _states.push_back({{}, rootState, rootState, noPattern,
+                                   _states[state].depth + 1});
+                _states[state].children.emplace_back(uc, next);
+            }
+            state = next;
+        }
+
+        // A duplicate pattern replaces the earlier replacement
+        if(_states[state].pattern != noPattern)
+            _redactions[_states[state].pattern].second = std::move(redaction.second);
+        else
+        {
+            _states[state].pattern = _redactions.size();
+            _redactions.push_back(std::move(redaction));
+        }
+    }
+
+    for(const auto &child : _states[rootState].children)
+        _rootNext[child.first] = child.second;
+
+    // Compute failure and dictionary links breadth-first, so each state's
+    // failure state (which is shallower) is complete before the state itself.
+    std::deque<StateIdx> queue;
+    for(const auto &child : _states[rootState].children)
+        queue.push_back(child.second);  // fail/dictLink are already the root
+    while(!queue.empty())
+    {
+        StateIdx state = queue.front();
+        queue.pop_front();
+        for(const auto &child : _states[state].children)
+        {
+            StateIdx fail = step(_states[state].fail, child.first);
+            State &childState = _states[child.second];
+            childState.fail = fail;
+            childState.dictLink = (_states[fail].pattern != noPattern) ?
+                fail : _states[fail].dictLink;
+            queue.push_back(child.second);
+        }
+    }
+}
+
+auto StringRedactor::findChild(StateIdx state, unsigned char c) const -> StateIdx
+{
+    for(const auto &child : _states[state].children)
+    {
+        if(child.first == c)
+            return child.second;
+    }
+    return rootState;
+}
+
+auto StringRedactor::step(StateIdx state, unsigned char c) const -> StateIdx
+{
+    while(state != rootState)
+    {
+        StateIdx next = findChild(state, c);
+        if(next != rootState)
+            return next;
+        state = _states[state].fail;
+    }
+    return _rootNext[c];
+}
+
+std::string StringRedactor::redact(StringSlice text) const
+{
+    if(_redactions.empty())
+        return text.to_string();
+
+    std::string result;
+    // Text has been copied to result up to this position
+    std::size_t copiedTo = 0;
+    // The best match found that hasn't been replaced yet.  It's replaced once
+    // no match starting at or before it could be found.
+    std::size_t pendingStart = 0, pendingPattern = noPattern;
+
+    std::size_t i = 0;
+    StateIdx state = rootState;
+    // Replace the pending match, then resume scanning after it.  Scanning
+    // restarts from the root state so matches that overlap the pending match
+    // aren't considered, but matches that begin after it are found even if
+    // they were already passed while looking for a longer pending match.
+    auto replacePending = [&]()
+    {
+        const auto &redaction = _redactions[pendingPattern];
+        if(result.empty())
+            result.reserve(text.size());
+        result.append(text.data() + copiedTo, pendingStart - copiedTo);
+        result += redaction.second;
+        copiedTo = pendingStart + redaction.first.size();
+        pendingPattern = noPattern;
+        i = copiedTo;
+        state = rootState;
+    };
+
+    while(true)
+    {
+        if(i == text.size())
+        {
+            if(pendingPattern == noPattern)
+                break;
+            replacePending();
+            continue;
+        }
+
+        state = step(state, static_cast<unsigned char>(text[i]));
+
+        // Any match ending here or later starts at or after (i+1-depth).  If
+        // that's past the pending match, nothing can preempt it.
+        if(pendingPattern != noPattern && i + 1 - _states[state].depth > pendingStart)
+        {
+            replacePending();
+            continue;
+        }
+
+        // Consider all patterns ending here; prefer the leftmost, then longest
+        StateIdx output = (_states[state].pattern != noPattern) ? state : _states[state].dictLink;
+        while(output != rootState)
+        {
+            std::size_t start = i + 1 - _states[output].depth;
+            if(pendingPattern == noPattern || start < pendingStart ||
+               (start == pendingStart &&
+                _states[output].depth > _redactions[pendingPattern].first.size()))
+            {
+                pendingStart = start;
+                pendingPattern = _states[output].pattern;
+            }
+            output = _states[output].dictLink;
+        }
+        ++i;
+    }
+
+    // If nothing matched, just copy the text
+    if(copiedTo == 0)
+        return text.to_string();
+
+    result.append(text.data() + copiedTo, text.size() - copiedTo);
+    return result;
+}
+
+}}
@@ -0,0 +1,98 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+#include <kapps_core/core.h>
+#include "stringslice.h"
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kapps { namespace core {
+
+// StringRedactor replaces any number of fixed patterns in text with their
+// replacements in a single pass over the text.  This is used for log
+// redactions, where the set of patterns changes rarely but every log message
+// has to be scanned.
+//
+// The patterns are compiled into an Aho-Corasick automaton when the redactor
+// is constructed, so redacting a string is linear in the length of the text
+// (plus the number of matches), regardless of the number of patterns.
+//
+// Text is matched as bytes, so UTF-8 text can be redacted without converting
+// it.  When matches overlap, the leftmost match is replaced, and the longest
+// pattern is preferred among matches starting at the same position.
+// Replacement text is never re-scanned for other patterns.
+class KAPPS_CORE_EXPORT StringRedactor
+{
+public:
+    // A pattern and its replacement
+    using Redaction = std::pair<std::string, std::string>;
+
+private:
+    using StateIdx = std::uint32_t;
+    // Index of the root state; also used to indicate "no state" for
+    // dictionary links since the root never has an output.
+    static constexpr StateIdx rootState = 0;
+    // Indicates that a state is not the end of any pattern
+    static constexpr std::size_t noPattern = static_cast<std::size_t>(-1);
+
+    struct State
+    {
+        // Transitions to child states, in no particular order.  Most states
+        // have only one child, so a small vector is more compact and faster
+        // than a map.
+        std::vector<std::pair<unsigned char, StateIdx>> children;
+        // Failure link - longest proper suffix that is also a state
+        StateIdx fail;
+        // Dictionary link - longest proper suffix that ends a pattern
+        StateIdx dictLink;
+        // The pattern ending at this state, or noPattern
+        std::size_t pattern;
+        // Length of the text matched to reach this state
+        std::size_t depth;
+    };
+
+public:
+    // Create a redactor with no patterns; redact() returns text unchanged.
+    StringRedactor();
+    // Compile the patterns given.  Empty patterns are ignored.  If a pattern
+    // is specified more than once, the last replacement is used.
+    StringRedactor(std::vector<Redaction> redactions);
+
+private:
+    StateIdx findChild(StateIdx state, unsigned char c) const;
+    StateIdx step(StateIdx state, unsigned char c) const;
+
+public:
+    bool empty() const {return _redactions.empty();}
+
+    // Redact text; returns the text with all patterns replaced.
+    std::string redact(StringSlice text) const;
+
+private:
+    std::vector<Redaction> _redactions;
+    std::vector<State> _states;
+    // The root has a transition for every byte, look these up directly
+    std::array<StateIdx, 256> _rootNext;
+};
+
+}}
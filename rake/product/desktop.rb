@@ -30,6 +30,7 @@ module PiaDesktop
             .use(versionlib.export, :export)
             .use(kappsModules[:core].export, :export)
             .use(kappsModules[:regions].export, :export)
+            .use(deps[:lzma].export)
             .useQt('Network', :export)
             .tap {|v| PiaBreakpad::add(v)}
             .install(stage, :lib)
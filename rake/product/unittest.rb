@@ -8,8 +8,12 @@ module PiaUnitTest
     Tests = [
         'any',
         'apiclient',
+        'bandwidthhistory',
         'check',
+        'clientconnection',
         'connectionconfig',
+        'core_logfilter',
+        'core_stringredactor',
         'core_util',
         'exec',
         'ipaddress',
@@ -20,6 +24,7 @@ module PiaUnitTest
         'latencytracker',
         'linebuffer',
         'localsockets',
+        'logrotator',
         'nearestlocations',
         'networkmonitor',
         'networktaskwithretry',
@@ -29,12 +34,14 @@ module PiaUnitTest
         'openssl',
         'path',
         'portforwarder',
+        'propertywriter',
         'raii',
         'regionlist',
         'retainshared',
         'semversion',
         'servicegroup',
         'settings',
+        'socksserver',
         'subnetbypass',
         'tasks',
         'transportselector',
@@ -47,8 +54,11 @@ module PiaUnitTest
             t << 'wfp_filters'
         elsif Build.linux?
             t << 'core_fs'
+            t << 'posixping'
+            t << 'splicerelay'
             t << 'splitdnsinfo'
             t << 'rt_tables_initializer'
+            t << 'wgstats'
         elsif Build.macos?
            t << 'core_fs'
            t << 'constrainedhash'
@@ -100,6 +110,7 @@ module PiaUnitTest
             .use(versionlib.export, :export)
             .use(deps[:jsonmcpp], :export)
             .use(deps[:embeddablewg].export, :export)
+            .use(deps[:lzma].export, :export)
             .coverage(true) # Generate coverage information when possible
         if(Build.windows?)
             allTestsLib
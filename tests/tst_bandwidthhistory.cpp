@@ -0,0 +1,165 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include <common/src/common.h>
+#include "daemon/src/bandwidthhistory.h"
+#include <QtTest>
+
+namespace
+{
+    using Resolution = BandwidthHistory::Resolution;
+
+    const qint64 minuteMs{60 * 1000};
+    const qint64 hourMs{60 * minuteMs};
+}
+
+class tst_bandwidthhistory : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Samples record the interval since the previous sample
+    void samples()
+    {
+        BandwidthHistory history;
+        history.add(1000, 10, 1);
+        history.add(2000, 20, 2);
+        const auto &last = history.add(3500, 30, 3);
+
+        QCOMPARE(last.seq, 3u);
+        QCOMPARE(last.timestamp, 2000);
+        QCOMPARE(last.duration, 1500);
+
+        auto entries = history.window(Resolution::Sample, 0, 10);
+        QCOMPARE(entries.size(), 3u);
+        QCOMPARE(entries[0].seq, 1u);
+        QCOMPARE(entries[0].duration, 0);
+        QCOMPARE(entries[1].received, 20u);
+        QCOMPARE(entries[2].sent, 3u);
+    }
+
+    // The ring keeps only the newest entries once it fills
+    void ringCapacity()
+    {
+        BandwidthHistory history{4, 4, 4};
+        for(qint64 i = 1; i <= 10; ++i)
+            history.add(i * 1000, static_cast<quint64>(i), 0);
+
+        QCOMPARE(history.size(Resolution::Sample), 4u);
+        auto entries = history.window(Resolution::Sample, 0, 10);
+        QCOMPARE(entries.size(), 4u);
+        for(std::size_t i = 0; i < entries.size(); ++i)
+        {
+            QCOMPARE(entries[i].seq, 7u + i);
+            QCOMPARE(entries[i].received, 7u + i);
+        }
+    }
+
+    // Windows start after the given sequence number and are limited to the
+    // newest entries
+    void window()
+    {
+        BandwidthHistory history{8, 4, 4};
+        for(qint64 i = 1; i <= 12; ++i)
+            history.add(i * 1000, static_cast<quint64>(i), 0);
+        // Entries 5-12 are retained
+
+        auto entries = history.window(Resolution::Sample, 9, 100);
+        QCOMPARE(entries.size(), 3u);
+        QCOMPARE(entries.front().seq, 10u);
+
+        entries = history.window(Resolution::Sample, 0, 2);
+        QCOMPARE(entries.size(), 2u);
+        QCOMPARE(entries.front().seq, 11u);
+        QCOMPARE(entries.back().seq, 12u);
+
+        // Sequence numbers before the ring begin all of the retained entries
+        entries = history.window(Resolution::Sample, 2, 100);
+        QCOMPARE(entries.size(), 8u);
+        QCOMPARE(entries.front().seq, 5u);
+
+        // Nothing newer than the newest entry
+        QVERIFY(history.window(Resolution::Sample, 12, 100).empty());
+        QVERIFY(history.window(Resolution::Sample, 50, 100).empty());
+    }
+
+    // Samples roll up into minutes, and minutes into hours
+    void rollups()
+    {
+        BandwidthHistory history;
+        // Two samples in the first minute, one in the second, one in the
+        // fourth (the third minute has no samples)
+        history.add(10 * 1000, 100, 10);
+        history.add(50 * 1000, 200, 20);
+        history.add(minuteMs + 5000, 300, 30);
+        // The second minute isn't complete until a later sample arrives
+        QCOMPARE(history.size(Resolution::Minute), 1u);
+        history.add(3 * minuteMs + 5000, 400, 40);
+
+        auto minutes = history.window(Resolution::Minute, 0, 10);
+        QCOMPARE(minutes.size(), 2u);
+        QCOMPARE(minutes[0].seq, 1u);
+        QCOMPARE(minutes[0].timestamp, 0);
+        QCOMPARE(minutes[0].duration, minuteMs);
+        QCOMPARE(minutes[0].received, 300u);
+        QCOMPARE(minutes[0].sent, 30u);
+        QCOMPARE(minutes[1].seq, 2u);
+        QCOMPARE(minutes[1].timestamp, minuteMs);
+        QCOMPARE(minutes[1].received, 300u);
+
+        // The first hour is still open
+        QCOMPARE(history.size(Resolution::Hour), 0u);
+        history.add(hourMs + 1000, 500, 50);
+        // Completes the fourth minute, then the next minute completes the hour
+        history.add(hourMs + minuteMs + 1000, 600, 60);
+
+        auto hours = history.window(Resolution::Hour, 0, 10);
+        QCOMPARE(hours.size(), 1u);
+        QCOMPARE(hours[0].timestamp, 0);
+        QCOMPARE(hours[0].duration, hourMs);
+        QCOMPARE(hours[0].received, 1000u);
+        QCOMPARE(hours[0].sent, 100u);
+    }
+
+    // Clearing discards entries but continues the sequence numbers
+    void clear()
+    {
+        BandwidthHistory history;
+        history.add(1000, 1, 1);
+        history.add(2000, 2, 2);
+        history.add(minuteMs + 1000, 3, 3);
+        history.clear();
+
+        QCOMPARE(history.size(Resolution::Sample), 0u);
+        QCOMPARE(history.size(Resolution::Minute), 0u);
+        QVERIFY(history.window(Resolution::Sample, 0, 10).empty());
+
+        const auto &sample = history.add(5 * minuteMs, 4, 4);
+        QCOMPARE(sample.seq, 4u);
+        // The duration is unknown after clearing
+        QCOMPARE(sample.duration, 0);
+        // The open rollup was discarded, so this sample starts a new minute
+        history.add(6 * minuteMs, 5, 5);
+        auto minutes = history.window(Resolution::Minute, 0, 10);
+        QCOMPARE(minutes.size(), 1u);
+        QCOMPARE(minutes[0].seq, 2u);
+        QCOMPARE(minutes[0].received, 4u);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_bandwidthhistory)
+#include TEST_MOC
@@ -0,0 +1,154 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include <QtTest>
+
+#include "daemon/src/daemon.h"
+#include <common/src/ipc.h>
+#include <common/src/jsonrpc.h>
+#include <QCborValue>
+
+namespace
+{
+    // IPCConnection that just records the messages sent to the client.
+    // Messages from the client are simulated by emitting messageReceived().
+    class TestIPCConnection : public IPCConnection
+    {
+    public:
+        using IPCConnection::IPCConnection;
+
+        virtual bool isConnected() override {return true;}
+        virtual void setLagThreshold(int) override {}
+        virtual void sendMessage(const QByteArray &msg) override {sent.push_back(msg);}
+        virtual void close() override {}
+
+        std::vector<QByteArray> sent;
+    };
+}
+
+class tst_clientconnection : public QObject
+{
+    Q_OBJECT
+
+    // Like Daemon, the test RPCs defer the initial data for setSubscription
+    // and select the encoding for setRpcEncoding.  The initial data sent in
+    // response to initialDataDue() are just an empty "data" notification.
+    LocalMethodRegistry _registry{
+        {QStringLiteral("setSubscription"), [](const QJsonValue &)
+            {
+                ClientConnection::getInvokingClient()->deferInitialData();
+            }},
+        {QStringLiteral("setRpcEncoding"), [](const QString &encoding)
+            {
+                ClientConnection::getInvokingClient()->setEncoding(
+                    encoding == QStringLiteral("cbor") ? JsonRPCEncoding::Cbor : JsonRPCEncoding::Json);
+            }},
+        {QStringLiteral("connectVPN"), []{}}
+    };
+
+    // Send a notification from the client
+    void receive(IPCConnection &connection, const QString &method, const QJsonArray &params)
+    {
+        RemoteNotificationInterface remote;
+        connect(&remote, &RemoteNotificationInterface::messageReady,
+                &connection, &IPCConnection::messageReceived);
+        remote.postWithParams(method, params);
+    }
+
+    void trackInitialData(ClientConnection &client, int &count)
+    {
+        connect(&client, &ClientConnection::initialDataDue, this, [&client, &count]()
+        {
+            // Only the first emission is relevant; the test doesn't set
+            // getInitialDataSent() like Daemon does
+            if(count++ == 0)
+                client.post(QStringLiteral("data"), QJsonObject{});
+        });
+    }
+
+private slots:
+    // A client that subscribes before negotiating CBOR receives the initial
+    // data in CBOR.
+    void subscribeThenNegotiate()
+    {
+        TestIPCConnection connection{nullptr};
+        ClientConnection client{&connection, &_registry};
+        int initialDataCount{0};
+        trackInitialData(client, initialDataCount);
+
+        receive(connection, QStringLiteral("setSubscription"),
+                {QJsonObject{{QStringLiteral("state"), QJsonArray{QStringLiteral("connectionState")}}}});
+        QCOMPARE(initialDataCount, 0);
+        QVERIFY(connection.sent.empty());
+
+        receive(connection, QStringLiteral("setRpcEncoding"), {QStringLiteral("cbor")});
+        QCOMPARE(initialDataCount, 1);
+        QCOMPARE(connection.sent.size(), 1u);
+        QCborValue data = QCborValue::fromCbor(connection.sent.front());
+        QVERIFY(data.isMap());
+        QCOMPARE(data[QStringLiteral("method")].toString(), QStringLiteral("data"));
+    }
+
+    // A client that subscribes and then sends something other than
+    // setRpcEncoding receives the initial data in JSON at that point.
+    void subscribeWithoutNegotiating()
+    {
+        TestIPCConnection connection{nullptr};
+        ClientConnection client{&connection, &_registry};
+        int initialDataCount{0};
+        trackInitialData(client, initialDataCount);
+
+        receive(connection, QStringLiteral("setSubscription"), {QJsonValue{}});
+        QCOMPARE(initialDataCount, 0);
+
+        receive(connection, QStringLiteral("connectVPN"), {});
+        QCOMPARE(initialDataCount, 1);
+        QCOMPARE(connection.sent.size(), 1u);
+        QVERIFY(connection.sent.front().startsWith('{'));
+    }
+
+    // A client whose first message is anything else receives the initial data
+    // right away.
+    void nonNegotiatingFirstMessage()
+    {
+        TestIPCConnection connection{nullptr};
+        ClientConnection client{&connection, &_registry};
+        int initialDataCount{0};
+        trackInitialData(client, initialDataCount);
+
+        receive(connection, QStringLiteral("connectVPN"), {});
+        QCOMPARE(initialDataCount, 1);
+    }
+
+    // A client that doesn't send anything receives the initial data after a
+    // short timeout.
+    void silentClient()
+    {
+        TestIPCConnection connection{nullptr};
+        ClientConnection client{&connection, &_registry};
+        int initialDataCount{0};
+        trackInitialData(client, initialDataCount);
+
+        QCOMPARE(initialDataCount, 0);
+        QTRY_COMPARE(initialDataCount, 1);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_clientconnection)
+#include TEST_MOC
@@ -0,0 +1,132 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <QtTest>
+#include <kapps_core/src/logger.h>
+
+using kapps::core::LogCategory;
+using kapps::core::LogMessage;
+namespace corelog = kapps::core::log;
+
+namespace
+{
+    const LogCategory dnsCategory{__FILE__, "net.dns"};
+    const LogCategory httpCategory{__FILE__, "net.http"};
+    const LogCategory appCategory{__FILE__, "app.main"};
+
+    bool enabled(const LogCategory &category, LogMessage::Level level)
+    {
+        return corelog::levelEnabled(category, level);
+    }
+}
+
+class tst_core_logfilter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase()
+    {
+        corelog::enableLogging(true);
+    }
+
+    void cleanup()
+    {
+        corelog::setFilterRules({});
+    }
+
+    // With no rules, all levels are enabled
+    void testNoRules()
+    {
+        QVERIFY(enabled(dnsCategory, LogMessage::Level::Debug));
+        QVERIFY(enabled(dnsCategory, LogMessage::Level::Error));
+    }
+
+    void testValidRules()
+    {
+        // Exact category, all levels
+        corelog::setFilterRules({"net.dns=false"});
+        QVERIFY(!enabled(dnsCategory, LogMessage::Level::Debug));
+        QVERIFY(!enabled(dnsCategory, LogMessage::Level::Error));
+        QVERIFY(enabled(httpCategory, LogMessage::Level::Debug));
+        // Fatal is never filtered
+        QVERIFY(enabled(dnsCategory, LogMessage::Level::Fatal));
+
+        // Level suffix - only that level is affected; 'critical' is Error
+        corelog::setFilterRules({"net.dns.debug=false", "net.http.critical=false"});
+        QVERIFY(!enabled(dnsCategory, LogMessage::Level::Debug));
+        QVERIFY(enabled(dnsCategory, LogMessage::Level::Info));
+        QVERIFY(!enabled(httpCategory, LogMessage::Level::Error));
+        QVERIFY(enabled(httpCategory, LogMessage::Level::Warning));
+
+        // Wildcards at the end, beginning, or both; whitespace is trimmed
+        corelog::setFilterRules({"net.*=false"});
+        QVERIFY(!enabled(dnsCategory, LogMessage::Level::Info));
+        QVERIFY(!enabled(httpCategory, LogMessage::Level::Info));
+        QVERIFY(enabled(appCategory, LogMessage::Level::Info));
+        corelog::setFilterRules({" *.dns=false\t"});
+        QVERIFY(!enabled(dnsCategory, LogMessage::Level::Info));
+        QVERIFY(enabled(httpCategory, LogMessage::Level::Info));
+        corelog::setFilterRules({"*tt*.warning=false"});
+        QVERIFY(!enabled(httpCategory, LogMessage::Level::Warning));
+        QVERIFY(enabled(httpCategory, LogMessage::Level::Info));
+        QVERIFY(enabled(dnsCategory, LogMessage::Level::Warning));
+    }
+
+    // Malformed rules are ignored, other rules still apply
+    void testMalformedRules()
+    {
+        corelog::setFilterRules({"net.dns", "net.dns=", "net.dns=no",
+                             "net.dns=FALSE", "net*dns=false", "n*t.dns=false",
+                             "net.http=false"});
+        QVERIFY(enabled(dnsCategory, LogMessage::Level::Debug));
+        QVERIFY(enabled(dnsCategory, LogMessage::Level::Info));
+        QVERIFY(enabled(appCategory, LogMessage::Level::Info));
+        QVERIFY(!enabled(httpCategory, LogMessage::Level::Info));
+    }
+
+    // Later rules take precedence over earlier rules
+    void testPrecedence()
+    {
+        corelog::setFilterRules({"*=false", "net.*=true"});
+        QVERIFY(enabled(dnsCategory, LogMessage::Level::Info));
+        QVERIFY(!enabled(appCategory, LogMessage::Level::Info));
+
+        corelog::setFilterRules({"net.*=true", "*=false"});
+        QVERIFY(!enabled(dnsCategory, LogMessage::Level::Info));
+
+        // A level rule can re-enable one level of a disabled category
+        corelog::setFilterRules({"net.dns=false", "net.dns.warning=true"});
+        QVERIFY(enabled(dnsCategory, LogMessage::Level::Warning));
+        QVERIFY(!enabled(dnsCategory, LogMessage::Level::Info));
+        QVERIFY(!enabled(dnsCategory, LogMessage::Level::Error));
+    }
+
+    // Changing the rules invalidates cached filter states
+    void testRulesChanged()
+    {
+        QVERIFY(enabled(appCategory, LogMessage::Level::Info));
+        corelog::setFilterRules({"app.main=false"});
+        QVERIFY(!enabled(appCategory, LogMessage::Level::Info));
+        corelog::setFilterRules({});
+        QVERIFY(enabled(appCategory, LogMessage::Level::Info));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_core_logfilter)
+#include TEST_MOC
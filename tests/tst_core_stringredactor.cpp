@@ -0,0 +1,116 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#include <QtTest>
+#include <kapps_core/src/stringredactor.h>
+
+using kapps::core::StringRedactor;
+
+class tst_core_stringredactor : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testNoRedactions()
+    {
+        StringRedactor redactor;
+        QVERIFY(redactor.empty());
+        QCOMPARE(redactor.redact("some text"), std::string{"some text"});
+    }
+
+    void testRedact()
+    {
+        StringRedactor redactor{{{"token123", "<<token>>"},
+                                 {"10.0.0.5", "<<DIP IP>>"}}};
+        QCOMPARE(redactor.redact("auth with token123 to 10.0.0.5"),
+                 std::string{"auth with <<token>> to <<DIP IP>>"});
+        QCOMPARE(redactor.redact("token123token123"),
+                 std::string{"<<token>><<token>>"});
+        QCOMPARE(redactor.redact("token12"), std::string{"token12"});
+        QCOMPARE(redactor.redact(""), std::string{});
+    }
+
+    // Overlapping patterns - leftmost wins, then longest
+    void testOverlaps()
+    {
+        StringRedactor redactor{{{"ab", "<1>"}, {"c", "<2>"}, {"bcd", "<3>"},
+                                 {"abcd", "<4>"}}};
+        QCOMPARE(redactor.redact("abc"), std::string{"<1><2>"});
+        QCOMPARE(redactor.redact("abcd"), std::string{"<4>"});
+        QCOMPARE(redactor.redact("xbcdx"), std::string{"x<3>x"});
+        QCOMPARE(redactor.redact("cab"), std::string{"<2><1>"});
+    }
+
+    // Replacements aren't re-scanned for other patterns
+    void testReplacementNotRescanned()
+    {
+        StringRedactor redactor{{{"user", "<<name>>"}, {"name", "<<secret>>"}}};
+        QCOMPARE(redactor.redact("user"), std::string{"<<name>>"});
+    }
+
+    // UTF-8 text is matched as bytes
+    void testUtf8()
+    {
+        StringRedactor redactor{{{u8"Русский", "<<lang>>"}}};
+        QCOMPARE(redactor.redact(u8"язык: Русский."), std::string{u8"язык: <<lang>>."});
+    }
+
+    void testDuplicateAndEmptyPatterns()
+    {
+        StringRedactor redactor{{{"a", "1"}, {"a", "2"}, {"", "x"}}};
+        QCOMPARE(redactor.redact("banana"), std::string{"b2n2n2"});
+    }
+
+    // Throughput vs. number of redactions.  Run with -tickcounter or
+    // -callgrind for more precise results.
+    void benchmarkRedact_data()
+    {
+        QTest::addColumn<int>("redactionCount");
+        QTest::newRow("0") << 0;
+        QTest::newRow("1") << 1;
+        QTest::newRow("10") << 10;
+        QTest::newRow("100") << 100;
+        QTest::newRow("1000") << 1000;
+    }
+    void benchmarkRedact()
+    {
+        QFETCH(int, redactionCount);
+
+        std::vector<StringRedactor::Redaction> redactions;
+        for(int i=0; i<redactionCount; ++i)
+        {
+            redactions.push_back({QStringLiteral("secret-token-%1").arg(i).toStdString(),
+                                  QStringLiteral("<<token %1>>").arg(i).toStdString()});
+        }
+        StringRedactor redactor{std::move(redactions)};
+
+        // A typical log line, with one redaction if there are any
+        std::string line{"[2025-01-01 00:00:00.000][1234][daemon.wireguard][src/wireguardmethod.cpp:123][info] "
+                         "Connecting to 10.0.0.1:1337 with key secret-token-0 over interface wgpia0"};
+        std::string redacted;
+        QBENCHMARK
+        {
+            redacted = redactor.redact(line);
+        }
+        QVERIFY(redacted.size() > 0);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_core_stringredactor)
+#include TEST_MOC
@@ -23,8 +23,10 @@
 #include <common/src/json.h>
 
 #include <QJsonArray>
+#include <QJsonDocument>
 #include <QJsonObject>
 #include <QString>
+#include <nlohmann/json.hpp>
 
 class TestSettings : public NativeJsonObject
 {
@@ -286,6 +288,63 @@ private slots:
         settings.validatedArrayField({ 1, 2, 3 });
         QVERIFY(!settings.error());
     }
+
+    // Patches generated by nlohmann::json::diff() produce the target value
+    // when applied to the source value
+    void applyDiffPatch_data()
+    {
+        QTest::addColumn<QByteArray>("source");
+        QTest::addColumn<QByteArray>("target");
+
+        QTest::newRow("unchanged") << QByteArray{R"({"a":1,"b":[1,2]})"}
+            << QByteArray{R"({"a":1,"b":[1,2]})"};
+        QTest::newRow("replace member") << QByteArray{R"({"us":{"latency":10,"name":"US"}})"}
+            << QByteArray{R"({"us":{"latency":12,"name":"US"}})"};
+        QTest::newRow("add and remove members") << QByteArray{R"({"us":{"latency":10},"ca":{}})"}
+            << QByteArray{R"({"us":{"latency":10},"de":{"latency":null}})"};
+        QTest::newRow("grow array") << QByteArray{R"({"a":[{"id":"x"}]})"}
+            << QByteArray{R"({"a":[{"id":"x"},{"id":"y"},{"id":"z"}]})"};
+        QTest::newRow("shrink array") << QByteArray{R"({"a":[1,2,3,4]})"}
+            << QByteArray{R"({"a":[1,5]})"};
+        QTest::newRow("escaped keys") << QByteArray{R"({"a/b":{"c~d":1}})"}
+            << QByteArray{R"({"a/b":{"c~d":2}})"};
+        QTest::newRow("change type") << QByteArray{R"({"a":{"b":1}})"}
+            << QByteArray{R"({"a":[1,2]})"};
+    }
+    void applyDiffPatch()
+    {
+        QFETCH(QByteArray, source);
+        QFETCH(QByteArray, target);
+
+        auto patch = nlohmann::json::diff(nlohmann::json::parse(source.toStdString()),
+                                          nlohmann::json::parse(target.toStdString()));
+        auto patchQt = QJsonDocument::fromJson(QByteArray::fromStdString(patch.dump())).array();
+
+        QJsonValue sourceQt = QJsonDocument::fromJson(source).object();
+        QJsonValue targetQt = QJsonDocument::fromJson(target).object();
+        QCOMPARE(applyJsonPatch(sourceQt, patchQt), targetQt);
+    }
+
+    void applyInvalidPatch()
+    {
+        QJsonValue value = QJsonObject{{"a", QJsonArray{1, 2}}};
+        auto applyOp = [&](QJsonObject op)
+        {
+            return applyJsonPatch(value, QJsonArray{op});
+        };
+        QVERIFY_EXCEPTION_THROWN(applyOp({{"op", "replace"}, {"path", "/b"}, {"value", 1}}),
+                                 std::exception);
+        QVERIFY_EXCEPTION_THROWN(applyOp({{"op", "remove"}, {"path", "/a/2"}}),
+                                 std::exception);
+        QVERIFY_EXCEPTION_THROWN(applyOp({{"op", "add"}, {"path", "/a/x"}, {"value", 1}}),
+                                 std::exception);
+        QVERIFY_EXCEPTION_THROWN(applyOp({{"op", "move"}, {"path", "/a"}, {"from", "/b"}}),
+                                 std::exception);
+        QVERIFY_EXCEPTION_THROWN(applyOp({{"op", "replace"}, {"path", "a"}, {"value", 1}}),
+                                 std::exception);
+        // The original value isn't modified
+        QCOMPARE(value, QJsonValue{QJsonObject{{"a", QJsonArray{1, 2}}}});
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_json)
@@ -24,6 +24,7 @@
 
 #include <QJsonObject>
 
+Q_DECLARE_METATYPE(JsonRPCEncoding)
 
 class tst_jsonrpc : public QObject
 {
@@ -76,6 +77,71 @@ private slots:
         QCOMPARE(call->result(), 12 + 34);
     }
 
+    // Test a call with both the request and response encoded in CBOR
+    void clientToServerCborCall()
+    {
+        bool responded = false;
+        LocalMethodRegistry registry {
+            { QStringLiteral("test"), [&](int param) { return param + 34; } },
+        };
+        LocalCallInterface server(&registry);
+        RemoteCallInterface client;
+        server.setEncoding(JsonRPCEncoding::Cbor);
+        client.setEncoding(JsonRPCEncoding::Cbor);
+        // Check that the messages are CBOR and don't contain the IPC frame
+        // marker
+        auto checkMessage = [](const QByteArray &msg)
+        {
+            QCOMPARE(detectJsonRPCEncoding(msg), JsonRPCEncoding::Cbor);
+            QVERIFY(!msg.contains(static_cast<char>(0xFF)));
+        };
+        connect(&client, &RemoteCallInterface::messageReady, this, checkMessage);
+        connect(&server, &LocalCallInterface::messageReady, this, checkMessage);
+        connect(&client, &RemoteCallInterface::messageReady, &server, &LocalCallInterface::processMessage);
+        connect(&server, &LocalCallInterface::messageReady, &client, &RemoteCallInterface::processMessage);
+        // 221 + 34 = 255, which is encoded with a 0xFF byte
+        auto call = client.call(QStringLiteral("test"), 221);
+        call->notify([&](const Error&, const QJsonValue&) { responded = true; });
+        QTRY_VERIFY(responded);
+        QVERIFY(call->isResolved());
+        QCOMPARE(call->result(), 255);
+    }
+
+    // Test that messages survive a round trip through either encoding
+    void encodingRoundTrip_data()
+    {
+        QTest::addColumn<JsonRPCEncoding>("encoding");
+        QTest::newRow("json") << JsonRPCEncoding::Json;
+        QTest::newRow("cbor") << JsonRPCEncoding::Cbor;
+    }
+    void encodingRoundTrip()
+    {
+        QFETCH(JsonRPCEncoding, encoding);
+        const QJsonObject msg = buildJsonRPCRequest(QJsonValue::Undefined,
+            QStringLiteral("data"),
+            QJsonArray{QJsonObject{
+                {QStringLiteral("bytes"), QJsonArray{254, 255, 65534, 65535, -1, -255}},
+                {QStringLiteral("doubles"), QJsonArray{-1.0, 0.1, 1e300, -2.5e-8}},
+                {QStringLiteral("string"), QStringLiteral("\u00FE\u00FF \u4E2D\u6587")},
+                {QStringLiteral("null"), QJsonValue{}},
+                {QStringLiteral("bool"), true},
+            }});
+        const QByteArray encoded = encodeJsonRPCMessage(msg, encoding);
+        QCOMPARE(detectJsonRPCEncoding(encoded), encoding);
+        QVERIFY(!encoded.contains(static_cast<char>(0xFF)));
+        QCOMPARE(parseJsonRPCMessage(encoded), msg);
+    }
+
+    // A truncated CBOR escape is a parse error
+    void invalidCborEscape()
+    {
+        QByteArray encoded = encodeJsonRPCMessage(buildJsonRPCRequest(
+            QJsonValue::Undefined, QStringLiteral("test"), QJsonArray{-1.0}),
+            JsonRPCEncoding::Cbor);
+        encoded.append(static_cast<char>(0xFE));
+        QVERIFY_EXCEPTION_THROWN(parseJsonRPCMessage(encoded), JsonRPCParseError);
+    }
+
     // Test that a call() while disconnected is rejected
     void disconnectedCall()
     {
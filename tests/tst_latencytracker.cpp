@@ -19,6 +19,7 @@
 #include "daemon/src/latencytracker.h"
 #include "common/src/locations.h"
 #include <QtTest>
+#include <algorithm>
 #include <cassert>
 #include <unordered_set>
 
@@ -30,6 +31,18 @@ namespace
     };
 
     const QHostAddress localhost{QHostAddress::SpecialAddress::LocalHost};
+
+    // Service group for mock VPN servers (any VPN service causes a server to
+    // be used for ICMP latency measurements)
+    std::shared_ptr<kapps::regions::ServiceGroup> mockVpnServiceGroup()
+    {
+        return std::make_shared<kapps::regions::ServiceGroup>(
+            std::vector<std::uint16_t>{}, false,
+            std::vector<std::uint16_t>{}, false,
+            std::vector<std::uint16_t>{1337}, false,
+            std::vector<std::uint16_t>{}, std::string{}, std::string{},
+            std::vector<std::uint16_t>{});
+    }
 }
 
 class MockPingServers : public QObject
@@ -117,12 +130,13 @@ signals:
 
 private slots:
     void onNewMeasurements(const LatencyTracker::Latencies &measurements);
+    void onNewStats(const LatencyTracker::Measurements &measurements);
 };
 
 MeasurementSplitter::MeasurementSplitter(LatencyTracker &tracker)
 {
     connect(&tracker, &LatencyTracker::newMeasurements, this,
-            &MeasurementSplitter::onNewMeasurements);
+            &MeasurementSplitter::onNewStats);
 }
 
 MeasurementSplitter::MeasurementSplitter(LatencyBatch &batch)
@@ -137,6 +151,17 @@ void MeasurementSplitter::onNewMeasurements(const LatencyTracker::Latencies &mea
         emit newMeasurement(measurement.first, measurement.second);
 }
 
+void MeasurementSplitter::onNewStats(const LatencyTracker::Measurements &measurements)
+{
+    for(const auto &measurement : measurements)
+    {
+        // Only measurements with a latency are split; all the mock servers
+        // respond
+        if(measurement.second.latency)
+            emit newMeasurement(measurement.first, measurement.second.latency.get());
+    }
+}
+
 class tst_latencytracker : public QObject
 {
     Q_OBJECT
@@ -272,6 +297,86 @@ private slots:
         QVERIFY(!measurementSpy.wait(2000));
     }
 
+    // Locations that were measured recently aren't measured again when the
+    // locations are updated, but all locations are measured again after a
+    // network change
+    void networkChangeSweep()
+    {
+        LatencyTracker tracker{};
+        MeasurementSplitter splitter{tracker};
+        tracker.start();
+
+        QSignalSpy measurementSpy{&splitter, &MeasurementSplitter::newMeasurement};
+        tracker.updateLocations(_mockServers.mockServerList());
+        while(measurementSpy.size() < MockPingServerCount)
+            QVERIFY(measurementSpy.wait());
+        measurementSpy.clear();
+        QCOMPARE(tracker.counters().probes, static_cast<quint64>(MockPingServerCount));
+
+        // Nothing is due yet
+        tracker.updateLocations(_mockServers.mockServerList());
+        QVERIFY(!measurementSpy.wait(500));
+        QCOMPARE(tracker.counters().probes, static_cast<quint64>(MockPingServerCount));
+        QCOMPARE(tracker.counters().deferred, static_cast<quint64>(MockPingServerCount));
+
+        // Several network changes cause one sweep
+        tracker.networkChanged();
+        tracker.networkChanged();
+        while(measurementSpy.size() < MockPingServerCount)
+            QVERIFY(measurementSpy.wait(5000));
+        QVERIFY(!measurementSpy.wait(500));
+        QCOMPARE(measurementSpy.size(), MockPingServerCount);
+        QCOMPARE(tracker.counters().sweeps, static_cast<quint64>(1));
+        QCOMPARE(tracker.counters().probes, static_cast<quint64>(MockPingServerCount*2));
+    }
+
+    // Verify that LatencySchedule backs off stable and distant locations
+    void scheduleBackoff()
+    {
+        using std::chrono::milliseconds;
+        using std::chrono::minutes;
+        using Clock = LatencySchedule::Clock;
+        const LatencyHistory::Stats first{milliseconds{100}, milliseconds{0}, 0.0};
+        const LatencyHistory::Stats stable{milliseconds{104}, milliseconds{1}, 0.0};
+        const LatencyHistory::Stats changed{milliseconds{200}, milliseconds{25}, 0.0};
+
+        LatencySchedule schedule;
+        auto start = Clock::now();
+        QVERIFY(schedule.isDue(start, false));
+        schedule.measured(start);
+        QVERIFY(!schedule.isDue(start + minutes{0}, false));
+        QVERIFY(schedule.isDue(start + minutes{1}, false));
+
+        // A stable result doubles the interval; priority locations still use
+        // the minimum interval
+        schedule.addResult(first, stable, false, false);
+        QCOMPARE(schedule.interval(), Clock::duration{minutes{2}});
+        QVERIFY(!schedule.isDue(start + minutes{1}, false));
+        QVERIFY(schedule.isDue(start + minutes{1}, true));
+        QVERIFY(schedule.isDue(start + minutes{2}, false));
+
+        // The interval is limited
+        for(int i=0; i<10; ++i)
+            schedule.addResult(first, stable, false, false);
+        QCOMPARE(schedule.interval(), Clock::duration{minutes{32}});
+
+        // A change resets the interval
+        schedule.addResult(first, changed, false, false);
+        QCOMPARE(schedule.interval(), Clock::duration{minutes{1}});
+
+        // Distant locations are backed off even if they change
+        schedule.addResult(first, changed, false, true);
+        QCOMPARE(schedule.interval(), Clock::duration{minutes{2}});
+
+        // Priority locations aren't backed off
+        schedule.addResult(first, stable, true, false);
+        QCOMPARE(schedule.interval(), Clock::duration{minutes{1}});
+
+        // Resetting makes the location due immediately
+        schedule.reset();
+        QVERIFY(schedule.isDue(start, false));
+    }
+
     //Verify that a LatencyBatch is cleaned up properly under normal
     //circumstances (all addresses are valid and respond)
     void normalCleanup()
@@ -347,6 +452,139 @@ private slots:
         QCOMPARE(measurementSpy.size(), 0);
     }
 
+    // Verify that ICMP echo requests are sent in bursts of the configured
+    // size, spaced by the configured interval
+    void burstPacing()
+    {
+#if defined(Q_OS_WIN)
+        QSKIP("ICMP pings are not paced on Windows");
+#else
+        const PingPacing pacing{3, std::chrono::milliseconds{200}};
+        QElapsedTimer elapsed;
+        elapsed.start();
+        auto pBatch{new LatencyBatch{_mockServers.mockPingLocations(), this,
+                                     1, pacing}};
+        QSignalSpy destroySpy{pBatch, &QObject::destroyed};
+
+        // The first burst is sent immediately, and is capped at the burst size
+        QCOMPARE(pBatch->sentCount(), pacing.burstSize);
+
+        // The rest are sent after the burst interval (timers may fire slightly
+        // early, allow 10%)
+        QTRY_COMPARE(pBatch->sentCount(),
+                     static_cast<std::size_t>(MockPingServerCount));
+        QVERIFY(elapsed.elapsed() >= pacing.burstInterval.count() * 9 / 10);
+
+        destroySpy.wait();
+#endif
+    }
+
+    // With several servers per location, each server is measured, and the
+    // healthy servers are ranked so connections try the fastest one first
+    void serverRanking()
+    {
+        auto pServiceGroup = mockVpnServiceGroup();
+        std::vector<std::shared_ptr<const kapps::regions::Server>> servers;
+        // The documentation address never responds; list it first to verify
+        // that ranking moves it after the responsive servers
+        for(const auto &ip : {kapps::core::Ipv4Address{192, 0, 2, 1},
+                              kapps::core::Ipv4Address{127, 0, 0, 1},
+                              kapps::core::Ipv4Address{127, 0, 0, 2}})
+        {
+            servers.push_back(std::make_shared<kapps::regions::Server>(ip,
+                "n/a", std::string{}, pServiceGroup));
+        }
+        auto pRegion = std::make_shared<kapps::regions::Region>("mock-multi",
+            true, false, false, kapps::core::Ipv4Address{}, std::move(servers));
+        LocationsById locations{{"mock-multi", QSharedPointer<Location>::create(
+            std::move(pRegion), nullable_t<double>{})}};
+
+        LatencyTracker tracker{};
+        tracker.setServersPerLocation(3);
+        QSignalSpy rankingSpy{&tracker, &LatencyTracker::serverRankingsChanged};
+        tracker.start();
+        tracker.updateLocations(locations);
+
+        // The rankings are emitted when the batch times out
+        QVERIFY(rankingSpy.wait(30000));
+        auto rankings = rankingSpy.takeFirst()[0].value<LatencyTracker::ServerRankings>();
+        QCOMPARE(rankings.size(), static_cast<std::size_t>(1));
+        QCOMPARE(rankings[0].first, QStringLiteral("mock-multi"));
+        // The unresponsive server isn't ranked
+        auto ranked = rankings[0].second;
+        std::sort(ranked.begin(), ranked.end());
+        QCOMPARE(ranked, (std::vector<QString>{QStringLiteral("127.0.0.1"),
+                                               QStringLiteral("127.0.0.2")}));
+
+        // Applying the ranking puts the fastest server first
+        ServerRankingMap rankingMap{{rankings[0].first, rankings[0].second}};
+        QVERIFY(applyLocationLatencies(locations, {}, {}, rankingMap));
+        const auto &pRanked = locations.at("mock-multi");
+        QCOMPARE(pRanked->servers()[0].ip(), rankings[0].second[0]);
+        QCOMPARE(pRanked->servers()[2].ip(), QStringLiteral("192.0.2.1"));
+        QCOMPARE(pRanked->serverWithIndexForService(0, Service::WireGuard)->ip(),
+                 rankings[0].second[0]);
+
+        // Measuring one server per location clears the rankings
+        tracker.setServersPerLocation(1);
+        QCOMPARE(rankingSpy.size(), 1);
+        rankings = rankingSpy.takeFirst()[0].value<LatencyTracker::ServerRankings>();
+        QCOMPARE(rankings.size(), static_cast<std::size_t>(1));
+        QVERIFY(rankings[0].second.empty());
+    }
+
+    // Verify the latency statistics computed by LatencyHistory
+    void historyStats()
+    {
+        using std::chrono::milliseconds;
+        LatencyHistory history;
+
+        // Nothing is known initially
+        auto stats = history.stats();
+        QVERIFY(!stats.latency);
+        QCOMPARE(stats.jitter, milliseconds{0});
+        QCOMPARE(stats.loss, 0.0);
+
+        // The first measurement is the latency, there's no jitter yet
+        stats = history.addMeasurement(milliseconds{100});
+        QCOMPARE(stats.latency, nullable_t<milliseconds>{milliseconds{100}});
+        QCOMPARE(stats.jitter, milliseconds{0});
+
+        // The latency moves 1/4 toward new measurements; so does the jitter
+        // (toward the change from the last round trip)
+        stats = history.addMeasurement(milliseconds{200});
+        QCOMPARE(stats.latency, nullable_t<milliseconds>{milliseconds{125}});
+        QCOMPARE(stats.jitter, milliseconds{25});
+
+        // Lost pings don't change the latency or jitter
+        stats = history.addLoss();
+        QCOMPARE(stats.latency, nullable_t<milliseconds>{milliseconds{125}});
+        QCOMPARE(stats.jitter, milliseconds{25});
+        QCOMPARE(stats.loss, 1.0/3.0);
+    }
+
+    // Verify that the loss ratio only considers the most recent results
+    void historyLossWindow()
+    {
+        using std::chrono::milliseconds;
+        LatencyHistory history;
+
+        // Only losses - the latency is still unknown
+        for(std::size_t i=0; i<LatencyHistory::HistorySize; ++i)
+            history.addLoss();
+        auto stats = history.stats();
+        QVERIFY(!stats.latency);
+        QCOMPARE(stats.loss, 1.0);
+
+        // Each reply pushes out one loss
+        stats = history.addMeasurement(milliseconds{50});
+        QCOMPARE(stats.loss, 0.9);
+        for(std::size_t i=1; i<LatencyHistory::HistorySize; ++i)
+            stats = history.addMeasurement(milliseconds{50});
+        QCOMPARE(stats.loss, 0.0);
+        QCOMPARE(stats.latency, nullable_t<milliseconds>{milliseconds{50}});
+    }
+
     //Verify that equivalent IP addresses are found correctly
     void equivalentIpAddresses()
     {
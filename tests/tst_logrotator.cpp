@@ -0,0 +1,192 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include <common/src/builtin/logrotator.h>
+#include <QtTest>
+#include <QFileInfo>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+
+namespace
+{
+    // Start of an xz stream
+    const QByteArray xzMagic{"\xFD" "7zXZ\0", 6};
+
+    // Create a ".old" segment of incompressible data, so compressed sizes are
+    // predictable
+    void writeOldSegment(const QString &logPath, int size, quint32 seed)
+    {
+        QByteArray data{size, Qt::Uninitialized};
+        QRandomGenerator rng{seed};
+        rng.fillRange(reinterpret_cast<quint32*>(data.data()), size / 4);
+        QFile segment{logPath + oldFileSuffix};
+        QVERIFY(segment.open(QIODevice::WriteOnly));
+        QCOMPARE(segment.write(data), static_cast<qint64>(size));
+    }
+
+    // Rotate a new segment, and wait for it to be compressed
+    void rotateSegment(LogRotator &rotator, const QString &logPath, int size,
+                       quint32 seed)
+    {
+        writeOldSegment(logPath, size, seed);
+        // Returns false until the prior segment has been compressed
+        QTRY_VERIFY(rotator.rotateOldSegment());
+        QVERIFY(!QFile::exists(logPath + oldFileSuffix));
+        QTRY_VERIFY(!QFile::exists(logPath + LogRotator::rotatingSuffix));
+    }
+
+    qint64 fileSize(const QString &path)
+    {
+        return QFileInfo{path}.size();
+    }
+}
+
+class tst_logrotator : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testGenerationPath()
+    {
+        QCOMPARE(LogRotator::generationPath(QStringLiteral("/var/log/daemon.log"), 1),
+                 QStringLiteral("/var/log/daemon.log.1.xz"));
+        QCOMPARE(LogRotator::generationPath(QStringLiteral("/var/log/daemon.log"), 12),
+                 QStringLiteral("/var/log/daemon.log.12.xz"));
+    }
+
+    // Segments aren't taken when compressed rotation is disabled
+    void testDisabled()
+    {
+        QTemporaryDir tempDir;
+        QString logPath = tempDir.filePath(QStringLiteral("daemon.log"));
+        LogRotator rotator{logPath};
+        writeOldSegment(logPath, 1024, 1);
+        QVERIFY(!rotator.rotateOldSegment());
+        rotator.configure(0, 1024*1024);
+        QVERIFY(!rotator.rotateOldSegment());
+        QVERIFY(QFile::exists(logPath + oldFileSuffix));
+    }
+
+    // Each rotation becomes generation 1 and shifts older generations up;
+    // generations beyond the count limit are deleted
+    void testGenerationLimit()
+    {
+        QTemporaryDir tempDir;
+        QString logPath = tempDir.filePath(QStringLiteral("daemon.log"));
+        LogRotator rotator{logPath};
+        rotator.configure(2, 1024*1024);
+
+        rotateSegment(rotator, logPath, 4096, 1);
+        QVERIFY(QFile::exists(LogRotator::generationPath(logPath, 1)));
+        QVERIFY(!QFile::exists(LogRotator::generationPath(logPath, 2)));
+        QFile gen1{LogRotator::generationPath(logPath, 1)};
+        QVERIFY(gen1.open(QIODevice::ReadOnly));
+        QCOMPARE(gen1.read(xzMagic.size()), xzMagic);
+        gen1.close();
+
+        // Segments of increasing size, so the order of the generations can be
+        // checked from their sizes
+        rotateSegment(rotator, logPath, 8192, 2);
+        rotateSegment(rotator, logPath, 16384, 3);
+        // Stopping waits for the limits to be enforced
+        rotator.stop();
+
+        QVERIFY(fileSize(LogRotator::generationPath(logPath, 1)) > 16384);
+        QVERIFY(fileSize(LogRotator::generationPath(logPath, 2)) > 8192);
+        QVERIFY(fileSize(LogRotator::generationPath(logPath, 2)) < 16384);
+        QVERIFY(!QFile::exists(LogRotator::generationPath(logPath, 3)));
+    }
+
+    // Generations that exceed the disk budget are deleted, oldest first
+    void testDiskBudget()
+    {
+        QTemporaryDir tempDir;
+        QString logPath = tempDir.filePath(QStringLiteral("daemon.log"));
+        LogRotator rotator{logPath};
+        // Room for one 4 KiB segment, but not two
+        rotator.configure(5, 6000);
+
+        rotateSegment(rotator, logPath, 4096, 1);
+        rotateSegment(rotator, logPath, 4096, 2);
+        rotator.stop();
+
+        QVERIFY(QFile::exists(LogRotator::generationPath(logPath, 1)));
+        QVERIFY(!QFile::exists(LogRotator::generationPath(logPath, 2)));
+    }
+
+    // A segment left over from a prior run is compressed when rotation is
+    // configured
+    void testResumeSegment()
+    {
+        QTemporaryDir tempDir;
+        QString logPath = tempDir.filePath(QStringLiteral("daemon.log"));
+        writeOldSegment(logPath, 4096, 1);
+        QVERIFY(QFile::rename(logPath + oldFileSuffix,
+                              logPath + LogRotator::rotatingSuffix));
+
+        LogRotator rotator{logPath};
+        rotator.configure(2, 1024*1024);
+        QTRY_VERIFY(QFile::exists(LogRotator::generationPath(logPath, 1)));
+        QTRY_VERIFY(!QFile::exists(logPath + LogRotator::rotatingSuffix));
+    }
+
+    // Stopping during compression keeps the segment to resume later
+    void testStopDuringCompression()
+    {
+        QTemporaryDir tempDir;
+        QString logPath = tempDir.filePath(QStringLiteral("daemon.log"));
+        LogRotator rotator{logPath};
+        rotator.configure(2, 1024*1024*1024);
+
+        // Large enough that compression takes a while
+        writeOldSegment(logPath, 32*1024*1024, 1);
+        QVERIFY(rotator.rotateOldSegment());
+        const QString tempPath = LogRotator::generationPath(logPath, 1) + QStringLiteral(".tmp");
+        QTRY_VERIFY(QFile::exists(tempPath));
+
+        rotator.stop();
+        QVERIFY(QFile::exists(logPath + LogRotator::rotatingSuffix));
+        QCOMPARE(fileSize(logPath + LogRotator::rotatingSuffix),
+                 static_cast<qint64>(32*1024*1024));
+        QVERIFY(!QFile::exists(tempPath));
+        QVERIFY(!QFile::exists(LogRotator::generationPath(logPath, 1)));
+    }
+
+    // wipe() deletes all generations
+    void testWipe()
+    {
+        QTemporaryDir tempDir;
+        QString logPath = tempDir.filePath(QStringLiteral("daemon.log"));
+        LogRotator rotator{logPath};
+        rotator.configure(3, 1024*1024);
+        rotateSegment(rotator, logPath, 4096, 1);
+        rotateSegment(rotator, logPath, 4096, 2);
+
+        rotator.wipe();
+        QVERIFY(!QFile::exists(LogRotator::generationPath(logPath, 1)));
+        QVERIFY(!QFile::exists(LogRotator::generationPath(logPath, 2)));
+
+        // Rotation continues after wiping
+        rotateSegment(rotator, logPath, 4096, 3);
+        QVERIFY(QFile::exists(LogRotator::generationPath(logPath, 1)));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_logrotator)
+#include TEST_MOC
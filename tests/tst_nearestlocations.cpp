@@ -20,6 +20,7 @@
 #include <common/src/settings/locations.h>
 #include <common/src/locations.h>
 #include <QtTest>
+#include <cmath>
 
 namespace samples
 {
@@ -361,6 +362,19 @@ const auto locationsGeo = QJsonDocument::fromJson(R"(
         "country_groups":{},
         "gps":{}
     })").object();
+
+    // Metadata with coordinates for the regions in 'locations'
+    const auto metadataGps = QJsonDocument::fromJson(R"({
+        "translations":{},
+        "country_groups":{},
+        "gps":{
+            "us2": ["40.71", "-74.01"],
+            "hungary": ["47.50", "19.04"],
+            "us_california": ["34.05", "-118.24"],
+            "ro": ["44.43", "26.10"],
+            "poland": ["52.23", "21.01"]
+        }
+    })").object();
 }
 
 class tst_nearestlocations : public QObject
@@ -481,6 +495,161 @@ private slots:
         QVERIFY(!nearest2);
     }
 
+    // Apply latency updates to already-built locations
+    void testApplyLocationLatencies()
+    {
+        setLatencies();
+        buildRegions();
+
+        // Applying the same latencies changes nothing
+        auto pOrigUs2 = locs.at("us2");
+        auto pOrigHungary = locs.at("hungary");
+        QVERIFY(!applyLocationLatencies(locs, latencies));
+        QCOMPARE(locs.at("us2"), pOrigUs2);
+
+        // Make us_california the fastest auto region; only that location is
+        // replaced
+        latencies[QStringLiteral("us_california")] = 550;
+        QVERIFY(applyLocationLatencies(locs, latencies));
+        QCOMPARE(locs.at("us2"), pOrigUs2);
+        QCOMPARE(locs.at("hungary"), pOrigHungary);
+        QCOMPARE(locs.at("us_california")->latency(), nullable_t<double>{550.0});
+        QVERIFY(!locs.at("us_california")->servers().empty());
+
+        NearestLocations nearestLocations{locs};
+        QCOMPARE(nearestLocations.getNearestSafeVpnLocation(false)->id(), "us_california");
+
+        // Removing a latency clears it
+        latencies.erase(QStringLiteral("us_california"));
+        QVERIFY(applyLocationLatencies(locs, latencies));
+        QVERIFY(!locs.at("us_california")->latency());
+    }
+
+    // A NearestLocations can be kept and updated with changed locations
+    void testIncrementalUpdate()
+    {
+        setLatencies();
+        buildRegions();
+        NearestLocations nearest{locs};
+        QCOMPARE(nearest.getNearestSafeVpnLocation(false)->id(), "us2");
+        QCOMPARE(nearest.getNearestSafeVpnLocation(true)->id(), "ro");
+
+        // Re-rank changed locations
+        latencies[QStringLiteral("us_california")] = 550;
+        latencies[QStringLiteral("poland")] = 750;
+        QVERIFY(applyLocationLatencies(locs, latencies));
+        nearest.update(locs);
+        QCOMPARE(nearest.getNearestSafeVpnLocation(false)->id(), "us_california");
+        QCOMPARE(nearest.getNearestSafeVpnLocation(true)->id(), "poland");
+
+        // Remove a location
+        locs.erase("us_california");
+        nearest.update(locs);
+        QCOMPARE(nearest.getNearestSafeVpnLocation(false)->id(), "us2");
+
+        // The results match a new NearestLocations
+        NearestLocations rebuilt{locs};
+        auto startsWithU = [](const Location &loc){return loc.id().startsWith(QStringLiteral("u"));};
+        QCOMPARE(nearest.getBestMatchingLocation(startsWithU), rebuilt.getBestMatchingLocation(startsWithU));
+        QCOMPARE(nearest.getBestLocation(), rebuilt.getBestLocation());
+
+        // Removing all locations leaves nothing to select
+        nearest.update({});
+        QVERIFY(!nearest.getBestLocation());
+    }
+
+    // Jitter and loss are penalized when selecting the nearest location
+    void testLatencyQuality()
+    {
+        setLatencies();
+        buildRegions();
+
+        // us2 (600ms) is erratic, so us_california (700ms) is preferred
+        LatencyQualityMap quality;
+        quality[QStringLiteral("us2")] = {60, 0};
+        QVERIFY(applyLocationLatencies(locs, latencies, quality));
+        QCOMPARE(locs.at("us2")->latencyQuality(), (LatencyQuality{60, 0}));
+        QCOMPARE(locs.at("us2")->selectionScore(), nullable_t<double>{720.0});
+        QCOMPARE(Location::selectionScore(600.0, LatencyQuality{60, 0}), 720.0);
+        QCOMPARE(NearestLocations{locs}.getNearestSafeVpnLocation(false)->id(), "us_california");
+
+        // If us_california is losing pings, us2 is preferred again
+        quality[QStringLiteral("us_california")] = {0, 0.5};
+        QVERIFY(applyLocationLatencies(locs, latencies, quality));
+        QCOMPARE(NearestLocations{locs}.getNearestSafeVpnLocation(false)->id(), "us2");
+
+        // The latency quality is persisted compactly
+        QJsonValue qualityJson;
+        QVERIFY(json_cast(quality, qualityJson));
+        QCOMPARE(qualityJson.toObject().value(QStringLiteral("us2")), (QJsonValue{QJsonArray{60.0, 0.0}}));
+        LatencyQualityMap restored;
+        QVERIFY(json_cast(qualityJson, restored));
+        QVERIFY(restored == quality);
+    }
+
+    // Latencies are predicted from the distance to the client's estimated
+    // position
+    void testLatencyPredictor()
+    {
+        // New York to London is about 5570 km
+        QVERIFY(std::abs(LatencyPredictor::distanceKm(40.71, -74.01, 51.51, -0.13) - 5570) < 50);
+
+        LatencyPredictor predictor;
+        QVERIFY(!predictor.predict(51.51, -0.13));
+
+        // Client near New York
+        predictor.addMeasurement(40.71, -74.01, 10);   // New York
+        predictor.addMeasurement(38.91, -77.04, 15);   // Washington
+        predictor.addMeasurement(41.88, -87.63, 30);   // Chicago
+        // Regions without coordinates are ignored
+        predictor.addMeasurement(qQNaN(), qQNaN(), 1);
+
+        auto losAngeles = predictor.predict(34.05, -118.24);
+        auto london = predictor.predict(51.51, -0.13);
+        QVERIFY(losAngeles);
+        QVERIFY(london);
+        QVERIFY(losAngeles.get() > 30);
+        QVERIFY(losAngeles.get() < london.get());
+        QVERIFY(LatencyPredictor::distanceKm(predictor.latitude(), predictor.longitude(),
+                                             40.71, -74.01) < 500);
+        QVERIFY(!predictor.predict(qQNaN(), qQNaN()));
+    }
+
+    // Unmeasured locations are ranked by predicted latency
+    void testPredictedLatencies()
+    {
+        latencies.clear();
+        latencies[QStringLiteral("us2")] = 20;
+        latencies[QStringLiteral("hungary")] = 120;
+        auto built = buildModernLocations(latencies, samples::locations,
+            samples::emptyShadowsocks, samples::metadataGps, {}, {});
+        LocationsById &predictedLocs = built.first;
+
+        // Without predictions, the unmeasured auto regions are sorted by ID
+        auto notUs2 = [](const Location &loc){return loc.id() != QStringLiteral("us2");};
+        QCOMPARE(NearestLocations{predictedLocs}.getBestMatchingLocation(notUs2)->id(), "poland");
+
+        QVERIFY(applyPredictedLatencies(predictedLocs, built.second));
+        QVERIFY(!applyPredictedLatencies(predictedLocs, built.second));
+        // Measured locations have no prediction; unmeasured locations have no
+        // latency
+        QVERIFY(!predictedLocs.at("us2")->predictedLatency());
+        QVERIFY(!predictedLocs.at("us_california")->latency());
+        QVERIFY(predictedLocs.at("us_california")->predictedLatency());
+        QVERIFY(predictedLocs.at("us_california")->predictedLatency().get() <
+                predictedLocs.at("poland")->predictedLatency().get());
+
+        // The client is near us2, so us_california is predicted to be nearest
+        QCOMPARE(NearestLocations{predictedLocs}.getBestMatchingLocation(notUs2)->id(), "us_california");
+
+        // Once it's measured, the prediction is cleared
+        latencies[QStringLiteral("us_california")] = 90;
+        QVERIFY(applyLocationLatencies(predictedLocs, latencies));
+        QVERIFY(applyPredictedLatencies(predictedLocs, built.second));
+        QVERIFY(!predictedLocs.at("us_california")->predictedLatency());
+        QCOMPARE(predictedLocs.at("us_california")->selectionScore(), nullable_t<double>{90.0});
+    }
+
     // // Test all combinations of preferences with geo, auto, and port forwarding.
     // //
     void testGeoPreferences()
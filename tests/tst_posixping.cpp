@@ -0,0 +1,83 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include "daemon/src/posix/posix_ping.h"
+#include <QtTest>
+
+namespace
+{
+    const quint32 loopback{0x7F000001};   // 127.0.0.1
+}
+
+class tst_posixping : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Real pings are only possible if the system permits ICMP datagram
+    // sockets (net.ipv4.ping_group_range); otherwise the pings are mocked.
+    void requireDatagramSocket(const PosixPing &ping)
+    {
+        if(!ping.usingDatagramSocket())
+            QSKIP("ICMP datagram sockets are not permitted for this user");
+    }
+
+private slots:
+    // Ping loopback with a single echo request
+    void loopbackEcho()
+    {
+        PosixPing ping;
+        requireDatagramSocket(ping);
+
+        QSignalSpy replySpy{&ping, &PosixPing::receivedReply};
+        QVERIFY(ping.sendEchoRequest(loopback));
+        QVERIFY(replySpy.wait());
+        QCOMPARE(replySpy.size(), 1);
+        QCOMPARE(replySpy[0][0].value<quint32>(), loopback);
+        auto roundTrip = replySpy[0][1].value<std::chrono::microseconds>();
+        QVERIFY(roundTrip >= std::chrono::microseconds::zero());
+        QVERIFY(roundTrip < std::chrono::seconds{1});
+    }
+
+    // Ping several loopback addresses in one batch; each replies once
+    void loopbackBatch()
+    {
+        PosixPing ping;
+        requireDatagramSocket(ping);
+
+        std::vector<quint32> addresses{loopback, loopback+1, loopback+2, loopback+3};
+        QSignalSpy replySpy{&ping, &PosixPing::receivedReply};
+        auto result = ping.sendEchoRequests(addresses.data(), addresses.size());
+        QCOMPARE(result.sent, addresses.size());
+
+        while(replySpy.size() < static_cast<int>(addresses.size()))
+            QVERIFY(replySpy.wait());
+        // Make sure there aren't any duplicate replies
+        QVERIFY(!replySpy.wait(100));
+
+        std::vector<quint32> replies;
+        for(const auto &args : replySpy)
+            replies.push_back(args[0].value<quint32>());
+        std::sort(replies.begin(), replies.end());
+        QVERIFY(replies == addresses);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_posixping)
+#include TEST_MOC
@@ -0,0 +1,151 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include "daemon/src/propertywriter.h"
+#include <QtTest>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTemporaryDir>
+#include <string>
+
+namespace
+{
+    const PropertyWriter::SplitFile testSplitFiles[]
+    {
+        {"latencies", "latencies.json"},
+        {"regions", "regions.json"},
+    };
+    const char *const testMainFilename = "data.json";
+
+    QJsonObject readJsonFile(const Path &path)
+    {
+        QFile file{path};
+        if(!file.open(QIODevice::ReadOnly))
+            return {};
+        return QJsonDocument::fromJson(file.readAll()).object();
+    }
+
+    void writeJsonFile(const Path &path, const QJsonObject &object)
+    {
+        QFile file{path};
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write(QJsonDocument{object}.toJson());
+    }
+
+    QJsonObject testData()
+    {
+        return QJsonObject{
+            {QStringLiteral("latencies"), QJsonObject{{QStringLiteral("us_ny"), 20}}},
+            {QStringLiteral("regions"), QJsonArray{QStringLiteral("us_ny")}},
+            {QStringLiteral("winDnsCacheDeleted"), true},
+        };
+    }
+}
+
+class tst_propertywriter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Queued writes are written with the newest content once flushed
+    void writeCoalesced()
+    {
+        QTemporaryDir tempDir;
+        Path dir{tempDir.path()};
+        // The directory is created if needed
+        Path subdir = dir / "settings";
+
+        {
+            PropertyWriter writer{subdir};
+            writer.queueWrite("a.json", QJsonObject{{QStringLiteral("value"), 1}});
+            writer.queueWrite("a.json", QJsonObject{{QStringLiteral("value"), 2}});
+            writer.queueWrite("b.json", QJsonObject{{QStringLiteral("value"), 3}});
+            writer.flush();
+
+            QCOMPARE(readJsonFile(subdir / "a.json"), (QJsonObject{{QStringLiteral("value"), 2}}));
+            QCOMPARE(readJsonFile(subdir / "b.json"), (QJsonObject{{QStringLiteral("value"), 3}}));
+
+            // Files are identified by name, not by the string passed
+            const std::string firstName{"c.json"}, secondName{"c.json"};
+            writer.queueWrite(firstName.c_str(), QJsonObject{{QStringLiteral("value"), 5}});
+            writer.queueWrite(secondName.c_str(), QJsonObject{{QStringLiteral("value"), 6}});
+            writer.flush();
+            QCOMPARE(readJsonFile(subdir / "c.json"), (QJsonObject{{QStringLiteral("value"), 6}}));
+
+            // Writes still queued at destruction are completed
+            writer.queueWrite("a.json", QJsonObject{{QStringLiteral("value"), 4}});
+        }
+        QCOMPARE(readJsonFile(subdir / "a.json"), (QJsonObject{{QStringLiteral("value"), 4}}));
+    }
+
+    // Only the files for changed properties are written
+    void splitWriteChanges()
+    {
+        QTemporaryDir tempDir;
+        Path dir{tempDir.path()};
+        PropertyWriter writer{dir};
+
+        writer.queueSplitWrite(testData(), testMainFilename, testSplitFiles,
+                               {QStringLiteral("latencies")}, false);
+        writer.flush();
+        QCOMPARE(readJsonFile(dir / "latencies.json"),
+                 (QJsonObject{{QStringLiteral("latencies"), testData()[QStringLiteral("latencies")]}}));
+        QVERIFY(!QFile::exists(dir / "regions.json"));
+        QVERIFY(!QFile::exists(dir / testMainFilename));
+
+        // A change to any other property writes the main file, without the
+        // split properties
+        writer.queueSplitWrite(testData(), testMainFilename, testSplitFiles,
+                               {QStringLiteral("winDnsCacheDeleted")}, false);
+        writer.flush();
+        QCOMPARE(readJsonFile(dir / testMainFilename),
+                 (QJsonObject{{QStringLiteral("winDnsCacheDeleted"), true}}));
+        QVERIFY(!QFile::exists(dir / "regions.json"));
+    }
+
+    // Upgrading from a main file containing everything moves the split
+    // properties to their own files and removes them from the main file
+    void splitWriteMigration()
+    {
+        QTemporaryDir tempDir;
+        Path dir{tempDir.path()};
+        writeJsonFile(dir / testMainFilename, testData());
+
+        QSet<QString> missing = PropertyWriter::findMissingSplitFiles(dir, testSplitFiles);
+        QCOMPARE(missing, (QSet<QString>{QStringLiteral("latencies"), QStringLiteral("regions")}));
+
+        PropertyWriter writer{dir};
+        writer.queueSplitWrite(testData(), testMainFilename, testSplitFiles,
+                               missing, true);
+        writer.flush();
+
+        QCOMPARE(readJsonFile(dir / testMainFilename),
+                 (QJsonObject{{QStringLiteral("winDnsCacheDeleted"), true}}));
+        QCOMPARE(readJsonFile(dir / "latencies.json"),
+                 (QJsonObject{{QStringLiteral("latencies"), testData()[QStringLiteral("latencies")]}}));
+        QCOMPARE(readJsonFile(dir / "regions.json"),
+                 (QJsonObject{{QStringLiteral("regions"), testData()[QStringLiteral("regions")]}}));
+
+        // Nothing is missing after migrating
+        QVERIFY(PropertyWriter::findMissingSplitFiles(dir, testSplitFiles).empty());
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_propertywriter)
+#include TEST_MOC
@@ -477,6 +477,43 @@ private slots:
         QCOMPARE(pServer->openVpnTcpPorts(), std::vector<quint16>{80 COMMA 443 COMMA 853 COMMA 8443});
     }
 
+    // Servers are selected by service and port from the Location's index
+    void serverSelection()
+    {
+        LocationsById locs{buildRegionsFromJson(sample_docs::oneLocation)};
+        const auto &pAl = locs.at("al");
+        QVERIFY(pAl);
+
+        QVERIFY(pAl->hasService(Service::WireGuard));
+        QVERIFY(!pAl->hasService(Service::Shadowsocks));
+        QCOMPARE(pAl->countServersForService(Service::OpenVpnUdp), static_cast<std::size_t>(1));
+        QCOMPARE(pAl->countServersForPort(Service::OpenVpnTcp, 443), static_cast<std::size_t>(1));
+        QCOMPARE(pAl->countServersForPort(Service::OpenVpnTcp, 53), static_cast<std::size_t>(0));
+        QCOMPARE(pAl->allPortsForService(Service::OpenVpnUdp),
+                 (DescendingPortSet{8080, 853, 123, 53}));
+        DescendingPortSet allPorts{1};
+        pAl->allPortsForService(Service::OpenVpnTcp, allPorts);
+        QCOMPARE(allPorts, (DescendingPortSet{8443, 853, 443, 80, 1}));
+
+        // A port that isn't offered falls back to any server for the service
+        QCOMPARE(pAl->serverWithIndex(0, Service::OpenVpnTcp, 53)->ip(), "31.171.154.138");
+        QCOMPARE(pAl->serverWithIndexForPort(0, Service::OpenVpnTcp, 443)->ip(), "31.171.154.138");
+        QVERIFY(!pAl->serverWithIndexForService(1, Service::OpenVpnUdp));
+        QCOMPARE(pAl->randomServerForService(Service::WireGuard)->ip(), "31.171.154.131");
+        QVERIFY(!pAl->randomServerForPort(Service::WireGuard, 53));
+
+        // The IKEv2 server isn't used for latency measurements
+        for(int i=0; i<20; ++i)
+            QVERIFY(pAl->randomIcmpLatencyServer()->ip() != "31.171.154.135");
+
+        // Ranking the servers rebuilds the index in the new order
+        Location ranked{*pAl, {}, {}, {QStringLiteral("31.171.154.131")}};
+        QCOMPARE(ranked.servers()[0].ip(), "31.171.154.131");
+        QCOMPARE(ranked.serverWithIndexForService(0, Service::WireGuard)->ip(), "31.171.154.131");
+        QCOMPARE(ranked.serverWithIndexForService(0, Service::OpenVpnUdp)->ip(), "31.171.154.136");
+        QCOMPARE(ranked.countServersForService(Service::OpenVpnTcp), static_cast<std::size_t>(1));
+    }
+
     // // Building locations with a set of latency measurements should apply those
     // // measurements
     void preserveLatency()
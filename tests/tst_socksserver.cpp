@@ -0,0 +1,230 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include "daemon/src/socksserverthread.h"
+#include <common/src/thread.h>
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    const QHostAddress loopback{QHostAddress::SpecialAddress::LocalHost};
+    const QString loopbackInterface{QStringLiteral("lo")};
+
+    // SOCKS replies preceding the relayed data - method selection (2),
+    // username/password auth (2), and connect (10)
+    const int socksReplyLength{2 + 2 + 10};
+
+    const std::chrono::seconds testIdleTimeout{30};
+    const int waitMsec{10000};
+
+    // The load test takes a while and loads the machine; it only runs if this
+    // environment variable is set
+    const char loadTestEnvVar[]{"PIA_SOCKS_LOAD_TEST"};
+}
+
+// Echo server run on a worker thread, so the tests can block on their own
+// sockets
+class EchoServer
+{
+public:
+    EchoServer()
+    {
+        _thread.invokeOnThread([this]()
+        {
+            auto pServer = new QTcpServer{&_thread.objectOwner()};
+            if(!pServer->listen(loopback))
+                return;
+            _port = pServer->serverPort();
+            QObject::connect(pServer, &QTcpServer::newConnection, pServer, [pServer]()
+            {
+                while(auto pSocket = pServer->nextPendingConnection())
+                {
+                    QObject::connect(pSocket, &QTcpSocket::readyRead, pSocket,
+                        [pSocket](){pSocket->write(pSocket->readAll());});
+                    QObject::connect(pSocket, &QTcpSocket::disconnected, pSocket,
+                                     &QObject::deleteLater);
+                }
+            });
+        });
+    }
+
+    quint16 port() const {return _port;}
+
+private:
+    RunningWorkerThread _thread;
+    quint16 _port{0};
+};
+
+class tst_socksserver : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Build the complete client side of a SOCKS connection to targetPort on
+    // loopback, followed by payload.  The proxy processes the pipelined
+    // messages in order and forwards the payload once connected.
+    QByteArray buildRequest(const QByteArray &password, quint16 targetPort,
+                            const QByteArray &payload)
+    {
+        QByteArray request;
+        // Greeting - version 5, one method, username/password
+        request.append('\x05').append('\x01').append('\x02');
+        // Username/password auth
+        request.append('\x01');
+        request.append(static_cast<char>(SocksConnection::username.size()));
+        request.append(SocksConnection::username);
+        request.append(static_cast<char>(password.size()));
+        request.append(password);
+        // Connect to 127.0.0.1:targetPort
+        request.append('\x05').append('\x01').append('\x00').append('\x01');
+        request.append('\x7F').append('\x00').append('\x00').append('\x01');
+        request.append(static_cast<char>(targetPort >> 8));
+        request.append(static_cast<char>(targetPort & 0xFF));
+        request.append(payload);
+        return request;
+    }
+
+    // Read exactly size bytes, or fewer if the socket stalls or closes
+    QByteArray readExactly(QTcpSocket &socket, int size, int timeoutMsec = waitMsec)
+    {
+        QByteArray data;
+        while(data.size() < size)
+        {
+            if(socket.bytesAvailable() <= 0 && !socket.waitForReadyRead(timeoutMsec))
+                break;
+            data += socket.read(size - data.size());
+        }
+        return data;
+    }
+
+    // Check the SOCKS replies and the echoed payload
+    bool checkResponse(QTcpSocket &socket, const QByteArray &payload)
+    {
+        QByteArray replies = readExactly(socket, socksReplyLength);
+        if(replies.size() != socksReplyLength)
+            return false;
+        // Accepted username/password, auth succeeded, connect succeeded
+        if(replies[1] != '\x02' || replies[3] != '\x00' || replies[5] != '\x00')
+            return false;
+        return readExactly(socket, payload.size()) == payload;
+    }
+
+private slots:
+    // Load test - drive a few thousand connections through the proxy, with
+    // many open concurrently.  Opt-in, set PIA_SOCKS_LOAD_TEST=1 to run it.
+    void loadTest()
+    {
+        if(!qEnvironmentVariableIsSet(loadTestEnvVar))
+            QSKIP("Load test not enabled, set PIA_SOCKS_LOAD_TEST to run it");
+
+        const int totalConnections{2000};
+        const int concurrentConnections{64};
+        const int payloadSize{4096};
+
+        EchoServer echo;
+        QVERIFY(echo.port());
+
+        SocksServerThread proxy{SocksServerThread::defaultWorkerCount(),
+                                {concurrentConnections, testIdleTimeout}};
+        proxy.start(loopback, loopbackInterface);
+        QVERIFY(proxy.port());
+
+        QElapsedTimer elapsed;
+        elapsed.start();
+        int completed{0};
+        while(completed < totalConnections)
+        {
+            std::vector<std::unique_ptr<QTcpSocket>> batch;
+            std::vector<QByteArray> payloads;
+            for(int i=0; i<concurrentConnections && completed + i < totalConnections; ++i)
+            {
+                // Distinct payload for each connection
+                QByteArray payload{payloadSize, static_cast<char>('a' + (completed + i) % 26)};
+                batch.emplace_back(new QTcpSocket{});
+                batch.back()->connectToHost(loopback, proxy.port());
+                batch.back()->write(buildRequest(proxy.password(), echo.port(), payload));
+                payloads.push_back(std::move(payload));
+            }
+            for(std::size_t i=0; i<batch.size(); ++i)
+                QVERIFY(checkResponse(*batch[i], payloads[i]));
+            completed += static_cast<int>(batch.size());
+        }
+
+        qInfo() << "Relayed" << totalConnections << "connections in"
+            << elapsed.elapsed() << "ms with" << SocksServerThread::defaultWorkerCount()
+            << "workers";
+        proxy.stop();
+    }
+
+    // Connections beyond the limit wait until others close
+    void connectionLimit()
+    {
+        EchoServer echo;
+        QVERIFY(echo.port());
+
+        SocksServerThread proxy{1, {2, testIdleTimeout}};
+        proxy.start(loopback, loopbackInterface);
+        QVERIFY(proxy.port());
+
+        const QByteArray payload{"hello"};
+        QTcpSocket first, second, third;
+        for(QTcpSocket *pSocket : {&first, &second, &third})
+        {
+            pSocket->connectToHost(loopback, proxy.port());
+            pSocket->write(buildRequest(proxy.password(), echo.port(), payload));
+        }
+
+        QVERIFY(checkResponse(first, payload));
+        QVERIFY(checkResponse(second, payload));
+        // The third connection isn't served yet
+        QVERIFY(!third.waitForReadyRead(500));
+
+        first.disconnectFromHost();
+        QVERIFY(checkResponse(third, payload));
+        proxy.stop();
+    }
+
+    // Idle connections are closed
+    void idleTimeout()
+    {
+        EchoServer echo;
+        QVERIFY(echo.port());
+
+        SocksServerThread proxy{1, {8, std::chrono::milliseconds{300}}};
+        proxy.start(loopback, loopbackInterface);
+        QVERIFY(proxy.port());
+
+        const QByteArray payload{"hello"};
+        QTcpSocket client;
+        client.connectToHost(loopback, proxy.port());
+        client.write(buildRequest(proxy.password(), echo.port(), payload));
+        QVERIFY(checkResponse(client, payload));
+
+        QVERIFY(client.state() == QAbstractSocket::SocketState::UnconnectedState ||
+                client.waitForDisconnected(waitMsec));
+        proxy.stop();
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_socksserver)
+#include TEST_MOC
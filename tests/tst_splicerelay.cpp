@@ -0,0 +1,192 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include "daemon/src/linux/linux_splicerelay.h"
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <ctime>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    // Enough data to fill the relay pipes several times, so backpressure is
+    // exercised
+    const int transferSize{1024 * 1024};
+
+    const std::chrono::seconds relayIdleTimeout{30};
+}
+
+class tst_splicerelay : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Connect a client socket to a local server, and return the accepted
+    // socket's descriptor (duplicated, the accepted QTcpSocket is destroyed)
+    kapps::core::PosixFd connectLocal(QTcpServer &server, QTcpSocket &client)
+    {
+        client.connectToHost(QHostAddress::LocalHost, server.serverPort());
+        if(!client.waitForConnected(5000) || !server.waitForNewConnection(5000))
+            return {};
+        std::unique_ptr<QTcpSocket> pAccepted{server.nextPendingConnection()};
+        if(!pAccepted)
+            return {};
+        kapps::core::PosixFd fd{::dup(static_cast<int>(pAccepted->socketDescriptor()))};
+        pAccepted->abort();
+        return fd;
+    }
+
+    // Read size bytes from a socket.  This runs the event loop (rather than
+    // blocking in waitForReadyRead()) so the relay can run.
+    QByteArray readAll(QTcpSocket &socket, int size)
+    {
+        QByteArray data;
+        QDeadlineTimer deadline{10000};
+        while(data.size() < size && !deadline.hasExpired())
+        {
+            QTest::qWait(10);
+            data += socket.readAll();
+        }
+        return data;
+    }
+
+private slots:
+    // Relay data in both directions, then close both sides
+    void relayBothDirections()
+    {
+        QTcpServer server;
+        QVERIFY(server.listen(QHostAddress::LocalHost));
+
+        // "client" is the SOCKS client, "target" is the remote end
+        QTcpSocket client, target;
+        auto clientFd = connectLocal(server, client);
+        QVERIFY(clientFd);
+        auto targetFd = connectLocal(server, target);
+        QVERIFY(targetFd);
+
+        SpliceRelay relay{std::move(clientFd), std::move(targetFd), relayIdleTimeout};
+        QVERIFY(relay.valid());
+        QSignalSpy finishedSpy{&relay, &SpliceRelay::finished};
+
+        QByteArray request{transferSize, 'q'};
+        client.write(request);
+        QCOMPARE(readAll(target, transferSize), request);
+
+        QByteArray response{transferSize / 2, 'r'};
+        target.write(response);
+        QCOMPARE(readAll(client, response.size()), response);
+
+        QTRY_COMPARE(relay.outboundBytes(), static_cast<quint64>(request.size()));
+        QTRY_COMPARE(relay.inboundBytes(), static_cast<quint64>(response.size()));
+
+        // Closing the client shuts down the target's side, then the target
+        // closes and the relay finishes
+        client.disconnectFromHost();
+        QTRY_COMPARE(target.state(), QAbstractSocket::SocketState::UnconnectedState);
+        QTRY_COMPARE(finishedSpy.size(), 1);
+    }
+
+    // When the target reads slowly, the relay waits for it to drain the pipe
+    // instead of spinning on the source, and all data still arrive intact
+    void slowReader()
+    {
+        QTcpServer server;
+        QVERIFY(server.listen(QHostAddress::LocalHost));
+
+        QTcpSocket client, target;
+        auto clientFd = connectLocal(server, client);
+        QVERIFY(clientFd);
+        auto targetFd = connectLocal(server, target);
+        QVERIFY(targetFd);
+
+        // Keep the target's buffers small, so the relay pipe fills while the
+        // target isn't reading
+        int bufferSize{4096};
+        ::setsockopt(targetFd.get(), SOL_SOCKET, SO_SNDBUF, &bufferSize,
+                     sizeof(bufferSize));
+        ::setsockopt(static_cast<int>(target.socketDescriptor()), SOL_SOCKET,
+                     SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+        target.setReadBufferSize(bufferSize);
+
+        SpliceRelay relay{std::move(clientFd), std::move(targetFd), relayIdleTimeout};
+        QVERIFY(relay.valid());
+
+        QByteArray request{transferSize / 4, 's'};
+        client.write(request);
+
+        // Stall the target - the relay must not busy-wait meanwhile
+        std::clock_t cpuStart = std::clock();
+        QTest::qWait(500);
+        auto cpuMsec = (std::clock() - cpuStart) * 1000 / CLOCKS_PER_SEC;
+        QVERIFY2(cpuMsec < 250,
+                 qPrintable(QStringLiteral("Used %1 ms CPU while stalled").arg(cpuMsec)));
+        QVERIFY(relay.outboundBytes() < static_cast<quint64>(request.size()));
+
+        // Read slowly through the small buffer
+        QCOMPARE(readAll(target, request.size()), request);
+        QTRY_COMPARE(relay.outboundBytes(), static_cast<quint64>(request.size()));
+    }
+
+    // The relay finishes if the other side doesn't close after one side does
+    void closeTimeout()
+    {
+        QTcpServer server;
+        QVERIFY(server.listen(QHostAddress::LocalHost));
+
+        QTcpSocket client, target;
+        auto clientFd = connectLocal(server, client);
+        QVERIFY(clientFd);
+        auto targetFd = connectLocal(server, target);
+        QVERIFY(targetFd);
+
+        SpliceRelay relay{std::move(clientFd), std::move(targetFd), relayIdleTimeout};
+        QVERIFY(relay.valid());
+        QSignalSpy finishedSpy{&relay, &SpliceRelay::finished};
+
+        // Shut down only the target's write half; the client receives EOF
+        // but never closes
+        ::shutdown(static_cast<int>(target.socketDescriptor()), SHUT_WR);
+        QVERIFY(finishedSpy.wait(10000));
+    }
+
+    // The relay finishes if nothing is relayed for the idle timeout
+    void idleTimeout()
+    {
+        QTcpServer server;
+        QVERIFY(server.listen(QHostAddress::LocalHost));
+
+        QTcpSocket client, target;
+        auto clientFd = connectLocal(server, client);
+        QVERIFY(clientFd);
+        auto targetFd = connectLocal(server, target);
+        QVERIFY(targetFd);
+
+        SpliceRelay relay{std::move(clientFd), std::move(targetFd),
+                          std::chrono::milliseconds{200}};
+        QVERIFY(relay.valid());
+        QSignalSpy finishedSpy{&relay, &SpliceRelay::finished};
+        QVERIFY(finishedSpy.wait(5000));
+        QTRY_COMPARE(client.state(), QAbstractSocket::SocketState::UnconnectedState);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_splicerelay)
+#include TEST_MOC
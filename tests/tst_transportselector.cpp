@@ -18,6 +18,8 @@
 
 #include <common/src/common.h>
 #include <QtTest>
+#include <QTcpServer>
+#include <QUdpSocket>
 
 #include "daemon/src/vpn.h"
 #include "common/src/locations.h"
@@ -53,6 +55,71 @@ namespace samples
     }
   ]
 }
+)").object();
+    // Races probe several transports on one server, so this location's server
+    // has both OpenVPN UDP and TCP
+    const auto raceLocationJson = QJsonDocument::fromJson(R"(
+{
+  "groups": {
+    "ovpntcp": [{ "name": "openvpn_tcp", "ports": [500, 1003,1004] }],
+    "ovpnudp": [{ "name": "openvpn_udp", "ports": [8080, 1001,1002] }]
+  },
+  "regions": [
+    {
+      "id": "nz",
+      "name": "New Zealand",
+      "country": "NZ",
+      "auto_region": true,
+      "dns": "nz.privacy.network",
+      "port_forward": true,
+      "geo": false,
+      "offline": false,
+      "servers": {
+        "ovpnudp": [{ "ip": "43.250.207.85", "cn": "newzealand403" }],
+        "ovpntcp": [{ "ip": "43.250.207.85", "cn": "newzealand403" }]
+      }
+    }
+  ]
+}
+)").object();
+    // Like raceLocationJson, but the servers don't offer UDP port 1001, and
+    // the "sg" server doesn't offer UDP at all
+    const auto raceOtherPortsJson = QJsonDocument::fromJson(R"(
+{
+  "groups": {
+    "ovpntcp": [{ "name": "openvpn_tcp", "ports": [500, 1003,1004] }],
+    "ovpnudp": [{ "name": "openvpn_udp", "ports": [8080, 1002] }]
+  },
+  "regions": [
+    {
+      "id": "au",
+      "name": "Australia",
+      "country": "AU",
+      "auto_region": true,
+      "dns": "au.privacy.network",
+      "port_forward": true,
+      "geo": false,
+      "offline": false,
+      "servers": {
+        "ovpnudp": [{ "ip": "43.250.207.95", "cn": "australia403" }],
+        "ovpntcp": [{ "ip": "43.250.207.95", "cn": "australia403" }]
+      }
+    },
+    {
+      "id": "sg",
+      "name": "Singapore",
+      "country": "SG",
+      "auto_region": true,
+      "dns": "sg.privacy.network",
+      "port_forward": true,
+      "geo": false,
+      "offline": false,
+      "servers": {
+        "ovpntcp": [{ "ip": "43.250.207.105", "cn": "singapore403" }]
+      }
+    }
+  ]
+}
 )").object();
     const auto metadataJson = QJsonDocument::fromJson(R"({
         "translations":{},
@@ -177,6 +244,203 @@ private slots:
         // again from the beginning with udp
         QVERIFY(transportSelector.lastUsed().protocol() == "udp");
     }
+
+    void testRaceCandidates()
+    {
+        QHostAddress dummyAddr{0xC0000201};
+        bool delayNext;
+
+        LocationsById locs{buildRegionsFromJson(samples::raceLocationJson)};
+        const Location &location = *locs.at("nz");
+
+        TransportSelector transportSelector;
+        transportSelector.reset("udp", 0, true, udpPorts, tcpPorts);
+        const Server *pServer = transportSelector.beginAttempt(location, dummyAddr, delayNext);
+        QVERIFY(pServer);
+
+        // The preferred transport comes first, then alternates alternating
+        // between protocols.  Default ports are resolved for the server.
+        const auto candidates = transportSelector.beginRace(*pServer, 4);
+        QCOMPARE(candidates.size(), std::size_t{4});
+        QCOMPARE(candidates[0], (Transport{"udp", preferredUdpPort}));
+        QCOMPARE(candidates[1], (Transport{"udp", firstAltUdp}));
+        QCOMPARE(candidates[2], (Transport{"tcp", preferredTcpPort}));
+        QCOMPARE(candidates[3], (Transport{"udp", secondAltUdp}));
+
+        // Only one race per connection sequence
+        QVERIFY(transportSelector.beginRace(*pServer, 4).empty());
+
+        // A new sequence can race again, but not without alternates
+        transportSelector.reset("udp", 0, false, udpPorts, tcpPorts);
+        transportSelector.beginAttempt(location, dummyAddr, delayNext);
+        QVERIFY(transportSelector.beginRace(*pServer, 4).empty());
+    }
+
+    // If the server doesn't offer the selected port, the server's default port
+    // for the selected protocol is preferred.  If it doesn't offer the
+    // selected protocol at all, an alternate can't stand in for the preferred
+    // transport, so there's no race.
+    void testRacePreferredNotOffered()
+    {
+        QHostAddress dummyAddr{0xC0000201};
+        bool delayNext;
+
+        LocationsById locs{buildRegionsFromJson(samples::raceLocationJson)};
+        LocationsById otherLocs{buildRegionsFromJson(samples::raceOtherPortsJson)};
+
+        TransportSelector transportSelector;
+        transportSelector.reset("udp", secondAltUdp, true, udpPorts, tcpPorts);
+        QVERIFY(transportSelector.beginAttempt(*locs.at("nz"), dummyAddr, delayNext));
+
+        const auto candidates = transportSelector.beginRace(otherLocs.at("au")->servers().front(), 3);
+        QCOMPARE(candidates.size(), std::size_t{3});
+        QCOMPARE(candidates[0], (Transport{"udp", preferredUdpPort}));
+        QCOMPARE(candidates[1], (Transport{"tcp", preferredTcpPort}));
+        QCOMPARE(candidates[2], (Transport{"udp", firstAltUdp}));
+
+        transportSelector.reset("udp", secondAltUdp, true, udpPorts, tcpPorts);
+        QVERIFY(transportSelector.beginAttempt(*locs.at("nz"), dummyAddr, delayNext));
+        QVERIFY(transportSelector.beginRace(otherLocs.at("sg")->servers().front(), 3).empty());
+    }
+
+    void testRaceWinner()
+    {
+        QHostAddress dummyAddr{0xC0000201};
+        bool delayNext;
+
+        LocationsById locs{buildRegionsFromJson(samples::raceLocationJson)};
+        const Location &location = *locs.at("nz");
+
+        // Use the default preferred transport timeout; the race winner is
+        // tried without waiting for it
+        TransportSelector transportSelector;
+        transportSelector.reset("udp", 0, true, udpPorts, tcpPorts);
+        const Server *pServer = transportSelector.beginAttempt(location, dummyAddr, delayNext);
+        QVERIFY(pServer);
+
+        // The preferred transport winning has no effect
+        transportSelector.raceWon({"udp", preferredUdpPort}, pServer->ip());
+        transportSelector.beginAttempt(location, dummyAddr, delayNext);
+        QCOMPARE(transportSelector.lastUsed(), (Transport{"udp", preferredUdpPort}));
+
+        // An alternate winning is tried next on the probed server
+        transportSelector.raceWon({"tcp", firstAltTcp}, pServer->ip());
+        pServer = transportSelector.beginAttempt(location, dummyAddr, delayNext);
+        QCOMPARE(transportSelector.lastUsed(), (Transport{"tcp", firstAltTcp}));
+        QVERIFY(pServer);
+        QCOMPARE(pServer->ip(), QStringLiteral("43.250.207.85"));
+
+        // Then the preferred transport again - the other alternates still wait
+        // for the preferred transport timeout
+        transportSelector.beginAttempt(location, dummyAddr, delayNext);
+        QCOMPARE(transportSelector.lastUsed(), (Transport{"udp", preferredUdpPort}));
+        transportSelector.beginAttempt(location, dummyAddr, delayNext);
+        QCOMPARE(transportSelector.lastUsed(), (Transport{"udp", preferredUdpPort}));
+
+        // A network change discards a winner
+        transportSelector.raceWon({"tcp", firstAltTcp}, pServer->ip());
+        transportSelector.beginAttempt(location, QHostAddress{0xC0000202}, delayNext);
+        QCOMPARE(transportSelector.lastUsed(), (Transport{"udp", preferredUdpPort}));
+    }
+
+    void testTransportRace()
+    {
+        // Only the TCP transport is reachable - nothing answers UDP probes on
+        // this port
+        QTcpServer tcpServer;
+        QVERIFY(tcpServer.listen(QHostAddress::LocalHost));
+        QUdpSocket udpSink;
+        QVERIFY(udpSink.bind(QHostAddress::LocalHost));
+
+        TransportRace race;
+        int wins{0};
+        Transport winner;
+        QString winnerIp;
+        connect(&race, &TransportRace::won, this,
+            [&](const Transport &transport, const QString &serverIp)
+            {
+                ++wins;
+                winner = transport;
+                winnerIp = serverIp;
+            });
+
+        // The alternate wins only once the preferred probe times out (3s)
+        QElapsedTimer elapsed;
+        elapsed.start();
+        race.start(QHostAddress::LocalHost,
+                   {{"udp", udpSink.localPort()}, {"tcp", tcpServer.serverPort()}},
+                   {});
+        QTRY_COMPARE_WITH_TIMEOUT(wins, 1, 10000);
+        QVERIFY(elapsed.elapsed() >= 2500);
+        QCOMPARE(winner, (Transport{"tcp", tcpServer.serverPort()}));
+        QCOMPARE(winnerIp, QStringLiteral("127.0.0.1"));
+    }
+
+    void testTransportRacePreferredSlower()
+    {
+        // The alternate TCP transport responds right away, but the preferred
+        // UDP transport responds a bit later, and it still wins
+        QTcpServer tcpServer;
+        QVERIFY(tcpServer.listen(QHostAddress::LocalHost));
+        QUdpSocket udpServer;
+        QVERIFY(udpServer.bind(QHostAddress::LocalHost));
+        connect(&udpServer, &QUdpSocket::readyRead, this, [&]()
+        {
+            QHostAddress sender;
+            quint16 senderPort{0};
+            udpServer.readDatagram(nullptr, 0, &sender, &senderPort);
+            QTimer::singleShot(200, &udpServer, [&udpServer, sender, senderPort]()
+            {
+                udpServer.writeDatagram(QByteArray(1, '\0'), sender, senderPort);
+            });
+        });
+
+        TransportRace race;
+        int wins{0};
+        Transport winner;
+        connect(&race, &TransportRace::won, this,
+            [&](const Transport &transport, const QString &)
+            {
+                ++wins;
+                winner = transport;
+            });
+
+        race.start(QHostAddress::LocalHost,
+                   {{"udp", udpServer.localPort()}, {"tcp", tcpServer.serverPort()}},
+                   {});
+        QTRY_COMPARE(wins, 1);
+        QCOMPARE(winner, (Transport{"udp", udpServer.localPort()}));
+    }
+
+    void testTransportRacePreferredFailed()
+    {
+        // The preferred TCP port refuses connections, so the alternate wins
+        // without waiting for the probe timeout
+        quint16 closedPort{0};
+        {
+            QTcpServer closedServer;
+            QVERIFY(closedServer.listen(QHostAddress::LocalHost));
+            closedPort = closedServer.serverPort();
+        }
+        QTcpServer tcpServer;
+        QVERIFY(tcpServer.listen(QHostAddress::LocalHost));
+
+        TransportRace race;
+        int wins{0};
+        Transport winner;
+        connect(&race, &TransportRace::won, this,
+            [&](const Transport &transport, const QString &)
+            {
+                ++wins;
+                winner = transport;
+            });
+
+        race.start(QHostAddress::LocalHost,
+                   {{"tcp", closedPort}, {"tcp", tcpServer.serverPort()}},
+                   {});
+        QTRY_COMPARE_WITH_TIMEOUT(wins, 1, 2000);
+        QCOMPARE(winner, (Transport{"tcp", tcpServer.serverPort()}));
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_transportselector)
@@ -0,0 +1,279 @@
+// Copyright (c) 2025 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include <common/src/common.h>
+#include "daemon/src/linux/linux_wgstats.h"
+#include "daemon/src/linux/linux_libnl.h"
+#include "daemon/src/linux/linux_nlcache.h"
+#include <QtTest>
+#include <linux/wireguard.h>
+#include <linux/time_types.h>
+#include <cstring>
+
+namespace
+{
+    using Key = std::array<std::uint8_t, WG_KEY_LEN>;
+
+    Key mockKey(std::uint8_t value)
+    {
+        Key key;
+        key.fill(value);
+        return key;
+    }
+
+    // Builds a WG_CMD_GET_DEVICE message like the kernel's dump replies
+    class MockDumpMsg
+    {
+    public:
+        MockDumpMsg()
+        {
+            append(nullptr, NLMSG_HDRLEN);
+            genlmsghdr genHeader{};
+            genHeader.cmd = WG_CMD_GET_DEVICE;
+            genHeader.version = WG_GENL_VERSION;
+            append(&genHeader, sizeof(genHeader));
+            append(nullptr, GENL_HDRLEN - sizeof(genHeader));
+        }
+
+    public:
+        // Begin a nested attribute; returns its offset for endNest()
+        int beginNest(std::uint16_t type)
+        {
+            int offset = _data.size();
+            put(static_cast<std::uint16_t>(type | NLA_F_NESTED), nullptr, 0);
+            return offset;
+        }
+        void endNest(int offset)
+        {
+            nlattr *pAttr = reinterpret_cast<nlattr*>(_data.data() + offset);
+            pAttr->nla_len = static_cast<std::uint16_t>(_data.size() - offset);
+        }
+
+        void put(std::uint16_t type, const void *pData, std::size_t len)
+        {
+            nlattr attr{};
+            attr.nla_type = type;
+            attr.nla_len = static_cast<std::uint16_t>(NLA_HDRLEN + len);
+            append(&attr, sizeof(attr));
+            append(pData, len);
+            append(nullptr, NLA_ALIGN(len) - len);
+        }
+        void putU64(std::uint16_t type, std::uint64_t value)
+        {
+            put(type, &value, sizeof(value));
+        }
+
+        // Add a peer - only the public key if rxBytes is 0
+        void putPeer(const Key &key, std::uint64_t rxBytes, std::uint64_t txBytes,
+                     std::int64_t handshakeSec)
+        {
+            int peer = beginNest(0);
+            put(WGPEER_A_PUBLIC_KEY, key.data(), key.size());
+            if(rxBytes)
+            {
+                putU64(WGPEER_A_RX_BYTES, rxBytes);
+                putU64(WGPEER_A_TX_BYTES, txBytes);
+                __kernel_timespec handshake{};
+                handshake.tv_sec = handshakeSec;
+                handshake.tv_nsec = 500;
+                put(WGPEER_A_LAST_HANDSHAKE_TIME, &handshake, sizeof(handshake));
+            }
+            endNest(peer);
+        }
+
+        nlmsghdr &header()
+        {
+            nlmsghdr *pHeader = reinterpret_cast<nlmsghdr*>(_data.data());
+            pHeader->nlmsg_len = static_cast<std::uint32_t>(_data.size());
+            return *pHeader;
+        }
+
+    private:
+        void append(const void *pData, std::size_t len)
+        {
+            if(pData)
+                _data.append(reinterpret_cast<const char*>(pData), static_cast<int>(len));
+            else
+                _data.append(static_cast<int>(len), '\0');
+        }
+
+    private:
+        QByteArray _data;
+    };
+}
+
+class tst_wgstats : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase()
+    {
+        if(!libnl::load())
+            QSKIP("libnl is not available");
+    }
+
+    // Peers' stats are parsed from the nested peer attributes
+    void parsePeers()
+    {
+        MockDumpMsg msg;
+        int peers = msg.beginNest(WGDEVICE_A_PEERS);
+        msg.putPeer(mockKey(1), 1000, 2000, 1600000000);
+        msg.putPeer(mockKey(2), 3000, 4000, 1600000100);
+        msg.endNest(peers);
+
+        LinuxWgStats::DumpParser parser;
+        parser.parseMessage(msg.header());
+        auto result = parser.takePeers();
+        QCOMPARE(result.size(), std::size_t{2});
+        QCOMPARE(result[0]._publicKey, mockKey(1));
+        QCOMPARE(result[0]._rxBytes, std::uint64_t{1000});
+        QCOMPARE(result[0]._txBytes, std::uint64_t{2000});
+        QCOMPARE(result[0]._lastHandshakeSec, std::int64_t{1600000000});
+        QCOMPARE(result[0]._lastHandshakeNsec, std::int64_t{500});
+        QCOMPARE(result[1]._publicKey, mockKey(2));
+        QCOMPARE(result[1]._rxBytes, std::uint64_t{3000});
+
+        // Taking the peers resets the parser
+        QVERIFY(parser.takePeers().empty());
+    }
+
+    // A peer continued in the next message (with just its key and more
+    // allowed IPs) is only reported once, with the stats from its first part
+    void peerContinuation()
+    {
+        MockDumpMsg first;
+        int peers = first.beginNest(WGDEVICE_A_PEERS);
+        first.putPeer(mockKey(1), 1000, 2000, 1600000000);
+        first.putPeer(mockKey(2), 3000, 4000, 1600000100);
+        first.endNest(peers);
+
+        MockDumpMsg second;
+        peers = second.beginNest(WGDEVICE_A_PEERS);
+        int peer = second.beginNest(0);
+        second.put(WGPEER_A_PUBLIC_KEY, mockKey(2).data(), WG_KEY_LEN);
+        int allowedIps = second.beginNest(WGPEER_A_ALLOWEDIPS);
+        second.endNest(allowedIps);
+        second.endNest(peer);
+        second.putPeer(mockKey(3), 5000, 6000, 1600000200);
+        second.endNest(peers);
+
+        LinuxWgStats::DumpParser parser;
+        parser.parseMessage(first.header());
+        parser.parseMessage(second.header());
+        auto result = parser.takePeers();
+        QCOMPARE(result.size(), std::size_t{3});
+        QCOMPARE(result[1]._publicKey, mockKey(2));
+        QCOMPARE(result[1]._rxBytes, std::uint64_t{3000});
+        QCOMPARE(result[1]._lastHandshakeSec, std::int64_t{1600000100});
+        QCOMPARE(result[2]._publicKey, mockKey(3));
+    }
+
+    // Missing stats are 0; a message without peers has no peers, and a peer
+    // without a public key is an error
+    void missingAttributes()
+    {
+        MockDumpMsg keyOnly;
+        int peers = keyOnly.beginNest(WGDEVICE_A_PEERS);
+        keyOnly.putPeer(mockKey(1), 0, 0, 0);
+        keyOnly.endNest(peers);
+
+        LinuxWgStats::DumpParser parser;
+        parser.parseMessage(keyOnly.header());
+        auto result = parser.takePeers();
+        QCOMPARE(result.size(), std::size_t{1});
+        QCOMPARE(result[0]._rxBytes, std::uint64_t{0});
+        QCOMPARE(result[0]._txBytes, std::uint64_t{0});
+        QCOMPARE(result[0]._lastHandshakeSec, std::int64_t{0});
+
+        MockDumpMsg noPeers;
+        parser.parseMessage(noPeers.header());
+        QVERIFY(parser.takePeers().empty());
+
+        MockDumpMsg noKey;
+        peers = noKey.beginNest(WGDEVICE_A_PEERS);
+        int peer = noKey.beginNest(0);
+        noKey.putU64(WGPEER_A_RX_BYTES, 1000);
+        noKey.endNest(peer);
+        noKey.endNest(peers);
+        QVERIFY_THROWS_EXCEPTION(LibnlError, parser.parseMessage(noKey.header()));
+
+        // A truncated key is rejected by the attribute policy
+        MockDumpMsg shortKey;
+        peers = shortKey.beginNest(WGDEVICE_A_PEERS);
+        peer = shortKey.beginNest(0);
+        shortKey.put(WGPEER_A_PUBLIC_KEY, mockKey(1).data(), WG_KEY_LEN / 2);
+        shortKey.endNest(peer);
+        shortKey.endNest(peers);
+        QVERIFY_THROWS_EXCEPTION(LibnlError, parser.parseMessage(shortKey.header()));
+    }
+
+    // After a dump is abandoned (the request timed out), the next request
+    // starts a new dump, and late replies to the abandoned dump are ignored
+    void abandonedDump()
+    {
+        LinuxWgStats::DumpTracker dump;
+        dump.begin(10);
+
+        MockDumpMsg first;
+        int peers = first.beginNest(WGDEVICE_A_PEERS);
+        first.putPeer(mockKey(1), 1000, 2000, 1600000000);
+        first.endNest(peers);
+        first.header().nlmsg_seq = 10;
+        dump.handleMessage(first.header());
+
+        dump.abandon();
+        QVERIFY(!dump.requested());
+
+        // Second request
+        dump.begin(11);
+        QVERIFY(dump.requested());
+
+        MockDumpMsg late;
+        peers = late.beginNest(WGDEVICE_A_PEERS);
+        late.putPeer(mockKey(2), 3000, 4000, 1600000100);
+        late.endNest(peers);
+        late.header().nlmsg_seq = 10;
+        dump.handleMessage(late.header());
+        nlmsghdr lateDone{};
+        lateDone.nlmsg_type = NLMSG_DONE;
+        lateDone.nlmsg_seq = 10;
+        dump.handleDone(lateDone);
+        QVERIFY(!dump.complete());
+
+        MockDumpMsg second;
+        peers = second.beginNest(WGDEVICE_A_PEERS);
+        second.putPeer(mockKey(3), 5000, 6000, 1600000200);
+        second.endNest(peers);
+        second.header().nlmsg_seq = 11;
+        dump.handleMessage(second.header());
+        nlmsghdr done{};
+        done.nlmsg_type = NLMSG_DONE;
+        done.nlmsg_seq = 11;
+        dump.handleDone(done);
+        QVERIFY(dump.complete());
+
+        auto result = dump.takePeers();
+        QCOMPARE(result.size(), std::size_t{1});
+        QCOMPARE(result[0]._publicKey, mockKey(3));
+        QVERIFY(!dump.requested());
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_wgstats)
+#include TEST_MOC
@@ -18,7 +18,10 @@
 
 #include "daemon/src/wireguarduapi.h"
 #include <QtTest>
+#include <algorithm>
 #include <limits>
+#include <string>
+#include <vector>
 
 #if defined(Q_OS_WIN)
 #include <WinSock2.h> // ntohl(), etc.
@@ -30,6 +33,61 @@ namespace
 {
     // Dummy key name for messages
     const QLatin1String dummyKey{"dummy"};
+
+    const char testKey[] = "30f0a2fb80718b6c426688d1429fe612a9cb62e42d21c0dc8189058ab2cb217f";
+
+    // Feed a response to a ResponseParser in chunks of at most chunkSize
+    // bytes.  Returns the parsed lines as "name=value", or "" for the end.
+    std::vector<std::string> parseResponse(Uapi::ResponseParser &parser,
+                                           kapps::core::StringSlice response,
+                                           std::size_t chunkSize)
+    {
+        std::vector<std::string> lines;
+        Uapi::ResponseParser::Line line;
+        while(!response.empty())
+        {
+            auto space = parser.writableSpace();
+            auto count = std::min({space.size(), chunkSize, response.size()});
+            std::copy(response.begin(), response.begin() + count, space.begin());
+            parser.commit(count);
+            response = response.substr(count);
+            while(parser.next(line))
+            {
+                if(line.type == Uapi::ResponseParser::LineType::End)
+                    lines.push_back({});
+                else
+                    lines.push_back(line.name.to_string() + "=" + line.value.to_string());
+            }
+        }
+        return lines;
+    }
+
+    // Build a typical response to "get=1" for a device with peerCount peers
+    std::string buildStatusResponse(int peerCount)
+    {
+        std::string response;
+        response += "private_key=" + std::string{testKey} + "\n";
+        response += "listen_port=51820\n";
+        for(int i=0; i<peerCount; ++i)
+        {
+            response += "public_key=" + std::string{testKey} + "\n";
+            response += "preshared_key=" + std::string{testKey} + "\n";
+            response += "protocol_version=1\n";
+            if(i % 2)
+                response += "endpoint=[2001:db8::1]:1337\n";
+            else
+                response += "endpoint=203.0.113.1:1337\n";
+            response += "last_handshake_time_sec=1700000000\n";
+            response += "last_handshake_time_nsec=123456789\n";
+            response += "tx_bytes=" + std::to_string(6000000000ull + i) + "\n";
+            response += "rx_bytes=" + std::to_string(9000000000ull + i) + "\n";
+            response += "persistent_keepalive_interval=25\n";
+            response += "allowed_ip=0.0.0.0/0\n";
+            response += "allowed_ip=::/0\n";
+        }
+        response += "errno=0\n\n";
+        return response;
+    }
 }
 
 
@@ -41,40 +99,49 @@ private slots:
     void testParseLongLong()
     {
         // Valid tests
-        QCOMPARE(Uapi::parseLonglong<long long>(QLatin1String{"0"}), 0ll);
-        QCOMPARE(Uapi::parseLonglong<long long>(QLatin1String{"-1"}), -1ll);
-        QCOMPARE(Uapi::parseLonglong<long long>(QLatin1String{"6000000000"}), 6000000000ll);  // >32 bits
-        QCOMPARE(Uapi::parseLonglong<long long>(QLatin1String{"-6000000000"}), -6000000000ll);    // >32 bits
-        QCOMPARE(Uapi::parseLonglong<long long>(QLatin1String{"9223372036854775807"}), std::numeric_limits<long long>::max()); // max
-        QCOMPARE(Uapi::parseLonglong<long long>(QLatin1String{"-9223372036854775808"}), std::numeric_limits<long long>::min()); // min
-        QCOMPARE(Uapi::parseLonglong<unsigned long long>(QLatin1String{"0"}), 0ull);
-        QCOMPARE(Uapi::parseLonglong<unsigned long long>(QLatin1String{"6000000000"}), 6000000000ull); // >32 bits
-        QCOMPARE(Uapi::parseLonglong<unsigned long long>(QLatin1String{"18446744073709551615"}), std::numeric_limits<unsigned long long>::max());  // max
+        QCOMPARE(Uapi::parseInt<long long>("0"), 0ll);
+        QCOMPARE(Uapi::parseInt<long long>("-1"), -1ll);
+        QCOMPARE(Uapi::parseInt<long long>("6000000000"), 6000000000ll);  // >32 bits
+        QCOMPARE(Uapi::parseInt<long long>("-6000000000"), -6000000000ll);    // >32 bits
+        QCOMPARE(Uapi::parseInt<long long>("9223372036854775807"), std::numeric_limits<long long>::max()); // max
+        QCOMPARE(Uapi::parseInt<long long>("-9223372036854775808"), std::numeric_limits<long long>::min()); // min
+        QCOMPARE(Uapi::parseInt<unsigned long long>("0"), 0ull);
+        QCOMPARE(Uapi::parseInt<unsigned long long>("6000000000"), 6000000000ull); // >32 bits
+        QCOMPARE(Uapi::parseInt<unsigned long long>("18446744073709551615"), std::numeric_limits<unsigned long long>::max());  // max
 
         // Invalid tests
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseLonglong<long long>(QLatin1String{"invalid"}), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseLonglong<long long>(QLatin1String{" 0 "}), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseLonglong<long long>(QLatin1String{"0invalid"}), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseLonglong<long long>(QLatin1String{"0."}), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseLonglong<long long>(QLatin1String{"1e7"}), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseLonglong<unsigned long long>(QLatin1String{"invalid"}), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseLonglong<unsigned long long>(QLatin1String{" 0 "}), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseLonglong<unsigned long long>(QLatin1String{"0invalid"}), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseLonglong<unsigned long long>(QLatin1String{"0."}), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseLonglong<unsigned long long>(QLatin1String{"1e7"}), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<long long>("invalid"), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<long long>(" 0 "), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<long long>("0invalid"), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<long long>("0."), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<long long>("1e7"), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<unsigned long long>("invalid"), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<unsigned long long>(" 0 "), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<unsigned long long>("0invalid"), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<unsigned long long>("0."), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<unsigned long long>("1e7"), Error);
     }
 
     void testParseInt()
     {
         // Integers shorter than 64 bits are limited to the correct range
-        QCOMPARE(Uapi::parseInt<short>(QLatin1String{"32767"}), 32767);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<short>(QLatin1String{"32768"}), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<short>(QLatin1String{"-32769"}), Error);
+        QCOMPARE(Uapi::parseInt<short>("32767"), 32767);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<short>("32768"), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<short>("-32769"), Error);
+
+        QCOMPARE(Uapi::parseInt<unsigned short>("65535"), 65535);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<unsigned short>("65536"), Error);
+        // '-' is not permitted for unsigned types
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<unsigned short>("-1"), Error);
 
-        QCOMPARE(Uapi::parseInt<unsigned short>(QLatin1String{"65535"}), 65535);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<unsigned short>(QLatin1String{"65536"}), Error);
-        // Negative values do not throw for unsigned, due to strtoull()
-        // permitting '-' (takes 2's complement of the unsigned value)
+        // 64-bit values out of range throw too (rather than saturating)
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<long long>("9223372036854775808"), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<long long>("-9223372036854775809"), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseInt<unsigned long long>("18446744073709551616"), Error);
+
+        // Values don't need to be null-terminated; parse a slice of a line
+        kapps::core::StringSlice line{"rx_bytes=6000000000\ntx_bytes=1"};
+        QCOMPARE(Uapi::parseInt<unsigned long long>(line.substr(9, 10)), 6000000000ull);
     }
 
     void testParseWgKey()
@@ -84,28 +151,28 @@ private slots:
                         0x62, 0xe4, 0x2d, 0x21, 0xc0, 0xdc, 0x81, 0x89, 0x05,
                         0x8a, 0xb2, 0xcb, 0x21, 0x7f};
         wg_key key{};
-        Uapi::parseWireguardKey(QLatin1String{"30f0a2fb80718b6c426688d1429fe612a9cb62e42d21c0dc8189058ab2cb217f"},
+        Uapi::parseWireguardKey("30f0a2fb80718b6c426688d1429fe612a9cb62e42d21c0dc8189058ab2cb217f",
                                 key);
         QCOMPARE(QByteArray(reinterpret_cast<const char *>(&key[0]), sizeof(key)),
                  QByteArray(reinterpret_cast<const char *>(&expected[0]), sizeof(expected)));
 
         // Correct length, invalid chars
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseWireguardKey(QLatin1String{"30f0a2fb80718b6c426688d1429fe612a9cb62e42d21c0dc8189058ab2cbXXXX"},
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseWireguardKey("30f0a2fb80718b6c426688d1429fe612a9cb62e42d21c0dc8189058ab2cbXXXX",
                                                          key), Error);
         // key is unmodified
         QCOMPARE(QByteArray(reinterpret_cast<const char *>(&key[0]), sizeof(key)),
                  QByteArray(reinterpret_cast<const char *>(&expected[0]), sizeof(expected)));
         // Incorrect length
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseWireguardKey(QLatin1String{"30f0a2fb80718b6c426688d1429fe612a9cb62e42d21c0dc8189058ab2cb217f0000"},
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseWireguardKey("30f0a2fb80718b6c426688d1429fe612a9cb62e42d21c0dc8189058ab2cb217f0000",
                                                          key), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseWireguardKey(QLatin1String{"30f0a2fb80718b6c426688d1429fe612a9cb62e42d21c0dc8189058ab2cb"},
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseWireguardKey("30f0a2fb80718b6c426688d1429fe612a9cb62e42d21c0dc8189058ab2cb",
                                                          key), Error);
     }
 
     void testParsePeerEndpoint()
     {
         wg_peer peer{};
-        Uapi::parsePeerEndpoint(QLatin1String{"[8000::0090]:23456"}, peer);
+        Uapi::parsePeerEndpoint("[8000::0090]:23456", peer);
         QCOMPARE(peer.endpoint.addr6.sin6_family, AF_INET6);
         QCOMPARE(peer.endpoint.addr6.sin6_port, htons(23456));
         in6_addr expected6{{{0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -113,21 +180,21 @@ private slots:
         QCOMPARE((QByteArray{reinterpret_cast<const char*>(expected6.s6_addr), 16}),
                  (QByteArray{reinterpret_cast<const char*>(peer.endpoint.addr6.sin6_addr.s6_addr), 16}));
 
-        Uapi::parsePeerEndpoint(QLatin1String{"101.102.201.202:12345"}, peer);
+        Uapi::parsePeerEndpoint("101.102.201.202:12345", peer);
         QCOMPARE(peer.endpoint.addr4.sin_family, AF_INET);
         QCOMPARE(peer.endpoint.addr4.sin_port, htons(12345));
         QCOMPARE(peer.endpoint.addr4.sin_addr.s_addr, htonl(0x6566C9CAu));
 
-        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint(QLatin1String{"123456"}, peer), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint(QLatin1String{"100.200.100.200"}, peer), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint(QLatin1String{"100.200.100.300:345"}, peer), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint(QLatin1String{"[123:123"}, peer), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint(QLatin1String{"[123]"}, peer), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint(QLatin1String{"[123]123"}, peer), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint(QLatin1String{"[123]:123"}, peer), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint("123456", peer), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint("100.200.100.200", peer), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint("100.200.100.300:345", peer), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint("[123:123", peer), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint("[123]", peer), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint("[123]123", peer), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint("[123]:123", peer), Error);
         // Address too long for internal buffer
-        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint(QLatin1String{"[00:00:00:00:00:00:00:00:00:00:00:00:00:00:00:000]:123"}, peer), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint(QLatin1String{"000000000000000000000000000000000100.200.100.200:123"}, peer), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint("[00:00:00:00:00:00:00:00:00:00:00:00:00:00:00:000]:123", peer), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parsePeerEndpoint("000000000000000000000000000000000100.200.100.200:123", peer), Error);
         // Unchanged
         QCOMPARE(peer.endpoint.addr4.sin_family, AF_INET);
         QCOMPARE(peer.endpoint.addr4.sin_port, htons(12345));
@@ -137,7 +204,7 @@ private slots:
     void testParseAllowedIp()
     {
         wg_allowedip ip{};
-        Uapi::parseAllowedIp(QLatin1String{"8000::0090/96"}, ip);
+        Uapi::parseAllowedIp("8000::0090/96", ip);
         QCOMPARE(ip.family, AF_INET6);
         QCOMPARE(ip.cidr, 96);
         in6_addr expected6{{{0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -145,21 +212,21 @@ private slots:
         QCOMPARE((QByteArray{reinterpret_cast<const char*>(expected6.s6_addr), 16}),
                  (QByteArray{reinterpret_cast<const char*>(ip.ip6.s6_addr), 16}));
 
-        Uapi::parseAllowedIp(QLatin1String{"101.102.201.202/16"}, ip);
+        Uapi::parseAllowedIp("101.102.201.202/16", ip);
         QCOMPARE(ip.family, AF_INET);
         QCOMPARE(ip.cidr, 16);
         QCOMPARE(ip.ip4.s_addr, htonl(0x6566C9CAu));
 
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp(QLatin1String{"123456"}, ip), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp(QLatin1String{"100.200.100.200"}, ip), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp(QLatin1String{"100.200.100.300/12"}, ip), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp(QLatin1String{"123/32"}, ip), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp(QLatin1String{"123"}, ip), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp(QLatin1String{"123/64"}, ip), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp(QLatin1String{"123/64"}, ip), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp("123456", ip), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp("100.200.100.200", ip), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp("100.200.100.300/12", ip), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp("123/32", ip), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp("123", ip), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp("123/64", ip), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp("123/64", ip), Error);
         // Address too long for internal buffer
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp(QLatin1String{"00:00:00:00:00:00:00:00:00:00:00:00:00:00:00:000/64"}, ip), Error);
-        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp(QLatin1String{"000000000000000000000000000000000100.200.100.200/22"}, ip), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp("00:00:00:00:00:00:00:00:00:00:00:00:00:00:00:000/64", ip), Error);
+        QVERIFY_EXCEPTION_THROWN(Uapi::parseAllowedIp("000000000000000000000000000000000100.200.100.200/22", ip), Error);
         // Unchanged
         QCOMPARE(ip.family, AF_INET);
         QCOMPARE(ip.cidr, 16);
@@ -222,6 +289,106 @@ private slots:
         Uapi::appendRequest(msg, dummyKey, ip6);
         QCOMPARE(msg, QByteArrayLiteral("dummy=2800::56/64\n"));
     }
+
+    void testResponseParser_data()
+    {
+        QTest::addColumn<int>("chunkSize");
+        QTest::newRow("1") << 1;
+        QTest::newRow("7") << 7;
+        QTest::newRow("whole") << static_cast<int>(Uapi::ResponseParser::BufferSize);
+    }
+    void testResponseParser()
+    {
+        QFETCH(int, chunkSize);
+
+        // Lines can be split across reads at any point, CRLF is accepted,
+        // and unknown or invalid lines are skipped
+        Uapi::ResponseParser parser;
+        auto lines = parseResponse(parser,
+            "listen_port=51820\n"
+            "unknown_key=1\n"
+            "invalid line\n"
+            "endpoint=[2001:db8::1]:1337\r\n"
+            "rx_bytes=6000000000\n"
+            "errno=0\n"
+            "\n", static_cast<std::size_t>(chunkSize));
+        std::vector<std::string> expected{"listen_port=51820",
+                                          "endpoint=[2001:db8::1]:1337",
+                                          "rx_bytes=6000000000", "errno=0", ""};
+        QCOMPARE(lines, expected);
+    }
+
+    void testResponseParserLongLine()
+    {
+        // A line that exceeds the buffer is discarded, including the part
+        // received after the buffer was full
+        std::string response = "private_key=";
+        response.append(Uapi::ResponseParser::BufferSize, 'a');
+        response += "\nerrno=0\n\n";
+
+        Uapi::ResponseParser parser;
+        auto lines = parseResponse(parser, response, 1000);
+        std::vector<std::string> expected{"errno=0", ""};
+        QCOMPARE(lines, expected);
+    }
+
+    // Parse a complete status response, as WireguardDeviceStatusTask does.
+    // Run with -tickcounter or -callgrind for more precise results.
+    void benchmarkParseStatus_data()
+    {
+        QTest::addColumn<int>("peerCount");
+        QTest::newRow("1") << 1;
+        QTest::newRow("10") << 10;
+        QTest::newRow("100") << 100;
+    }
+    void benchmarkParseStatus()
+    {
+        QFETCH(int, peerCount);
+
+        const std::string response = buildStatusResponse(peerCount);
+        wg_key key{};
+        wg_peer peer{};
+        wg_allowedip allowedIp{};
+        long long total{0};
+        std::size_t lineCount{0};
+
+        QBENCHMARK
+        {
+            Uapi::ResponseParser parser;
+            Uapi::ResponseParser::Line line;
+            lineCount = 0;
+            kapps::core::StringSlice remaining{response};
+            while(!remaining.empty())
+            {
+                // Simulate socket reads directly into the parser's buffer
+                auto space = parser.writableSpace();
+                auto count = std::min(space.size(), remaining.size());
+                std::copy(remaining.begin(), remaining.begin() + count, space.begin());
+                parser.commit(count);
+                remaining = remaining.substr(count);
+
+                while(parser.next(line))
+                {
+                    ++lineCount;
+                    if(line.type == Uapi::ResponseParser::LineType::End)
+                        break;
+                    // Uapi::Key isn't visible here, dispatch on the name
+                    if(line.name.ends_with("_key"))
+                        Uapi::parseWireguardKey(line.value, key);
+                    else if(line.name == "endpoint")
+                        Uapi::parsePeerEndpoint(line.value, peer);
+                    else if(line.name == "allowed_ip")
+                        Uapi::parseAllowedIp(line.value, allowedIp);
+                    else
+                        total += Uapi::parseInt<long long>(line.value);
+                }
+            }
+        }
+
+        // 3 device lines, 11 per peer, and the blank line
+        QCOMPARE(lineCount, static_cast<std::size_t>(3 + 11 * peerCount + 1));
+        QVERIFY(total > 0);
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_wireguarduapi)